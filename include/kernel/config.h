@@ -43,11 +43,75 @@
 
 // vm class instanceof checks for parents
 #define VM_INSTOF_RECURSIVE 1
-#define VM_DEFERRED_REFDEC 0
+// Must be on with SMP refcounts, see refdec.c
+#define VM_DEFERRED_REFDEC VM_SMP
+
+// Bytecode interpreter dispatches with computed goto (gcc labels as values), not switch
+#define VM_EXEC_THREADED 1
+
+// Kernel memory (bytes) for pre-decoded bytecode, 0 turns decoding off
+#define VM_CODE_CACHE_SIZE (4*1024*1024)
+
+// Compile hot methods to native code, needs VM_CODE_CACHE_SIZE. Done on ia32/amd64 only.
+#define VM_JIT 1
+// Method entries and backward jumps before method is compiled
+#define VM_JIT_THRESHOLD 1000
+
+// Replace frequent op sequences with superinstructions when code is decoded
+#define VM_SUPERINSTR 1
+
+// Opcode pairs and triples profiler, turned on with 'opprof' debugger command
+#define VM_OPCODE_PROFILE 1
+
+// Per method calls/instructions/time profiler, turned on with 'mprof' debugger command
+#define VM_METHOD_PROFILE 1
+
+// Max number of returned call frames each thread keeps for reuse, 0 - no reuse
+#define VM_CALL_FRAME_POOL 16
+
+// Create ints which fit in 31 bits as immediate refs, no heap object. Reading
+// of such refs is always supported, so images stay usable if turned off.
+#define VM_TAGGED_INT 1
+
+// string.concat results of this length (bytes) and more are ropes, which
+// are flattened on first indexed access. 0 - always make flat string.
+#define VM_ROPE_MIN 256
+
+// Class loader keeps just one copy of each class/method/field name in
+// persistent intern table, so names can be compared by pointer
+#define VM_INTERN_NAMES 1
+
+// String find/equals use SSE2 or AVX2 code if CPU has it, see strops.c
+#define VM_STRING_SIMD 1
+
+// Directory lookup does not take lock, it is validated with sequence counter.
+// Off with VM_SMP: value found can be freed on other CPU before we ref_inc it
+#define VM_DIR_SEQLOCK (!VM_SMP)
+
+// Array page is grown by this percent of its size, so that append is
+// amortized O(1). Page is never less than VM_ARRAY_MIN_PAGE slots.
+#define VM_ARRAY_GROW_PERCENT 50
+#define VM_ARRAY_MIN_PAGE 16
+
+// Class keeps directory of its and inherited method names to ordinals,
+// dynamic invoke looks method up in it instead of scanning names
+#define VM_METHOD_INDEX 1
+
+// Class keeps display of its ancestors, so that instanceof and catch
+// check class in O(1) instead of walking parents
+#define VM_CLASS_DISPLAY 1
+
+// Compiler puts try ranges to per-method handler tables in class file,
+// throw looks catch up there, so that try costs nothing if nothing is thrown
+#define VM_HANDLER_TABLES 1
 
 #define OLD_VM_SLEEP 0
 #define NEW_SNAP_SYNC 0
 
+// VM threads check for snapshot request on backward jumps, calls and returns
+// only, not on each instruction
+#define VM_SAFEPOINTS 1
+
 // Interlock access to paged persistent address space with snapshot process
 #define SNAP_MEMORY_LOCK 1
 
@@ -80,6 +144,12 @@
 #  define HAVE_KOLIBRI 0
 #endif
 
+// SMP-ready allocator and refcounts: refcounts are atomic, objects are
+// allocated from per-CPU buffers without taking allocator mutex. It is
+// just this part of VM, interpreter itself is not SMP-safe, and there
+// is no arch with HAVE_SMP on, so it is off and built only if forced.
+#define VM_SMP HAVE_SMP
+
 #define MEM_RECLAIM 1
 // verify on-disk snapshot consistency after snapshot
 #define VERIFY_SNAP 1
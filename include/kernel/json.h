@@ -83,6 +83,7 @@ void json_putc_console( json_output *jo, char c );
 
 
 void json_dump_threads( json_output *jo );
+void json_dump_method_profile( json_output *jo );
 
 
 
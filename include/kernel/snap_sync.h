@@ -23,6 +23,9 @@ void phantom_thread_wait_4_snap( void );
 void phantom_snapper_wait_4_threads( void );
 void phantom_snapper_reenable_threads( void );
 
+// Snapper got all threads stopped, start is when it asked them to
+void phantom_snapper_count_safepoint_wait( bigtime_t start );
+
 void phantom_snap_threads_interlock_init( void );
 
 // see vm/refdec.c for use
@@ -97,7 +97,7 @@ errno_t get_stats_record( int id, struct kernel_stats *out );
 
 #define     DEFERRED_REFDEC_RUNS                    32
 #define     DEFERRED_REFDEC_REQS                    33
-#define     DEFERRED_REFDEC_LOST                    34
+#define     DEFERRED_REFDEC_WAIT                    34
 #define     OBJECT_ALLOC                            35
 #define     OBJECT_FREE                             36
 #define     OBJECT_SATURATE                         37
@@ -118,6 +118,13 @@ errno_t get_stats_record( int id, struct kernel_stats *out );
 #define     STAT_CNT_INTERRUPT                      47
 #define     STAT_CNT_SOFTINT                        48
 
+// Object arenas fill, percent. Incremented and decremented, total is current value.
+#define     STAT_CNT_ARENA_FILL_ROOT                49
+#define     STAT_CNT_ARENA_FILL_STACK               50
+#define     STAT_CNT_ARENA_FILL_INT                 51
+#define     STAT_CNT_ARENA_FILL_SMALL               52
+#define     STAT_CNT_ARENA_FILL_LARGE               53
+
 void stat_increment_counter( int nCounter );
 
 #define STAT_INC_CNT( ___nCounter ) do { \
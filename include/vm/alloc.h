@@ -29,6 +29,8 @@ void pvm_alloc_init( void * _pvm_object_space_start, unsigned int size );
 void pvm_alloc_threaded_init(void);
 
 void pvm_alloc_clear_mem(void);
+// load arena layout from object space header, before root object is used
+void pvm_alloc_load_layout(void);
 
 pvm_object_storage_t *get_root_object_storage(void);
 
@@ -56,6 +58,7 @@ void ref_inc_p(pvm_object_storage_t *p);
 
 
 void do_ref_dec_p(pvm_object_storage_t *p); // for deferred refdec
+void deferred_refdec(pvm_object_storage_t *p); // see refdec.c
 
 
 
@@ -72,10 +75,12 @@ void * get_pvm_object_space_end(void);
 void refzero_process_children( pvm_object_storage_t *o );
 void ref_saturate_p(pvm_object_storage_t *p);
 
-// called by refcount code - collapse free objects and attempt to 
-// unmap 'em
+// called by refcount code - attempt to unmap free object pages
 void pvm_collapse_free(pvm_object_storage_t *op); 
 
+// called by refcount code - object is dead, allocator can reuse it, see alloc.c
+void pvm_alloc_free(pvm_object_storage_t *op);
+
 
 
 
@@ -148,6 +153,26 @@ struct persistent_arena
 typedef struct persistent_arena persistent_arena_t;
 
 
+// Object space starts with this header, root object follows it.
+// Old object space has no header and starts with root object.
+
+#define PVM_OBJECT_SPACE_MARKER 0xAAAA5BCE
+
+#define PVM_OBJECT_SPACE_MAX_ARENAS 8
+
+struct pvm_object_space_header
+{
+    u_int32_t           marker;
+
+    u_int32_t           n_arenas;
+    // object space size this layout was made for
+    u_int32_t           size;
+
+    // offsets from object space start, entry after last arena is its end
+    u_int32_t           arena_start[PVM_OBJECT_SPACE_MAX_ARENAS+1];
+};
+
+
 
 
 
@@ -27,9 +27,57 @@ struct pvm_bulk_class_head
     u_int32_t   data_length;
 };
 
+
+/**
+ *
+ * Indexed bulk. First record of file is a pseudo class named
+ * PVM_BULK_INDEX_NAME, its data is an index head and a hash table
+ * of class record offsets. Rest of file is the usual sequence of
+ * class records, so old loaders just skip the index.
+ *
+**/
+
+#define PVM_BULK_INDEX_NAME     "phantom.bulk.index"
+#define PVM_BULK_INDEX_MAGIC    0x78644942 // 'BIdx'
+#define PVM_BULK_INDEX_VERSION  1
+
+struct pvm_bulk_index_head
+{
+    u_int32_t   magic;
+    u_int32_t   version;
+    u_int32_t   n_slots;        // Power of 2
+    u_int32_t   n_classes;
+};
+
+struct pvm_bulk_index_slot
+{
+    u_int32_t   hash;           // pvm_bulk_name_hash() of class name
+    u_int32_t   head_offset;    // Of class head in file, 0 for empty slot
+};
+
+//! Class name hash, '/' is the same as '.', leading separator is ignored
+static __inline__ u_int32_t pvm_bulk_name_hash( const char *name )
+{
+    u_int32_t hash = 2166136261u;
+
+    if( *name == '.' || *name == '/' )
+        name++;
+
+    for( ; *name; name++ )
+    {
+        unsigned char c = (*name == '/') ? '.' : *name;
+        hash = (hash ^ c) * 16777619u;
+    }
+
+    return hash;
+}
+
+
 int pvm_load_class_from_module( const char *class_name, struct pvm_object *out );
 int pvm_load_class_from_memory( const void *data, int fsize, struct pvm_object *out );
 void pvm_bulk_init( pvm_bulk_seek_t sf, pvm_bulk_read_t rd );
+//! Bulk file is in memory, load classes from it in place
+void pvm_bulk_map( const void *image, int size );
 
 // Just load a file to mem
 int load_code(void **out_code, unsigned int *out_size, const char *fn);
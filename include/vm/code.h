@@ -10,6 +10,7 @@
 
 
 #include <vm/internal_da.h>
+#include <vm/object_flags.h>
 
 
 struct pvm_object       pvm_code_get_string(struct pvm_code_handler *code);
@@ -26,6 +27,155 @@ void   	                pvm_code_check_bounds( struct pvm_code_handler *code, un
 
 int                     pvm_code_do_get_int( const unsigned char *addr );
 
+//! Number of operand bytes after the opcode at ip, -1 if we can't say
+int                     pvm_code_op_len( const unsigned char *code, unsigned ip, unsigned max );
+
+
+// Verified code (see code_verify.c) is read with no bounds checks:
+// IP is always at instruction start and operands are inside code.
+
+static inline unsigned char pvm_code_get_byte_unchecked(struct pvm_code_handler *code)
+{
+    return code->code[code->IP++];
+}
+
+static inline int pvm_code_get_int32_unchecked(struct pvm_code_handler *code)
+{
+    int ret = pvm_code_do_get_int( code->code+code->IP );
+    code->IP += 4;
+    return ret;
+}
+
+static inline unsigned int pvm_code_get_rel_IP_as_abs_unchecked(struct pvm_code_handler *code)
+{
+    int here = code->IP;
+    return here + pvm_code_get_int32_unchecked(code);
+}
+
+struct vm_code_catch;
+
+//! Check bytecode, mark code object as verified if it is ok. Returns 0 if verified.
+errno_t                 pvm_code_verify( struct pvm_object code );
+//! Same, handlers of exception table are checked too. Flag is cleared if not verified.
+errno_t                 pvm_code_verify_handlers( struct pvm_object code, const struct vm_code_catch *table, unsigned int count );
+
+//! Code bytes, as set to pvm_code_handler, are in code object, get this object
+static inline struct pvm_object_storage * pvm_code_storage( const unsigned char *code )
+{
+    return (void *)
+        (code - __offsetof(struct data_area_4_code, code) - __offsetof(struct pvm_object_storage, da));
+}
+
+//! Code bytes, as set to pvm_code_handler, are in code object, get its verified flag
+static inline int       pvm_code_is_verified( const unsigned char *code )
+{
+    if( 0 == code ) return 0;
+
+    return pvm_code_storage( code )->_flags & PHANTOM_OBJECT_STORAGE_FLAG_IS_VERIFIED;
+}
+
+
+
+// Pre-decoded code cache, see code_cache.c
+
+struct jit_code;
+
+struct pvm_code_op
+{
+    unsigned char               opcode;
+    unsigned short              ic;             // Call site inline cache index + 1, 0 - none
+    unsigned int                next_IP;        // IP of the next instruction
+    int                         arg[3];         // Decoded operands, jump targets are absolute
+};
+
+
+// Call site inline cache. Entry is filled once and never replaced,
+// so that readers need no lock. All entries die when class or
+// interface is created, for new one can reuse address of a dead one.
+
+#define PVM_IC_WAYS             4
+#define PVM_IC_NAME_SIZE        24
+
+struct pvm_ic_entry
+{
+    struct pvm_object_storage * key;            // Interface for call, class for dynamic invoke
+    struct pvm_object_storage * code;           // Method code, call
+    int                         ordinal;        // Method ordinal, dynamic invoke
+    unsigned int                name_len;
+    char                        name[PVM_IC_NAME_SIZE]; // Method name, dynamic invoke
+    volatile unsigned int       epoch;          // Written last, entry is valid if equals pvm_ic_epoch
+};
+
+struct pvm_inline_cache
+{
+    unsigned int                IP;             // Call site
+    int                         used;           // Entries taken, PVM_IC_WAYS+1 - megamorphic site
+    unsigned int                epoch;          // Entries are for this epoch
+    unsigned int                hits;
+    unsigned int                misses;
+    struct pvm_ic_entry         e[PVM_IC_WAYS];
+};
+
+struct pvm_code_cache
+{
+    struct pvm_code_cache *     next;           // Hash chain
+    const unsigned char *       code;           // Bytecode we describe - key
+    unsigned int                code_size;
+    unsigned int                sum;            // Code fingerprint, see code_cache_sum
+    size_t                      mem;            // Bytes of kernel memory we use
+
+    u_int32_t *                 map;            // IP -> op index + 1, 0 means no record, interpret bytes
+
+    unsigned int                invocations;    // Times we entered this code at IP 0, for JIT
+    struct jit_code *           jit;            // Native code, if compiled
+
+    unsigned int                nics;
+    struct pvm_inline_cache *   ics;            // Call site caches, see pvm_code_op.ic
+
+    unsigned int                nops;
+    struct pvm_code_op          ops[];
+};
+
+//! Get (decode on first call) records for given bytecode. Returns 0 if cache is full or turned off.
+struct pvm_code_cache *         pvm_code_cache_get( const unsigned char *code, unsigned int code_size );
+//! Code is going to be freed or new code is created at this address, kill its records.
+void                    pvm_code_cache_forget( const unsigned char *code );
+//! Attach native code. Returns nonzero if someone did it before us.
+int                     pvm_code_cache_set_jit( struct pvm_code_cache *cc, struct jit_code *jc );
+
+//! Call site cache lookup, returns 0 if not found
+struct pvm_object_storage * pvm_ic_get_code( struct pvm_inline_cache *ic, struct pvm_object_storage *iface );
+void                    pvm_ic_put_code( struct pvm_inline_cache *ic, struct pvm_object_storage *iface, struct pvm_object_storage *code );
+
+//! Dynamic invoke site cache lookup, returns -1 if not found
+int                     pvm_ic_get_ordinal( struct pvm_inline_cache *ic, struct pvm_object_storage *class, const char *name, unsigned int name_len );
+void                    pvm_ic_put_ordinal( struct pvm_inline_cache *ic, struct pvm_object_storage *class, const char *name, unsigned int name_len, int ordinal );
+
+//! Class or interface is created, forget all the cached lookups
+void                    pvm_ic_invalidate_all(void);
+
+
+// Opcode pairs and triples profiler, see opcode_prof.c
+
+#if VM_OPCODE_PROFILE
+extern volatile int     pvm_opprof_on;
+//! Count op executed after prev1, which was executed after prev2
+void                    pvm_opprof_count( unsigned char prev2, unsigned char prev1, unsigned char op );
+#endif
+
+
+// Per method profiler, see method_prof.c
+
+#if VM_METHOD_PROFILE
+struct pvm_mprof_method;
+
+extern volatile int     pvm_mprof_on;
+//! Thread called method, which is current code now
+void                    pvm_mprof_invoked( struct data_area_4_thread *da );
+//! Thread switched to other code. Charges time since *since and *instructions to prev, returns record for current code or 0 if profiler is off.
+struct pvm_mprof_method * pvm_mprof_switch( struct data_area_4_thread *da, struct pvm_mprof_method *prev, bigtime_t *since, unsigned int *instructions );
+#endif
+
 
 struct vm_code_linenum
 {
@@ -33,3 +183,23 @@ struct vm_code_linenum
 	int         line;
 };
 
+
+/**
+ *
+ * Exception handler table entry, made from class file 'H' record.
+ *
+ * Method's table is an array: binary with entries sorted by start
+ * ascending, end descending, and then names of classes to catch.
+ * Exception thrown at IP is caught by entry if start < IP <= end,
+ * as IP points after the instruction which throws or calls.
+ *
+**/
+
+struct vm_code_catch
+{
+	u_int32_t   start;      // try range
+	u_int32_t   end;
+	u_int32_t   handler;    // IP to jump to
+	u_int32_t   name;       // Index of catch class name in table array
+};
+
@@ -93,6 +93,7 @@ DEF_I(weakref)
 DEF_I(window)
 DEF_I(directory)
 DEF_I(connection)
+DEF_I(rope)
 //DEF_I(hash)
 
 #undef DEF_I
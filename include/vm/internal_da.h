@@ -121,8 +121,15 @@ struct data_area_4_int
     int             value;
 };
 
-// TODO: make sure it is not an lvalue for security reasons!
-#define pvm_get_int( o )  ( (int) (((struct data_area_4_int *)&(o.data->da))->value))
+// Immediate or boxed int, both can be met
+static inline int pvm_get_int_value( pvm_object_t o )
+{
+    if( pvm_is_immediate( o ) )
+        return pvm_immediate_int( o );
+    return ((struct data_area_4_int *)&(o.data->da))->value;
+}
+
+#define pvm_get_int( o )  pvm_get_int_value( o )
 
 struct data_area_4_long
 {
@@ -160,7 +167,65 @@ struct data_area_4_string
 #define pvm_get_str_len( o )  ( (int) (((struct data_area_4_string *)&(o.data->da))->length))
 #define pvm_get_str_data( o )  ( (char *) (((struct data_area_4_string *)&(o.data->da))->data))
 
+// Cached hashes, kept after string data, aligned. Strings made by
+// old kernels have no room for it, their hashes are calculated each time.
+struct pvm_string_hash
+{
+    u_int32_t                   key;            // calc_hash of data bytes, as directory does
+    u_int32_t                   code;           // hashCode(), calc_hash of length and data
+};
+
+#define PVM_STRING_HASH_OFFSET( n_bytes ) ((sizeof(struct data_area_4_string) + (n_bytes) + 3) & ~3)
+#define PVM_STRING_DA_SIZE( n_bytes ) (PVM_STRING_HASH_OFFSET( n_bytes ) + sizeof(struct pvm_string_hash))
+
 int pvm_strcmp(pvm_object_t s1, pvm_object_t s2);
+//! Compares contents, uses hashes if known and pointers for interned strings
+int pvm_string_equals(pvm_object_t s1, pvm_object_t s2);
+
+//! Hash of string bytes, calculated once
+u_int32_t pvm_string_hash(pvm_object_t s);
+//! Same, but 0 if not calculated yet
+u_int32_t pvm_string_hash_cached(pvm_object_t s);
+//! Value for hashCode(), calculated once
+u_int32_t pvm_string_hashcode(pvm_object_t s);
+//! Must be called if string bytes are changed after creation
+void pvm_string_hash_reset(pvm_object_t s);
+
+//! Consumes s, returns reference to interned string equal to it
+pvm_object_t pvm_intern_string(pvm_object_t s);
+
+// Byte string primitives, best version for this CPU is set at start, see strops.c
+//! Position of needle in hay or 0
+extern const char * (*pvm_str_find)( const char *hay, int hay_len, const char *needle, int needle_len );
+//! Nonzero if len bytes are equal
+extern int (*pvm_str_equal)( const void *a, const void *b, int len );
+//! Length of common prefix of two len bytes strings
+extern int (*pvm_str_prefix)( const void *a, const void *b, int len );
+//! Position of first byte c in len bytes or -1
+extern int (*pvm_mem_find_byte)( const void *p, int c, int len );
+//! Internet checksum (RFC 1071) of len bytes
+extern int (*pvm_mem_checksum)( const void *p, int len );
+//! Use given version - "scalar", "sse2", "avx2". ENXIO if CPU can't run it
+int pvm_strops_select( const char *name );
+
+
+// Lazy string concatenation result, see rope.c. Tree is dropped
+// when rope is flattened on first indexed access.
+struct data_area_4_rope
+{
+    pvm_object_t                left;           // string or rope, null if flat
+    pvm_object_t                right;
+    pvm_object_t                flat;           // string, null until flattened
+    int                         length;         // bytes, as in string
+    int                         depth;          // max node count on path to leaf string
+};
+
+// Returns new reference to concatenation of two strings or ropes
+pvm_object_t pvm_string_concat( pvm_object_t s1, pvm_object_t s2 );
+// Flat string for a rope, rope keeps the reference
+pvm_object_t pvm_rope_flat( pvm_object_t rope );
+// Consumes rope reference and returns reference to its flat string
+pvm_object_t pvm_rope_release_flat( pvm_object_t rope );
 
 
 // NB! See JIT assembly hardcode for object structure offsets
@@ -182,8 +247,17 @@ struct data_area_4_class
     struct pvm_object		field_names; // array of field names
 
     struct pvm_object		const_pool; // array of object constants
+
+    // Fields below must be last, classes of older images have no room for them
+    struct pvm_object		method_index; // directory: method name -> ordinal, including inherited
+    struct pvm_object		display; // binary: ancestor class pointers, root first, this class last
+    struct pvm_object		handler_tables; // array of exception handler tables, see vm_code_catch
 };
 
+//! Class object has room for field, see above
+#define PVM_CLASS_HAS_FIELD( __os, __field ) \
+    ( (__os)->_da_size >= __offsetof( struct data_area_4_class, __field ) + sizeof( struct pvm_object ) )
+
 
 
 struct pvm_code_handler
@@ -231,10 +305,20 @@ struct data_area_4_thread
     // misc data
     int stack_depth;	// number of frames
     //long memory_size;	// memory allocated - deallocated by this thread
+
+    // Fields below must be last, threads of older images have no room for them
+
+    // Emptied call frames to reuse, linked by prev. See VM_CALL_FRAME_POOL.
+    struct pvm_object                   frame_pool;
+    int                                 frame_pool_size;
 };
 
 typedef struct data_area_4_thread thread_context_t;
 
+//! Thread object has room for field, see above
+#define PVM_THREAD_HAS_FIELD( __os, __field ) \
+    ( (__os)->_da_size >= __offsetof( struct data_area_4_thread, __field ) + sizeof( ((struct data_area_4_thread *)0)->__field ) )
+
 /*
 // Thread factory is used to keep thread number
 struct data_area_4_thread_factory
@@ -475,25 +559,17 @@ struct data_area_4_window
 };
 
 
-// Very dumb implementation, redo with hash map or bin search or tree
-// Container entry has struct pvm_object at the beginning and the rest is 0-term name string
+// Robin Hood hash table, see directory.c. Layout made by older kernels
+// is converted in place, so this must not grow and lock must stay where it was.
 struct data_area_4_directory
 {
-/* old, unused?
-    u_int32_t                           elSize;         // size of one dir entry, bytes, defaults to 256
-
-    u_int32_t                           capacity;       // size of binary container in entries
-    u_int32_t                           nEntries;       // number of actual entries
-
-    struct pvm_object   		container;      // Where we actually hold it
-*/
-
-    u_int32_t                           capacity;       // size of 1nd level arrays
+    u_int16_t                           format;         // HDIR_FORMAT, old layout had capacity here
+    volatile u_int16_t                  seq;            // Odd while table is changed, readers check it
     u_int32_t                           nEntries;       // number of actual entries stored
 
-    struct pvm_object   		keys;      	// Where we actually hold keys
-    struct pvm_object   		values;      	// Where we actually hold values
-    u_int8_t 				*flags;      	// Is this keys/values slot pointing to 2nd level array
+    struct pvm_object   		table;      	// Array, key and value for each slot
+    struct pvm_object   		old_table;      // Being moved to table by incremental rehash, or null
+    size_t                              rehash_pos;     // Slots of old_table below it are moved
 
     hal_spinlock_t                      lock;
 
@@ -504,6 +580,9 @@ typedef struct data_area_4_directory hashdir_t;
 // directory.c
 errno_t hdir_add( hashdir_t *dir, const char *ikey, size_t i_key_len, pvm_object_t add );
 errno_t hdir_find( hashdir_t *dir, const char *ikey, size_t i_key_len, pvm_object_t *out, int delete_found );
+// Same with string object key, which caches hash
+errno_t hdir_add_key( hashdir_t *dir, pvm_object_t key, pvm_object_t add );
+errno_t hdir_find_key( hashdir_t *dir, pvm_object_t key, pvm_object_t *out, int delete_found );
 
 
 
@@ -124,6 +124,28 @@ struct pvm_object pvm_exec_lookup_class_by_name( struct pvm_object name );
 #define pvm_is_null( o ) ((o).data == 0 || ((o).data == pvm_create_null_object().data))
 #define pvm_isnull( o ) ((o).data == 0 || ((o).data == pvm_create_null_object().data))
 
+/**
+ *
+ * Immediate int. Reference with lowest bit of data set is not a pointer,
+ * it keeps (value << 1) | 1. Interface is int class default interface,
+ * so method calls work as usual. Storage is at least 4 bytes aligned,
+ * so real objects never have this bit set.
+ *
+ * Such reference is not refcounted and is not visited by GC.
+ *
+**/
+
+#define PVM_IMMEDIATE_TAG       1
+
+#define PVM_IMMEDIATE_INT_MIN   (-(1 << 30))
+#define PVM_IMMEDIATE_INT_MAX   ((1 << 30) - 1)
+
+#define pvm_is_immediate_p( p ) (((addr_t)(p)) & PVM_IMMEDIATE_TAG)
+#define pvm_is_immediate( o )   pvm_is_immediate_p( (o).data )
+
+#define pvm_immediate_int_fits( v ) ( ((v) >= PVM_IMMEDIATE_INT_MIN) && ((v) <= PVM_IMMEDIATE_INT_MAX) )
+#define pvm_immediate_int( o )  ( ((int)(u_int32_t)(addr_t)((o).data)) >> 1 )
+
 /**
  *
  * 'object' class is:
@@ -138,6 +160,9 @@ int pvm_object_class_exactly_is( struct pvm_object object, struct pvm_object tcl
 int pvm_object_class_is_or_parent( struct pvm_object object, struct pvm_object tclass );
 int pvm_object_class_is_or_child( struct pvm_object object, struct pvm_object tclass );
 
+// Make class ancestors display, see object.c
+void pvm_build_class_display( struct pvm_object tclass );
+
 //#define pvm_class_check(__o,__c) if(!pvm_object_class_is( __o, __c )) pvm_panic("Wrong class");
 
 /**
@@ -159,6 +184,8 @@ void                  pvm_set_array_ofield(struct pvm_object_storage *o, unsigne
 int                   get_array_size(struct pvm_object_storage *array);
 void                  pvm_append_array(struct pvm_object_storage *array, struct pvm_object value_to_append );
 void                  pvm_pop_array(struct pvm_object_storage *array, struct pvm_object value_to_pop );
+void                  pvm_reserve_array(struct pvm_object_storage *array, int capacity );
+void                  pvm_trim_array(struct pvm_object_storage *array );
 
 // Debug
 
@@ -202,6 +229,8 @@ struct pvm_object     pvm_get_mutex_class(void);
 struct pvm_object     pvm_get_cond_class(void);
 struct pvm_object     pvm_get_sema_class(void);
 
+struct pvm_object     pvm_get_rope_class(void);
+
 
 struct pvm_object     pvm_create_null_object(void);
 struct pvm_object     pvm_create_class_object(struct pvm_object name, struct pvm_object iface, int da_size);
@@ -210,6 +239,8 @@ struct pvm_object     pvm_create_interface_object( int n_methods, struct pvm_obj
 struct pvm_object     pvm_create_code_object(int size, void *code);
 
 struct pvm_object     pvm_create_int_object(int value);
+//! Always gives immediate, value must fit, see pvm_immediate_int_fits()
+struct pvm_object     pvm_create_immediate_int(int value);
 struct pvm_object     pvm_create_long_object(int64_t value);
 struct pvm_object     pvm_create_float_object(float value);
 struct pvm_object     pvm_create_double_object(double value);
@@ -105,6 +105,12 @@ POSF(IS_CODE,0x01)
 // This object has week ref on it (must be on _satellites chain)
 #define PHANTOM_OBJECT_STORAGE_FLAG_HAS_WEAKREF 0x100000
 
+// Code object passed load time checks, see code_verify.c
+#define PHANTOM_OBJECT_STORAGE_FLAG_IS_VERIFIED 0x200000
+
+// String is in intern table, see intern.c. No other interned string is equal to it
+#define PHANTOM_OBJECT_STORAGE_FLAG_IS_INTERNED 0x400000
+
 
 #endif // PO_OBJECT_FLAGS_H
 
@@ -21,6 +21,7 @@ int             pvm_ip_to_linenum(pvm_object_t tclass, int method_ordinal, int i
 int             pvm_get_method_name_count( pvm_object_t tclass );
 pvm_object_t    pvm_get_method_name( pvm_object_t tclass, int method_ordinal );
 int             pvm_get_method_ordinal( pvm_object_t tclass, pvm_object_t mname );
+void            pvm_build_method_index( pvm_object_t tclass );
 
 
 
@@ -19,6 +19,8 @@
 
 void pvm_root_init(void);
 
+pvm_object_t pvm_create_intern_table(void);
+
 void phantom_setenv( const char *name, const char *value );
 int phantom_getenv( const char *name, char *value, int vsize );
 
@@ -72,6 +74,8 @@ struct pvm_root_t
     struct pvm_object           cond_class;
     struct pvm_object           sema_class;
 
+    struct pvm_object           rope_class;
+
 
     struct pvm_object           null_object;
     struct pvm_object           sys_interface_object;   // Each method is a consecutive syscall (sys 0 first, sys 1 second etc) + return
@@ -85,6 +89,8 @@ struct pvm_root_t
 
     struct pvm_object           kernel_stats;           // Persisent kernel statistics
 
+    struct pvm_object           intern_table;           // Class and method names, see intern.c
+
 };
 
 extern struct pvm_root_t pvm_root;
@@ -191,6 +197,8 @@ extern struct pvm_root_t pvm_root;
 
 #define PVM_ROOT_OBJECT_SEMA_CLASS 32
 
+#define PVM_ROOT_OBJECT_ROPE_CLASS 33
+
 // Runtime restoration facilities
 
 
@@ -215,6 +223,10 @@ extern struct pvm_root_t pvm_root;
 
 #define PVM_ROOT_KERNEL_STATISTICS 72
 
+// Interned names, null if made by kernel with VM_INTERN_NAMES off
+#define PVM_ROOT_OBJECT_INTERN_TABLE 73
+
+// Don't change, it is persistent root object size
 #define PVM_ROOT_OBJECTS_COUNT (PVM_ROOT_KERNEL_STATISTICS+31)
 
 
@@ -18,10 +18,31 @@
 
 #include "vm/internal_da.h"
 
-void 				pvm_ostack_push( struct data_area_4_object_stack* stack, struct pvm_object o );
-struct pvm_object 		pvm_ostack_pop( struct data_area_4_object_stack* stack );
+// Page is full or empty - grow or go to older page, see stacks.c
+void 				pvm_ostack_push_slow( struct data_area_4_object_stack* stack, struct pvm_object o );
+struct pvm_object 		pvm_ostack_pop_slow( struct data_area_4_object_stack* stack );
+
+static inline void pvm_ostack_push( struct data_area_4_object_stack* stack, struct pvm_object o )
+{
+    struct data_area_4_object_stack* s = stack->curr_da;
+    if( s->common.free_cell_ptr < s->common.__sSize )
+        s->stack[s->common.free_cell_ptr++] = o;
+    else
+        pvm_ostack_push_slow( stack, o );
+}
+
+static inline struct pvm_object pvm_ostack_pop( struct data_area_4_object_stack* stack )
+{
+    struct data_area_4_object_stack* s = stack->curr_da;
+    if( s->common.free_cell_ptr > 0 )
+        return s->stack[--(s->common.free_cell_ptr)];
+    return pvm_ostack_pop_slow( stack );
+}
+
 struct pvm_object 		pvm_ostack_top( struct data_area_4_object_stack* stack );
 int 				pvm_ostack_empty( struct data_area_4_object_stack* stack );
+//! Drop all, releasing references
+void 				pvm_ostack_reset( struct data_area_4_object_stack* stack );
 
 struct pvm_object  		pvm_ostack_pull( struct data_area_4_object_stack* stack, int pos );
 
@@ -33,10 +54,29 @@ struct pvm_object 		pvm_ostack_abs_get( struct data_area_4_object_stack* stack,
 void 				pvm_istack_abs_set( struct data_area_4_integer_stack* rootda, int abs_pos, int val );
 int 				pvm_istack_abs_get( struct data_area_4_integer_stack* rootda, int abs_pos );
 
-void 				pvm_istack_push( struct data_area_4_integer_stack* stack, int o );
-int 				pvm_istack_pop( struct data_area_4_integer_stack* stack );
+void 				pvm_istack_push_slow( struct data_area_4_integer_stack* stack, int o );
+int 				pvm_istack_pop_slow( struct data_area_4_integer_stack* stack );
+
+static inline void pvm_istack_push( struct data_area_4_integer_stack* stack, int o )
+{
+    struct data_area_4_integer_stack* s = stack->curr_da;
+    if( s->common.free_cell_ptr < s->common.__sSize )
+        s->stack[s->common.free_cell_ptr++] = o;
+    else
+        pvm_istack_push_slow( stack, o );
+}
+
+static inline int pvm_istack_pop( struct data_area_4_integer_stack* stack )
+{
+    struct data_area_4_integer_stack* s = stack->curr_da;
+    if( s->common.free_cell_ptr > 0 )
+        return s->stack[--(s->common.free_cell_ptr)];
+    return pvm_istack_pop_slow( stack );
+}
+
 int 				pvm_istack_top( struct data_area_4_integer_stack* stack );
 int 				pvm_istack_empty( struct data_area_4_integer_stack* stack );
+void 				pvm_istack_reset( struct data_area_4_integer_stack* stack );
 
 
 void 				pvm_lstack_push( struct data_area_4_integer_stack* rootda, int64_t o );
@@ -49,6 +89,8 @@ void 				pvm_estack_push( struct data_area_4_exception_stack* stack, struct pvm_
 struct pvm_exception_handler 	pvm_estack_pop( struct data_area_4_exception_stack* stack );
 struct pvm_exception_handler 	pvm_estack_top( struct data_area_4_exception_stack* stack );
 int 				pvm_estack_empty( struct data_area_4_exception_stack* stack );
+//! Drop all, releasing references
+void 				pvm_estack_reset( struct data_area_4_exception_stack* stack );
 
 int 				pvm_estack_foreach(
 		                       struct data_area_4_exception_stack* stack,
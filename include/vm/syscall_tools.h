@@ -46,8 +46,11 @@
 
 //             SYSCALL_THROW_STRING( /*"not a string arg: "*/  __func__ );
 // TODO it does not SYS_FREE_O(obj)!
+// Rope is replaced with its flat string, obj must be an owned reference
 #define ASSERT_STRING(obj) \
     do { \
+	if( IS_PHANTOM_ROPE(obj) ) \
+        obj = pvm_rope_release_flat(obj); \
 	if( !IS_PHANTOM_STRING(obj) ) \
         SYSCALL_THROW_STRING( "not a string arg: " __FILE__ ":" __XSTRING(__LINE__) ); \
     } while(0)
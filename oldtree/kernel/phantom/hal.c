@@ -177,6 +177,26 @@ void hal_assert_failed(char *file, int line)
 
 
 
+// -----------------------------------------------------------------------
+//
+// JIT code memory. Kernel heap is executable.
+//
+// -----------------------------------------------------------------------
+
+
+void *jit_alloc_exec( size_t size )
+{
+    return malloc( size );
+}
+
+void jit_free_exec( void *mem, size_t size )
+{
+    (void) size;
+    free( mem );
+}
+
+
+
 // -----------------------------------------------------------------------
 //
 // end of HAL impl
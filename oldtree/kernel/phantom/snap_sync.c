@@ -24,7 +24,9 @@
 
 #include <kernel/snap_sync.h>
 #include <kernel/init.h>
+#include <kernel/debug.h>
 #include <hal.h>
+#include <time.h>
 
 /* This is set from snap code to ask us to hold our breath */
 
@@ -116,6 +118,8 @@ void phantom_snapper_wait_4_threads( void )
 {
     SHOW_FLOW0( 5, "phantom_snapper_wait_4_threads");
 
+    bigtime_t start = hal_system_time();
+
     phantom_virtual_machine_snap_request++; // Ask them to go sleep
 
     int threads_4_wait = phantom_vm_threads_get_count();
@@ -153,6 +157,7 @@ void phantom_snapper_wait_4_threads( void )
 
     SHOW_FLOW0( 5, "Snapper is free to snap");
 
+    phantom_snapper_count_safepoint_wait( start );
 }
 
 
@@ -201,6 +206,60 @@ void phantom_snapper_reenable_threads( void )
 
 
 
+// ----------------------------------------------------------------
+// Time to safepoint stats
+// ----------------------------------------------------------------
+
+// VM threads poll for snap request in safepoints only (see VM_SAFEPOINTS),
+// here we see how long it takes for all of them to get there.
+
+// Complain if threads take longer than that to stop, usec
+#define SAFEPOINT_WAIT_WARN (1000*1000)
+
+static bigtime_t        safepoint_wait_last;
+static bigtime_t        safepoint_wait_max;
+static bigtime_t        safepoint_wait_total;
+static u_int32_t        safepoint_wait_count;
+
+
+void phantom_snapper_count_safepoint_wait( bigtime_t start )
+{
+    bigtime_t waited = hal_system_time() - start;
+
+    // Can be reentered by snapper and GC'or, but it is just a statistics
+    safepoint_wait_last = waited;
+    safepoint_wait_total += waited;
+    safepoint_wait_count++;
+
+    if( waited > safepoint_wait_max )
+        safepoint_wait_max = waited;
+
+    SHOW_FLOW( 1, "threads reached safepoint in %d usec", (int)waited );
+
+    if( waited > SAFEPOINT_WAIT_WARN )
+        SHOW_ERROR( 0, "threads took %d msec to reach safepoint", (int)(waited/1000) );
+}
+
+
+static void dbg_safepoint_stats( int ac, char **av )
+{
+    (void) ac;
+    (void) av;
+
+    printf("Time to safepoint, %u waits: last %d usec, max %d usec, avg %d usec\n",
+           safepoint_wait_count, (int)safepoint_wait_last, (int)safepoint_wait_max,
+           safepoint_wait_count ? (int)(safepoint_wait_total / safepoint_wait_count) : 0 );
+}
+
+static void safepoint_stats_init( void )
+{
+    dbg_add_command( &dbg_safepoint_stats, "safepoint", "Time VM threads took to stop for snapshot" );
+}
+
+INIT_ME( 0, safepoint_stats_init, 0 )
+
+
+
 
 
 
@@ -126,6 +126,8 @@ static pvm_object_t cn_fio_blocking_syscall_worker( pvm_object_t conn, struct da
         break;
 
     case CONN_OP_WRITE:
+        if( IS_PHANTOM_ROPE(arg) )
+            arg = pvm_rope_flat(arg); // Rope keeps it, we don't
         if( !IS_PHANTOM_STRING(arg) )
         {
             e = EINVAL;
@@ -322,22 +322,15 @@ errno_t ko_map_method( int *out_ord, ko_handle_t *ko_this, const char *method_na
 
     pvm_object_t tclass = _this.data->_class;
 
-    // TODO XXX VERY ineffective!
-    int ord;
-    for( ord = 0; ord < 256; ord++ )
-    {
-        pvm_object_t mn = pvm_get_method_name( tclass, ord );
-        if( pvm_is_null(mn) )
-            return ENOENT;
+    pvm_object_t mname = pvm_create_string_object( method_name );
+    int ord = pvm_get_method_ordinal( tclass, mname );
+    ref_dec_o( mname );
 
-        if(EQ_STRING_P2C(mn,method_name))
-        {
-            *out_ord = ord;
-            return 0;
-        }
-    }
+    if( ord < 0 )
+        return ENOENT;
 
-    return ENOENT;
+    *out_ord = ord;
+    return 0;
 }
 
 //! Async call - void, does not wait
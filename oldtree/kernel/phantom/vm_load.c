@@ -163,6 +163,10 @@ void load_classes_module()
     }
 
     pvm_bulk_init( bulk_seek_f, bulk_read_f );
+
+    // Module stays in memory, classes are loaded right from it
+    if( bulk_size > 0 )
+        pvm_bulk_map( bulk_code, bulk_size );
 }
 
 
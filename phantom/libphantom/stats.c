@@ -158,7 +158,7 @@ const char *stat_counter_name[MAX_STAT_COUNTERS] =
 
     "Defrd refdec runs",
     "Defrd refdec reqs",
-    "Defrd refdec lost",
+    "Defrd refdec waits",
 
     "Object alloc",
     "Object free",
@@ -182,6 +182,13 @@ const char *stat_counter_name[MAX_STAT_COUNTERS] =
 
     "Interrupts",
     "SoftIRQ",
+
+    // 49
+    "Arena root fill %",
+    "Arena stack fill %",
+    "Arena int fill %",
+    "Arena small fill %",
+    "Arena large fill %",
 };
 
 
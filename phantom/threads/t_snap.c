@@ -18,6 +18,7 @@
 #include <phantom_libc.h>
 #include <kernel/page.h>
 #include <kernel/snap_sync.h>
+#include <time.h>
 
 #include <thread_private.h>
 
@@ -229,7 +230,9 @@ void phantom_thread_wait_4_snap( void )
 
 void phantom_snapper_wait_4_threads( void )
 {
+    bigtime_t start = hal_system_time();
     snapper_lock();
+    phantom_snapper_count_safepoint_wait( start );
 }
 
 void phantom_snapper_reenable_threads( void )
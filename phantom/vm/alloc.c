@@ -17,6 +17,10 @@
 #include <kernel/stats.h>
 #include <kernel/page.h>
 #include <kernel/vm.h>
+#include <kernel/init.h>
+#include <kernel/debug.h>
+#include <kernel/smp.h>
+#include <threads.h>
 
 
 #define debug_memory_leaks 0
@@ -29,6 +33,8 @@
 
 
 static void init_free_object_header( pvm_object_storage_t *op, unsigned int size );
+static void alloc_save_layout(void);
+static void dbg_arenas( int ac, char **av );
 
 // TODO Object alloc - gigant lock for now. This is to be redone with separate locks for buckets/arenas.
 static hal_mutex_t  _vm_alloc_mutex;
@@ -39,16 +45,18 @@ hal_mutex_t  *vm_alloc_mutex; // used in gc.c
 static void * pvm_object_space_start;
 static void * pvm_object_space_end;
 
-void * get_pvm_object_space_start() { return pvm_object_space_start; }
-void * get_pvm_object_space_end() { return pvm_object_space_end; }
+// Arena layout is kept here, at object space start. Zero for old object space which has no header.
+static struct pvm_object_space_header * space_header;
 
 
 //
 #define ARENAS 5
 static void * start_a[ARENAS];
 static void * end_a[ARENAS];
-// Last position where allocator finished looking for objects
-static void * curr_a[ARENAS];
+
+// First object is right after the header
+void * get_pvm_object_space_start() { return start_a[0]; }
+void * get_pvm_object_space_end() { return pvm_object_space_end; }
 
 
 // Names helper
@@ -63,6 +71,56 @@ static int percent_a[ARENAS] = { 15, 15, 2, 28, 40 };
 #endif
 
 
+/**
+ *
+ * Segregated fit.
+ *
+ * Free objects of each arena are kept in doubly linked lists by size
+ * class, and bitmap tells which lists are not empty, so finding free
+ * memory takes the same time however full the arena is. There is a
+ * class for each size up to ALLOC_EXACT_MAX bytes, bigger objects are
+ * kept in lists by power of 2.
+ *
+ * Free object in list is linked through its _class field and has
+ * ALLOC_FREE_LISTED in _da_size. Objects freed by refcount code are
+ * marked ALLOC_FREE_PENDING and pushed to a lock free stack, allocator
+ * moves them to lists under its mutex, merging each with free objects
+ * which follow it.
+ *
+ * Lists are not persistent. Arena is scanned once after start, when
+ * first object is allocated from it, and scanned again, merging all
+ * the neighbour free objects, if no free object is big enough.
+ *
+**/
+
+#define ALLOC_EXACT_SHIFT       9
+#define ALLOC_EXACT_MAX         (1 << ALLOC_EXACT_SHIFT)
+#define ALLOC_EXACT_CLASSES     (ALLOC_EXACT_MAX/4)
+#define ALLOC_CLASSES           (ALLOC_EXACT_CLASSES + 32 - ALLOC_EXACT_SHIFT)
+#define ALLOC_MAP_WORDS         ((ALLOC_CLASSES+31)/32)
+
+// Free objects of power of 2 list to check before going to a bigger class
+#define ALLOC_FIT_TRIES         8
+
+// Markers in _da_size of free object, live object can't be that big
+#define ALLOC_FREE_LISTED       0xFEEEF00D
+#define ALLOC_FREE_PENDING      0xFEEEBEEF
+
+#define ALLOC_NEXT(op)          ((op)->_class.data)
+#define ALLOC_PREV(op)          ((op)->_class.interface)
+
+static pvm_object_storage_t *   free_lists[ARENAS][ALLOC_CLASSES];
+static u_int32_t                free_map[ARENAS][ALLOC_MAP_WORDS];
+// Arena was scanned after start, lists are valid
+static volatile int             free_listed[ARENAS];
+// Bytes in lists, arena fill level is calculated from it
+static unsigned int             free_bytes[ARENAS];
+// Objects put to lists since last scan, no use to scan again if none
+static int                      free_since_scan[ARENAS];
+// Freed by refcount code, not in lists yet
+static pvm_object_storage_t * volatile free_pending;
+
+
 static inline int find_arena(unsigned int size, unsigned int flags, bool saturated)
 {
     int arena = 0; // root|saturated|code|class|interface|Large - nearly constant
@@ -109,26 +167,35 @@ static inline unsigned int round_size(unsigned int size, int arena)
     return size;
 }
 
-pvm_object_storage_t *get_root_object_storage() { return pvm_object_space_start; }
+pvm_object_storage_t *get_root_object_storage() { return start_a[0]; }
 
-// TODO must be rewritten - arena properties must be kept in persistent memory
-static void init_arenas( void * _pvm_object_space_start, unsigned int size )
+// Default layout, arenas are sized by percent_a[]. Actual one is loaded from
+// object space header by pvm_alloc_load_layout() and changes at run time.
+static void init_arenas( void * _pvm_object_space_start, unsigned int size, int with_header )
 {
     pvm_object_space_start = _pvm_object_space_start;
     pvm_object_space_end = pvm_object_space_start + size;
 
     void * cur = _pvm_object_space_start;
+    space_header = 0;
+
+    if( with_header )
+    {
+        space_header = _pvm_object_space_start;
+        cur += sizeof(struct pvm_object_space_header);
+        size -= sizeof(struct pvm_object_space_header);
+    }
+
     int percent_100 = 0;
     int i;
     for( i = 0; i < ARENAS; i++) {
         start_a[i] = cur;
-        curr_a[i] = cur;
         cur += (size / 400) * percent_a[i] * 4;  //align 4 bytes
         percent_100 += percent_a[i];
         end_a[i] = cur;
     }
     assert(percent_100 == 100); //check twice!
-    end_a[ARENAS-1] = pvm_object_space_start + size; //to be exact
+    end_a[ARENAS-1] = pvm_object_space_end; //to be exact
 }
 
 
@@ -139,7 +206,10 @@ void pvm_alloc_clear_mem()
     int i;
     for( i = 0; i < ARENAS; i++) {
         init_free_object_header((pvm_object_storage_t *)start_a[i], end_a[i] - start_a[i]);
+        free_listed[i] = 0; // will be scanned on first allocation
     }
+
+    alloc_save_layout();
 }
 
 
@@ -149,7 +219,7 @@ void pvm_alloc_init( void * _pvm_object_space_start, unsigned int size )
     assert(_pvm_object_space_start != 0);
     assert(size > 0);
 
-    init_arenas(_pvm_object_space_start, size);
+    init_arenas(_pvm_object_space_start, size, 1);
 
 
     //init_gc();  // here, if needed
@@ -164,6 +234,13 @@ void pvm_alloc_threaded_init(void)
     vm_alloc_mutex = &_vm_alloc_mutex;
 }
 
+static void pvm_alloc_dbg_init(void)
+{
+    dbg_add_command( dbg_arenas, "arenas", "arenas - show object arenas layout and fill levels");
+}
+
+INIT_ME( 0, pvm_alloc_dbg_init, 0 )
+
 
 static void init_object_header(pvm_object_storage_t *op, unsigned int size)
 {
@@ -185,19 +262,365 @@ static void init_free_object_header(pvm_object_storage_t *op, unsigned int size)
     op->_ah.gc_flags = 0;
     op->_ah.refCount = 0;
     op->_ah.exact_size = size;
+    op->_da_size = 0; // not in free lists
 }
 
 
 #define PVM_MIN_FRAGMENT_SIZE  (sizeof(pvm_object_storage_t) + sizeof(int) )      /* should be a minimal object size at least */
 
 
-// returns allocated object
-static pvm_object_storage_t *alloc_eat_some(pvm_object_storage_t *op, unsigned int size)
+
+// Write arena layout to object space header
+static void alloc_save_layout(void)
+{
+    if( space_header == 0 )
+        return;
+
+    int i;
+    for( i = 0; i < ARENAS; i++ )
+        space_header->arena_start[i] = start_a[i] - pvm_object_space_start;
+
+    space_header->arena_start[ARENAS] = end_a[ARENAS-1] - pvm_object_space_start;
+    space_header->n_arenas = ARENAS;
+    space_header->size = pvm_object_space_end - pvm_object_space_start;
+    space_header->marker = PVM_OBJECT_SPACE_MARKER;
+}
+
+// Called on VM start before root object is looked at
+void pvm_alloc_load_layout(void)
+{
+    struct pvm_object_space_header *h = pvm_object_space_start;
+    unsigned int size = pvm_object_space_end - pvm_object_space_start;
+
+    if( h->marker != PVM_OBJECT_SPACE_MARKER )
+    {
+        // Old object space starts with root object, arenas are made by percent_a[]
+        if( ((pvm_object_storage_t *)h)->_ah.object_start_marker == PVM_OBJECT_START_MARKER )
+        {
+            printf("Object space has no header, arenas are not resized\n");
+            init_arenas( pvm_object_space_start, size, 0 );
+        }
+        // Else it is a fresh one, pvm_alloc_clear_mem() will write header
+        return;
+    }
+
+    if( (h->n_arenas != ARENAS) || (h->size > size) || (h->arena_start[0] != sizeof(*h)) )
+        panic("Object space header: %d arenas in %d bytes, can't use in %d bytes with %d arenas",
+              h->n_arenas, h->size, size, ARENAS );
+
+    int i;
+    for( i = 0; i < ARENAS; i++ )
+    {
+        if( h->arena_start[i] >= h->arena_start[i+1] )
+            panic("Object space header: arena %d at %d ends at %d", i, h->arena_start[i], h->arena_start[i+1] );
+
+        start_a[i] = pvm_object_space_start + h->arena_start[i];
+        end_a[i] = pvm_object_space_start + h->arena_start[i+1];
+    }
+
+    if( h->size < size )
+    {
+        // Object space is bigger now, add the rest to the last arena
+        init_free_object_header( end_a[ARENAS-1], size - h->size );
+        end_a[ARENAS-1] = pvm_object_space_end;
+        alloc_save_layout();
+    }
+}
+
+
+
+#if VM_SMP
+
+/**
+ *
+ * Per-CPU allocation buffers.
+ *
+ * Small objects of stack, int and small arenas are carved from a region
+ * which CPU took from arena, no mutex is needed for that - just disabled
+ * preemption. Rest of region is a usual free object all the time, so
+ * heap can be walked, but pvm_find() and collapsing skip regions which
+ * are in use now. Objects of region freed on the same CPU are kept in
+ * per-CPU free lists by exact size and reused first. Ones freed on other
+ * CPUs (RefDec thread frees most of them, see refdec.c) are pushed to
+ * region's lock-free list, and owner moves them to its lists when it
+ * needs an object. They are marked pending till then, so no one else
+ * takes them even if region is given back meanwhile.
+ *
+ * Regions are known to this kernel only, after restart all of them are
+ * usual memory again.
+ *
+**/
+
+// Region size
+#define ALLOC_BUF_SIZE          (16*1024)
+// Bigger objects are allocated from arena
+#define ALLOC_BUF_MAX_OBJECT    256
+
+struct alloc_buffer
+{
+    void *                      start;
+    void *                      end;
+    // Carve from here, free object header is here
+    void *                      pos;
+    // Freed objects of region by exact_size/4
+    pvm_object_storage_t *      free[ALLOC_BUF_MAX_OBJECT/4+1];
+    // Freed by other CPUs, linked by ALLOC_NEXT
+    pvm_object_storage_t * volatile remote_free;
+};
+
+static struct alloc_buffer      alloc_buf[MAX_CPUS][ARENAS];
+
+static inline int alloc_buf_arena( int arena )
+{
+    return (arena >= 1) && (arena <= 3); // stack, int, small
+}
+
+// Region of some CPU which has this address, or 0
+static struct alloc_buffer * alloc_buf_owner( void *addr, int arena )
+{
+    int i;
+    for( i = 0; i < MAX_CPUS; i++ )
+    {
+        struct alloc_buffer *b = &alloc_buf[i][arena];
+        if( (addr >= b->start) && (addr < b->end) )
+            return b;
+    }
+    return 0;
+}
+
+#endif // VM_SMP
+
+
+static inline int alloc_class( unsigned int size )
+{
+    if( size <= ALLOC_EXACT_MAX )
+        return (size/4) - 1;
+
+    return ALLOC_EXACT_CLASSES - ALLOC_EXACT_SHIFT + (31 - __builtin_clz(size));
+}
+
+static void alloc_link( pvm_object_storage_t *op, int arena )
+{
+    int c = alloc_class( op->_ah.exact_size );
+
+    op->_da_size = ALLOC_FREE_LISTED;
+    free_bytes[arena] += op->_ah.exact_size;
+    ALLOC_PREV(op) = 0;
+    ALLOC_NEXT(op) = free_lists[arena][c];
+    if( ALLOC_NEXT(op) )
+        ALLOC_PREV(ALLOC_NEXT(op)) = op;
+
+    free_lists[arena][c] = op;
+    free_map[arena][c/32] |= 1u << (c%32);
+}
+
+static void alloc_unlink( pvm_object_storage_t *op, int arena )
+{
+    int c = alloc_class( op->_ah.exact_size );
+
+    if( ALLOC_PREV(op) )
+        ALLOC_NEXT(ALLOC_PREV(op)) = ALLOC_NEXT(op);
+    else
+        free_lists[arena][c] = ALLOC_NEXT(op);
+
+    if( ALLOC_NEXT(op) )
+        ALLOC_PREV(ALLOC_NEXT(op)) = ALLOC_PREV(op);
+
+    if( free_lists[arena][c] == 0 )
+        free_map[arena][c/32] &= ~(1u << (c%32));
+
+    free_bytes[arena] -= op->_ah.exact_size;
+    op->_da_size = 0;
+}
+
+// First not empty class starting from given one, or -1
+static int alloc_map_find( int arena, int from )
+{
+    int w = from / 32;
+    if( w >= ALLOC_MAP_WORDS )
+        return -1;
+
+    u_int32_t bits = free_map[arena][w] & (~0u << (from % 32));
+    while( bits == 0 )
+    {
+        if( ++w >= ALLOC_MAP_WORDS )
+            return -1;
+        bits = free_map[arena][w];
+    }
+
+    return w*32 + __builtin_ctz( bits );
+}
+
+// Free object which can be merged to the one before it. Pending ones are
+// not ours yet, except for the first scan - those are left from previous run.
+static int alloc_can_merge( pvm_object_storage_t *op, int arena, int first )
+{
+    if( op->_ah.alloc_flags != PVM_OBJECT_AH_ALLOCATOR_FLAG_FREE )
+        return 0;
+
+    if( (op->_da_size == ALLOC_FREE_PENDING) && !first )
+        return 0;
+
+#if VM_SMP
+    if( alloc_buf_owner( op, arena ) ) // Some CPU carves it now
+        return 0;
+#else
+    (void) arena;
+#endif
+
+    return 1;
+}
+
+// Put free object to lists, merging free objects after it
+static void alloc_free_put( pvm_object_storage_t *op, int arena )
+{
+    void *end = end_a[arena];
+    unsigned int size = op->_ah.exact_size;
+
+    while( (void *)op + size < end )
+    {
+        pvm_object_storage_t *next = (void *)op + size;
+
+        if( !alloc_can_merge( next, arena, 0 ) )
+            break;
+
+        if( next->_da_size == ALLOC_FREE_LISTED )
+            alloc_unlink( next, arena );
+
+        size += next->_ah.exact_size;
+        DEBUG_PRINT("^");
+    }
+
+    init_free_object_header( op, size );
+    alloc_link( op, arena );
+}
+
+// Rebuild arena lists, merging all the neighbour free objects
+static void alloc_scan( int arena )
 {
+    int first = !free_listed[arena];
+    void *end = end_a[arena];
+    pvm_object_storage_t *op = start_a[arena];
+
+    memset( free_lists[arena], 0, sizeof(free_lists[arena]) );
+    memset( free_map[arena], 0, sizeof(free_map[arena]) );
+    free_bytes[arena] = 0;
+
+    while( (void *)op < end )
+    {
+        assert( op->_ah.object_start_marker == PVM_OBJECT_START_MARKER );
+
+#if VM_SMP
+        // Free space of per-CPU buffer is not ours, jump over the whole region
+        struct alloc_buffer *b = alloc_buf_owner( op, arena );
+        if( b )
+        {
+            op = b->end;
+            continue;
+        }
+#endif
+
+        if( !(PVM_OBJECT_AH_ALLOCATOR_FLAG_ALLOCATED & op->_ah.alloc_flags) &&
+            (PVM_OBJECT_AH_ALLOCATOR_FLAG_FREE != op->_ah.alloc_flags) ) // refcount == 0, but refzero or in buffer or both
+        {
+            DEBUG_PRINT("(c)");
+            refzero_process_children( op );
+            // Free or pending here
+        }
+
+        if( !alloc_can_merge( op, arena, first ) )
+        {
+            op = (void *)op + op->_ah.exact_size;
+            continue;
+        }
+
+        unsigned int size = op->_ah.exact_size;
+
+        while( ((void *)op + size < end) && alloc_can_merge( (void *)op + size, arena, first ) )
+            size += ((pvm_object_storage_t *)((void *)op + size))->_ah.exact_size;
+
+        init_free_object_header( op, size );
+        alloc_link( op, arena );
+
+        op = (void *)op + size;
+    }
+
+    free_since_scan[arena] = 0;
+    free_listed[arena] = 1;
+}
+
+// Move objects freed by refcount code to lists
+static void alloc_drain_pending(void)
+{
+    pvm_object_storage_t *op = __sync_lock_test_and_set( &free_pending, 0 );
+
+    while( op )
+    {
+        pvm_object_storage_t *next = ALLOC_NEXT(op);
+        int arena = find_arena_by_address( op );
+
+#if VM_SMP
+        if( alloc_buf_owner( op, arena ) )
+            op->_da_size = 0; // Goes to lists when region is given back
+        else
+#endif
+        alloc_free_put( op, arena );
+
+        free_since_scan[arena]++;
+        op = next;
+    }
+}
+
+// Lock-free push of free object to list linked by ALLOC_NEXT
+static void alloc_stack_push( pvm_object_storage_t * volatile *list, pvm_object_storage_t *op )
+{
+    pvm_object_storage_t *head;
+    do {
+        head = *list;
+        ALLOC_NEXT(op) = head;
+    } while( !__sync_bool_compare_and_swap( list, head, op ) );
+}
+
+// Take object of given size from lists, returns allocated object
+static pvm_object_storage_t * alloc_take( unsigned int size, int arena )
+{
+    int c = alloc_class( size );
+    pvm_object_storage_t *op = 0;
+
+    if( c < ALLOC_EXACT_CLASSES )
+        op = free_lists[arena][c];
+    else
+    {
+        // Sizes in this list differ, check some of them
+        pvm_object_storage_t *p = free_lists[arena][c];
+        int tries;
+
+        for( tries = 0; p && (tries < ALLOC_FIT_TRIES); tries++, p = ALLOC_NEXT(p) )
+        {
+            if( p->_ah.exact_size >= size )
+            {
+                op = p;
+                break;
+            }
+        }
+    }
+
+    if( op == 0 )
+    {
+        // Any object of a bigger class fits
+        c = alloc_map_find( arena, c+1 );
+        if( c < 0 )
+            return 0;
+
+        op = free_lists[arena][c];
+    }
+
     assert( op->_ah.object_start_marker == PVM_OBJECT_START_MARKER );
     assert( op->_ah.alloc_flags == PVM_OBJECT_AH_ALLOCATOR_FLAG_FREE );
+    assert( op->_ah.exact_size >= size );
+
+    alloc_unlink( op, arena );
 
-    assert(op->_ah.exact_size >= size);
     unsigned int surplus = op->_ah.exact_size - size;
     if (surplus < PVM_MIN_FRAGMENT_SIZE) {
         // don't break in too small pieces
@@ -207,59 +630,184 @@ static pvm_object_storage_t *alloc_eat_some(pvm_object_storage_t *op, unsigned i
 
     init_object_header(op, size);  //update size and alloc_flags
 
-    void *o = (void*)op + size;
-    pvm_object_storage_t *opppa = (pvm_object_storage_t *)o;
-    init_free_object_header(opppa, surplus);
+    pvm_object_storage_t *rest = (void *)op + size;
+    init_free_object_header(rest, surplus);
+    alloc_free_put(rest, arena);
+
     return op;
 }
 
 
-// try to collapse current with next objects until they are free
-static void alloc_collapse_with_next_free(pvm_object_storage_t *op, unsigned int need_size, void * end, int arena)
+// --------------------------------------------------------------
+// Arenas resizing: boundary moves over free object of a neighbour
+// --------------------------------------------------------------
+
+// Take at least this much, if neighbour can give
+#define ALLOC_GROW_STEP         (256*1024)
+
+static int alloc_fill( int arena )
 {
-    assert( op->_ah.object_start_marker == PVM_OBJECT_START_MARKER );
-    assert( op->_ah.alloc_flags == PVM_OBJECT_AH_ALLOCATOR_FLAG_FREE );
+    unsigned int size = end_a[arena] - start_a[arena];
 
-    unsigned int size = op->_ah.exact_size;
-    do {
-        void *o = (void *)op + size;
-        pvm_object_storage_t *opppa = (pvm_object_storage_t *)o;
-        if (
-             ( o < end )  &&
-             ( (void *)opppa < end )  &&
-             ( opppa->_ah.alloc_flags == PVM_OBJECT_AH_ALLOCATOR_FLAG_FREE )  &&
-             ( size < need_size * 32 ) //limit page in amount
-           )
-        {
-            size += opppa->_ah.exact_size;
-            DEBUG_PRINT("^");
-        } else {
-            break;
-        }
-    } while(1);
+    if( size < 100 )
+        return 100;
+
+    unsigned int free = free_bytes[arena] / (size / 100);
+    return (free > 100) ? 0 : 100 - free;
+}
+
+// Fill level is a counter which is incremented and decremented, like disk queue size
+static void alloc_publish_fill( int arena )
+{
+    static int published[ARENAS];
 
-    if (size > op->_ah.exact_size)
+    if( !free_listed[arena] )
+        return;
+
+    int fill = alloc_fill( arena );
+    STAT_INC_CNT_N( STAT_CNT_ARENA_FILL_ROOT + arena, fill - published[arena] );
+    published[arena] = fill;
+}
+
+// How much of free object of size have can be given away, 0 if less than need
+static unsigned int alloc_grow_amount( int from, unsigned int have, unsigned int need )
+{
+    if( have < need + PVM_MIN_FRAGMENT_SIZE )
+        return 0;
+
+    // Neighbour keeps half of its free memory
+    unsigned int give = free_bytes[from] / 2;
+
+    if( give > have - PVM_MIN_FRAGMENT_SIZE )
+        give = have - PVM_MIN_FRAGMENT_SIZE;
+
+    if( give > need && give > ALLOC_GROW_STEP )
+        give = (need > ALLOC_GROW_STEP) ? need : ALLOC_GROW_STEP;
+
+    give &= ~3u;
+    return (give >= need) ? give : 0;
+}
+
+// Arena starts here now, previous one ends here
+static void alloc_set_boundary( int arena, void *addr )
+{
+    start_a[arena] = addr;
+    end_a[arena-1] = addr;
+    alloc_save_layout();
+}
+
+// Take beginning of the next arena
+static int alloc_grow_up( int arena, unsigned int need )
+{
+    int from = arena + 1;
+    pvm_object_storage_t *op = start_a[from];
+
+    if( (op->_ah.alloc_flags != PVM_OBJECT_AH_ALLOCATOR_FLAG_FREE) || (op->_da_size != ALLOC_FREE_LISTED) )
+        return -1;
+
+    unsigned int give = alloc_grow_amount( from, op->_ah.exact_size, need );
+    if( give == 0 )
+        return -1;
+
+    alloc_unlink( op, from );
+
+    // Rest header goes first, so that heap walker never meets garbage
+    pvm_object_storage_t *rest = (void *)op + give;
+    init_free_object_header( rest, op->_ah.exact_size - give );
+    init_free_object_header( op, give );
+
+    alloc_set_boundary( from, rest );
+
+    alloc_free_put( rest, from );
+    alloc_free_put( op, arena );
+
+    return 0;
+}
+
+// Take end of the previous arena
+static int alloc_grow_down( int arena, unsigned int need )
+{
+    int from = arena - 1;
+    void *end = end_a[from];
+    pvm_object_storage_t *op = start_a[from];
+    pvm_object_storage_t *last = 0;
+
+    // No way back from arena start but a walk, this is a rare case
+    while( (void *)op < end )
     {
-        init_free_object_header(op, size);  //update exact_size
-        DEBUG_PRINT1("%d", arena);
+        last = op;
+        op = (void *)op + op->_ah.exact_size;
     }
+
+    if( (last == 0) || (last->_ah.alloc_flags != PVM_OBJECT_AH_ALLOCATOR_FLAG_FREE) || (last->_da_size != ALLOC_FREE_LISTED) )
+        return -1;
+
+    unsigned int give = alloc_grow_amount( from, last->_ah.exact_size, need );
+    if( give == 0 )
+        return -1;
+
+    alloc_unlink( last, from );
+
+    pvm_object_storage_t *taken = end - give;
+    init_free_object_header( taken, give );
+    init_free_object_header( last, last->_ah.exact_size - give );
+
+    alloc_set_boundary( arena, taken );
+
+    alloc_free_put( last, from );
+    alloc_free_put( taken, arena );
+
+    return 0;
 }
 
-// suspected to break object land - alloc_collapse_with_next_free: assertion 'op->_ah.object_start_marker == PVM_OBJECT_START_MARKER' failed
+// Move arena boundary over free memory of a neighbour, returns 0 if arena grew
+static int alloc_arena_grow( int arena, unsigned int need )
+{
+    if( space_header == 0 )
+        return -1; // Layout can't be saved
+
+    int up = arena + 1;
+    int down = arena - 1;
+
+    if( (up < ARENAS) && !free_listed[up] )
+        alloc_scan( up );
+
+    if( (down >= 0) && !free_listed[down] )
+        alloc_scan( down );
+
+    // Neighbour which has more free memory goes first
+    int up_first = (up < ARENAS) && ( (down < 0) || (free_bytes[up] >= free_bytes[down]) );
+    int try;
+
+    for( try = 0; try < 2; try++ )
+    {
+        int go_up = try ? !up_first : up_first;
+        int rc = -1;
+
+        if( go_up && (up < ARENAS) )
+            rc = alloc_grow_up( arena, need );
+
+        if( !go_up && (down >= 0) )
+            rc = alloc_grow_down( arena, need );
+
+        if( rc == 0 )
+        {
+            DEBUG_PRINT1("\n(arena %d grew)", arena);
+            alloc_publish_fill( go_up ? up : down );
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+
+// Free objects are merged when put to lists, here we just unmap pages
 void pvm_collapse_free(pvm_object_storage_t *op)
 {
 #if VM_UNMAP_UNUSED_OBJECTS
     if(vm_alloc_mutex) hal_mutex_lock( vm_alloc_mutex );  // TODO avoid Giant lock
 
-    int arena = find_arena_by_address(op);
-    if( arena < 0 )
-        return;
-
-    void *start = (void *)op;
-    void *end = ( start < curr_a[arena] ) ? curr_a[arena] : end_a[arena];
-    // Attempt to collapse up to 10 pages
-    alloc_collapse_with_next_free( op, PAGE_SIZE*10, end, arena);
-
     addr_t data_start = (addr_t) &(op->da);
     size_t data_size  = op->_ah.exact_size;
 
@@ -287,26 +835,6 @@ void pvm_collapse_free(pvm_object_storage_t *op)
 }
 
 
-// walk through
-static pvm_object_storage_t *alloc_wrap_to_next_object(pvm_object_storage_t *op, void * start, void * end, int *wrap, int arena)
-{
-    assert(op->_ah.object_start_marker == PVM_OBJECT_START_MARKER);
-
-    void *o = (void *)op + op->_ah.exact_size;
-
-    if( o >= end )
-    {
-        assert(o <= end);
-        o = start;
-        (*wrap)++;
-        DEBUG_PRINT("\n(alloc wrap)");
-        DEBUG_PRINT1("%d", arena);
-    }
-    return (pvm_object_storage_t *)o;
-}
-
-
-
 static inline int pvm_alloc_is_object(pvm_object_storage_t *o)
 {
     return o->_ah.object_start_marker == PVM_OBJECT_START_MARKER;
@@ -350,74 +878,32 @@ void pvm_object_is_allocated_assert(pvm_object_storage_t *o)
 
 
 
-// Find a piece of mem of given or bigger size. Linear allocation.
+// Find a piece of mem of given or bigger size. Called with allocator mutex taken.
 static struct pvm_object_storage *pvm_find(unsigned int size, int arena)
 {
+    alloc_drain_pending();
 
-#define CURR_POS  curr_a[arena]
-
-//    static int rest_cnt = 0;
-//
-//    if(size < 64 && rest_cnt++ > 2000)
-//    {
-//        CURR_POS = start_a[arena];
-//        rest_cnt = 0;
-//    }
-    // a kind of optimization above
-
+    if( !free_listed[arena] )
+        alloc_scan( arena );
 
+    pvm_object_storage_t *result = alloc_take( size, arena );
 
-    struct pvm_object_storage *result = 0;
-
-    struct pvm_object_storage *start = start_a[arena];
-    struct pvm_object_storage *end = end_a[arena];
-
-    int wrap = 0;
-    struct pvm_object_storage *curr = CURR_POS;
-
-    while(result == 0)
+    if( (result == 0) && free_since_scan[arena] )
     {
-        if( wrap > 1 ) {
-            return 0;
-        }
-
-        if( PVM_OBJECT_AH_ALLOCATOR_FLAG_ALLOCATED & curr->_ah.alloc_flags )
-        {
-            DEBUG_PRINT("a");
-            // Is allocated? Go to the next one.
-            curr = alloc_wrap_to_next_object(curr, start, end, &wrap, arena);
-            continue;
-        }
-
-        if( PVM_OBJECT_AH_ALLOCATOR_FLAG_FREE != curr->_ah.alloc_flags ) // refcount == 0, but refzero or in buffer or both
-        {
-            DEBUG_PRINT("(c)");
-            refzero_process_children( curr );
-            // Supposed to be free here
-        }
-
-        // now free
-        assert( PVM_OBJECT_AH_ALLOCATOR_FLAG_FREE == curr->_ah.alloc_flags );
+        // Objects freed after scan are merged with the ones after them only
+        DEBUG_PRINT1("\n(alloc scan %d)", arena);
+        alloc_scan( arena );
+        result = alloc_take( size, arena );
+    }
 
-        if (curr->_ah.exact_size < size) {
-            alloc_collapse_with_next_free(curr, size, end, arena);
-            // try again -
-            if (curr->_ah.exact_size < size) {
-                DEBUG_PRINT("|");
-                curr = alloc_wrap_to_next_object(curr, start, end, &wrap, arena);
-                continue;
-            }
-        }
+    if( (result == 0) && (0 == alloc_arena_grow( arena, size )) )
+        result = alloc_take( size, arena );
 
-        result = alloc_eat_some(curr, size);
-        //break;
-    }
+    if( result )
+        DEBUG_PRINT("+");
 
-    assert(result != 0);
-    DEBUG_PRINT("+");
+    alloc_publish_fill( arena );
 
-    CURR_POS = alloc_wrap_to_next_object(result, start, end, &wrap, arena);
-    //CURR_POS = result;
     return result;
 }
 
@@ -466,6 +952,213 @@ static pvm_object_storage_t * pool_alloc(unsigned int size, int arena)
 }
 
 
+#if VM_SMP
+
+// Move objects freed by other CPUs to own lists. Called with preemption disabled
+static void alloc_buf_take_remote( struct alloc_buffer *b )
+{
+    pvm_object_storage_t *op = __sync_lock_test_and_set( &b->remote_free, 0 );
+
+    while( op )
+    {
+        pvm_object_storage_t *next = ALLOC_NEXT(op);
+
+        if( ((void *)op >= b->start) && ((void *)op < b->pos) )
+        {
+            op->_da_size = 0; // Not pending, region retire will merge it
+            ALLOC_NEXT(op) = b->free[op->_ah.exact_size/4];
+            b->free[op->_ah.exact_size/4] = op;
+        }
+        else
+            alloc_stack_push( &free_pending, op ); // Was freed while region changed
+
+        op = next;
+    }
+}
+
+// Called with preemption disabled
+static pvm_object_storage_t * alloc_buf_carve( struct alloc_buffer *b, unsigned int size )
+{
+    pvm_object_storage_t *op = b->free[size/4];
+
+    if( (op == 0) && b->remote_free )
+    {
+        alloc_buf_take_remote( b );
+        op = b->free[size/4];
+    }
+
+    if( op )
+    {
+        b->free[size/4] = ALLOC_NEXT(op);
+        init_object_header( op, op->_ah.exact_size );
+        return op;
+    }
+
+    if( (b->pos == 0) || ((unsigned int)(b->end - b->pos) < size + PVM_MIN_FRAGMENT_SIZE) )
+        return 0;
+
+    op = b->pos;
+    pvm_object_storage_t *rest = (void *)op + size;
+
+    // Rest header goes first, so that heap walker never meets garbage
+    init_free_object_header( rest, b->end - (void *)rest );
+    __sync_synchronize();
+    init_object_header( op, size );
+
+    b->pos = rest;
+    return op;
+}
+
+// Called with allocator mutex taken. Region is usual arena memory from now.
+static void alloc_buf_retire( struct alloc_buffer *b, int arena )
+{
+    pvm_object_storage_t *op = b->start;
+    void *end = b->end;
+
+    b->start = b->end = b->pos = 0;
+    memset( b->free, 0, sizeof(b->free) );
+
+    if( op == 0 )
+        return;
+
+    // Rest of region and objects freed in it go to lists
+    while( (void *)op < end )
+    {
+        if( alloc_can_merge( op, arena, 0 ) )
+        {
+            alloc_free_put( op, arena );
+            free_since_scan[arena]++;
+        }
+
+        op = (void *)op + op->_ah.exact_size;
+    }
+
+    // Objects freed by other CPUs are pending, walk above skipped them
+    op = __sync_lock_test_and_set( &b->remote_free, 0 );
+
+    while( op )
+    {
+        pvm_object_storage_t *next = ALLOC_NEXT(op);
+        int a = find_arena_by_address( op );
+
+        alloc_free_put( op, a );
+        free_since_scan[a]++;
+        op = next;
+    }
+}
+
+// Called with allocator mutex taken and preemption disabled
+static int alloc_buf_refill( struct alloc_buffer *b, int arena )
+{
+    alloc_buf_retire( b, arena );
+
+    pvm_object_storage_t *op = pvm_find( ALLOC_BUF_SIZE, arena );
+    if( op == 0 )
+        return -1;
+
+    init_free_object_header( op, op->_ah.exact_size );
+
+    b->start = b->pos = op;
+    b->end = (void *)op + op->_ah.exact_size;
+
+    return 0;
+}
+
+// Returns 0 if object must be allocated from arena
+static pvm_object_storage_t * buf_alloc( unsigned int size, int arena )
+{
+    pvm_object_storage_t * data;
+
+    hal_disable_preemption();
+    data = alloc_buf_carve( &alloc_buf[GET_CPU_ID()][arena], size );
+    hal_enable_preemption();
+
+    if( data || (vm_alloc_mutex == 0) )
+        return data;
+
+    hal_mutex_lock( vm_alloc_mutex );
+    hal_disable_preemption();
+
+    // Other thread of this CPU could refill it while we waited for mutex
+    struct alloc_buffer *b = &alloc_buf[GET_CPU_ID()][arena];
+    data = alloc_buf_carve( b, size );
+
+    if( (data == 0) && (0 == alloc_buf_refill( b, arena )) )
+        data = alloc_buf_carve( b, size );
+
+    hal_enable_preemption();
+    hal_mutex_unlock( vm_alloc_mutex );
+
+    return data;
+}
+
+// Object of some CPU region is kept for that CPU, returns 0 if not
+static int alloc_buf_recycle( pvm_object_storage_t *op )
+{
+    unsigned int size = op->_ah.exact_size;
+    int arena = find_arena_by_address( op );
+
+    if( (size > ALLOC_BUF_MAX_OBJECT) || !alloc_buf_arena( arena ) )
+        return 0;
+
+    hal_disable_preemption();
+
+    // Own CPU region, no one else touches its lists
+    struct alloc_buffer *b = &alloc_buf[GET_CPU_ID()][arena];
+    int own = ((void *)op >= b->start) && ((void *)op < b->pos);
+
+    if( own )
+    {
+        op->_ah.alloc_flags = PVM_OBJECT_AH_ALLOCATOR_FLAG_FREE;
+        ALLOC_NEXT(op) = b->free[size/4];
+        b->free[size/4] = op;
+    }
+
+    hal_enable_preemption();
+
+    if( own )
+        return 1;
+
+    b = alloc_buf_owner( op, arena );
+    if( b == 0 )
+        return 0;
+
+    // Marker first, so that region retire never takes it
+    op->_da_size = ALLOC_FREE_PENDING;
+    __sync_synchronize();
+    op->_ah.alloc_flags = PVM_OBJECT_AH_ALLOCATOR_FLAG_FREE;
+
+    alloc_stack_push( &b->remote_free, op );
+    return 1;
+}
+
+#endif // VM_SMP
+
+
+// Called by refcount code for object which is dead now, takes no locks
+void pvm_alloc_free( pvm_object_storage_t *op )
+{
+#if VM_SMP
+    if( alloc_buf_recycle( op ) )
+        return;
+#endif
+
+    if( !free_listed[find_arena_by_address( op )] )
+    {
+        // Arena scan will find it
+        op->_ah.alloc_flags = PVM_OBJECT_AH_ALLOCATOR_FLAG_FREE;
+        return;
+    }
+
+    // Marker first, so that arena scan never takes pending object
+    op->_da_size = ALLOC_FREE_PENDING;
+    __sync_synchronize();
+    op->_ah.alloc_flags = PVM_OBJECT_AH_ALLOCATOR_FLAG_FREE;
+
+    alloc_stack_push( &free_pending, op );
+}
+
+
 //allocation statistics:
 #define max_stat_size 4096
 static long created_o[ARENAS][max_stat_size+1];
@@ -483,6 +1176,12 @@ pvm_object_storage_t * pvm_object_alloc( unsigned int data_area_size, unsigned i
     int arena = find_arena(size, flags, saturated);
     size = round_size(size, arena);
 
+#if VM_SMP
+    data = 0;
+    if( alloc_buf_arena( arena ) && (size <= ALLOC_BUF_MAX_OBJECT) )
+        data = buf_alloc(size, arena);
+    if( data == 0 )
+#endif
     data = pool_alloc(size, arena);
 
     if( data == 0 )
@@ -664,4 +1363,24 @@ static void memcheck_print_histogram(unsigned int arena)
 
 
 
+static void dbg_arenas( int ac, char **av )
+{
+    (void) ac;
+    (void) av;
+
+    printf("Arenas layout is %s\n", space_header ? "kept in object space header" : "fixed, old object space" );
+    printf("  # name                start        size        free  fill\n");
+
+    int i;
+    for( i = 0; i < ARENAS; i++ )
+    {
+        printf("  %d %-14s %10ld %11ld ", i, name_a[i],
+               (long)(start_a[i] - pvm_object_space_start), (long)(end_a[i] - start_a[i]) );
+
+        if( free_listed[i] )
+            printf("%11u  %3d%%\n", free_bytes[i], alloc_fill( i ) );
+        else
+            printf("  not scanned yet\n");
+    }
+}
 
@@ -13,6 +13,7 @@
 #include <vm/code.h>
 #include <vm/alloc.h>
 #include <vm/reflect.h>
+#include <vm/p2c.h>
 
 #include <threads.h>
 #include <exceptions.h>
@@ -131,7 +132,7 @@ void pvm_backtrace(struct data_area_4_thread *tda)
 
         printf("pvm_backtrace frame IP: %d\n", fda->IP);
 
-        pvm_object_t tclass = thiso.data->_class;
+        pvm_object_t tclass = pvm_get_class( thiso );
         int ord = fda->ordinal;
 
         int lineno = pvm_ip_to_linenum(tclass, ord, fda->IP);
@@ -217,37 +218,149 @@ int pvm_get_method_name_count( pvm_object_t tclass )
     return get_array_size( mnames.data );
 }
 
-// returns ord or -1
-int pvm_get_method_ordinal( pvm_object_t tclass, pvm_object_t mname )
+// Parent of class which has method names, or null if there is no such
+static pvm_object_t method_names_parent( pvm_object_t tclass )
 {
-    struct data_area_4_class *cda= pvm_object_da( tclass, class );
-    pvm_object_t mnames = cda->method_names;
+    pvm_object_t parent = pvm_object_da( tclass, class )->class_parent;
 
-    if( pvm_is_null(mnames) )
-        return -1;
+    if( pvm_is_null( parent ) || parent.data == pvm_get_null_class().data )
+        return pvm_get_null_object();
 
-    if( pvm_is_null(mname) )
-        return -1;
+    return parent;
+}
 
-    if( !pvm_object_class_exactly_is( mname, pvm_get_string_class() ) )
-        return -1;
+// Look for name in method_names of class itself, returns ord or -1
+static int scan_method_names( pvm_object_t tclass, pvm_object_t mname, u_int32_t hash )
+{
+    pvm_object_t mnames = pvm_object_da( tclass, class )->method_names;
 
+    if( pvm_is_null(mnames) )
+        return -1;
 
     int nitems = get_array_size( mnames.data );
     int i;
 
+    // Names are compared by pointer if interned, by hash otherwise
     for( i = 0; i < nitems; i++ )
     {
         pvm_object_t curr_mname = pvm_get_ofield( mnames, i );
 
-        int diff = pvm_strcmp( curr_mname, mname);
-        if( diff == 0 )
+        if( pvm_is_null( curr_mname ) )
+            continue;
+
+        if( curr_mname.data == mname.data )
+            return i;
+
+        if( pvm_string_hash( curr_mname ) != hash )
+            continue;
+
+        if( pvm_string_equals( curr_mname, mname ) )
             return i;
     }
 
     return -1;
 }
 
+#if VM_METHOD_INDEX
+
+// Classes of images made before index was added have no field for it
+static inline int class_has_method_index( pvm_object_t tclass )
+{
+    return PVM_CLASS_HAS_FIELD( tclass.data, method_index );
+}
+
+//! Make name to ordinal directory for class, called by class loader or on first lookup
+void pvm_build_method_index( pvm_object_t tclass )
+{
+    if( !class_has_method_index( tclass ) )
+        return;
+
+    pvm_object_t index = pvm_create_directory_object();
+    hashdir_t *dir = pvm_object_da( index, directory );
+
+    // Child first, so that its name for ordinal wins
+    pvm_object_t c = tclass;
+    int depth = 1024; // max parent levels
+
+    while( !pvm_is_null( c ) && depth-- > 0 )
+    {
+        pvm_object_t mnames = pvm_object_da( c, class )->method_names;
+
+        if( !pvm_is_null( mnames ) )
+        {
+            int nitems = get_array_size( mnames.data );
+            int i;
+
+            for( i = 0; i < nitems; i++ )
+            {
+                pvm_object_t mname = pvm_get_ofield( mnames, i );
+
+                if( pvm_is_null( mname ) || !IS_PHANTOM_STRING( mname ) )
+                    continue;
+
+                // EEXIST for name which child has already
+                hdir_add_key( dir, mname, pvm_create_int_object( i ) );
+            }
+        }
+
+        c = method_names_parent( c );
+    }
+
+    struct data_area_4_class *cda = pvm_object_da( tclass, class );
+
+    // Two threads could build it at once, then one index is just dropped
+    if( pvm_is_null( cda->method_index ) )
+        cda->method_index = index;
+    else
+        ref_dec_o( index );
+}
+
+static int find_in_method_index( pvm_object_t tclass, pvm_object_t mname )
+{
+    struct data_area_4_class *cda = pvm_object_da( tclass, class );
+
+    if( pvm_is_null( cda->method_index ) )
+        pvm_build_method_index( tclass );
+
+    pvm_object_t ord;
+    if( hdir_find_key( pvm_object_da( cda->method_index, directory ), mname, &ord, 0 ) )
+        return -1;
+
+    int ret = pvm_get_int( ord );
+    ref_dec_o( ord );
+
+    return ret;
+}
+
+#endif // VM_METHOD_INDEX
+
+// returns ord or -1
+int pvm_get_method_ordinal( pvm_object_t tclass, pvm_object_t mname )
+{
+    if( pvm_is_null(mname) )
+        return -1;
+
+    if( !pvm_object_class_exactly_is( mname, pvm_get_string_class() ) )
+        return -1;
+
+#if VM_METHOD_INDEX
+    if( class_has_method_index( tclass ) )
+        return find_in_method_index( tclass, mname );
+#endif
+
+    u_int32_t hash = pvm_string_hash( mname );
+    int depth = 1024; // max parent levels
+
+    for( ; !pvm_is_null( tclass ) && depth-- > 0; tclass = method_names_parent( tclass ) )
+    {
+        int ord = scan_method_names( tclass, mname, hash );
+        if( ord >= 0 )
+            return ord;
+    }
+
+    return -1;
+}
+
 
 
 
@@ -291,5 +404,8 @@ pvm_object_t pvm_get_class( pvm_object_t o )
     if( pvm_is_null(o))
         return o;
 
+    if( pvm_is_immediate(o) )
+        return pvm_get_int_class();
+
     return o.data->_class;
 }
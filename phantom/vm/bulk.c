@@ -9,6 +9,10 @@
  * a new OS to init itself from. List is to be stored on a CD or on a new system fresh
  * formatted disk in a boot module.
  *
+ * If bulk starts with an index (see bulk.h), class is found by hash, else
+ * file is scanned. If bulk is in memory (pvm_bulk_map), class is loaded
+ * directly from it, else it is read with seek/read callbacks.
+ *
  **/
 
 #include <phantom_libc.h>
@@ -28,6 +32,10 @@
 static pvm_bulk_read_t  readf;
 static pvm_bulk_seek_t  seekf;
 
+// Whole bulk file, if it is in memory
+static const char      *image;
+static int              image_size;
+
 
 void pvm_bulk_init( pvm_bulk_seek_t sf, pvm_bulk_read_t rd )
 {
@@ -35,57 +43,175 @@ void pvm_bulk_init( pvm_bulk_seek_t sf, pvm_bulk_read_t rd )
     seekf = sf;
 }
 
-static int skip( int len );
+void pvm_bulk_map( const void *_image, int size )
+{
+    image = _image;
+    image_size = size;
+}
+
 static int load( int len, struct pvm_object   *out );
 static int cncmp( const char *a, const char *b );
+static int find_indexed( const char *class_name, struct pvm_object *out, int *ret );
+static int find_scan( const char *class_name, struct pvm_object *out );
 
 // Return 0 on success
 int pvm_load_class_from_module( const char *class_name, struct pvm_object   *out )
 {
-    seekf(0);
+    int ret;
 
     if(DEBUG) printf("Bulk: looking for class %s\n", class_name);
 
     if( 0 == load_class_from_file( class_name, out) )
         return 0;
 
-    while(1)
+    if( find_indexed( class_name, out, &ret ) )
+        return ret;
+
+    return find_scan( class_name, out );
+}
+
+
+// Read len bytes at pos, returns 0 on success
+static int read_at( int pos, int len, void *buf )
+{
+    if( image )
     {
-        int rlen;
-        struct pvm_bulk_class_head      ch;
+        if( pos < 0 || len < 0 || pos > image_size || len > image_size - pos )
+            return -1;
 
-        rlen = readf( sizeof( struct pvm_bulk_class_head ), &ch );
-        if( rlen != sizeof( struct pvm_bulk_class_head ) )
-            break;
+        memcpy( buf, image + pos, len );
+        return 0;
+    }
 
-        if(DEBUG) printf("Bulk: checking class %s\n", ch.name);
+    if( seekf( pos ) )
+        return -1;
+
+    return readf( len, buf ) == len ? 0 : -1;
+}
 
-        if( 0 == cncmp( class_name, ch.name ) )
-            return load(ch.data_length, out);
-        else
-            skip(ch.data_length);
+// Class head at pos, in place if bulk is in memory or read to buf
+static const struct pvm_bulk_class_head * get_head( int pos, struct pvm_bulk_class_head *buf )
+{
+    if( image )
+    {
+        if( pos < 0 || pos > image_size - (int)sizeof( *buf ) )
+            return 0;
+
+        return (const struct pvm_bulk_class_head *)(image + pos);
     }
 
-    return -1;
+    if( read_at( pos, sizeof( *buf ), buf ) )
+        return 0;
+
+    buf->name[PVM_BULK_CN_LENGTH-1] = 0;
+    return buf;
+}
+
+// Load class from data at pos
+static int load_at( int pos, u_int32_t len, struct pvm_object *out )
+{
+    if( image )
+    {
+        if( pos < 0 || pos > image_size || len > (u_int32_t)(image_size - pos) )
+            return -1;
+
+        return pvm_load_class_from_memory( image + pos, len, out );
+    }
+
+    if( seekf( pos ) )
+        return -1;
+
+    return load( len, out );
 }
 
 
-static int skip( int len )
+// Returns 0 if there is no index, else *ret is result of class load
+static int find_indexed( const char *class_name, struct pvm_object *out, int *ret )
 {
-    char buf[512];
+    struct pvm_bulk_class_head          chbuf;
+    const struct pvm_bulk_class_head   *ch;
+    struct pvm_bulk_index_head          ih;
+
+    ch = get_head( 0, &chbuf );
+    if( ch == 0 || cncmp( PVM_BULK_INDEX_NAME, ch->name ) )
+        return 0;
+
+    u_int32_t index_len = ch->data_length;
+    int slots_pos = sizeof( struct pvm_bulk_class_head ) + sizeof( ih );
 
-    while( len > 0 )
+    if( index_len < sizeof( ih ) || read_at( sizeof( struct pvm_bulk_class_head ), sizeof( ih ), &ih ) )
+        return 0;
+
+    if( ih.magic != PVM_BULK_INDEX_MAGIC || ih.version != PVM_BULK_INDEX_VERSION )
+        return 0;
+
+    if( ih.n_slots == 0 || (ih.n_slots & (ih.n_slots-1)) ||
+        ih.n_slots > (index_len - sizeof( ih )) / sizeof( struct pvm_bulk_index_slot ) )
+        return 0;
+
+    u_int32_t hash = pvm_bulk_name_hash( class_name );
+    u_int32_t mask = ih.n_slots - 1;
+    u_int32_t i;
+
+    for( i = 0; i < ih.n_slots; i++ )
     {
-        int l = len;
-        if( l > 512 ) l = 512;
+        struct pvm_bulk_index_slot s;
+        int spos = slots_pos + ((hash + i) & mask) * sizeof( s );
 
-        int ret = readf( l, buf );
-        if( ret <= 0 )
-            return -1;
+        if( read_at( spos, sizeof( s ), &s ) )
+            return 0;
+
+        // Empty slot ends probe sequence, no such class
+        if( s.head_offset == 0 )
+            break;
+
+        if( s.hash != hash )
+            continue;
+
+        ch = get_head( s.head_offset, &chbuf );
+        if( ch == 0 )
+            return 0;
+
+        if(DEBUG) printf("Bulk: index points to class %s\n", ch->name);
+
+        if( cncmp( class_name, ch->name ) )
+            continue;
+
+        *ret = load_at( s.head_offset + sizeof( struct pvm_bulk_class_head ), ch->data_length, out );
+        return 1;
+    }
 
-        len -= ret;
+    *ret = -1;
+    return 1;
+}
+
+// Old bulk without index - look through all of it
+static int find_scan( const char *class_name, struct pvm_object *out )
+{
+    int pos = 0;
+
+    while(1)
+    {
+        struct pvm_bulk_class_head          chbuf;
+        const struct pvm_bulk_class_head   *ch = get_head( pos, &chbuf );
+
+        if( ch == 0 )
+            break;
+
+        if(DEBUG) printf("Bulk: checking class %s\n", ch->name);
+
+        pos += sizeof( struct pvm_bulk_class_head );
+
+        if( 0 == cncmp( class_name, ch->name ) )
+            return load_at( pos, ch->data_length, out );
+
+        if( ch->data_length > (u_int32_t)(0x7FFFFFFF - pos) )
+            break;
+
+        pos += ch->data_length;
     }
-    return 0;
+
+    return -1;
 }
 
 
@@ -100,7 +226,10 @@ static int load( int len, struct pvm_object   *out )
 
     int rret = readf( len, buf );
     if( rret != len )
+    {
+        free( buf );
         return -1;
+    }
 
 
     int lret = pvm_load_class_from_memory( buf, len, out );
@@ -16,6 +16,8 @@
 #include "vm/object_flags.h"
 #include "vm/exception.h"
 
+#include "ids/opcode_ids.h"
+
 #define hal_printf printf
 
 #define int_size() 4
@@ -125,6 +127,148 @@ struct pvm_object pvm_code_get_string(struct pvm_code_handler *code)
 }
 
 
+// Number of operand bytes after the opcode, -1 if we can't say
+int pvm_code_op_len( const unsigned char *code, unsigned ip, unsigned max )
+{
+    unsigned char op = code[ip++];
+
+    if( (op & 0xF0) == opcode_sys_0 )   return 0;
+    if( (op & 0xE0) == opcode_call_00 ) return 1;
+
+    switch(op)
+    {
+    case opcode_iconst_8bit:
+    case opcode_os_load8:
+    case opcode_os_save8:
+    case opcode_is_load8:
+    case opcode_is_save8:
+    case opcode_sys_8bit:
+        return 1;
+
+    case opcode_djnz:
+    case opcode_jz:
+    case opcode_jmp:
+    case opcode_push_catcher:
+    case opcode_iconst_32bit:
+    case opcode_const_pool:
+    case opcode_os_load32:
+    case opcode_os_save32:
+    case opcode_os_pull32:
+    case opcode_os_get32:
+    case opcode_os_set32:
+    case opcode_is_get32:
+    case opcode_is_set32:
+        return 4;
+
+    case opcode_ilt_jz:
+    case opcode_ile_jz:
+    case opcode_igt_jz:
+    case opcode_ige_jz:
+        return 4;
+
+    case opcode_is_inc32:
+        return 4+4;
+
+    case opcode_is_get32_iconst_ilt_jz:
+    case opcode_is_get32_iconst_ile_jz:
+    case opcode_is_get32_iconst_igt_jz:
+    case opcode_is_get32_iconst_ige_jz:
+        return 4+4+4;
+
+    case opcode_call_8bit:
+        return 1+4;
+
+    case opcode_call_32bit:
+    case opcode_static_invoke:
+        return 4+4;
+
+    case opcode_iconst_64bit:
+        return 8;
+
+    case opcode_sconst_bin:
+    case opcode_summon_by_name:
+        if( ip+4 > max ) return -1;
+        return 4 + pvm_code_do_get_int( code+ip );
+
+    case opcode_debug:
+        if( ip+1 > max ) return -1;
+        if( !(code[ip] & 0x80) ) return 1;
+        if( ip+1+4 > max ) return -1;
+        return 1 + 4 + pvm_code_do_get_int( code+ip+1 );
+
+    case opcode_switch:
+        if( ip+4 > max ) return -1;
+        return 4*3 + 4*pvm_code_do_get_int( code+ip );
+
+    case opcode_nop:
+    case opcode_ret:
+    case opcode_short_call_0:
+    case opcode_short_call_1:
+    case opcode_short_call_2:
+    case opcode_short_call_3:
+    case opcode_is_dup:
+    case opcode_is_drop:
+    case opcode_os_dup:
+    case opcode_os_drop:
+    case opcode_new:
+    case opcode_copy:
+    case opcode_iconst_0:
+    case opcode_iconst_1:
+    case opcode_cast:
+    case opcode_pop_catcher:
+    case opcode_throw:
+    case opcode_summon_thread:
+    case opcode_summon_this:
+    case opcode_summon_null:
+    case opcode_summon_class_class:
+    case opcode_summon_int_class:
+    case opcode_summon_string_class:
+    case opcode_summon_interface_class:
+    case opcode_summon_code_class:
+    case opcode_summon_array_class:
+    case opcode_i2o:
+    case opcode_o2i:
+    case opcode_isum:
+    case opcode_imul:
+    case opcode_isubul:
+    case opcode_isublu:
+    case opcode_idivul:
+    case opcode_idivlu:
+    case opcode_ior:
+    case opcode_iand:
+    case opcode_ixor:
+    case opcode_inot:
+    case opcode_log_or:
+    case opcode_log_and:
+    case opcode_log_xor:
+    case opcode_log_not:
+    case opcode_ige:
+    case opcode_ile:
+    case opcode_igt:
+    case opcode_ilt:
+    case opcode_os_eq:
+    case opcode_os_neq:
+    case opcode_os_isnull:
+    case opcode_prefix_long:
+    case opcode_prefix_float:
+    case opcode_prefix_double:
+    case opcode_general_lock:
+    case opcode_general_unlock:
+    case opcode_dynamic_invoke:
+    case opcode_ishl:
+    case opcode_ishr:
+    case opcode_ushr:
+    case opcode_fromi:
+    case opcode_froml:
+    case opcode_fromf:
+    case opcode_fromd:
+        return 0;
+    }
+
+    return -1;
+}
+
+
 /**
  *
  * Call frame setup
@@ -0,0 +1,776 @@
+/**
+ *
+ * Phantom OS
+ *
+ * Copyright (C) 2005-2016 Dmitry Zavalishin, dz@dz.ru
+ *
+ * Pre-decoded bytecode cache.
+ *
+ * For each code object we keep (in kernel memory, not in persistent
+ * one!) an array of fixed size records, one per instruction, with
+ * operands already converted from big endian and jump targets made
+ * absolute. Interpreter executes records instead of bytes when it can.
+ *
+ * IP is still a byte offset in code, so call frames, exceptions,
+ * line number maps and snapshots see nothing new. Cache is lost on
+ * reboot and is rebuilt lazily on first execution of code after
+ * restart.
+ *
+**/
+
+#define DEBUG_MSG_PREFIX "vm.dcode"
+#include <debug_ext.h>
+#define debug_level_flow 6
+#define debug_level_error 10
+#define debug_level_info 10
+
+#include <phantom_libc.h>
+#include <kernel/init.h>
+#include <kernel/mutex.h>
+#include <kernel/atomic.h>
+#include <kernel/debug.h>
+
+#include <vm/code.h>
+#include <vm/internal_da.h>
+
+#include "ids/opcode_ids.h"
+
+#include "jit.h"
+
+
+#if VM_CODE_CACHE_SIZE
+
+
+#define CODE_CACHE_HASH_SIZE 1024
+
+static struct pvm_code_cache *  code_cache_hash[CODE_CACHE_HASH_SIZE];
+static hal_mutex_t              code_cache_mutex;
+static size_t                   code_cache_mem = 0;
+static int                      inited = 0;
+
+// Inline cache entries of other epochs are dead
+static volatile unsigned int    pvm_ic_epoch = 1;
+
+static void pvm_code_cache_init(void);
+static void dbg_ic_stats( int ac, char **av );
+
+INIT_ME( 0, pvm_code_cache_init, 0 )
+
+
+static void pvm_code_cache_init(void)
+{
+    hal_mutex_init( &code_cache_mutex, "CodeCache" );
+    inited = 1;
+
+    dbg_add_command( dbg_ic_stats, "ic", "ic [min calls] - call site inline caches hit rate");
+}
+
+static inline unsigned code_cache_hash_f( const unsigned char *code )
+{
+    return (((addr_t)code) >> 4) % CODE_CACHE_HASH_SIZE;
+}
+
+#define CODE_CACHE_SUM_BYTES 16
+
+// Cheap fingerprint - size and some bytes spread over code. Record can
+// outlive its code object if finalizer was not called for it (code
+// objects of older images have no finalizer flag), so pointer and size
+// are not enough to be sure it is the same code.
+static unsigned int code_cache_sum( const unsigned char *code, unsigned int code_size )
+{
+    unsigned int sum = code_size;
+    unsigned int step = code_size / CODE_CACHE_SUM_BYTES + 1;
+    unsigned int i;
+
+    for( i = 0; i < code_size; i += step )
+        sum = sum * 31 + code[i];
+
+    if( code_size )
+        sum = sum * 31 + code[code_size-1];
+
+    return sum;
+}
+
+
+// Does this op find a method to call?
+static int code_cache_op_is_call( unsigned char op )
+{
+    if( (op & 0xE0) == opcode_call_00 ) return 1;
+
+    switch(op)
+    {
+    case opcode_short_call_0:
+    case opcode_short_call_1:
+    case opcode_short_call_2:
+    case opcode_short_call_3:
+    case opcode_call_8bit:
+    case opcode_call_32bit:
+    case opcode_dynamic_invoke:
+        return 1;
+    }
+    return 0;
+}
+
+// Can interpreter take operands of this op from record?
+static int code_cache_op_decodable( unsigned char op )
+{
+    switch(op)
+    {
+    case opcode_iconst_64bit:
+    case opcode_sconst_bin:
+    case opcode_summon_by_name:
+    case opcode_debug:
+    case opcode_switch:
+        return 0;
+    }
+    return 1;
+}
+
+static void code_cache_decode_args( struct pvm_code_op *op, const unsigned char *code, unsigned ip )
+{
+    unsigned char opc = op->opcode;
+
+    op->arg[0] = op->arg[1] = op->arg[2] = 0;
+
+    if( (opc & 0xE0) == opcode_call_00 )
+    {
+        op->arg[0] = code[ip];
+        return;
+    }
+
+    switch(opc)
+    {
+    case opcode_iconst_8bit:
+    case opcode_os_load8:
+    case opcode_os_save8:
+    case opcode_is_load8:
+    case opcode_is_save8:
+    case opcode_sys_8bit:
+        op->arg[0] = code[ip];
+        break;
+
+    case opcode_djnz:
+    case opcode_jz:
+    case opcode_jmp:
+    case opcode_push_catcher:
+    case opcode_ilt_jz:
+    case opcode_ile_jz:
+    case opcode_igt_jz:
+    case opcode_ige_jz:
+        // See pvm_code_get_rel_IP_as_abs
+        op->arg[0] = ip + pvm_code_do_get_int( code+ip );
+        break;
+
+    case opcode_iconst_32bit:
+    case opcode_const_pool:
+    case opcode_os_load32:
+    case opcode_os_save32:
+    case opcode_os_pull32:
+    case opcode_os_get32:
+    case opcode_os_set32:
+    case opcode_is_get32:
+    case opcode_is_set32:
+        op->arg[0] = pvm_code_do_get_int( code+ip );
+        break;
+
+    case opcode_call_8bit:
+        op->arg[0] = code[ip];
+        op->arg[1] = pvm_code_do_get_int( code+ip+1 );
+        break;
+
+    case opcode_call_32bit:
+    case opcode_static_invoke:
+    case opcode_is_inc32:
+        op->arg[0] = pvm_code_do_get_int( code+ip );
+        op->arg[1] = pvm_code_do_get_int( code+ip+4 );
+        break;
+
+    case opcode_is_get32_iconst_ilt_jz:
+    case opcode_is_get32_iconst_ile_jz:
+    case opcode_is_get32_iconst_igt_jz:
+    case opcode_is_get32_iconst_ige_jz:
+        op->arg[0] = pvm_code_do_get_int( code+ip );
+        op->arg[1] = pvm_code_do_get_int( code+ip+4 );
+        op->arg[2] = ip+8 + pvm_code_do_get_int( code+ip+8 );
+        break;
+    }
+}
+
+
+#if VM_SUPERINSTR
+
+// --------------------------------------------------------------------------
+// Superinstructions. Frequent sequences of records are replaced with one
+// record which does it all. Only first record of sequence is changed, so
+// one can still jump into the middle of it, and IP is still a byte offset.
+// --------------------------------------------------------------------------
+
+// Record for IP, if it is decoded
+static struct pvm_code_op * code_cache_rec( struct pvm_code_cache *cc, unsigned ip )
+{
+    if( ip >= cc->code_size || 0 == cc->map[ip] ) return 0;
+    return cc->ops + (cc->map[ip] - 1);
+}
+
+static int code_cache_is_op( const struct pvm_code_op *op, unsigned char opcode )
+{
+    return op && op->opcode == opcode;
+}
+
+static int code_cache_iconst( const struct pvm_code_op *op, int *v )
+{
+    if( 0 == op ) return 0;
+
+    switch(op->opcode)
+    {
+    case opcode_iconst_0:       *v = 0; return 1;
+    case opcode_iconst_1:       *v = 1; return 1;
+    case opcode_iconst_8bit:
+    case opcode_iconst_32bit:   *v = op->arg[0]; return 1;
+    }
+    return 0;
+}
+
+// Compare followed by jz -> compare and jump if false, 0 if op is not a compare
+static unsigned char code_cache_cmp_jz( const struct pvm_code_op *op )
+{
+    if( 0 == op ) return 0;
+
+    switch(op->opcode)
+    {
+    case opcode_ilt:    return opcode_ilt_jz;
+    case opcode_ile:    return opcode_ile_jz;
+    case opcode_igt:    return opcode_igt_jz;
+    case opcode_ige:    return opcode_ige_jz;
+    }
+    return 0;
+}
+
+static unsigned char code_cache_get_cmp_jz( unsigned char cmp_jz )
+{
+    switch(cmp_jz)
+    {
+    case opcode_ilt_jz: return opcode_is_get32_iconst_ilt_jz;
+    case opcode_ile_jz: return opcode_is_get32_iconst_ile_jz;
+    case opcode_igt_jz: return opcode_is_get32_iconst_igt_jz;
+    case opcode_ige_jz: return opcode_is_get32_iconst_ige_jz;
+    }
+    return 0;
+}
+
+static int code_cache_is_prefix( const struct pvm_code_op *op )
+{
+    return op && ( op->opcode == opcode_prefix_long ||
+                   op->opcode == opcode_prefix_float ||
+                   op->opcode == opcode_prefix_double );
+}
+
+static void code_cache_fuse( struct pvm_code_cache *cc )
+{
+    struct pvm_code_op *prev = 0;
+    unsigned ip;
+
+    // Records are in IP order, and each pattern looks forward only,
+    // so we never see a record we changed as a part of a sequence.
+    for( ip = 0; ip < cc->code_size; ip++ )
+    {
+        struct pvm_code_op *op = code_cache_rec( cc, ip );
+        if( 0 == op ) continue;
+
+        // Prefixed op is not ours to take
+        if( code_cache_is_prefix( prev ) )
+        {
+            prev = op;
+            continue;
+        }
+        prev = op;
+
+        struct pvm_code_op *o1 = code_cache_rec( cc, op->next_IP );
+        unsigned char cmp_jz = code_cache_cmp_jz( op );
+
+        // ilt; jz
+        if( cmp_jz )
+        {
+            if( code_cache_is_op( o1, opcode_jz ) )
+            {
+                op->opcode = cmp_jz;
+                op->arg[0] = o1->arg[0];
+                op->next_IP = o1->next_IP;
+            }
+            continue;
+        }
+
+        if( op->opcode != opcode_is_get32 )
+            continue;
+
+        int k;
+        if( !code_cache_iconst( o1, &k ) )
+            continue;
+
+        struct pvm_code_op *o2 = code_cache_rec( cc, o1->next_IP );
+        struct pvm_code_op *o3 = o2 ? code_cache_rec( cc, o2->next_IP ) : 0;
+
+        // is_get32 N; iconst; ilt; jz
+        cmp_jz = code_cache_cmp_jz( o2 );
+        if( cmp_jz && code_cache_is_op( o3, opcode_jz ) )
+        {
+            op->opcode = code_cache_get_cmp_jz( cmp_jz );
+            op->arg[1] = k;
+            op->arg[2] = o3->arg[0];
+            op->next_IP = o3->next_IP;
+            continue;
+        }
+
+        // is_get32 N; iconst; isum; is_dup; is_set32 N; is_drop - that is 'i = i + k;'
+        if( !code_cache_is_op( o2, opcode_isum ) || !code_cache_is_op( o3, opcode_is_dup ) )
+            continue;
+
+        struct pvm_code_op *o4 = code_cache_rec( cc, o3->next_IP );
+        struct pvm_code_op *o5 = o4 ? code_cache_rec( cc, o4->next_IP ) : 0;
+
+        if( code_cache_is_op( o4, opcode_is_set32 ) && o4->arg[0] == op->arg[0] &&
+            code_cache_is_op( o5, opcode_is_drop ) )
+        {
+            op->opcode = opcode_is_inc32;
+            op->arg[1] = k;
+            op->next_IP = o5->next_IP;
+        }
+    }
+}
+
+#endif // VM_SUPERINSTR
+
+
+static void code_cache_free( struct pvm_code_cache *cc )
+{
+    if( cc->ics ) free( cc->ics );
+    free( cc->map );
+    free( cc );
+}
+
+
+static struct pvm_code_cache * code_cache_decode( const unsigned char *code, unsigned int code_size )
+{
+    unsigned ip;
+    unsigned nops = 0;
+    unsigned nics = 0;
+
+    // Pass 1 - count instructions we can decode
+    for( ip = 0; ip < code_size; )
+    {
+        int len = pvm_code_op_len( code, ip, code_size );
+        if( len < 0 || ip + 1 + len > code_size ) break;
+        if( code_cache_op_decodable( code[ip] ) )
+        {
+            nops++;
+            if( code_cache_op_is_call( code[ip] ) && nics < 0xFFFF ) nics++;
+        }
+        ip += 1 + len;
+    }
+
+    size_t size = sizeof(struct pvm_code_cache) + nops * sizeof(struct pvm_code_op);
+    size_t map_size = code_size * sizeof(u_int32_t);
+    size_t ics_size = nics * sizeof(struct pvm_inline_cache);
+
+    if( code_cache_mem + size + map_size + ics_size > VM_CODE_CACHE_SIZE )
+        return 0;
+
+    struct pvm_code_cache *cc = calloc( 1, size );
+    if( 0 == cc ) return 0;
+
+    cc->map = calloc( 1, map_size );
+    if( 0 == cc->map )
+    {
+        free(cc);
+        return 0;
+    }
+
+    if( nics )
+    {
+        cc->ics = calloc( 1, ics_size );
+        if( 0 == cc->ics )
+        {
+            code_cache_free( cc );
+            return 0;
+        }
+    }
+
+    cc->code = code;
+    cc->code_size = code_size;
+    cc->sum = code_cache_sum( code, code_size );
+    cc->mem = size + map_size + ics_size;
+    cc->nops = nops;
+    cc->nics = nics;
+
+    // Pass 2 - fill records. Bytes we did not decode stay 0 in map.
+    unsigned n = 0;
+    unsigned nic = 0;
+    for( ip = 0; ip < code_size && n < nops; )
+    {
+        int len = pvm_code_op_len( code, ip, code_size );
+        if( len < 0 || ip + 1 + len > code_size ) break;
+
+        if( code_cache_op_decodable( code[ip] ) )
+        {
+            struct pvm_code_op *op = cc->ops + n;
+
+            op->opcode = code[ip];
+            op->next_IP = ip + 1 + len;
+            code_cache_decode_args( op, code, ip+1 );
+
+            if( code_cache_op_is_call( op->opcode ) && nic < nics )
+            {
+                cc->ics[nic].IP = ip;
+                op->ic = ++nic;
+            }
+
+            cc->map[ip] = ++n;
+        }
+
+        ip += 1 + len;
+    }
+
+#if VM_SUPERINSTR
+    code_cache_fuse( cc );
+#endif
+
+    return cc;
+}
+
+
+struct pvm_code_cache * pvm_code_cache_get( const unsigned char *code, unsigned int code_size )
+{
+    if( !inited || 0 == code ) return 0;
+
+    unsigned h = code_cache_hash_f( code );
+    struct pvm_code_cache *cc;
+
+    hal_mutex_lock( &code_cache_mutex );
+    for( cc = code_cache_hash[h]; cc; cc = cc->next )
+    {
+        if( cc->code == code )
+            break;
+    }
+    hal_mutex_unlock( &code_cache_mutex );
+
+    if( cc && (cc->code_size != code_size || cc->sum != code_cache_sum( code, code_size )) )
+    {
+        // Left from dead code object at the same address
+        pvm_code_cache_forget( code );
+        cc = 0;
+    }
+
+    if( cc )
+        return cc;
+
+    // Decode outside of lock, it is long
+    struct pvm_code_cache *ncc = code_cache_decode( code, code_size );
+    if( 0 == ncc ) return 0;
+
+    hal_mutex_lock( &code_cache_mutex );
+    for( cc = code_cache_hash[h]; cc; cc = cc->next )
+    {
+        if( cc->code == code )
+            break;
+    }
+
+    if( 0 == cc )
+    {
+        ncc->next = code_cache_hash[h];
+        code_cache_hash[h] = ncc;
+        code_cache_mem += ncc->mem;
+        cc = ncc;
+        ncc = 0;
+    }
+    hal_mutex_unlock( &code_cache_mutex );
+
+    // Someone did it in parallel
+    if( ncc )
+        code_cache_free( ncc );
+
+    SHOW_FLOW( 7, "decoded %d bytes, %d ops, cache mem %d", code_size, cc->nops, code_cache_mem );
+    return cc;
+}
+
+
+void pvm_code_cache_forget( const unsigned char *code )
+{
+    if( !inited ) return;
+
+    unsigned h = code_cache_hash_f( code );
+    struct pvm_code_cache *cc = 0;
+    struct pvm_code_cache **pp;
+
+    hal_mutex_lock( &code_cache_mutex );
+    for( pp = code_cache_hash+h; *pp; pp = &((*pp)->next) )
+    {
+        if( (*pp)->code == code )
+        {
+            cc = *pp;
+            *pp = cc->next;
+            code_cache_mem -= cc->mem;
+            break;
+        }
+    }
+    hal_mutex_unlock( &code_cache_mutex );
+
+    if( cc )
+    {
+#if JIT_ENABLED
+        if( cc->jit ) jit_free_code( cc->jit );
+#endif
+        code_cache_free( cc );
+    }
+}
+
+
+int pvm_code_cache_set_jit( struct pvm_code_cache *cc, struct jit_code *jc )
+{
+    int rc = 1;
+
+    hal_mutex_lock( &code_cache_mutex );
+    if( 0 == cc->jit )
+    {
+        cc->jit = jc;
+        rc = 0;
+    }
+    hal_mutex_unlock( &code_cache_mutex );
+
+    return rc;
+}
+
+
+
+// --------------------------------------------------------------------------
+// Inline caches
+// --------------------------------------------------------------------------
+
+
+void pvm_ic_invalidate_all(void)
+{
+    ATOMIC_ADD_AND_FETCH( &pvm_ic_epoch, 1 );
+}
+
+
+// Returns entry to fill or 0 if site is megamorphic
+static struct pvm_ic_entry * pvm_ic_claim( struct pvm_inline_cache *ic )
+{
+    unsigned int epoch = pvm_ic_epoch;
+
+    if( ic->epoch != epoch )
+    {
+        // All entries are dead, start from scratch
+        hal_mutex_lock( &code_cache_mutex );
+        if( ic->epoch != epoch )
+        {
+            int i;
+            for( i = 0; i < PVM_IC_WAYS; i++ )
+                ic->e[i].epoch = 0;
+            ic->used = 0;
+            ic->epoch = epoch;
+        }
+        hal_mutex_unlock( &code_cache_mutex );
+    }
+
+    // Count stops at PVM_IC_WAYS+1, enough to see site is megamorphic.
+    // Counting on each miss would wrap used to negative some day.
+    int slot;
+    do {
+        slot = ic->used;
+        if( slot > PVM_IC_WAYS )
+            return 0;
+    } while( !__sync_bool_compare_and_swap( &ic->used, slot, slot+1 ) );
+
+    if( slot < 0 || slot >= PVM_IC_WAYS )
+        return 0;
+
+    return ic->e + slot;
+}
+
+
+struct pvm_object_storage * pvm_ic_get_code( struct pvm_inline_cache *ic, struct pvm_object_storage *iface )
+{
+    unsigned int epoch = pvm_ic_epoch;
+    int i;
+
+    for( i = 0; i < PVM_IC_WAYS; i++ )
+    {
+        struct pvm_ic_entry *e = ic->e + i;
+        if( e->epoch == epoch && e->key == iface )
+        {
+            ic->hits++;
+            return e->code;
+        }
+    }
+
+    ic->misses++;
+    return 0;
+}
+
+void pvm_ic_put_code( struct pvm_inline_cache *ic, struct pvm_object_storage *iface, struct pvm_object_storage *code )
+{
+    struct pvm_ic_entry *e = pvm_ic_claim( ic );
+    if( 0 == e ) return;
+
+    e->key = iface;
+    e->code = code;
+    __sync_synchronize();
+    e->epoch = ic->epoch;
+}
+
+
+int pvm_ic_get_ordinal( struct pvm_inline_cache *ic, struct pvm_object_storage *class, const char *name, unsigned int name_len )
+{
+    unsigned int epoch = pvm_ic_epoch;
+    int i;
+
+    for( i = 0; i < PVM_IC_WAYS; i++ )
+    {
+        struct pvm_ic_entry *e = ic->e + i;
+        if( e->epoch == epoch && e->key == class &&
+            e->name_len == name_len && 0 == memcmp( e->name, name, name_len ) )
+        {
+            ic->hits++;
+            return e->ordinal;
+        }
+    }
+
+    ic->misses++;
+    return -1;
+}
+
+void pvm_ic_put_ordinal( struct pvm_inline_cache *ic, struct pvm_object_storage *class, const char *name, unsigned int name_len, int ordinal )
+{
+    if( name_len > PVM_IC_NAME_SIZE )
+        return;
+
+    struct pvm_ic_entry *e = pvm_ic_claim( ic );
+    if( 0 == e ) return;
+
+    e->key = class;
+    e->ordinal = ordinal;
+    e->name_len = name_len;
+    memcpy( e->name, name, name_len );
+    __sync_synchronize();
+    e->epoch = ic->epoch;
+}
+
+
+static void dbg_ic_stats( int ac, char **av )
+{
+    unsigned int min_calls = 1000;
+    unsigned long long hits = 0, misses = 0;
+    int sites = 0, mega = 0;
+    int i;
+
+    if( ac > 1 )
+        min_calls = atoi( av[1] );
+
+    printf("Call sites with %u calls or more:\n", min_calls );
+    printf("      code       IP  ways      hits    misses  hit%%\n");
+
+    hal_mutex_lock( &code_cache_mutex );
+    for( i = 0; i < CODE_CACHE_HASH_SIZE; i++ )
+    {
+        struct pvm_code_cache *cc;
+        for( cc = code_cache_hash[i]; cc; cc = cc->next )
+        {
+            unsigned int n;
+            for( n = 0; n < cc->nics; n++ )
+            {
+                struct pvm_inline_cache *ic = cc->ics + n;
+                unsigned int calls = ic->hits + ic->misses;
+
+                if( 0 == calls ) continue;
+
+                sites++;
+                hits += ic->hits;
+                misses += ic->misses;
+                if( ic->used > PVM_IC_WAYS ) mega++;
+
+                if( calls < min_calls ) continue;
+
+                printf("%10p %8u %5d %9u %9u %4u%s\n",
+                       cc->code, ic->IP, ic->used > PVM_IC_WAYS ? PVM_IC_WAYS : ic->used,
+                       ic->hits, ic->misses, (unsigned)(ic->hits * 100ull / calls),
+                       ic->used > PVM_IC_WAYS ? " mega" : ""
+                      );
+            }
+        }
+    }
+    hal_mutex_unlock( &code_cache_mutex );
+
+    unsigned long long calls = hits + misses;
+    printf("%d sites used, %d megamorphic, hit rate %d%%\n",
+           sites, mega, calls ? (int)(hits * 100 / calls) : 0 );
+}
+
+
+#else // VM_CODE_CACHE_SIZE
+
+struct pvm_code_cache * pvm_code_cache_get( const unsigned char *code, unsigned int code_size )
+{
+    (void) code;
+    (void) code_size;
+    return 0;
+}
+
+void pvm_code_cache_forget( const unsigned char *code )
+{
+    (void) code;
+}
+
+int pvm_code_cache_set_jit( struct pvm_code_cache *cc, struct jit_code *jc )
+{
+    (void) cc;
+    (void) jc;
+    return 1;
+}
+
+// Never called, there are no call site caches without code cache
+
+struct pvm_object_storage * pvm_ic_get_code( struct pvm_inline_cache *ic, struct pvm_object_storage *iface )
+{
+    (void) ic;
+    (void) iface;
+    return 0;
+}
+
+void pvm_ic_put_code( struct pvm_inline_cache *ic, struct pvm_object_storage *iface, struct pvm_object_storage *code )
+{
+    (void) ic;
+    (void) iface;
+    (void) code;
+}
+
+int pvm_ic_get_ordinal( struct pvm_inline_cache *ic, struct pvm_object_storage *class, const char *name, unsigned int name_len )
+{
+    (void) ic;
+    (void) class;
+    (void) name;
+    (void) name_len;
+    return -1;
+}
+
+void pvm_ic_put_ordinal( struct pvm_inline_cache *ic, struct pvm_object_storage *class, const char *name, unsigned int name_len, int ordinal )
+{
+    (void) ic;
+    (void) class;
+    (void) name;
+    (void) name_len;
+    (void) ordinal;
+}
+
+void pvm_ic_invalidate_all(void)
+{
+}
+
+#endif // VM_CODE_CACHE_SIZE
+
+
+void pvm_gc_finalizer_code( struct pvm_object_storage * os )
+{
+    struct data_area_4_code *da = (struct data_area_4_code *)os->da;
+    pvm_code_cache_forget( da->code );
+}
+
@@ -0,0 +1,639 @@
+/**
+ *
+ * Phantom OS
+ *
+ * Copyright (C) 2005-2016 Dmitry Zavalishin, dz@dz.ru
+ *
+ * Load time bytecode verifier.
+ *
+ * Checks that each instruction is known and its operands are inside
+ * the code, that all jumps go to the start of some instruction, that
+ * control can't run off the code end and that stack depth is the same
+ * on all paths to an instruction. Verified code object is flagged,
+ * and interpreter reads it with no bounds checks.
+ *
+ * Depths are counted from the method entry. Int stack has n_param on
+ * entry, object stack keeps params below us, so we check int stack
+ * underflow only. Syscalls, dynamic invoke and prefixed ops have stack
+ * effect we can't know here, after them depth is unknown, which is
+ * fine with any other one.
+ *
+ * Handlers of method's exception table are reached by no jump, they
+ * are checked as catchers: must be an instruction start, depth unknown.
+ *
+ * Code which is not verified is run as before, with all the checks.
+ *
+**/
+
+#define DEBUG_MSG_PREFIX "vm.verify"
+#include <debug_ext.h>
+#define debug_level_flow 6
+#define debug_level_error 10
+#define debug_level_info 10
+
+#include <phantom_assert.h>
+#include <phantom_libc.h>
+#include <errno.h>
+
+#include "vm/object.h"
+#include "vm/object_flags.h"
+#include "vm/internal_da.h"
+#include "vm/code.h"
+
+#include "ids/opcode_ids.h"
+
+
+// Max n_param of call, see init_cfda
+#define VERIFY_MAX_PARAM        (1024*16)
+
+#define DEPTH_NONE              (-0x7FFFFFFF)   // Not reached yet
+#define DEPTH_UNKNOWN           (-0x7FFFFFFE)   // Any depth
+
+struct verify_state
+{
+    const unsigned char *       code;
+    unsigned int                size;
+
+    const struct vm_code_catch *catch;          // Handler table, handlers are entered as catchers
+    unsigned int                ncatch;
+
+    unsigned char *             start;          // Instruction starts here
+    int *                       is_depth;       // Int stack depth on entry to instruction
+    int *                       os_depth;       // Object stack depth on entry to instruction
+
+    int                         is_after;       // Depths after current instruction, for jumps
+    int                         os_after;
+
+    unsigned int *              work;           // IPs to (re)check
+    unsigned int                nwork;
+    unsigned int                work_size;
+
+    const char *                error;
+    unsigned int                error_IP;
+};
+
+// Stack effect of one op
+struct verify_effect
+{
+    int                         is_in;          // Must be on stack
+    int                         is_out;         // Replaces is_in
+    int                         os_in;
+    int                         os_out;
+    int                         unknown;        // Result depth can't be found
+    int                         terminal;       // Control does not pass to next op
+    int                         is_pos;         // Int stack position accessed, -1 - none
+};
+
+
+static int verify_fail( struct verify_state *vs, unsigned int ip, const char *why )
+{
+    vs->error = why;
+    vs->error_IP = ip;
+    return -1;
+}
+
+
+// --------------------------------------------------------------------------
+// Branches
+// --------------------------------------------------------------------------
+
+// Calls f for each jump target of op at ip, op length is known to be ok
+static int verify_targets( struct verify_state *vs, unsigned int ip, int (*f)( struct verify_state *vs, unsigned int from, unsigned int to, int catcher ) )
+{
+    const unsigned char *code = vs->code;
+    unsigned char op = code[ip];
+    unsigned int arg = ip+1;
+
+    switch(op)
+    {
+    case opcode_djnz:
+    case opcode_jz:
+    case opcode_jmp:
+    case opcode_ilt_jz:
+    case opcode_ile_jz:
+    case opcode_igt_jz:
+    case opcode_ige_jz:
+        // See pvm_code_get_rel_IP_as_abs
+        return f( vs, ip, arg + pvm_code_do_get_int( code+arg ), 0 );
+
+    case opcode_push_catcher:
+        return f( vs, ip, arg + pvm_code_do_get_int( code+arg ), 1 );
+
+    case opcode_is_get32_iconst_ilt_jz:
+    case opcode_is_get32_iconst_ile_jz:
+    case opcode_is_get32_iconst_igt_jz:
+    case opcode_is_get32_iconst_ige_jz:
+        return f( vs, ip, arg+8 + pvm_code_do_get_int( code+arg+8 ), 0 );
+
+    case opcode_switch:
+        {
+            unsigned int tabsize = pvm_code_do_get_int( code+arg );
+            unsigned int table = arg + 4*3;
+            unsigned int i;
+
+            // Entries are relative to themselves, default is right after table
+            for( i = 0; i < tabsize; i++ )
+            {
+                unsigned int e = table + 4*i;
+                if( f( vs, ip, e + pvm_code_do_get_int( code+e ), 0 ) ) return -1;
+            }
+            return f( vs, ip, table + 4*tabsize, 0 );
+        }
+    }
+
+    return 0;
+}
+
+static int verify_target_ok( struct verify_state *vs, unsigned int from, unsigned int to, int catcher )
+{
+    (void) catcher;
+
+    if( to >= vs->size || !vs->start[to] )
+        return verify_fail( vs, from, "jump target is not an instruction" );
+
+    return 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Pass 1 - instruction boundaries and operands
+// --------------------------------------------------------------------------
+
+static int verify_operands( struct verify_state *vs, unsigned int ip )
+{
+    const unsigned char *code = vs->code;
+    unsigned int arg = ip+1;
+
+    switch(code[ip])
+    {
+    case opcode_call_8bit:
+        if( (unsigned)pvm_code_do_get_int( code+arg+1 ) > VERIFY_MAX_PARAM )
+            return verify_fail( vs, ip, "too many call parameters" );
+        break;
+
+    case opcode_call_32bit:
+    case opcode_static_invoke:
+        if( pvm_code_do_get_int( code+arg ) < 0 )
+            return verify_fail( vs, ip, "negative method ordinal" );
+        if( (unsigned)pvm_code_do_get_int( code+arg+4 ) > VERIFY_MAX_PARAM )
+            return verify_fail( vs, ip, "too many call parameters" );
+        break;
+
+    case opcode_const_pool:
+        if( pvm_code_do_get_int( code+arg ) < 0 )
+            return verify_fail( vs, ip, "negative constant id" );
+        break;
+
+    case opcode_sconst_bin:
+    case opcode_summon_by_name:
+        if( pvm_code_do_get_int( code+arg ) < 0 )
+            return verify_fail( vs, ip, "negative string length" );
+        break;
+
+    case opcode_switch:
+        // Op length could overflow on a huge one
+        if( (unsigned)pvm_code_do_get_int( code+arg ) > vs->size / 4 )
+            return verify_fail( vs, ip, "bad switch table size" );
+        if( pvm_code_do_get_int( code+arg+8 ) == 0 )
+            return verify_fail( vs, ip, "switch divisor is zero" );
+        break;
+
+    case opcode_os_load32:
+    case opcode_os_save32:
+    case opcode_os_pull32:
+    case opcode_os_get32:
+    case opcode_os_set32:
+    case opcode_is_get32:
+    case opcode_is_set32:
+    case opcode_is_inc32:
+    case opcode_is_get32_iconst_ilt_jz:
+    case opcode_is_get32_iconst_ile_jz:
+    case opcode_is_get32_iconst_igt_jz:
+    case opcode_is_get32_iconst_ige_jz:
+        if( pvm_code_do_get_int( code+arg ) < 0 )
+            return verify_fail( vs, ip, "negative slot" );
+        break;
+    }
+
+    return 0;
+}
+
+static int verify_boundaries( struct verify_state *vs )
+{
+    unsigned int ip;
+
+    for( ip = 0; ip < vs->size; )
+    {
+        int len = pvm_code_op_len( vs->code, ip, vs->size );
+
+        // Check before use - length can come from code itself
+        if( len < 0 || len > (int)(vs->size - ip - 1) )
+            return verify_fail( vs, ip, "unknown op or operands out of code" );
+
+        vs->start[ip] = 1;
+
+        if( verify_operands( vs, ip ) )
+            return -1;
+
+        ip += 1 + len;
+    }
+
+    for( ip = 0; ip < vs->size; ip++ )
+    {
+        if( vs->start[ip] && verify_targets( vs, ip, verify_target_ok ) )
+            return -1;
+    }
+
+    unsigned int i;
+    for( i = 0; i < vs->ncatch; i++ )
+    {
+        unsigned int to = vs->catch[i].handler;
+        if( to >= vs->size || !vs->start[to] )
+            return verify_fail( vs, to, "handler is not an instruction" );
+    }
+
+    return 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Pass 2 - stack depths
+// --------------------------------------------------------------------------
+
+static void verify_effect( const unsigned char *code, unsigned int ip, struct verify_effect *e )
+{
+    unsigned char op = code[ip];
+    unsigned int arg = ip+1;
+
+    memset( e, 0, sizeof(*e) );
+    e->is_pos = -1;
+
+    if( (op & 0xF0) == opcode_sys_0 ) { e->unknown = 1; return; }
+
+    if( (op & 0xE0) == opcode_call_00 )
+    {
+        e->os_in = code[arg] + 1;
+        e->os_out = 1;
+        return;
+    }
+
+    switch(op)
+    {
+    case opcode_nop:
+    case opcode_debug:
+    case opcode_pop_catcher:
+    case opcode_fromi:
+        return;
+
+    case opcode_ret:
+    case opcode_jmp:
+        e->terminal = 1;
+        return;
+
+    case opcode_throw:
+        e->os_in = 1;
+        e->terminal = 1;
+        return;
+
+    case opcode_switch:
+        e->is_in = 1;
+        e->terminal = 1;
+        return;
+
+    case opcode_djnz:
+        e->is_in = 1; e->is_out = 1;
+        return;
+
+    case opcode_jz:
+    case opcode_is_drop:
+    case opcode_is_save8:
+        e->is_in = 1;
+        return;
+
+    case opcode_is_set32:
+        e->is_in = 1;
+        e->is_pos = pvm_code_do_get_int( code+arg );
+        return;
+
+    case opcode_ilt_jz:
+    case opcode_ile_jz:
+    case opcode_igt_jz:
+    case opcode_ige_jz:
+        e->is_in = 2;
+        return;
+
+    case opcode_is_inc32:
+    case opcode_is_get32_iconst_ilt_jz:
+    case opcode_is_get32_iconst_ile_jz:
+    case opcode_is_get32_iconst_igt_jz:
+    case opcode_is_get32_iconst_ige_jz:
+        e->is_pos = pvm_code_do_get_int( code+arg );
+        return;
+
+    case opcode_is_dup:
+        e->is_in = 1; e->is_out = 2;
+        return;
+
+    case opcode_iconst_0:
+    case opcode_iconst_1:
+    case opcode_iconst_8bit:
+    case opcode_iconst_32bit:
+    case opcode_is_load8:
+        e->is_out = 1;
+        return;
+
+    case opcode_is_get32:
+        e->is_out = 1;
+        e->is_pos = pvm_code_do_get_int( code+arg );
+        return;
+
+    case opcode_iconst_64bit:
+        e->is_out = 2;
+        return;
+
+    case opcode_isum:
+    case opcode_imul:
+    case opcode_isubul:
+    case opcode_isublu:
+    case opcode_idivul:
+    case opcode_idivlu:
+    case opcode_ior:
+    case opcode_iand:
+    case opcode_ixor:
+    case opcode_log_or:
+    case opcode_log_and:
+    case opcode_log_xor:
+    case opcode_ige:
+    case opcode_ile:
+    case opcode_igt:
+    case opcode_ilt:
+    case opcode_ishl:
+    case opcode_ishr:
+    case opcode_ushr:
+        e->is_in = 2; e->is_out = 1;
+        return;
+
+    case opcode_inot:
+    case opcode_log_not:
+        e->is_in = 1; e->is_out = 1;
+        return;
+
+    case opcode_os_dup:
+        e->os_in = 1; e->os_out = 2;
+        return;
+
+    case opcode_os_drop:
+    case opcode_os_save8:
+    case opcode_os_save32:
+    case opcode_os_set32:
+    case opcode_general_lock:
+    case opcode_general_unlock:
+        e->os_in = 1;
+        return;
+
+    case opcode_push_catcher:
+        e->os_in = 1;
+        return;
+
+    case opcode_os_load8:
+    case opcode_os_load32:
+    case opcode_os_get32:
+    case opcode_os_pull32:
+    case opcode_const_pool:
+    case opcode_sconst_bin:
+    case opcode_summon_thread:
+    case opcode_summon_this:
+    case opcode_summon_null:
+    case opcode_summon_class_class:
+    case opcode_summon_int_class:
+    case opcode_summon_string_class:
+    case opcode_summon_interface_class:
+    case opcode_summon_code_class:
+    case opcode_summon_array_class:
+    case opcode_summon_by_name:
+        e->os_out = 1;
+        return;
+
+    case opcode_new:
+    case opcode_copy:
+    case opcode_short_call_0:
+    case opcode_short_call_1:
+    case opcode_short_call_2:
+    case opcode_short_call_3:
+        e->os_in = 1; e->os_out = 1;
+        return;
+
+    case opcode_cast:
+        e->os_in = 2; e->os_out = 1;
+        return;
+
+    case opcode_call_8bit:
+        e->os_in = pvm_code_do_get_int( code+arg+1 ) + 1;
+        e->os_out = 1;
+        return;
+
+    case opcode_call_32bit:
+        e->os_in = pvm_code_do_get_int( code+arg+4 ) + 1;
+        e->os_out = 1;
+        return;
+
+    case opcode_static_invoke:
+        e->os_in = pvm_code_do_get_int( code+arg+4 ) + 2;
+        e->os_out = 1;
+        return;
+
+    case opcode_i2o:
+        e->is_in = 1; e->os_out = 1;
+        return;
+
+    case opcode_o2i:
+        e->os_in = 1; e->is_out = 1;
+        return;
+
+    case opcode_os_eq:
+    case opcode_os_neq:
+        e->os_in = 2; e->is_out = 1;
+        return;
+
+    case opcode_os_isnull:
+        e->os_in = 1; e->is_out = 1;
+        return;
+    }
+
+    // Prefixes, dynamic invoke, conversions
+    e->unknown = 1;
+}
+
+
+static void verify_push_work( struct verify_state *vs, unsigned int ip )
+{
+    // Each IP is put here at most twice: when reached and when becomes unknown
+    assert( vs->nwork < vs->work_size );
+    vs->work[vs->nwork++] = ip;
+}
+
+// Merge state coming to ip, returns -1 if depths differ
+static int verify_merge( struct verify_state *vs, unsigned int from, unsigned int ip, int is, int os )
+{
+    int *pi = vs->is_depth + ip;
+    int *po = vs->os_depth + ip;
+
+    if( *pi == DEPTH_NONE )
+    {
+        *pi = is;
+        *po = os;
+        verify_push_work( vs, ip );
+        return 0;
+    }
+
+    if( *pi == DEPTH_UNKNOWN )
+        return 0;
+
+    if( is == DEPTH_UNKNOWN )
+    {
+        *pi = *po = DEPTH_UNKNOWN;
+        verify_push_work( vs, ip );
+        return 0;
+    }
+
+    if( *pi != is || *po != os )
+        return verify_fail( vs, from, "stack depth differs on paths to instruction" );
+
+    return 0;
+}
+
+// Jump target gets state after jump instruction, catcher gets unknown
+static int verify_flow_target( struct verify_state *vs, unsigned int from, unsigned int to, int catcher )
+{
+    if( catcher )
+        return verify_merge( vs, from, to, DEPTH_UNKNOWN, DEPTH_UNKNOWN );
+
+    return verify_merge( vs, from, to, vs->is_after, vs->os_after );
+}
+
+static int verify_depths( struct verify_state *vs )
+{
+    if( verify_merge( vs, 0, 0, 1, 0 ) ) // Int stack has n_param on entry
+        return -1;
+
+    unsigned int i;
+    for( i = 0; i < vs->ncatch; i++ )
+    {
+        unsigned int to = vs->catch[i].handler;
+        if( verify_merge( vs, to, to, DEPTH_UNKNOWN, DEPTH_UNKNOWN ) )
+            return -1;
+    }
+
+    while( vs->nwork )
+    {
+        unsigned int ip = vs->work[--vs->nwork];
+        int is = vs->is_depth[ip];
+        int os = vs->os_depth[ip];
+
+        struct verify_effect e;
+        verify_effect( vs->code, ip, &e );
+
+        if( is != DEPTH_UNKNOWN )
+        {
+            if( is < e.is_in )
+                return verify_fail( vs, ip, "int stack underflow" );
+
+            // Slot must be below operands we pop
+            if( e.is_pos >= is - e.is_in )
+                return verify_fail( vs, ip, "int stack slot is out of stack" );
+
+            is += e.is_out - e.is_in;
+            os += e.os_out - e.os_in;
+        }
+
+        if( e.unknown )
+            is = os = DEPTH_UNKNOWN;
+
+        unsigned int next = ip + 1 + pvm_code_op_len( vs->code, ip, vs->size );
+
+        if( !e.terminal )
+        {
+            if( next >= vs->size )
+                return verify_fail( vs, ip, "control runs off code end" );
+            if( verify_merge( vs, ip, next, is, os ) )
+                return -1;
+        }
+
+        // Jumps happen after operands are popped, as in interpreter
+        vs->is_after = is;
+        vs->os_after = os;
+        if( verify_targets( vs, ip, verify_flow_target ) )
+            return -1;
+    }
+
+    return 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Entry
+// --------------------------------------------------------------------------
+
+
+static errno_t verify_code( struct verify_state *vs )
+{
+    if( vs->size == 0 )
+        return verify_fail( vs, 0, "empty code" ) ? EINVAL : 0;
+
+    vs->start = calloc( vs->size, sizeof(unsigned char) );
+    vs->is_depth = calloc( vs->size, sizeof(int) );
+    vs->os_depth = calloc( vs->size, sizeof(int) );
+    vs->work_size = vs->size * 2;
+    vs->work = calloc( vs->work_size, sizeof(unsigned int) );
+
+    errno_t rc = ENOMEM;
+
+    if( vs->start && vs->is_depth && vs->os_depth && vs->work )
+    {
+        unsigned int i;
+        for( i = 0; i < vs->size; i++ )
+            vs->is_depth[i] = vs->os_depth[i] = DEPTH_NONE;
+
+        rc = (verify_boundaries( vs ) || verify_depths( vs )) ? EINVAL : 0;
+    }
+
+    if( vs->start ) free( vs->start );
+    if( vs->is_depth ) free( vs->is_depth );
+    if( vs->os_depth ) free( vs->os_depth );
+    if( vs->work ) free( vs->work );
+
+    return rc;
+}
+
+
+errno_t pvm_code_verify( struct pvm_object code )
+{
+    return pvm_code_verify_handlers( code, 0, 0 );
+}
+
+errno_t pvm_code_verify_handlers( struct pvm_object code, const struct vm_code_catch *table, unsigned int count )
+{
+    if( !(code.data->_flags & PHANTOM_OBJECT_STORAGE_FLAG_IS_CODE) )
+        return EINVAL;
+
+    code.data->_flags &= ~PHANTOM_OBJECT_STORAGE_FLAG_IS_VERIFIED;
+
+    struct data_area_4_code *cda = (struct data_area_4_code *)&(code.data->da);
+
+    struct verify_state vs;
+    memset( &vs, 0, sizeof(vs) );
+
+    vs.code = cda->code;
+    vs.size = cda->code_size;
+    vs.catch = table;
+    vs.ncatch = count;
+
+    errno_t rc = verify_code( &vs );
+
+    if( rc == 0 )
+        code.data->_flags |= PHANTOM_OBJECT_STORAGE_FLAG_IS_VERIFIED;
+    else if( vs.error )
+        SHOW_FLOW( 2, "code not verified: %s at IP %u", vs.error, vs.error_IP );
+
+    return rc;
+}
@@ -19,9 +19,11 @@
 #include <vm/alloc.h>
 #include <vm/internal.h>
 #include <vm/internal_da.h>
+#include <vm/code.h>
 #include "ids/opcode_ids.h"
 
 #include <assert.h>
+#include <hashfunc.h>
 
 #include <video/screen.h>
 
@@ -114,8 +116,25 @@ void pvm_gc_iter_void(gc_iterator_call_t func, struct pvm_object_storage * os, v
     // Empty
 }
 
+struct pvm_object     pvm_create_immediate_int(int _value)
+{
+    struct pvm_object ret;
+
+    assert( pvm_immediate_int_fits( _value ) );
+
+    ret.data = (void *)(addr_t)( (((u_int32_t)_value) << 1) | PVM_IMMEDIATE_TAG );
+    ret.interface = pvm_object_da( pvm_get_int_class(), class )->object_default_interface.data;
+
+    return ret;
+}
+
 struct pvm_object     pvm_create_int_object(int _value)
 {
+#if VM_TAGGED_INT
+    if( pvm_immediate_int_fits( _value ) )
+        return pvm_create_immediate_int( _value );
+#endif
+
 	struct pvm_object	out = pvm_object_create_fixed( pvm_get_int_class() );
 	((struct data_area_4_int*)&(out.data->da))->value = _value;
 	return out;
@@ -215,7 +234,7 @@ void pvm_gc_iter_double(gc_iterator_call_t func, struct pvm_object_storage * os,
 
 struct pvm_object     pvm_create_string_object_binary(const char *value, int n_bytes)
 {
-	int das = sizeof(struct data_area_4_string)+n_bytes;
+	int das = PVM_STRING_DA_SIZE(n_bytes);
 	struct pvm_object string_class = pvm_get_string_class();
 
 	struct pvm_object	_data = pvm_object_create_dynamic( string_class, das );
@@ -241,7 +260,7 @@ struct pvm_object     pvm_create_string_object_binary_cat(
 		const char *value2, int n_bytes2
 )
 {
-	int das = sizeof(struct data_area_4_string)+n_bytes1+n_bytes2;
+	int das = PVM_STRING_DA_SIZE(n_bytes1+n_bytes2);
 	struct pvm_object string_class = pvm_get_string_class();
 
 	struct pvm_object	_data = pvm_object_create_dynamic( string_class, das );
@@ -295,7 +314,91 @@ int pvm_strcmp(pvm_object_t s1, pvm_object_t s2)
     if( l1 > l2 ) return 1;
     if( l2 > l1 ) return -1;
 
-    return strncmp( d1, d2, l1 );
+    int pos = pvm_str_prefix( d1, d2, l1 );
+    if( pos == l1 ) return 0;
+
+    return ((unsigned char)d1[pos]) - ((unsigned char)d2[pos]);
+}
+
+
+static struct pvm_string_hash * pvm_string_hash_slot( pvm_object_t s )
+{
+    unsigned int off = PVM_STRING_HASH_OFFSET( pvm_get_str_len( s ) );
+
+    // Made by old kernel?
+    if( s.data->_da_size < off + sizeof(struct pvm_string_hash) )
+        return 0;
+
+    return (struct pvm_string_hash *)(s.data->da + off);
+}
+
+u_int32_t pvm_string_hash( pvm_object_t s )
+{
+    struct pvm_string_hash *h = pvm_string_hash_slot( s );
+
+    if( h && h->key )
+        return h->key;
+
+    const char *data = pvm_get_str_data( s );
+    u_int32_t key = calc_hash( data, data + pvm_get_str_len( s ) );
+
+    // Races are ok, all threads write the same value
+    if( h ) h->key = key;
+    return key;
+}
+
+u_int32_t pvm_string_hash_cached( pvm_object_t s )
+{
+    struct pvm_string_hash *h = pvm_string_hash_slot( s );
+    return h ? h->key : 0;
+}
+
+u_int32_t pvm_string_hashcode( pvm_object_t s )
+{
+    struct pvm_string_hash *h = pvm_string_hash_slot( s );
+
+    if( h && h->code )
+        return h->code;
+
+    // Must be the same as si_void_15_hashcode gave before
+    // hashes were cached - persistent hash maps depend on it
+    const char *da = (const char *)s.data->da;
+    u_int32_t code = calc_hash( da, da + sizeof(struct data_area_4_string) + pvm_get_str_len( s ) );
+
+    if( h ) h->code = code;
+    return code;
+}
+
+void pvm_string_hash_reset( pvm_object_t s )
+{
+    struct pvm_string_hash *h = pvm_string_hash_slot( s );
+
+    if( h )
+    {
+        h->key = 0;
+        h->code = 0;
+    }
+}
+
+int pvm_string_equals( pvm_object_t s1, pvm_object_t s2 )
+{
+    if( s1.data == s2.data )
+        return 1;
+
+    // There is just one interned string for given contents
+    if( s1.data->_flags & s2.data->_flags & PHANTOM_OBJECT_STORAGE_FLAG_IS_INTERNED )
+        return 0;
+
+    int len = pvm_get_str_len( s1 );
+    if( len != pvm_get_str_len( s2 ) )
+        return 0;
+
+    u_int32_t h1 = pvm_string_hash_cached( s1 );
+    u_int32_t h2 = pvm_string_hash_cached( s2 );
+    if( h1 && h2 && h1 != h2 )
+        return 0;
+
+    return pvm_str_equal( pvm_get_str_data( s1 ), pvm_get_str_data( s2 ), len );
 }
 
 
@@ -323,7 +426,7 @@ pvm_create_page_object( int n_slots, struct pvm_object *init, int init_slots )
 	//if( init_value )	memcpy( data_area, init_value, das );
 	//else            	memset( data_area, 0, das );
 
-	assert(init_slots < n_slots);
+	assert(init_slots <= n_slots);
 
 	int i;
 	for( i = 0; i < init_slots; i++ )
@@ -426,6 +529,9 @@ struct pvm_object     pvm_create_interface_object( int n_methods, struct pvm_obj
     struct pvm_object	ret = create_interface_worker( n_methods );
     struct pvm_object * data_area = (struct pvm_object *)ret.data->da;
 
+    // Can reuse address of dead one, which can be in call site caches
+    pvm_ic_invalidate_all();
+
     if(pvm_is_null( parent_class ))
         pvm_exec_panic( "create interface: parent is null" );
 
@@ -490,6 +596,11 @@ struct pvm_object pvm_create_class_object(struct pvm_object name, struct pvm_obj
 
 	da->class_name                  = name;
 	da->class_parent                = pvm_get_null_class();
+	da->method_index                = pvm_get_null_object();
+	da->display                     = pvm_get_null_object();
+	da->handler_tables              = pvm_get_null_object();
+
+	pvm_ic_invalidate_all(); // See pvm_create_interface_object
 
 	return _data;
 }
@@ -507,6 +618,9 @@ void pvm_internal_init_class(struct pvm_object_storage * os)
         da->class_parent		= pvm_get_null_class();
 
         da->static_vars                 = pvm_create_object( pvm_get_array_class() );
+        da->method_index                = pvm_get_null_object();
+        da->display                     = pvm_get_null_object();
+        da->handler_tables              = pvm_get_null_object();
 }
 
 
@@ -522,6 +636,15 @@ void pvm_gc_iter_class(gc_iterator_call_t func, struct pvm_object_storage * os,
         gc_fcall( func, arg, da->ip2line_maps );
         gc_fcall( func, arg, da->method_names );
         gc_fcall( func, arg, da->field_names );
+
+        if( PVM_CLASS_HAS_FIELD( os, method_index ) )
+            gc_fcall( func, arg, da->method_index );
+
+        if( PVM_CLASS_HAS_FIELD( os, display ) )
+            gc_fcall( func, arg, da->display );
+
+        if( PVM_CLASS_HAS_FIELD( os, handler_tables ) )
+            gc_fcall( func, arg, da->handler_tables );
 }
 
 
@@ -542,6 +665,10 @@ void pvm_internal_init_thread(struct pvm_object_storage * os)
 	da->owner.data = 0;
 	da->environment.data = 0;
 
+	da->frame_pool.data = 0;
+	da->frame_pool.interface = 0;
+	da->frame_pool_size = 0;
+
 	da->code.code     			= 0;
 	da->code.IP 			= 0;
 	da->code.IP_max             	= 0;
@@ -558,6 +685,8 @@ void pvm_gc_iter_thread(gc_iterator_call_t func, struct pvm_object_storage * os,
 	gc_fcall( func, arg, da->call_frame );
 	gc_fcall( func, arg, da->owner );
 	gc_fcall( func, arg, da->environment );
+	if( PVM_THREAD_HAS_FIELD( os, frame_pool ) )
+		gc_fcall( func, arg, da->frame_pool ); // Pooled frames are linked by prev, frame iterator follows
 }
 
 
@@ -1049,16 +1178,15 @@ void pvm_restart_directory( pvm_object_t o )
 
 struct pvm_object     pvm_create_directory_object(void)
 {
-    pvm_object_t ret = pvm_object_create_fixed( pvm_get_directory_class() );
-    return ret;
+    return pvm_create_object( pvm_get_directory_class() );
 }
 
 void pvm_gc_iter_directory(gc_iterator_call_t func, struct pvm_object_storage * os, void *arg)
 {
     struct data_area_4_directory      *da = (struct data_area_4_directory *)os->da;
 
-    gc_fcall( func, arg, da->keys );
-    gc_fcall( func, arg, da->values );
+    gc_fcall( func, arg, da->table );
+    gc_fcall( func, arg, da->old_table );
 }
 
 
@@ -1153,6 +1281,8 @@ struct pvm_object     pvm_create_code_object(int size, void *code)
 	struct pvm_object ret = pvm_object_create_dynamic( pvm_get_code_class(), size + sizeof(struct data_area_4_code) );
 
 	struct data_area_4_code *da = (struct data_area_4_code *)ret.data->da;
+	// Old code object at this address could die with no finalizer call
+	pvm_code_cache_forget( da->code );
 	da->code_size = size;
 	memcpy( da->code, code, size );
 	return ret;
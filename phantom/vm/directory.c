@@ -15,7 +15,14 @@
 #define debug_level_error 10
 #define debug_level_info 10
 
+#include <phantom_libc.h>
 #include <hashfunc.h>
+#include <kernel/init.h>
+#include <kernel/debug.h>
+#include <kernel/atomic.h>
+#include <threads.h>
+#include <time.h>
+#include <hal.h>
 #include <vm/syscall.h>
 #include <vm/object.h>
 #include <vm/alloc.h>
@@ -55,295 +62,596 @@
 
 
 /**
- *
- * BUG! TODO no mutex, TODO general short-term sync primitive for persistent mem
  *
  * General design:
  *
- * 3 arrays, array of strings (keys), array of obvects (values), bit array of flags - single or multiple value in dir entry.
- * Hash func points to array slot.
- * If we have just one entry for given key, just hold it and its key in corresponding arrays. Have 0 in multiple flag array.
- * If we have more than one entry for given key, hold 2nd level arrays (for values and keys) in corresponding arrays. Have 1 in multiple flag array.
- * In 2nd level arrays key and value positions are correspond too. Null in key slot menas that slot is unused.
+ * Open addressing hash table with Robin Hood hashing. Table is an array
+ * object, slot i is a key string at 2*i and a value at 2*i+1. Null key
+ * means empty slot. Table size is a power of 2.
+ *
+ * Entry lives in slot it hashes to or after it. On insert, entry which is
+ * farther from its home slot takes the place of one which is nearer, so
+ * probe sequences are short and lookup stops as soon as it meets entry
+ * nearer to home than searched key would be. Delete shifts following
+ * entries back, there are no tombstones. Key distance from home is
+ * calculated from key hash, which is cached in key string.
+ *
+ * Table is made twice bigger when it is 7/8 full. Rehash is incremental:
+ * old table is kept and each put or remove moves HDIR_REHASH_STEP slots
+ * of it to the new table. Lookup checks new table, then not yet moved
+ * part of old one. Entry removed from old table is replaced with a
+ * tombstone (any non-string object), as shifting would mix moved and not
+ * moved slots.
+ *
+ * Directories made by older kernels had fixed size 1st level arrays of
+ * keys and values and 2nd level arrays for collisions. They are converted
+ * by hdir_upgrade() on restart or on first access.
+ *
+ * Readers:
+ *
+ * Writers take lock and make seq odd while they change anything, get
+ * does not lock at all (see hdir_find_optimistic). It reads seq, looks
+ * up and checks that seq is the same and even, else retries, and after
+ * a few failures takes lock as writers do. Readers do not write to
+ * directory, so they do not bounce its cache lines between CPUs.
+ *
+ * Reader can look at a key which is removed and freed meanwhile, it just
+ * reads garbage and throws it away as seq is changed. It must not write
+ * there, so it uses hashes cached in keys only. Tables are worse
+ * to walk if freed, so table which is rehashed is not released when it
+ * is drained, but on the next grow.
+ *
+ * Value found can be freed by writer on other CPU after seq check and
+ * before reader takes reference, so with VM_SMP readers take lock.
  *
 **/
-/*
-typedef struct hashdir {
-    u_int32_t                           capacity;       // size of 1nd level arrays
-    u_int32_t                           nEntries;       // number of actual entries stored
 
-    struct pvm_object   		keys;      	// Where we actually hold keys
-    struct pvm_object   		values;      	// Where we actually hold values
-    u_int8_t 				*flags;      	// Is this keys/values slot pointing to 2nd level array
+#define HDIR_FORMAT             0x6972          // Low half of 'HDir', old layout had capacity <= 10000 here
+#define HDIR_MIN_SLOTS          16
+#define HDIR_REHASH_STEP        16
+#define HDIR_READ_TRIES         4
+
+#if defined(ARCH_ia32) || defined(ARCH_amd64)
+// Loads are not reordered with loads and stores with stores, just stop compiler
+#define HDIR_SEQ_BARRIER()      __asm__ __volatile__("" ::: "memory")
+#else
+#define HDIR_SEQ_BARRIER()      __sync_synchronize()
+#endif
+
+// Layout made by older kernels, converted in place
+struct hdir_old_layout
+{
+    u_int32_t                           capacity;       // size of 1st level arrays
+    u_int32_t                           nEntries;
+
+    struct pvm_object                   keys;           // Key or 2nd level array of keys
+    struct pvm_object                   values;         // Value or 2nd level array of values
+    u_int8_t                            *flags;         // Not persistent, garbage after restart
 
     hal_spinlock_t                      lock;
+};
 
-} hashdir_t;
-*/
-static int hdir_cmp_keys( const char *ikey, size_t ikey_len, pvm_object_t okey );
 
+static errno_t do_hdir_find( hashdir_t *dir, const char *ikey, size_t i_key_len, u_int32_t hash, pvm_object_t *out, int delete_found );
+static errno_t do_hdir_add( hashdir_t *dir, const char *ikey, size_t i_key_len, u_int32_t hash, pvm_object_t add );
+static void hdir_init_table( hashdir_t *dir );
+static void hdir_upgrade( hashdir_t *dir );
+static void hdir_rehash_step( hashdir_t *dir, int nslots );
+static void hdir_grow( hashdir_t *dir );
 
-// TODO add parameter for find and remove mode
-errno_t hdir_find( hashdir_t *dir, const char *ikey, size_t i_key_len, pvm_object_t *out, int delete_found )
+#if VM_DIR_SEQLOCK
+// Benchmark switches it to compare
+static int hdir_read_locked = 0;
+
+static void dbg_dir_bench( int ac, char **av );
+
+static void hdir_init(void)
 {
-    if( dir->nEntries == 0 ) return ENOENT;
+    dbg_add_command( dbg_dir_bench, "dirbench", "dirbench [threads] [keys] - time concurrent directory lookups, locked and not");
+}
 
-    assert(dir->capacity);
-    assert(dir->keys.data != 0);
-    assert(dir->values.data != 0);
-    assert(dir->flags != 0);
+INIT_ME( 0, hdir_init, 0 )
+#endif
 
-    LOCK_DIR(dir);
 
-    int keypos = calc_hash( ikey, ikey+i_key_len ) % dir->capacity;
+static inline pvm_object_t * hdir_slots( pvm_object_t table )
+{
+    struct data_area_4_array *da = pvm_object_da( table, array );
+    return (pvm_object_t *)&(da->page.data->da);
+}
+
+static inline u_int32_t hdir_capacity( pvm_object_t table )
+{
+    return get_array_size( table.data ) / 2;
+}
+
+static inline u_int32_t hdir_home( u_int32_t hash, u_int32_t mask )
+{
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+    return hash & mask;
+}
+
+static inline int hdir_key_equal( pvm_object_t okey, u_int32_t okey_hash, const char *ikey, size_t ikey_len, u_int32_t ikey_hash )
+{
+    return okey_hash == ikey_hash &&
+        ikey_len == (size_t)pvm_get_str_len( okey ) &&
+        pvm_str_equal( pvm_get_str_data( okey ), ikey, ikey_len );
+}
+
+//! Old table has slots which are not moved yet
+static inline int hdir_rehashing( pvm_object_t old_table, u_int32_t moved )
+{
+    return !pvm_is_null( old_table ) && moved < hdir_capacity( old_table );
+}
+
+// Called with lock taken. Seq is or'ed, not incremented - old layout had garbage there.
+static inline void hdir_write_begin( hashdir_t *dir )
+{
+    dir->seq |= 1;
+    HDIR_SEQ_BARRIER();
+}
+
+static inline void hdir_write_end( hashdir_t *dir )
+{
+    HDIR_SEQ_BARRIER();
+    dir->seq++;
+}
+
+// Array of given number of empty slots
+static pvm_object_t hdir_create_table( u_int32_t capacity )
+{
+    pvm_object_t table = pvm_create_array_object();
+    struct data_area_4_array *da = pvm_object_da( table, array );
 
-    // Can't access array slot out of array's real size
-    int kasize = get_array_size( dir->keys.data );
-    if( keypos >= kasize )
-        goto not_found;
+    da->page = pvm_create_page_object( capacity * 2, 0, 0 );
+    da->page_size = capacity * 2;
+    da->used_slots = capacity * 2;
+
+    return table;
+}
 
-    pvm_object_t okey = pvm_get_array_ofield( dir->keys.data, keypos );
-    if( pvm_is_null( okey ) )
+#define HDIR_NO_HASH            (-2)
+
+//! Returns slot number or -1. Slots below 'moved' are skipped, they are in new table.
+//! Lock-free reader can meet a freed key, so it must not write hash to key, and gets HDIR_NO_HASH if it is not cached.
+static int hdir_lookup( pvm_object_t table, u_int32_t moved, const char *ikey, size_t ikey_len, u_int32_t hash, int lockfree )
+{
+    pvm_object_t *slots = hdir_slots( table );
+    u_int32_t mask = hdir_capacity( table ) - 1;
+    u_int32_t i = hdir_home( hash, mask );
+    u_int32_t dist;
+
+    for( dist = 0; dist <= mask; dist++, i = (i+1) & mask )
     {
-    not_found:
-        UNLOCK_DIR(dir);
-        return ENOENT;
+        if( i < moved )
+            continue;
+
+        pvm_object_t okey = slots[2*i];
+
+        if( pvm_is_null( okey ) )
+            return -1;
+
+        if( !IS_PHANTOM_STRING( okey ) )
+            continue; // Tombstone
+
+        u_int32_t okey_hash = lockfree ? pvm_string_hash_cached( okey ) : pvm_string_hash( okey );
+        if( lockfree && 0 == okey_hash )
+            return HDIR_NO_HASH;
+
+        // Would be here already if it was in table
+        if( ((i - hdir_home( okey_hash, mask )) & mask) < dist )
+            return -1;
+
+        if( hdir_key_equal( okey, okey_hash, ikey, ikey_len, hash ) )
+            return i;
     }
 
-    u_int8_t flags = dir->flags[keypos];
+    return -1;
+}
 
-    // No indirection?
-    if( flags == 0 )
+//! Key must not be in table. Takes references.
+static void hdir_insert( pvm_object_t table, pvm_object_t key, pvm_object_t value, u_int32_t hash )
+{
+    pvm_object_t *slots = hdir_slots( table );
+    u_int32_t mask = hdir_capacity( table ) - 1;
+    u_int32_t i = hdir_home( hash, mask );
+    u_int32_t dist = 0;
+
+    for( ;; i = (i+1) & mask, dist++ )
     {
-        if( 0 == hdir_cmp_keys( ikey, i_key_len, okey ) )
+        pvm_object_t *s = slots + 2*i;
+
+        if( pvm_is_null( s[0] ) )
         {
-            *out = pvm_get_array_ofield( dir->values.data, keypos );
-            ref_inc_o( *out );
-            if( delete_found )
-            {
-                pvm_set_array_ofield( dir->values.data, keypos, pvm_create_null_object() );
-                pvm_set_array_ofield( dir->keys.data, keypos, pvm_create_null_object() );
-                dir->nEntries--;
-            }
-            UNLOCK_DIR(dir);
-            return 0;
+            s[0] = key;
+            s[1] = value;
+            return;
+        }
+
+        u_int32_t s_hash = pvm_string_hash( s[0] );
+        u_int32_t s_dist = (i - hdir_home( s_hash, mask )) & mask;
+
+        // Resident is nearer to home - take its place, move it on
+        if( s_dist < dist )
+        {
+            pvm_object_t tk = s[0], tv = s[1];
+            s[0] = key; s[1] = value;
+            key = tk; value = tv;
+            hash = s_hash;
+            dist = s_dist;
         }
     }
+}
 
-    // Indirect, find by linear search in 2nd level array
-    // okey is arrray
+//! Empties slot, following entries are shifted back. Does not release references.
+static void hdir_remove_slot( pvm_object_t table, u_int32_t i )
+{
+    pvm_object_t *slots = hdir_slots( table );
+    u_int32_t mask = hdir_capacity( table ) - 1;
 
-    pvm_object_t keyarray = pvm_get_array_ofield( dir->keys.data, keypos );
-    pvm_object_t valarray = pvm_get_array_ofield( dir->values.data, keypos );
-    if( pvm_is_null( valarray ) )
+    for( ;; )
     {
-        lprintf("keyarray exists, valertray not"); // don't panic ;), but actually it is inconsistent
-        UNLOCK_DIR(dir);
-        return ENOENT;
+        u_int32_t next = (i+1) & mask;
+        pvm_object_t nkey = slots[2*next];
+
+        if( pvm_is_null( nkey ) || hdir_home( pvm_string_hash( nkey ), mask ) == next )
+            break;
+
+        slots[2*i] = nkey;
+        slots[2*i+1] = slots[2*next+1];
+        i = next;
     }
 
-    size_t indir_size = get_array_size( keyarray.data );
+    slots[2*i] = pvm_get_null_object();
+    slots[2*i+1] = pvm_get_null_object();
+}
 
-    int i;
-    for( i = 0; i < indir_size; i++ )
+
+
+errno_t hdir_find( hashdir_t *dir, const char *ikey, size_t i_key_len, pvm_object_t *out, int delete_found )
+{
+    return do_hdir_find( dir, ikey, i_key_len, calc_hash( ikey, ikey+i_key_len ), out, delete_found );
+}
+
+//! Key is a string object, its cached hash is used
+errno_t hdir_find_key( hashdir_t *dir, pvm_object_t key, pvm_object_t *out, int delete_found )
+{
+    return do_hdir_find( dir, pvm_get_str_data(key), pvm_get_str_len(key), pvm_string_hash(key), out, delete_found );
+}
+
+errno_t hdir_add( hashdir_t *dir, const char *ikey, size_t i_key_len, pvm_object_t add )
+{
+    return do_hdir_add( dir, ikey, i_key_len, calc_hash( ikey, ikey+i_key_len ), add );
+}
+
+//! Key is a string object, its cached hash is used
+errno_t hdir_add_key( hashdir_t *dir, pvm_object_t key, pvm_object_t add )
+{
+    return do_hdir_add( dir, pvm_get_str_data(key), pvm_get_str_len(key), pvm_string_hash(key), add );
+}
+
+
+#if VM_DIR_SEQLOCK
+//! Lookup without lock. Returns EAGAIN if directory was changed under us too often or is not upgraded yet.
+static errno_t hdir_find_optimistic( hashdir_t *dir, const char *ikey, size_t i_key_len, u_int32_t hash, pvm_object_t *out )
+{
+    int tries;
+
+    for( tries = 0; tries < HDIR_READ_TRIES; tries++ )
     {
-        pvm_object_t indir_key = pvm_get_array_ofield( keyarray.data, i );
+        // As in locked path - must not be preempted between check and ref_inc
+        int ie = hal_save_cli();
+
+        u_int16_t seq = dir->seq;
+        HDIR_SEQ_BARRIER();
+
+        int format = dir->format;
+        u_int32_t nEntries = dir->nEntries;
+        pvm_object_t table = dir->table;
+        pvm_object_t old_table = dir->old_table;
+        u_int32_t moved = dir->rehash_pos;
+
+        // Do not walk tables unless they were consistent - and alive
+        HDIR_SEQ_BARRIER();
+        if( (seq & 1) || dir->seq != seq )
+        {
+            if( ie ) hal_sti();
+            continue;
+        }
 
-        if( 0 == hdir_cmp_keys( ikey, i_key_len, indir_key ) )
+        if( format != HDIR_FORMAT )
         {
-            *out = pvm_get_array_ofield( valarray.data, i );
-            ref_inc_o( *out );
-            if( delete_found )
+            if( ie ) hal_sti();
+            return EAGAIN;
+        }
+
+        pvm_object_t value;
+        int pos = -1;
+
+        if( nEntries > 0 )
+        {
+            pos = hdir_lookup( table, 0, ikey, i_key_len, hash, 1 );
+
+            if( pos == -1 && hdir_rehashing( old_table, moved ) )
             {
-                pvm_set_array_ofield( valarray.data, i, pvm_create_null_object() );
-                pvm_set_array_ofield( keyarray.data, i, pvm_create_null_object() );
-                dir->nEntries--;
+                table = old_table;
+                pos = hdir_lookup( table, moved, ikey, i_key_len, hash, 1 );
             }
-            UNLOCK_DIR(dir);
-            return 0;
+
+            if( pos >= 0 )
+                value = hdir_slots( table )[2*pos+1];
         }
-    }
 
-    UNLOCK_DIR(dir);
-    return ENOENT;
+        HDIR_SEQ_BARRIER();
+        if( dir->seq != seq )
+        {
+            if( ie ) hal_sti();
+            continue;
+        }
+
+        if( pos == HDIR_NO_HASH )
+        {
+            // Key of old image, let locked path calculate it
+            if( ie ) hal_sti();
+            return EAGAIN;
+        }
 
+        if( pos >= 0 )
+            *out = ref_inc_o( value );
+
+        if( ie ) hal_sti();
+        return pos >= 0 ? 0 : ENOENT;
+    }
+
+    return EAGAIN;
 }
+#endif // VM_DIR_SEQLOCK
 
 
-//! Return EEXIST if dup
-errno_t hdir_add( hashdir_t *dir, const char *ikey, size_t i_key_len, pvm_object_t add )
+static errno_t do_hdir_find( hashdir_t *dir, const char *ikey, size_t i_key_len, u_int32_t hash, pvm_object_t *out, int delete_found )
 {
-    pvm_object_t okey;
-
-    assert(dir->capacity);
-    assert(dir->keys.data != 0);
-    assert(dir->values.data != 0);
-    assert(dir->flags != 0);
+#if VM_DIR_SEQLOCK
+    if( !delete_found && !hdir_read_locked )
+    {
+        errno_t rc = hdir_find_optimistic( dir, ikey, i_key_len, hash, out );
+        if( rc != EAGAIN )
+            return rc;
+    }
+#endif
 
     LOCK_DIR(dir);
 
-    int keypos = calc_hash( ikey, ikey+i_key_len ) % dir->capacity;
+    if( dir->format != HDIR_FORMAT )
+        hdir_upgrade( dir );
 
-    // Can't access array slot out of array's real size
-    int kasize = get_array_size( dir->keys.data );
-#if 1 // turn off to generate pvm_panic and, if E4C enabled, exception
-    if( keypos >= kasize )
-        okey = pvm_create_null_object();
-    else
-#endif
-        okey = pvm_get_array_ofield( dir->keys.data, keypos );
-    u_int8_t flags = dir->flags[keypos];
+    if( dir->nEntries == 0 )
+    {
+        UNLOCK_DIR(dir);
+        return ENOENT;
+    }
 
-    // No indirection and key is equal
-    if( (!flags) && !pvm_is_null( okey ) )
+    pvm_object_t table = dir->table;
+    int pos = hdir_lookup( table, 0, ikey, i_key_len, hash, 0 );
+
+    if( pos < 0 && hdir_rehashing( dir->old_table, dir->rehash_pos ) )
     {
-        if( 0 == hdir_cmp_keys( ikey, i_key_len, okey ) )
-        {
-            UNLOCK_DIR(dir);
-            return EEXIST;
-        }
+        table = dir->old_table;
+        pos = hdir_lookup( table, dir->rehash_pos, ikey, i_key_len, hash, 0 );
     }
 
-    // No indirection and corresponding key slot is empty
-    if( (!flags) && pvm_is_null( okey ) )
+    if( pos < 0 )
     {
-        // Just put
+        UNLOCK_DIR(dir);
+        return ENOENT;
+    }
 
-        pvm_set_array_ofield( dir->keys.data, keypos, pvm_create_string_object_binary( ikey, i_key_len ) );
-        pvm_set_array_ofield( dir->values.data, keypos, add );
-        ref_inc_o( add );
-        dir->nEntries++;
+    pvm_object_t *slot = hdir_slots( table ) + 2*pos;
 
+    if( !delete_found )
+    {
+        *out = ref_inc_o( slot[1] );
         UNLOCK_DIR(dir);
         return 0;
     }
 
-    // No indirection, stored key exists and not equal to given
-    // Need to convert 1-entry to indirection
+    hdir_write_begin( dir );
+
+    // Caller gets our reference to value
+    *out = slot[1];
+    ref_dec_o( slot[0] );
 
-    if( (!flags) && !pvm_is_null( okey ) && (0 != hdir_cmp_keys( ikey, i_key_len, okey )) )
+    if( table.data == dir->table.data )
+        hdir_remove_slot( table, pos );
+    else
     {
-        pvm_object_t oval = pvm_get_array_ofield( dir->values.data, keypos );
+        slot[0] = pvm_create_int_object( 0 ); // Tombstone, see above
+        slot[1] = pvm_get_null_object();
+    }
 
-        // Now create arrays
-        pvm_object_t keya = pvm_create_array_object();
-        pvm_object_t vala = pvm_create_array_object();
+    dir->nEntries--;
+    hdir_rehash_step( dir, HDIR_REHASH_STEP );
 
-        // put old key/val
-        pvm_append_array( keya.data, okey );
-        pvm_append_array( vala.data, oval );
+    hdir_write_end( dir );
+    UNLOCK_DIR(dir);
+    return 0;
+}
 
-        // put new key/val
-        pvm_append_array( keya.data, pvm_create_string_object_binary( ikey, i_key_len ) );
-        pvm_append_array( vala.data, add );
-        ref_inc_o( add );
-        dir->nEntries++;
 
-        pvm_set_array_ofield( dir->keys.data, keypos, keya );
-        pvm_set_array_ofield( dir->values.data, keypos, vala );
-        dir->flags[keypos] = 1;
+//! Return EEXIST if dup
+static errno_t do_hdir_add( hashdir_t *dir, const char *ikey, size_t i_key_len, u_int32_t hash, pvm_object_t add )
+{
+    LOCK_DIR(dir);
+
+    if( dir->format != HDIR_FORMAT )
+        hdir_upgrade( dir );
 
+    if( (hdir_lookup( dir->table, 0, ikey, i_key_len, hash, 0 ) >= 0) ||
+        (hdir_rehashing( dir->old_table, dir->rehash_pos ) && hdir_lookup( dir->old_table, dir->rehash_pos, ikey, i_key_len, hash, 0 ) >= 0) )
+    {
         UNLOCK_DIR(dir);
-        return 0;
+        return EEXIST;
     }
 
-    assert(flags);
+    hdir_write_begin( dir );
 
-    // Indirection. Scan and check for key to exist
+    u_int32_t capacity = hdir_capacity( dir->table );
 
-    size_t indir_size = get_array_size( dir->keys.data );
+    if( (dir->nEntries + 1) > capacity - capacity/8 )
+        hdir_grow( dir );
 
-    int i, empty_pos = -1;
-    for( i = 0; i < indir_size; i++ )
-    {
-        pvm_object_t indir_key = pvm_get_array_ofield( dir->keys.data, i );
-        if(pvm_is_null(indir_key))
-        {
-            empty_pos = i;
-            continue;
-        }
+    hdir_rehash_step( dir, HDIR_REHASH_STEP );
 
-        // Have key
-        if( 0 == hdir_cmp_keys( ikey, i_key_len, indir_key ) )
-        {
-            UNLOCK_DIR(dir);
-            return EEXIST;
-        }
-    }
+    pvm_object_t key = pvm_create_string_object_binary( ikey, i_key_len );
+    pvm_string_hash( key ); // Cache it now, insert and lookup need it
 
-    // put new key/val
-    if( empty_pos >= 0 )
-    {
-        pvm_set_array_ofield( dir->keys.data, empty_pos, pvm_create_string_object_binary( ikey, i_key_len ) );
-        pvm_set_array_ofield( dir->values.data, empty_pos, add );
-    }
-    else
-    {
-        pvm_append_array( dir->keys.data, pvm_create_string_object_binary( ikey, i_key_len ) );
-        pvm_append_array( dir->values.data, add );
-    }
+    hdir_insert( dir->table, key, ref_inc_o( add ), hash );
     dir->nEntries++;
 
+    hdir_write_end( dir );
     UNLOCK_DIR(dir);
     return 0;
 }
 
 
-static int hdir_cmp_keys( const char *ikey, size_t ikey_len, pvm_object_t okey )
+//! Make table twice bigger, called in write section
+static void hdir_grow( hashdir_t *dir )
 {
-    size_t okey_len = pvm_get_str_len(okey);
-
-    if(okey_len > ikey_len) return 1;
-    if(ikey_len > okey_len) return -1;
-
-    const char *okeyp = pvm_get_str_data(okey);
+    u_int32_t capacity = hdir_capacity( dir->table );
 
-    int i;
-    for( i = 0; i < ikey_len; i++ )
+    if( !pvm_is_null( dir->old_table ) )
     {
-        if( *okeyp > *ikey ) return 1;
-        if( *ikey > *okeyp ) return 1;
+        // Previous rehash must be finished before next one
+        hdir_rehash_step( dir, hdir_capacity( dir->old_table ) );
+        // Was kept for readers which could be walking it when it was drained
+        ref_dec_o( dir->old_table );
     }
 
-    return 0;
-}
+    dir->old_table = dir->table;
+    dir->rehash_pos = 0;
+    dir->table = hdir_create_table( capacity * 2 );
 
-#define DEFAULT_SIZE 256
+    SHOW_FLOW( 1, "grow %d -> %d", capacity, capacity * 2 );
+}
 
-//! Return EEXIST if dup
-static errno_t hdir_init( hashdir_t *dir, size_t initial_size )
+//! Move some more old table slots to the new one, called in write section
+static void hdir_rehash_step( hashdir_t *dir, int nslots )
 {
-    if( initial_size <= 10)
-        initial_size = DEFAULT_SIZE;
+    if( !hdir_rehashing( dir->old_table, dir->rehash_pos ) )
+        return;
+
+    pvm_object_t *slots = hdir_slots( dir->old_table );
+    u_int32_t capacity = hdir_capacity( dir->old_table );
 
-    if( initial_size > 10000 )
+    while( nslots-- > 0 && dir->rehash_pos < capacity )
     {
-        SHOW_ERROR( 0, "hdir_init size %d", initial_size );
-        initial_size = DEFAULT_SIZE;
+        pvm_object_t *s = slots + 2*dir->rehash_pos;
+
+        // References are moved, not copied
+        if( !pvm_is_null( s[0] ) && IS_PHANTOM_STRING( s[0] ) )
+        {
+            hdir_insert( dir->table, s[0], s[1], pvm_string_hash( s[0] ) );
+            s[0] = pvm_get_null_object();
+            s[1] = pvm_get_null_object();
+        }
+
+        dir->rehash_pos++;
     }
 
-    hal_spin_init( &dir->lock );
+    // Drained table (only tombstones left there) stays till next grow, see above
+}
 
-    LOCK_DIR(dir);
 
+static void hdir_init_table( hashdir_t *dir )
+{
     dir->nEntries = 0;
-    dir->capacity = initial_size;
+    dir->table = hdir_create_table( HDIR_MIN_SLOTS );
+    dir->old_table = pvm_get_null_object();
+    dir->rehash_pos = 0;
+    dir->format = HDIR_FORMAT;
+}
 
-    dir->keys = pvm_create_array_object();
-    dir->values = pvm_create_array_object();
-    dir->flags = calloc( sizeof(u_int8_t), initial_size );
 
-    UNLOCK_DIR(dir);
+static void hdir_upgrade_put( hashdir_t *dir, pvm_object_t key, pvm_object_t value )
+{
+    if( !IS_PHANTOM_STRING( key ) )
+        return;
 
-    return 0;
+    const char *data = pvm_get_str_data( key );
+    int len = pvm_get_str_len( key );
+    u_int32_t hash = calc_hash( data, data+len );
+
+    // Old add could put same key twice, first one was found
+    if( hdir_lookup( dir->table, 0, data, len, hash, 0 ) >= 0 )
+        return;
+
+    // Old kernel made key without cached hash, copy
+    pvm_object_t nkey = pvm_create_string_object_binary( data, len );
+    pvm_string_hash( nkey );
+
+    u_int32_t capacity = hdir_capacity( dir->table );
+    if( dir->nEntries + 1 > capacity - capacity/8 )
+    {
+        // All old entries are in hand, no need to be incremental here
+        hdir_grow( dir );
+        hdir_rehash_step( dir, capacity );
+    }
+
+    hdir_insert( dir->table, nkey, ref_inc_o( value ), hash );
+    dir->nEntries++;
 }
 
+//! Convert directory made by older kernel, called with dir locked
+static void hdir_upgrade( hashdir_t *dir )
+{
+    struct hdir_old_layout old = *(struct hdir_old_layout *)dir;
 
+    // Readers see format set below, keep them out till we finish
+    hdir_write_begin( dir );
+    hdir_init_table( dir );
 
+    // Never initialized (was made by pvm_create_directory_object)
+    if( old.keys.data == 0 || old.values.data == 0 || pvm_is_null( old.keys ) )
+    {
+        hdir_write_end( dir );
+        return;
+    }
 
+    int n = get_array_size( old.keys.data );
+    int nv = get_array_size( old.values.data );
+    int i;
 
+    // Flags were not persistent, tell 2nd level arrays by class
+    for( i = 0; i < n && i < nv; i++ )
+    {
+        pvm_object_t okey = pvm_get_array_ofield( old.keys.data, i );
+        pvm_object_t oval = pvm_get_array_ofield( old.values.data, i );
 
+        if( pvm_is_null( okey ) )
+            continue;
 
+        if( !pvm_object_class_exactly_is( okey, pvm_get_array_class() ) )
+        {
+            hdir_upgrade_put( dir, okey, oval );
+            continue;
+        }
+
+        int j, n2 = get_array_size( okey.data );
+        for( j = 0; j < n2 && j < get_array_size( oval.data ); j++ )
+        {
+            pvm_object_t k2 = pvm_get_array_ofield( okey.data, j );
+            if( !pvm_is_null( k2 ) )
+                hdir_upgrade_put( dir, k2, pvm_get_array_ofield( oval.data, j ) );
+        }
+    }
+
+    SHOW_FLOW( 1, "upgraded, %d entries", dir->nEntries );
+    hdir_write_end( dir );
+
+    ref_dec_o( old.keys );
+    ref_dec_o( old.values );
+}
 
 
 
@@ -367,14 +675,9 @@ void pvm_internal_init_directory(struct pvm_object_storage * os)
 {
     struct data_area_4_directory      *da = (struct data_area_4_directory *)os->da;
 
-    //da->elSize = 256;
-    //da->capacity = 16;
-    //da->nEntries = 0;
-
-    //da->container = pvm_create_binary_object( da->elSize * da->capacity , 0 );
-
-    errno_t rc = hdir_init( da, 0 );
-    if( rc ) panic("can't create directory"); // TODO do not panic? must return errno?
+    hal_spin_init( &da->lock );
+    da->seq = 0;
+    hdir_init_table( da );
 }
 
 
@@ -384,8 +687,8 @@ void pvm_gc_iter_directory(gc_iterator_call_t func, struct pvm_object_storage *
 {
     struct data_area_4_directory      *da = (struct data_area_4_directory *)os->da;
 
-    gc_fcall( func, arg, da->keys );
-    gc_fcall( func, arg, da->values );
+    gc_fcall( func, arg, da->table );
+    gc_fcall( func, arg, da->old_table );
 }
 
 struct pvm_object     pvm_create_directory_object(void)
@@ -401,11 +704,174 @@ void pvm_gc_finalizer_directory( struct pvm_object_storage * os )
     assert(0);
 }
 
-// Unused, not supposed to be called
+// Directories are not in restart list, it would keep them all alive, so
+// it is called just for root one. Others are converted on first access.
 void pvm_restart_directory( pvm_object_t o )
 {
-    //struct data_area_4_directory *da = pvm_object_da( o, directory );
-    assert(0);
+    struct data_area_4_directory *da = pvm_object_da( o, directory );
+
+    LOCK_DIR(da);
+    if( da->format != HDIR_FORMAT )
+        hdir_upgrade( da );
+    UNLOCK_DIR(da);
 }
 
 
+
+#if VM_DIR_SEQLOCK
+
+// -----------------------------------------------------------------------
+// Benchmark
+// -----------------------------------------------------------------------
+
+#define DIRBENCH_THREADS        4
+#define DIRBENCH_MAX_THREADS    32
+#define DIRBENCH_KEYS           1024
+#define DIRBENCH_LOOKUPS        200000
+#define DIRBENCH_KEY_LEN        24
+
+struct dirbench_thread
+{
+    hashdir_t *                 dir;
+    const char *                keys;           // DIRBENCH_KEY_LEN each
+    int                         nkeys;
+    unsigned                    seed;
+
+    bigtime_t                   time;           // usec
+    int                         errors;
+};
+
+static volatile int             dirbench_done;
+
+static void dirbench_lookups( void *arg )
+{
+    struct dirbench_thread *t = arg;
+    unsigned seed = t->seed;
+    int i;
+
+    bigtime_t start = hal_system_time();
+
+    for( i = 0; i < DIRBENCH_LOOKUPS; i++ )
+    {
+        seed = seed * 1103515245 + 12345;
+        int k = (seed >> 16) % t->nkeys;
+        const char *key = t->keys + k * DIRBENCH_KEY_LEN;
+        pvm_object_t v;
+
+        if( hdir_find( t->dir, key, strlen( key ), &v, 0 ) )
+        {
+            t->errors++;
+            continue;
+        }
+
+        if( pvm_get_int( v ) != k )
+            t->errors++;
+
+        ref_dec_o( v );
+    }
+
+    t->time = hal_system_time() - start;
+    ATOMIC_ADD_AND_FETCH( &dirbench_done, 1 );
+}
+
+// Returns lookups per msec, all threads together
+static long dirbench_run( hashdir_t *dir, const char *keys, int nkeys, int nthreads, int *errors )
+{
+    struct dirbench_thread t[DIRBENCH_MAX_THREADS];
+    bigtime_t time = 1;
+    int i;
+
+    dirbench_done = 0;
+
+    for( i = 0; i < nthreads; i++ )
+    {
+        t[i].dir = dir;
+        t[i].keys = keys;
+        t[i].nkeys = nkeys;
+        t[i].seed = 12345 + i;
+        t[i].time = 0;
+        t[i].errors = 0;
+
+        if( hal_start_thread( dirbench_lookups, t + i, 0 ) <= 0 )
+        {
+            printf("dirbench: can't start thread\n");
+            ATOMIC_ADD_AND_FETCH( &dirbench_done, 1 );
+        }
+    }
+
+    while( dirbench_done < nthreads )
+        hal_sleep_msec( 10 );
+
+    for( i = 0; i < nthreads; i++ )
+    {
+        if( t[i].time > time ) time = t[i].time;
+        *errors += t[i].errors;
+    }
+
+    return (long)(((u_int64_t)DIRBENCH_LOOKUPS * nthreads * 1000) / time);
+}
+
+static void dbg_dir_bench( int ac, char **av )
+{
+    int maxthreads = DIRBENCH_THREADS;
+    int nkeys = DIRBENCH_KEYS;
+    int i;
+
+    if( ac > 1 ) maxthreads = atoi( av[1] );
+    if( ac > 2 ) nkeys = atoi( av[2] );
+
+    if( maxthreads <= 0 || maxthreads > DIRBENCH_MAX_THREADS || nkeys <= 0 )
+    {
+        printf("dirbench: threads must be 1 to %d, keys must be positive\n", DIRBENCH_MAX_THREADS );
+        return;
+    }
+
+    char *keys = malloc( nkeys * DIRBENCH_KEY_LEN );
+    if( 0 == keys )
+    {
+        printf("dirbench: out of memory\n");
+        return;
+    }
+
+    pvm_object_t o = pvm_create_directory_object();
+    hashdir_t *dir = pvm_object_da( o, directory );
+
+    for( i = 0; i < nkeys; i++ )
+    {
+        char *key = keys + i * DIRBENCH_KEY_LEN;
+        snprintf( key, DIRBENCH_KEY_LEN, "bench.key.%d", i );
+        hdir_add( dir, key, strlen( key ), pvm_create_int_object( i ) );
+    }
+
+    printf("%d keys, %d lookups per thread, lookups/msec\n", nkeys, DIRBENCH_LOOKUPS );
+    printf("  threads      locked    seqlock\n");
+
+    int saved = hdir_read_locked;
+    int nthreads = 1;
+
+    for(;;)
+    {
+        int errors = 0;
+
+        hdir_read_locked = 1;
+        long locked = dirbench_run( dir, keys, nkeys, nthreads, &errors );
+
+        hdir_read_locked = 0;
+        long optimistic = dirbench_run( dir, keys, nkeys, nthreads, &errors );
+
+        printf("  %7d %11ld %10ld%s\n", nthreads, locked, optimistic, errors ? " WRONG RESULT" : "" );
+
+        if( nthreads >= maxthreads )
+            break;
+
+        // 1, 2, 4... and asked number last
+        nthreads = (nthreads * 2 > maxthreads) ? maxthreads : nthreads * 2;
+    }
+
+    hdir_read_locked = saved;
+
+    ref_dec_o( o );
+    free( keys );
+}
+
+#endif // VM_DIR_SEQLOCK
@@ -28,14 +28,17 @@
 
 #include "ids/opcode_ids.h"
 
+#include "jit.h"
+
 #include <kernel/snap_sync.h>
 #include <kernel/debug.h>
 
 #include <exceptions.h>
 
 
-static errno_t find_dynamic_method( dynamic_method_info_t *mi );
+static errno_t find_dynamic_method( dynamic_method_info_t *mi, struct pvm_inline_cache *ic );
 struct pvm_object_storage * pvm_exec_find_static_method( pvm_object_t class_ref, int method_ordinal );
+static struct pvm_object_storage * pvm_exec_find_method_ic( struct pvm_object o, unsigned int method_index, struct pvm_inline_cache *ic );
 
 
 /*
@@ -220,10 +223,89 @@ static void pvm_exec_iset( struct data_area_4_thread *da, unsigned abs_stack_pos
 }
 
 
+/**
+ *
+ * Call frames pool. Returned frame with its stacks is kept in thread
+ * object for the next call, so call/return pair does not allocate.
+ * Pool is a usual persistent list, linked by prev just as call stack
+ * is, so snapshots and GC (see pvm_gc_iter_thread) see it as a part
+ * of thread.
+ *
+**/
+
+#if VM_CALL_FRAME_POOL
+// Thread of older image has no pool
+static inline int pvm_exec_has_frame_pool(struct data_area_4_thread *da)
+{
+    pvm_object_storage_t *os = (void *)da - __offsetof(pvm_object_storage_t, da);
+    return PVM_THREAD_HAS_FIELD( os, frame_pool_size );
+}
+#endif
+
+static struct pvm_object pvm_exec_get_call_frame(struct data_area_4_thread *da)
+{
+#if VM_CALL_FRAME_POOL
+    if( pvm_exec_has_frame_pool( da ) && (da->frame_pool.data != 0) )
+    {
+        struct pvm_object cf = da->frame_pool;
+        struct data_area_4_call_frame *cfda = pvm_object_da( cf, call_frame );
+
+        da->frame_pool = cfda->prev;
+        da->frame_pool_size--;
+
+        cfda->prev = pvm_get_null_object();
+        return cf;
+    }
+#endif
+    return pvm_create_call_frame_object();
+}
+
+// Returns 0 if frame can't be reused
+static int pvm_exec_put_call_frame(struct pvm_object cf, struct data_area_4_thread *da)
+{
+#if VM_CALL_FRAME_POOL
+    if( !pvm_exec_has_frame_pool( da ) )
+        return 0;
+
+    // Someone else has a reference to this frame
+    if( cf.data->_ah.refCount != 1 )
+        return 0;
+
+    if( da->frame_pool_size >= VM_CALL_FRAME_POOL )
+        return 0;
+
+    struct data_area_4_call_frame *cfda = pvm_object_da( cf, call_frame );
+
+    pvm_ostack_reset( pvm_object_da( cfda->ostack, object_stack ) );
+    pvm_istack_reset( pvm_object_da( cfda->istack, integer_stack ) );
+    pvm_estack_reset( pvm_object_da( cfda->estack, exception_stack ) );
+
+    ref_dec_o( cfda->this_object );
+    cfda->this_object = pvm_get_null_object();
+
+    cfda->IP_max = 0;
+    cfda->IP = 0;
+    cfda->code = 0;
+
+    cfda->prev = da->frame_pool;
+    da->frame_pool = cf;
+    da->frame_pool_size++;
+
+    return 1;
+#else
+    (void) cf;
+    (void) da;
+    return 0;
+#endif
+}
+
+
 static void free_call_frame(struct pvm_object cf, struct data_area_4_thread *da)
 {
     pvm_object_da( cf, call_frame )->prev.data = 0; // Or else refcounter will follow this link
-    ref_dec_o( cf ); // we are erasing reference to old call frame - release it!
+
+    if( !pvm_exec_put_call_frame( cf, da ) )
+        ref_dec_o( cf ); // we are erasing reference to old call frame - release it!
 
     da->stack_depth--;
 }
@@ -249,6 +331,26 @@ static int pvm_exec_find_catch(
                                unsigned int *jump_to,
                                struct pvm_object thrown_obj );
 
+#if VM_HANDLER_TABLES
+static int pvm_exec_find_table_catch(
+                               struct data_area_4_thread *da,
+                               unsigned int *jump_to,
+                               struct pvm_object thrown_obj );
+#endif
+
+// Catchers pushed at run time are nested in static try ranges, not vice versa - compiler makes it so
+static int pvm_exec_find_frame_catch( struct data_area_4_thread *da, unsigned int *jump_to, struct pvm_object thrown_obj )
+{
+    if( pvm_exec_find_catch( da->_estack, jump_to, thrown_obj ) )
+        return 1;
+
+#if VM_HANDLER_TABLES
+    return pvm_exec_find_table_catch( da, jump_to, thrown_obj );
+#else
+    return 0;
+#endif
+}
+
 
 // object to throw is on stack
 static void pvm_exec_do_throw(struct data_area_4_thread *da)
@@ -256,7 +358,7 @@ static void pvm_exec_do_throw(struct data_area_4_thread *da)
     unsigned int jump_to = (unsigned int)-1; // to cause fault
     struct pvm_object thrown_obj = os_pop();
     // call_frame.catch_found( &jump_to, thrown_obj )
-    while( !(pvm_exec_find_catch( da->_estack, &jump_to, thrown_obj )) )
+    while( !(pvm_exec_find_frame_catch( da, &jump_to, thrown_obj )) )
     {
         // like ret here
         LISTI("except does unwind, ");
@@ -295,7 +397,7 @@ static void pvm_exec_sys( struct data_area_4_thread *da, unsigned int syscall_in
     // which object's syscall we'll call
     struct pvm_object o = this_object();
 
-    syscall_func_t func = pvm_exec_find_syscall( o.data->_class, syscall_index );
+    syscall_func_t func = pvm_exec_find_syscall( pvm_get_class( o ), syscall_index );
 
     if( func == 0 )
     {
@@ -321,7 +423,8 @@ static void init_cfda(
     unsigned int method_index, 
     unsigned int n_param, 
     pvm_object_t new_this,     
-    pvm_object_t class_ref  // for static calls. will do VMT call if null
+    pvm_object_t class_ref, // for static calls. will do VMT call if null
+    struct pvm_inline_cache *ic // call site cache or 0
      )
 {
     cfda->ordinal = method_index;
@@ -376,7 +479,7 @@ static void init_cfda(
         code = pvm_exec_find_static_method( class_ref, method_index );
     }
     else
-        code = pvm_exec_find_method( new_this, method_index );
+        code = pvm_exec_find_method_ic( new_this, method_index, ic );
 
     assert(code != 0);
     pvm_exec_set_cs( cfda, code );
@@ -384,7 +487,7 @@ static void init_cfda(
 }
 
 
-static void pvm_exec_call( struct data_area_4_thread *da, unsigned int method_index, unsigned int n_param, int do_optimize_ret, pvm_object_t new_this )
+static void pvm_exec_call( struct data_area_4_thread *da, unsigned int method_index, unsigned int n_param, int do_optimize_ret, pvm_object_t new_this, struct pvm_inline_cache *ic )
 {
     if( DEB_CALLRET || debug_print_instr ) printf( "\ncall %d (stack_depth %d -> ", method_index, da->stack_depth );
 
@@ -412,14 +515,14 @@ static void pvm_exec_call( struct data_area_4_thread *da, unsigned int method_in
 
     pvm_exec_save_fast_acc(da);  // not needed for optimized stack in fact
 
-    struct pvm_object new_cf = pvm_create_call_frame_object();
+    struct pvm_object new_cf = pvm_exec_get_call_frame(da);
     struct data_area_4_call_frame* cfda = pvm_object_da( new_cf, call_frame );
 
     //if( pvm_is_null(new_this) )                new_this = os_pop();
 
     //struct pvm_object_storage *code = pvm_exec_find_method( new_this, method_index );
 
-    init_cfda(da, cfda, method_index, n_param, new_this, pvm_get_null_object() );
+    init_cfda(da, cfda, method_index, n_param, new_this, pvm_get_null_object(), ic );
 
     if (!optimize_stack)
         cfda->prev = da->call_frame;  // link
@@ -436,9 +539,19 @@ static void pvm_exec_call( struct data_area_4_thread *da, unsigned int method_in
     da->call_frame = new_cf;
     pvm_exec_load_fast_acc(da);
 
+#if VM_METHOD_PROFILE
+    if( pvm_mprof_on ) pvm_mprof_invoked( da );
+#endif
+
     if( DEB_CALLRET || debug_print_instr ) printf( "%d); ", da->stack_depth );
 }
 
+// Native code does calls with this one, see jit.c
+void pvm_exec_jit_call( struct data_area_4_thread *da, unsigned int method_index, unsigned int n_param, int do_optimize )
+{
+    pvm_exec_call( da, method_index, n_param, do_optimize, pvm_get_null_object(), 0 );
+}
+
 // TODO combine this and prev funcs where possible
 
 static void
@@ -456,12 +569,12 @@ pvm_exec_static_call(
 
     pvm_exec_save_fast_acc(da);  
 
-    struct pvm_object new_cf = pvm_create_call_frame_object();
+    struct pvm_object new_cf = pvm_exec_get_call_frame(da);
     struct data_area_4_call_frame* cfda = pvm_object_da( new_cf, call_frame );
 
     //struct pvm_object_storage *code = pvm_exec_find_static_method( class_ref, method_ordinal );
 
-    init_cfda(da, cfda, method_ordinal, n_param, new_this, class_ref );
+    init_cfda(da, cfda, method_ordinal, n_param, new_this, class_ref, 0 );
     
     cfda->prev = da->call_frame;  // link
     
@@ -469,6 +582,10 @@ pvm_exec_static_call(
     da->call_frame = new_cf;
     pvm_exec_load_fast_acc(da);
 
+#if VM_METHOD_PROFILE
+    if( pvm_mprof_on ) pvm_mprof_invoked( da );
+#endif
+
     if( DEB_CALLRET || debug_print_instr ) printf( "%d); ", da->stack_depth );
 }
 
@@ -496,6 +613,90 @@ pvm_exec_static_call(
  *
 **/
 
+
+/**
+ *
+ * Opcode dispatch.
+ *
+ * Each opcode implementation is marked with VM_CASE(table,opcode). With
+ * VM_EXEC_THREADED it is both a switch case and a label, and we dispatch
+ * with computed goto through per-prefix label tables below. Otherwise it
+ * is just a switch case.
+ *
+ * NB! If you add a VM_CASE, add it to corresponding VM_OPS_ list too,
+ * or threaded version will not find it: main table sends unknown
+ * opcodes to default (sys/call/panic), prefix tables - to nonprefix
+ * implementation.
+ *
+**/
+
+#if VM_EXEC_THREADED
+
+#define VM_CASE(tab,op)         case opcode_##op: vm_##tab##_##op:
+#define VM_DEFAULT(tab)         default: vm_##tab##_default:
+#define VM_GOTO_NOPREFIX        goto *vm_dispatch_main[instruction]
+
+#define VM_TAB_SET(tab,op)      vm_dispatch_##tab[opcode_##op] = &&vm_##tab##_##op;
+#define VM_TAB_LONG(op)         VM_TAB_SET(long,op)
+#define VM_TAB_FLOAT(op)        VM_TAB_SET(float,op)
+#define VM_TAB_DOUBLE(op)       VM_TAB_SET(double,op)
+#define VM_TAB_MAIN(op)         VM_TAB_SET(main,op)
+
+// Ops which have distinct implementation for long, float and double prefix
+#define VM_OPS_PREFIXED(_) \
+    _(ishl) _(ishr) _(ushr) _(isum) _(imul) _(isubul) _(isublu) _(idivul) _(idivlu) \
+    _(ior) _(iand) _(ixor) _(inot) _(log_or) _(log_and) _(log_xor) _(log_not) \
+    _(ige) _(ile) _(igt) _(ilt) _(fromi) _(froml) _(fromf) _(fromd) _(i2o) _(o2i)
+
+#define VM_OPS_MAIN(_) \
+    _(prefix_long) _(prefix_float) _(prefix_double) _(nop) _(debug) \
+    _(general_lock) _(general_unlock) _(is_dup) _(is_drop) \
+    _(iconst_0) _(iconst_1) _(iconst_8bit) _(iconst_32bit) _(iconst_64bit) \
+    _(const_pool) _(cast) VM_OPS_PREFIXED(_) \
+    _(os_eq) _(os_neq) _(os_isnull) \
+    _(summon_null) _(summon_thread) _(summon_this) _(summon_class_class) \
+    _(summon_interface_class) _(summon_code_class) _(summon_int_class) \
+    _(summon_string_class) _(summon_array_class) _(summon_by_name) \
+    _(new) _(copy) _(sconst_bin) \
+    _(jmp) _(djnz) _(jz) _(switch) _(ret) _(throw) _(push_catcher) _(pop_catcher) \
+    _(short_call_0) _(short_call_1) _(short_call_2) _(short_call_3) \
+    _(call_8bit) _(call_32bit) _(dynamic_invoke) _(static_invoke) \
+    _(os_dup) _(os_drop) _(os_pull32) _(os_load8) _(os_load32) _(os_save8) _(os_save32) \
+    _(is_load8) _(is_save8) _(os_get32) _(os_set32) _(is_get32) _(is_set32) \
+    _(ilt_jz) _(ile_jz) _(igt_jz) _(ige_jz) _(is_inc32) \
+    _(is_get32_iconst_ilt_jz) _(is_get32_iconst_ile_jz) \
+    _(is_get32_iconst_igt_jz) _(is_get32_iconst_ige_jz)
+
+#else // VM_EXEC_THREADED
+
+#define VM_CASE(tab,op)         case opcode_##op:
+#define VM_DEFAULT(tab)         default:
+#define VM_GOTO_NOPREFIX        goto noprefix
+
+#endif // VM_EXEC_THREADED
+
+
+/**
+ *
+ * Operands. If current instruction is pre-decoded (see code_cache.c),
+ * take them from record, else read from bytecode as usual. Raw reads
+ * are sequential, so operands must be fetched in order. Verified code
+ * (see code_verify.c) is read with no bounds check.
+ *
+**/
+
+#define VM_RAW_BYTE()           (vm_verified ? pvm_code_get_byte_unchecked(&(da->code)) : pvm_code_get_byte(&(da->code)))
+#define VM_RAW_INT32()          (vm_verified ? pvm_code_get_int32_unchecked(&(da->code)) : pvm_code_get_int32(&(da->code)))
+#define VM_RAW_REL_IP()         (vm_verified ? pvm_code_get_rel_IP_as_abs_unchecked(&(da->code)) : pvm_code_get_rel_IP_as_abs(&(da->code)))
+
+#define VM_ARG_BYTE(n)          (dop ? (unsigned char)dop->arg[n] : VM_RAW_BYTE())
+#define VM_ARG_INT32(n)         (dop ? dop->arg[n] : VM_RAW_INT32())
+#define VM_ARG_REL_IP(n)        (dop ? (unsigned int)dop->arg[n] : VM_RAW_REL_IP())
+
+// Call site cache of current instruction, if any
+#define VM_IC                   ((dop && dop->ic) ? dcode->ics + (dop->ic - 1) : 0)
+
+
 static void do_pvm_exec(pvm_object_t current_thread)
 {
     int prefix_long = 0;
@@ -505,6 +706,110 @@ static void do_pvm_exec(pvm_object_t current_thread)
 #define DO_TWICE  (prefix_long || prefix_double)
 #define DO_FPOINT (prefix_float || prefix_double)
 
+    // Decoded code we run, if any. Reloaded when code we run changes.
+    struct pvm_code_cache *dcode = 0;
+    const unsigned char *dcode_for = 0;
+    const struct pvm_code_op *dop;
+    // Code we run passed verifier, IP is always at instruction start
+    int vm_verified = 0;
+
+#if VM_OPCODE_PROFILE
+    // Two previous opcodes, for pairs and triples profiler
+    unsigned char opprof_prev1 = opcode_nop, opprof_prev2 = opcode_nop;
+#endif
+
+#if VM_METHOD_PROFILE
+    // Record for the code we run, time we started to and instructions done
+    struct pvm_mprof_method *mprof = 0;
+    bigtime_t mprof_since = 0;
+    unsigned int mprof_instructions = 0;
+#endif
+
+#if VM_OPCODE_PROFILE || VM_METHOD_PROFILE
+    // Some profiler is on. Reloaded on code change, so that there
+    // is just one check per instruction for all of them.
+    int vm_profile = 0;
+#endif
+
+#if JIT_ENABLED
+    // Native code for dcode, if any
+    struct jit_code *jcode = 0;
+
+    // Count method entry or backward jump, compile method when it is hot
+#define VM_JIT_COUNT() do { \
+        if( dcode && !jcode && (++dcode->invocations == VM_JIT_THRESHOLD) ) \
+        { jit_compile_method( dcode ); jcode = dcode->jit; } \
+    } while(0)
+#define VM_JIT_BACK_JUMP( __to ) do { if( ((unsigned int)(__to)) < da->code.IP ) VM_JIT_COUNT(); } while(0)
+#else
+#define VM_JIT_BACK_JUMP( __to )
+#endif // JIT_ENABLED
+
+    // Let snapshot happen. Must be used between instructions only, so that
+    // IP saved in call frame is the one to continue from.
+#if NEW_SNAP_SYNC
+    // touch special memory page, if snap is scheduled, page will be write-protected and we'll gen page fault
+#define VM_SNAP_CHECK() do { pvm_exec_save_fast_acc(da); touch_snap_catch(); } while(0)
+#else
+#define VM_SNAP_CHECK() do { \
+        if(phantom_virtual_machine_snap_request) \
+        { \
+            pvm_exec_save_fast_acc(da); /* Before snap */ \
+            phantom_thread_wait_4_snap(); \
+        } \
+    } while(0)
+#endif
+
+    // Any loop has a backward jump, any recursion has a call, so polling
+    // there (and on ret/throw) keeps time to safepoint bounded.
+#if VM_SAFEPOINTS
+#define VM_SAFEPOINT() VM_SNAP_CHECK()
+#else
+#define VM_SAFEPOINT()
+#endif
+
+    // Jump to __to, instruction is complete after that
+#define VM_JUMP( __to ) do { \
+        unsigned int __new_IP = (__to); \
+        if( __new_IP < da->code.IP ) \
+        { \
+            VM_JIT_BACK_JUMP( __new_IP ); \
+            da->code.IP = __new_IP; \
+            VM_SAFEPOINT(); \
+        } \
+        else \
+            da->code.IP = __new_IP; \
+    } while(0)
+
+#if VM_EXEC_THREADED
+    // Filled on first entry - label addresses are known inside this func only.
+    // Races here are harmless, all the threads write the same values.
+    static void *vm_dispatch_main[256];
+    static void *vm_dispatch_long[256];
+    static void *vm_dispatch_float[256];
+    static void *vm_dispatch_double[256];
+    static int vm_dispatch_ready = 0;
+
+    if( !vm_dispatch_ready )
+    {
+        int i;
+        for( i = 0; i < 256; i++ )
+        {
+            vm_dispatch_main[i]   = &&vm_main_default;
+            vm_dispatch_long[i]   = &&vm_long_default;
+            vm_dispatch_float[i]  = &&vm_float_default;
+            vm_dispatch_double[i] = &&vm_double_default;
+        }
+
+        VM_OPS_MAIN(VM_TAB_MAIN)
+        VM_OPS_PREFIXED(VM_TAB_LONG)
+        VM_OPS_PREFIXED(VM_TAB_FLOAT)
+        VM_OPS_PREFIXED(VM_TAB_DOUBLE)
+
+        vm_dispatch_ready = 1;
+    }
+#endif // VM_EXEC_THREADED
+
     if( !pvm_object_class_exactly_is( current_thread, pvm_get_thread_class() ))
         panic("attempt to run not a thread");
 
@@ -523,15 +828,9 @@ static void do_pvm_exec(pvm_object_t current_thread)
     while(1)
     {
 
-#if NEW_SNAP_SYNC
-        touch_snap_catch(); // touch special memory page, if snap is scheduled, page will be write-protected and we'll gen page fault
-#else
-        if(phantom_virtual_machine_snap_request)
-        {
-            pvm_exec_save_fast_acc(da); // Before snap
-            phantom_thread_wait_4_snap();
-            //pvm_exec_load_fast_acc(da); // We don't need this, if we die, we will enter again from above :)
-        }
+#if !VM_SAFEPOINTS
+        VM_SNAP_CHECK();
+        //pvm_exec_load_fast_acc(da); // We don't need this, if we die, we will enter again from above :)
 #endif
 
 #if 0 // GC_ENABLED  // GC can be enabled here for test purposes only.
@@ -544,19 +843,84 @@ static void do_pvm_exec(pvm_object_t current_thread)
         }
 #endif // GC_ENABLED
 
-        unsigned char instruction = pvm_code_get_byte(&(da->code));
+        if( da->code.code != dcode_for )
+        {
+            dcode_for = da->code.code;
+            dcode = pvm_code_cache_get( dcode_for, da->code.IP_max );
+            vm_verified = pvm_code_is_verified( dcode_for );
+#if VM_METHOD_PROFILE
+            if( mprof || pvm_mprof_on )
+                mprof = pvm_mprof_switch( da, mprof, &mprof_since, &mprof_instructions );
+            vm_profile = (mprof != 0);
+#endif
+#if VM_OPCODE_PROFILE
+            if( pvm_opprof_on ) vm_profile = 1;
+#endif
+#if JIT_ENABLED
+            jcode = dcode ? dcode->jit : 0;
+            if( 0 == da->code.IP ) VM_JIT_COUNT();
+#endif
+        }
+
+#if JIT_ENABLED
+        // Native code exits with IP of the first op it can't do, or after call
+        if( jcode && !(prefix_long || prefix_float || prefix_double) && jit_can_enter( jcode, da->code.IP ) )
+        {
+            jit_run( da, jcode );
+            // Native code polls on backward jumps only and exits on calls
+            VM_SAFEPOINT();
+            continue;
+        }
+#endif
+
+        unsigned char instruction;
+
+        dop = 0;
+        if( dcode && (vm_verified || da->code.IP < dcode->code_size) && dcode->map[da->code.IP] )
+        {
+            dop = dcode->ops + (dcode->map[da->code.IP] - 1);
+            instruction = dop->opcode;
+            da->code.IP = dop->next_IP;
+        }
+        else
+            instruction = VM_RAW_BYTE();
         //printf("instr 0x%02X ", instruction);
 
+#if VM_OPCODE_PROFILE || VM_METHOD_PROFILE
+        if( vm_profile )
+        {
+#if VM_METHOD_PROFILE
+            mprof_instructions++;
+#endif
+#if VM_OPCODE_PROFILE
+            if( pvm_opprof_on )
+            {
+                pvm_opprof_count( opprof_prev2, opprof_prev1, instruction );
+                opprof_prev2 = opprof_prev1;
+                opprof_prev1 = instruction;
+            }
+#endif
+        }
+#endif
+
+#if VM_EXEC_THREADED
+        // Prefix is reset here just as switch versions below do
+        if( prefix_long )   { prefix_long = 0;   goto *vm_dispatch_long[instruction]; }
+        if( prefix_float )  { prefix_float = 0;  goto *vm_dispatch_float[instruction]; }
+        if( prefix_double ) { prefix_double = 0; goto *vm_dispatch_double[instruction]; }
+        goto *vm_dispatch_main[instruction];
+#endif // VM_EXEC_THREADED
+
         if( prefix_long )
         {
             prefix_long = 0;
             switch(instruction)
             {
-            default:
+            VM_DEFAULT(long)
                 prefix_long = 1;  // attempt nonprefix impl of inctruction, maybe it checks for a modifier
-                goto noprefix;
+                VM_GOTO_NOPREFIX;
 
-            case opcode_ishl:
+            VM_CASE(long,ishl)
                 LISTI("l-ishl");
                 {
                     int64_t val = ls_pop();
@@ -564,7 +928,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_ishr:
+            VM_CASE(long,ishr)
                 LISTI("l-ishr");
                 {
                     int64_t val = ls_pop();
@@ -572,7 +936,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_ushr:
+            VM_CASE(long,ushr)
                 LISTI("l-ushr");
                 {
                     u_int64_t val = ls_pop();
@@ -581,7 +945,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 break;
 
 
-            case opcode_isum:
+            VM_CASE(long,isum)
                 LISTI("l-isum");
                 {
                     int64_t add = ls_pop();
@@ -589,7 +953,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_imul:
+            VM_CASE(long,imul)
                 LISTI("l-imul");
                 {
                     int64_t mul = ls_pop();
@@ -597,7 +961,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_isubul:
+            VM_CASE(long,isubul)
                 LISTI("l-isubul");
                 {
                     int64_t u = ls_pop();
@@ -606,7 +970,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_isublu:
+            VM_CASE(long,isublu)
                 LISTI("l-isublu");
                 {
                     int64_t u = ls_pop();
@@ -615,7 +979,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_idivul:
+            VM_CASE(long,idivul)
                 LISTI("l-idivul");
                 {
                     int64_t u = ls_pop();
@@ -624,7 +988,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_idivlu:
+            VM_CASE(long,idivlu)
                 LISTI("l-idivlu");
                 {
                     int64_t u = ls_pop();
@@ -633,29 +997,29 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_ior:
+            VM_CASE(long,ior)
                 LISTI("l-ior");
                 { int64_t operand = ls_pop();	ls_push( ls_pop() | operand ); }
                 break;
 
-            case opcode_iand:
+            VM_CASE(long,iand)
                 LISTI("l-iand");
                 { int64_t operand = ls_pop();	ls_push( ls_pop() & operand ); }
                 break;
 
-            case opcode_ixor:
+            VM_CASE(long,ixor)
                 LISTI("l-ixor");
                 { int64_t operand = ls_pop();	ls_push( ls_pop() ^ operand ); }
                 break;
 
-            case opcode_inot:
+            VM_CASE(long,inot)
                 LISTI("l-inot");
                 { int64_t operand = ls_pop();	ls_push( ~operand ); }
                 break;
 
 
 
-            case opcode_log_or:
+            VM_CASE(long,log_or)
                 LISTI("l-lor");
                 {
                     int64_t o1 = ls_pop();
@@ -664,7 +1028,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_log_and:
+            VM_CASE(long,log_and)
                 LISTI("l-land");
                 {
                     int64_t o1 = ls_pop();
@@ -673,7 +1037,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_log_xor:
+            VM_CASE(long,log_xor)
                 LISTI("l-lxor");
                 {
                     int64_t o1 = ls_pop() ? 1 : 0;
@@ -682,7 +1046,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_log_not:
+            VM_CASE(long,log_not)
                 LISTI("l-lnot");
                 {
                     int64_t operand = ls_pop();
@@ -691,35 +1055,35 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 break;
 
                 // NB! Returns int!
-            case opcode_ige:	// >=
+            VM_CASE(long,ige)	// >=
                 LISTI("l-ige");
                 { int64_t operand = ls_pop();	is_push( ls_pop() >= operand ); }
                 break;
-            case opcode_ile:	// <=
+            VM_CASE(long,ile)	// <=
                 LISTI("l-ile");
                 { int64_t operand = ls_pop();	is_push( ls_pop() <= operand ); }
                 break;
-            case opcode_igt:	// >
+            VM_CASE(long,igt)	// >
                 LISTI("l-igt");
                 { int64_t operand = ls_pop();	is_push( ls_pop() > operand ); }
                 break;
-            case opcode_ilt:	// <
+            VM_CASE(long,ilt)	// <
                 LISTI("l-ilt");
                 { int64_t operand = ls_pop();	is_push( ls_pop() < operand ); }
                 break;
 
-            case opcode_froml:
+            VM_CASE(long,froml)
                 LISTI("l-froml (nop)");
                 break;
 
-            case opcode_fromi:
+            VM_CASE(long,fromi)
                 LISTI("l-fromi");
                 {
                     ls_push( is_pop() );
                 }
                 break;
 
-            case opcode_fromd:
+            VM_CASE(long,fromd)
                 LISTI("l-fromd");
                 {
                     long l = ls_pop();
@@ -728,7 +1092,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_fromf:
+            VM_CASE(long,fromf)
                 LISTI("l-fromf");
                 {
                     int i = is_pop();
@@ -738,17 +1102,18 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 break;
 
 
-            case opcode_i2o:
+            VM_CASE(long,i2o)
                 LISTI("l-i2o");
                 os_push(pvm_create_long_object(ls_pop()));
                 break;
 
-            case opcode_o2i:
+            VM_CASE(long,o2i)
                 LISTI("l-o2i");
                 {
                     struct pvm_object o = os_pop();
                     if( o.data == 0 ) pvm_exec_panic("l-o2i(null)");
-                    ls_push( pvm_get_long( o ) );
+                    // Immediate int is widened
+                    ls_push( pvm_is_immediate( o ) ? (int64_t)pvm_get_int( o ) : pvm_get_long( o ) );
                     ref_dec_o(o);
                 }
                 break;
@@ -762,37 +1127,37 @@ static void do_pvm_exec(pvm_object_t current_thread)
             prefix_float = 0;
             switch(instruction)
             {
-            default: // Try classic implementation of that op
+            VM_DEFAULT(float) // Try classic implementation of that op
                 prefix_float = 1; // attempt nonprefix impl of inctruction, maybe it checks for a modifier
-                goto noprefix;
+                VM_GOTO_NOPREFIX;
                 //pvm_exec_panic("invalid double op");
                 //break;
 
-            case opcode_ishl: // Not defined for float, throw exception
-            case opcode_ishr:
-            case opcode_ushr:
-            case opcode_ior:
-            case opcode_iand:
-            case opcode_ixor:
-            case opcode_inot:
-            case opcode_log_or:
-            case opcode_log_and:
-            case opcode_log_xor:
-            case opcode_log_not:
+            VM_CASE(float,ishl) // Not defined for float, throw exception
+            VM_CASE(float,ishr)
+            VM_CASE(float,ushr)
+            VM_CASE(float,ior)
+            VM_CASE(float,iand)
+            VM_CASE(float,ixor)
+            VM_CASE(float,inot)
+            VM_CASE(float,log_or)
+            VM_CASE(float,log_and)
+            VM_CASE(float,log_xor)
+            VM_CASE(float,log_not)
                 pvm_exec_panic("invalid float op");
                 break;
 
-            case opcode_isum:
+            VM_CASE(float,isum)
                 LISTI("f-isum");
                 FLOAT_STACK_OP( + );
                 break;
 
-            case opcode_imul:
+            VM_CASE(float,imul)
                 LISTI("f-imul");
                 FLOAT_STACK_OP( * );
                 break;
 
-            case opcode_isubul:
+            VM_CASE(float,isubul)
                 LISTI("f-isubul");
                 {
                     int32_t u = is_pop();
@@ -802,7 +1167,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_isublu:
+            VM_CASE(float,isublu)
                 LISTI("f-isublu");
                 {
                     int32_t u = is_pop();
@@ -812,7 +1177,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_idivul:
+            VM_CASE(float,idivul)
                 LISTI("f-idivul");
                 {
                     int32_t u = is_pop();
@@ -822,7 +1187,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_idivlu:
+            VM_CASE(float,idivlu)
                 LISTI("f-idivlu");
                 {
                     int32_t u = is_pop();
@@ -837,7 +1202,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
 
 
                 // NB! Returns int!
-            case opcode_ige:
+            VM_CASE(float,ige)
                 LISTI("f-ige");
                 {
                     int32_t u = is_pop();
@@ -846,7 +1211,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                     is_push( r );
                 }
                 break;
-            case opcode_ile:
+            VM_CASE(float,ile)
                 LISTI("f-ile");
                 {
                     int32_t u = is_pop();
@@ -855,7 +1220,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                     is_push( r );
                 }
                 break;
-            case opcode_igt:
+            VM_CASE(float,igt)
                 LISTI("f-igt");
                 {
                     int32_t u = is_pop();
@@ -864,7 +1229,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                     is_push( r );
                 }
                 break;
-            case opcode_ilt:
+            VM_CASE(float,ilt)
                 LISTI("f-ilt");
                 {
                     int32_t u = is_pop();
@@ -875,11 +1240,11 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 break;
 
 
-            case opcode_fromf:
+            VM_CASE(float,fromf)
                 LISTI("f-fromf (nop)");
                 break;
 
-            case opcode_fromi:
+            VM_CASE(float,fromi)
                 LISTI("f-fromi");
                 {
                     float i = is_pop();
@@ -887,7 +1252,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_froml:
+            VM_CASE(float,froml)
                 LISTI("f-froml");
                 {
                     float l = ls_pop();
@@ -895,7 +1260,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_fromd:
+            VM_CASE(float,fromd)
                 LISTI("f-fromd");
                 {
                     int64_t l = ls_pop();
@@ -904,7 +1269,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_i2o:
+            VM_CASE(float,i2o)
                 LISTI("f-i2o");
                 {
                     //pvm_exec_panic("unimpl float i2o");
@@ -913,13 +1278,13 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_o2i:
+            VM_CASE(float,o2i)
                 LISTI("f-o2i");
                 //pvm_exec_panic("unimpl float o2i");
                 {
                     struct pvm_object o = os_pop();
                     if( o.data == 0 ) pvm_exec_panic("f-o2i(null)");
-                    float d = pvm_get_float( o );
+                    float d = pvm_is_immediate( o ) ? pvm_get_int( o ) : pvm_get_float( o );
                     is_push( TO_INT( d ) );
                     ref_dec_o(o);
                 }
@@ -936,38 +1301,38 @@ static void do_pvm_exec(pvm_object_t current_thread)
 
             switch(instruction)
             {
-            default:
+            VM_DEFAULT(double)
                 prefix_double = 1;  // attempt nonprefix impl of inctruction, maybe it checks for a modifier
-                goto noprefix;
-
-            case opcode_ishl: // Not defined for double, throw exception
-            case opcode_ishr:
-            case opcode_ushr:
-            case opcode_ior:
-            case opcode_iand:
-            case opcode_ixor:
-            case opcode_inot:
-            case opcode_log_or:
-            case opcode_log_and:
-            case opcode_log_xor:
-            case opcode_log_not:
+                VM_GOTO_NOPREFIX;
+
+            VM_CASE(double,ishl) // Not defined for double, throw exception
+            VM_CASE(double,ishr)
+            VM_CASE(double,ushr)
+            VM_CASE(double,ior)
+            VM_CASE(double,iand)
+            VM_CASE(double,ixor)
+            VM_CASE(double,inot)
+            VM_CASE(double,log_or)
+            VM_CASE(double,log_and)
+            VM_CASE(double,log_xor)
+            VM_CASE(double,log_not)
                 pvm_exec_panic("invalid double op");
                 break;
 
 
-            case opcode_isum:
+            VM_CASE(double,isum)
                 LISTI("d-isum");
                 DOUBLE_STACK_OP( + );
                 break;
 
-            case opcode_imul:
+            VM_CASE(double,imul)
                 LISTI("d-imul");
                 DOUBLE_STACK_OP( * );
 
 //                {                    int64_t mul = ls_pop();                    ls_push( ls_pop() * mul );                }
                 break;
 
-            case opcode_isubul:
+            VM_CASE(double,isubul)
                 LISTI("d-isubul");
                 {
                     int64_t u = ls_pop();
@@ -977,7 +1342,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_isublu:
+            VM_CASE(double,isublu)
                 LISTI("d-isublu");
                 {
                     int64_t u = ls_pop();
@@ -987,7 +1352,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_idivul:
+            VM_CASE(double,idivul)
                 LISTI("d-idivul");
                 {
                     int64_t u = ls_pop();
@@ -997,7 +1362,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_idivlu:
+            VM_CASE(double,idivlu)
                 LISTI("d-idivlu");
                 {
                     int64_t u = ls_pop();
@@ -1012,7 +1377,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
 
 
                 // NB! Returns int!
-            case opcode_ige:
+            VM_CASE(double,ige)
                 LISTI("d-ige");
                 {
                     int64_t u = ls_pop();
@@ -1021,7 +1386,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                     is_push( r );
                 }
                 break;
-            case opcode_ile:
+            VM_CASE(double,ile)
                 LISTI("d-ile");
                 {
                     int64_t u = ls_pop();
@@ -1030,7 +1395,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                     is_push( r );
                 }
                 break;
-            case opcode_igt:
+            VM_CASE(double,igt)
                 LISTI("d-igt");
                 {
                     int64_t u = ls_pop();
@@ -1039,7 +1404,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                     is_push( r );
                 }
                 break;
-            case opcode_ilt:
+            VM_CASE(double,ilt)
                 LISTI("d-ilt");
                 {
                     int64_t u = ls_pop();
@@ -1050,11 +1415,11 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 break;
 
 
-            case opcode_fromd:
+            VM_CASE(double,fromd)
                 LISTI("d-fromd (nop)");
                 break;
 
-            case opcode_fromi:
+            VM_CASE(double,fromi)
                 LISTI("d-fromi");
                 {
                     double i = is_pop();
@@ -1062,7 +1427,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_froml:
+            VM_CASE(double,froml)
                 LISTI("d-froml");
                 {
                     double l = ls_pop();
@@ -1070,7 +1435,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_fromf:
+            VM_CASE(double,fromf)
                 LISTI("d-fromf");
                 {
                     int i = is_pop();
@@ -1079,7 +1444,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_i2o: // ERROR IMPLEMENT ME
+            VM_CASE(double,i2o) // ERROR IMPLEMENT ME
                 LISTI("d-i2o");
                 {
                     //pvm_exec_panic("unimpl double i2o");
@@ -1088,13 +1453,13 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_o2i: // ERROR IMPLEMENT ME
+            VM_CASE(double,o2i) // ERROR IMPLEMENT ME
                 LISTI("d-o2i");
                 //pvm_exec_panic("unimpl double o2i");
                 {
                     struct pvm_object o = os_pop();
                     if( o.data == 0 ) pvm_exec_panic("d-o2i(null)");
-                    double d = pvm_get_double( o );
+                    double d = pvm_is_immediate( o ) ? pvm_get_int( o ) : pvm_get_double( o );
                     ls_push( TO_LONG( d ) );
                     ref_dec_o(o);
                 }
@@ -1105,7 +1470,9 @@ static void do_pvm_exec(pvm_object_t current_thread)
         } // if(prefix_double)
 
 
+#if !VM_EXEC_THREADED
     noprefix:
+#endif
         switch(instruction)
         {
 
@@ -1113,19 +1480,19 @@ static void do_pvm_exec(pvm_object_t current_thread)
 
         // NB! Not break, continue, or else code after the main switch will reset prefix and print warning
 
-        case opcode_prefix_long:   prefix_long   = 1; continue;
-        case opcode_prefix_float:  prefix_float  = 1; continue;
-        case opcode_prefix_double: prefix_double = 1; continue;
+        VM_CASE(main,prefix_long)   prefix_long   = 1; continue;
+        VM_CASE(main,prefix_float)  prefix_float  = 1; continue;
+        VM_CASE(main,prefix_double) prefix_double = 1; continue;
 
         // special opcodes -------------------------------------
 
-        case opcode_nop:
+        VM_CASE(main,nop)
             LISTI("nop");
             break;
 
-        case opcode_debug:
+        VM_CASE(main,debug)
             {
-                int type = pvm_code_get_byte(&(da->code)); //cf->cs.get_instr( cf->IP );
+                int type = VM_RAW_BYTE(); //cf->cs.get_instr( cf->IP );
                 printf("\n\nDebug 0x%02X", type );
                 if( type & 0x80 )
                 {
@@ -1158,7 +1525,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
 
             // sync ops ---------------------------------------
 
-        case opcode_general_lock:
+        VM_CASE(main,general_lock)
             LISTI("lock");
             {
                 // This is java monitor, arbitrary object
@@ -1168,7 +1535,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
             }
             break;
 
-        case opcode_general_unlock:
+        VM_CASE(main,general_unlock)
             LISTI("unlock");
             {
                 // This is java monitor, arbitrary object
@@ -1180,7 +1547,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
 
             // int stack ops ---------------------------------------
 
-        case opcode_is_dup:
+        VM_CASE(main,is_dup)
             LISTI("is dup");
             {
                 if(DO_TWICE)
@@ -1195,40 +1562,40 @@ static void do_pvm_exec(pvm_object_t current_thread)
             }
             break;
 
-        case opcode_is_drop:
+        VM_CASE(main,is_drop)
             LISTI("is drop");
             is_pop(); if(DO_TWICE) is_pop();
             break;
 
-        case opcode_iconst_0:
+        VM_CASE(main,iconst_0)
             LISTI("iconst 0");
             is_push(0); if(DO_TWICE) is_push(0);
             break;
 
-        case opcode_iconst_1:
+        VM_CASE(main,iconst_1)
             LISTI("iconst 1");
             is_push(1); if(DO_TWICE) is_push(1);
             break;
 
-        case opcode_iconst_8bit:
+        VM_CASE(main,iconst_8bit)
             {
-                int v = pvm_code_get_byte(&(da->code));
+                int v = VM_ARG_BYTE(0);
                 if(DO_TWICE) ls_push(v);
                 else is_push(v);
                 LISTIA("iconst8 = %d", v);
                 break;
             }
 
-        case opcode_iconst_32bit:
+        VM_CASE(main,iconst_32bit)
             {
-                int v = pvm_code_get_int32(&(da->code));
+                int v = VM_ARG_INT32(0);
                 if(DO_TWICE) ls_push(v);
                 else         is_push(v);
                 LISTIA("iconst32 = %d", v);
                 break;
             }
 
-        case opcode_iconst_64bit:
+        VM_CASE(main,iconst_64bit)
             {
                 int64_t v = pvm_code_get_int64(&(da->code));
                 ls_push(v);
@@ -1236,19 +1603,19 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 break;
             }
 
-        case opcode_const_pool:
+        VM_CASE(main,const_pool)
             {
                 pvm_object_t oc = pvm_get_class( this_object() );
                 struct data_area_4_class *cda = pvm_object_da( oc, class );
 
-                int32_t id = pvm_code_get_int32(&(da->code));
+                int32_t id = VM_ARG_INT32(0);
                 pvm_object_t co = pvm_get_ofield( cda->const_pool, id );
                 os_push(co);
                 LISTIA("const_pool id %d", id);
             }
             break;
 
-        case opcode_cast:
+        VM_CASE(main,cast)
             {
                 pvm_object_t target_class = os_pop();
                 pvm_object_t o = os_pop();
@@ -1261,7 +1628,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
             break;
 
 
-        case opcode_ishl:
+        VM_CASE(main,ishl)
             LISTI("ishl");
             {
                 int val = is_pop();
@@ -1269,7 +1636,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
             }
             break;
 
-        case opcode_ishr:
+        VM_CASE(main,ishr)
             LISTI("ishr");
             {
                 int val = is_pop();
@@ -1277,7 +1644,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
             }
             break;
 
-        case opcode_ushr:
+        VM_CASE(main,ushr)
             LISTI("ushr");
             {
                 unsigned val = is_pop();
@@ -1286,7 +1653,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
             break;
 
 
-        case opcode_isum:
+        VM_CASE(main,isum)
             LISTI("isum");
             {
                 int add = is_pop();
@@ -1295,7 +1662,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
             }
             break;
 
-        case opcode_imul:
+        VM_CASE(main,imul)
             LISTI("imul");
             {
                 int mul = is_pop();
@@ -1304,7 +1671,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
             }
             break;
 
-        case opcode_isubul:
+        VM_CASE(main,isubul)
             LISTI("isubul");
             {
                 int u = is_pop();
@@ -1313,7 +1680,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
             }
             break;
 
-        case opcode_isublu:
+        VM_CASE(main,isublu)
             LISTI("isublu");
             {
                 int u = is_pop();
@@ -1322,7 +1689,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
             }
             break;
 
-        case opcode_idivul:
+        VM_CASE(main,idivul)
             LISTI("idivul");
             {
                 int u = is_pop();
@@ -1331,7 +1698,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
             }
             break;
 
-        case opcode_idivlu:
+        VM_CASE(main,idivlu)
             LISTI("idivlu");
             {
                 int u = is_pop();
@@ -1340,29 +1707,29 @@ static void do_pvm_exec(pvm_object_t current_thread)
             }
             break;
 
-        case opcode_ior:
+        VM_CASE(main,ior)
             LISTI("ior");
             { int operand = is_pop();	is_push( is_pop() | operand ); }
             break;
 
-        case opcode_iand:
+        VM_CASE(main,iand)
             LISTI("iand");
             { int operand = is_pop();	is_push( is_pop() & operand ); }
             break;
 
-        case opcode_ixor:
+        VM_CASE(main,ixor)
             LISTI("ixor");
             { int operand = is_pop();	is_push( is_pop() ^ operand ); }
             break;
 
-        case opcode_inot:
+        VM_CASE(main,inot)
             LISTI("inot");
             { int operand = is_pop();	is_push( ~operand ); }
             break;
 
 
 
-        case opcode_log_or:
+        VM_CASE(main,log_or)
             LISTI("lor");
             {
                 int o1 = is_pop();
@@ -1371,7 +1738,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
             }
             break;
 
-        case opcode_log_and:
+        VM_CASE(main,log_and)
             LISTI("land");
             {
                 int o1 = is_pop();
@@ -1380,7 +1747,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
             }
             break;
 
-        case opcode_log_xor:
+        VM_CASE(main,log_xor)
             LISTI("lxor");
             {
                 int o1 = is_pop() ? 1 : 0;
@@ -1389,7 +1756,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
             }
             break;
 
-        case opcode_log_not:
+        VM_CASE(main,log_not)
             LISTI("lnot");
             {
                 int operand = is_pop();
@@ -1398,36 +1765,36 @@ static void do_pvm_exec(pvm_object_t current_thread)
             break;
 
 
-        case opcode_ige:	// >=
+        VM_CASE(main,ige)	// >=
             LISTI("ige");
             { int operand = is_pop();	is_push( is_pop() >= operand ); }
             break;
-        case opcode_ile:	// <=
+        VM_CASE(main,ile)	// <=
             LISTI("ile");
             { int operand = is_pop();	is_push( is_pop() <= operand ); }
             break;
-        case opcode_igt:	// >
+        VM_CASE(main,igt)	// >
             LISTI("igt");
             { int operand = is_pop();	is_push( is_pop() > operand ); }
             break;
-        case opcode_ilt:	// <
+        VM_CASE(main,ilt)	// <
             LISTI("ilt");
             { int operand = is_pop();	is_push( is_pop() < operand ); }
             break;
 
 
-            case opcode_fromi:
+            VM_CASE(main,fromi)
                 LISTI("i-fromi (nop)");
                 break;
 
-            case opcode_froml:
+            VM_CASE(main,froml)
                 LISTI("i-froml");
                 {
                     is_push( (int) ls_pop() );
                 }
                 break;
 
-            case opcode_fromd:
+            VM_CASE(main,fromd)
                 LISTI("i-fromd");
                 {
                     long l = ls_pop();
@@ -1436,7 +1803,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 break;
 
-            case opcode_fromf:
+            VM_CASE(main,fromf)
                 LISTI("i-fromf");
                 {
                     int i = is_pop();
@@ -1447,12 +1814,12 @@ static void do_pvm_exec(pvm_object_t current_thread)
 
 
 
-        case opcode_i2o:
+        VM_CASE(main,i2o)
             LISTI("i2o");
             os_push(pvm_create_int_object(is_pop()));
             break;
 
-        case opcode_o2i:
+        VM_CASE(main,o2i)
             LISTI("o2i");
             {
                 struct pvm_object o = os_pop();
@@ -1463,7 +1830,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
             break;
 
 
-        case opcode_os_eq:
+        VM_CASE(main,os_eq)
             LISTI("os eq");
             {
                 struct pvm_object o1 = os_pop();
@@ -1474,7 +1841,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 break;
             }
 
-        case opcode_os_neq:
+        VM_CASE(main,os_neq)
             LISTI("os neq");
             {
                 struct pvm_object o1 = os_pop();
@@ -1485,7 +1852,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 break;
             }
 
-        case opcode_os_isnull:
+        VM_CASE(main,os_isnull)
             LISTI("isnull");
             {
                 struct pvm_object o1 = os_pop();
@@ -1504,59 +1871,59 @@ static void do_pvm_exec(pvm_object_t current_thread)
 
             // summoning, special ----------------------------------------------------
 
-        case opcode_summon_null:
+        VM_CASE(main,summon_null)
             LISTI("push null");
             os_push( pvm_get_null_object() ); // so what opcode_os_push_null is for then?
             break;
 
-        case opcode_summon_thread:
+        VM_CASE(main,summon_thread)
             LISTI("summon thread");
             os_push( ref_inc_o( current_thread ) );
             //printf("ERROR: summon thread");
             break;
 
-        case opcode_summon_this:
+        VM_CASE(main,summon_this)
             LISTI("summon this");
             os_push( ref_inc_o( this_object() ) );
             break;
 
-        case opcode_summon_class_class:
+        VM_CASE(main,summon_class_class)
             LISTI("summon class class");
             // it has locked refcount
             os_push( pvm_get_class_class() );
             break;
 
-        case opcode_summon_interface_class:
+        VM_CASE(main,summon_interface_class)
             LISTI("summon interface class");
             // locked refcnt
             os_push( pvm_get_interface_class() );
             break;
 
-        case opcode_summon_code_class:
+        VM_CASE(main,summon_code_class)
             LISTI("summon code class");
         	// locked refcnt
             os_push( pvm_get_code_class() );
             break;
 
-        case opcode_summon_int_class:
+        VM_CASE(main,summon_int_class)
             LISTI("summon int class");
         	// locked refcnt
             os_push( pvm_get_int_class() );
             break;
 
-        case opcode_summon_string_class:
+        VM_CASE(main,summon_string_class)
             LISTI("summon string class");
         	// locked refcnt
             os_push( pvm_get_string_class() );
             break;
 
-        case opcode_summon_array_class:
+        VM_CASE(main,summon_array_class)
             LISTI("summon array class");
         	// locked refcnt
             os_push( pvm_get_array_class() );
             break;
 
-        case opcode_summon_by_name:
+        VM_CASE(main,summon_by_name)
             {
                 LISTI("summon by name");
                 struct pvm_object name = pvm_code_get_string(&(da->code));
@@ -1583,7 +1950,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
              **/
 
 
-        case opcode_new:
+        VM_CASE(main,new)
             LISTI("new");
             {
                 pvm_object_t cl = os_pop();
@@ -1592,7 +1959,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
             }
             break;
 
-        case opcode_copy:
+        VM_CASE(main,copy)
             LISTI("copy");
             {
                 pvm_object_t o = os_pop();
@@ -1626,13 +1993,13 @@ static void do_pvm_exec(pvm_object_t current_thread)
                     struct pvm_object o = pvm_get_ofield( to_decomp, num);
                     os_push( ref_inc_o( o ) );
                 }
-                os_push(to_decomp.data->_class);
+                os_push(pvm_get_class(to_decomp));
             }
             break;
 #endif
             // string ----------------------------------------------------------------
 
-        case opcode_sconst_bin:
+        VM_CASE(main,sconst_bin)
             LISTI("sconst bin");
             os_push(pvm_code_get_string(&(da->code)));
             break;
@@ -1640,41 +2007,133 @@ static void do_pvm_exec(pvm_object_t current_thread)
 
             // flow ------------------------------------------------------------------
 
-        case opcode_jmp:
+        VM_CASE(main,jmp)
             LISTIA("jmp %d", da->code.IP);
-            da->code.IP = pvm_code_get_rel_IP_as_abs(&(da->code));
+            {
+                unsigned int new_IP = VM_ARG_REL_IP(0);
+                VM_JUMP( new_IP );
+            }
             break;
 
 
-        case opcode_djnz:
+        VM_CASE(main,djnz)
             {
-                int new_IP = pvm_code_get_rel_IP_as_abs(&(da->code));
+                int new_IP = VM_ARG_REL_IP(0);
                 //is_top()--;
                 is_push( is_pop() - 1 );
-                if( is_top() ) da->code.IP = new_IP;
+                if( is_top() ) VM_JUMP( new_IP );
 
                 LISTIA("djnz (%d)", is_top() );
                 LISTIA("djnz -> %d", new_IP );
             }
             break;
 
-        case opcode_jz:
+        VM_CASE(main,jz)
             {
-                int new_IP = pvm_code_get_rel_IP_as_abs(&(da->code));
+                int new_IP = VM_ARG_REL_IP(0);
                 int test = is_pop();
-                if( !test ) da->code.IP = new_IP;
+                if( !test ) VM_JUMP( new_IP );
 
                 LISTIA("jz (%d)", test );
                 LISTIA("jz -> %d",  new_IP );
             }
             break;
 
+            // Superinstructions, see code_cache_fuse(). Jump if compare is false.
+
+        VM_CASE(main,ilt_jz)
+            {
+                int new_IP = VM_ARG_REL_IP(0);
+                int operand = is_pop();
+                if( !(is_pop() < operand) ) VM_JUMP( new_IP );
+                LISTIA("ilt jz -> %d",  new_IP );
+            }
+            break;
+
+        VM_CASE(main,ile_jz)
+            {
+                int new_IP = VM_ARG_REL_IP(0);
+                int operand = is_pop();
+                if( !(is_pop() <= operand) ) VM_JUMP( new_IP );
+                LISTIA("ile jz -> %d",  new_IP );
+            }
+            break;
 
-        case opcode_switch:
+        VM_CASE(main,igt_jz)
             {
-                unsigned int tabsize    = pvm_code_get_int32(&(da->code));
-                int shift               = pvm_code_get_int32(&(da->code));
-                unsigned int divisor    = pvm_code_get_int32(&(da->code));
+                int new_IP = VM_ARG_REL_IP(0);
+                int operand = is_pop();
+                if( !(is_pop() > operand) ) VM_JUMP( new_IP );
+                LISTIA("igt jz -> %d",  new_IP );
+            }
+            break;
+
+        VM_CASE(main,ige_jz)
+            {
+                int new_IP = VM_ARG_REL_IP(0);
+                int operand = is_pop();
+                if( !(is_pop() >= operand) ) VM_JUMP( new_IP );
+                LISTIA("ige jz -> %d",  new_IP );
+            }
+            break;
+
+            // Raw operands must be read in order, hence separate statements
+
+        VM_CASE(main,is_get32_iconst_ilt_jz)
+            {
+                int v = pvm_istack_abs_get( da->_istack, VM_ARG_INT32(0) );
+                int operand = VM_ARG_INT32(1);
+                int new_IP = VM_ARG_REL_IP(2);
+                if( !(v < operand) ) VM_JUMP( new_IP );
+                LISTIA("get const ilt jz -> %d",  new_IP );
+            }
+            break;
+
+        VM_CASE(main,is_get32_iconst_ile_jz)
+            {
+                int v = pvm_istack_abs_get( da->_istack, VM_ARG_INT32(0) );
+                int operand = VM_ARG_INT32(1);
+                int new_IP = VM_ARG_REL_IP(2);
+                if( !(v <= operand) ) VM_JUMP( new_IP );
+                LISTIA("get const ile jz -> %d",  new_IP );
+            }
+            break;
+
+        VM_CASE(main,is_get32_iconst_igt_jz)
+            {
+                int v = pvm_istack_abs_get( da->_istack, VM_ARG_INT32(0) );
+                int operand = VM_ARG_INT32(1);
+                int new_IP = VM_ARG_REL_IP(2);
+                if( !(v > operand) ) VM_JUMP( new_IP );
+                LISTIA("get const igt jz -> %d",  new_IP );
+            }
+            break;
+
+        VM_CASE(main,is_get32_iconst_ige_jz)
+            {
+                int v = pvm_istack_abs_get( da->_istack, VM_ARG_INT32(0) );
+                int operand = VM_ARG_INT32(1);
+                int new_IP = VM_ARG_REL_IP(2);
+                if( !(v >= operand) ) VM_JUMP( new_IP );
+                LISTIA("get const ige jz -> %d",  new_IP );
+            }
+            break;
+
+        VM_CASE(main,is_inc32)
+            {
+                unsigned int pos = VM_ARG_INT32(0);
+                int add = VM_ARG_INT32(1);
+                pvm_istack_abs_set( da->_istack, pos, pvm_istack_abs_get( da->_istack, pos ) + add );
+                LISTIA("is inc %d", pos );
+            }
+            break;
+
+
+        VM_CASE(main,switch)
+            {
+                unsigned int tabsize    = VM_RAW_INT32();
+                int shift               = VM_RAW_INT32();
+                unsigned int divisor    = VM_RAW_INT32();
                 int stack_top = is_pop();
 
                 //LISTIA("switch (%d+%d)/%d, ", stack_top, shift, divisor );
@@ -1692,9 +2151,9 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 {
                     da->code.IP = start_table_IP+(displ*4); // TODO BUG! 4!
                     LISTIA("load from %d, ", da->code.IP );
-                    new_IP = pvm_code_get_rel_IP_as_abs(&(da->code));
+                    new_IP = VM_RAW_REL_IP();
                 }
-                da->code.IP = new_IP;
+                VM_JUMP( new_IP );
 
                 //LISTIA("switch(%d) ->%d", displ, new_IP );
                 LISTIA("switch ->%d", new_IP );
@@ -1702,7 +2161,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
             break;
 
 
-        case opcode_ret:
+        VM_CASE(main,ret)
             {
                 if( DEB_CALLRET || debug_print_instr ) printf( "\nret     (stack_depth %d -> ", da->stack_depth );
                 struct pvm_object ret = pvm_object_da( da->call_frame, call_frame )->prev;
@@ -1714,20 +2173,22 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 }
                 pvm_exec_do_return(da);
                 if( DEB_CALLRET || debug_print_instr ) printf( "%d)", da->stack_depth );
+                VM_SAFEPOINT();
             }
             break;
 
             // exceptions are like ret ---------------------------------------------------
 
-        case opcode_throw:
+        VM_CASE(main,throw)
             if( DEB_CALLRET || debug_print_instr ) printf( "\nthrow     (stack_depth %d -> ", da->stack_depth );
             pvm_exec_do_throw(da);
             if( DEB_CALLRET || debug_print_instr ) printf( "%d)", da->stack_depth );
+            VM_SAFEPOINT();
             break;
 
-        case opcode_push_catcher:
+        VM_CASE(main,push_catcher)
             {
-                unsigned addr = pvm_code_get_rel_IP_as_abs(&(da->code));
+                unsigned addr = VM_ARG_REL_IP(0);
                 LISTIA("push catcher %u", addr );
                 //cf->push_catcher( addr, os_pop() );
                 //call_frame.estack().push(exception_handler(os_pop(),addr));
@@ -1743,7 +2204,7 @@ static void do_pvm_exec(pvm_object_t current_thread)
             }
             break;
 
-        case opcode_pop_catcher:
+        VM_CASE(main,pop_catcher)
             LISTI("pop catcher");
             //cf->pop_catcher();
             //call_frame.estack().pop();
@@ -1753,28 +2214,30 @@ static void do_pvm_exec(pvm_object_t current_thread)
             // ok, now method calls ------------------------------------------------------
 
             // these 4 are parameter-less calls!
-        case opcode_short_call_0:           pvm_exec_call(da,0,0,1,pvm_get_null_object());   break;
-        case opcode_short_call_1:           pvm_exec_call(da,1,0,1,pvm_get_null_object());   break;
-        case opcode_short_call_2:           pvm_exec_call(da,2,0,1,pvm_get_null_object());   break;
-        case opcode_short_call_3:           pvm_exec_call(da,3,0,1,pvm_get_null_object());   break;
+        VM_CASE(main,short_call_0)           pvm_exec_call(da,0,0,1,pvm_get_null_object(),VM_IC);   VM_SAFEPOINT(); break;
+        VM_CASE(main,short_call_1)           pvm_exec_call(da,1,0,1,pvm_get_null_object(),VM_IC);   VM_SAFEPOINT(); break;
+        VM_CASE(main,short_call_2)           pvm_exec_call(da,2,0,1,pvm_get_null_object(),VM_IC);   VM_SAFEPOINT(); break;
+        VM_CASE(main,short_call_3)           pvm_exec_call(da,3,0,1,pvm_get_null_object(),VM_IC);   VM_SAFEPOINT(); break;
 
-        case opcode_call_8bit:
+        VM_CASE(main,call_8bit)
             {
-                unsigned int method_index = pvm_code_get_byte(&(da->code));
-                unsigned int n_param = pvm_code_get_int32(&(da->code));
-                pvm_exec_call(da,method_index,n_param,1,pvm_get_null_object());
+                unsigned int method_index = VM_ARG_BYTE(0);
+                unsigned int n_param = VM_ARG_INT32(1);
+                pvm_exec_call(da,method_index,n_param,1,pvm_get_null_object(),VM_IC);
+                VM_SAFEPOINT();
             }
             break;
-        case opcode_call_32bit:
+        VM_CASE(main,call_32bit)
             {
-                unsigned int method_index = pvm_code_get_int32(&(da->code));
-                unsigned int n_param = pvm_code_get_int32(&(da->code));
-                pvm_exec_call(da,method_index,n_param,1,pvm_get_null_object());
+                unsigned int method_index = VM_ARG_INT32(0);
+                unsigned int n_param = VM_ARG_INT32(1);
+                pvm_exec_call(da,method_index,n_param,1,pvm_get_null_object(),VM_IC);
+                VM_SAFEPOINT();
             }
             break;
 
 
-        case opcode_dynamic_invoke:
+        VM_CASE(main,dynamic_invoke)
             {
                 dynamic_method_info_t mi;
 
@@ -1805,29 +2268,31 @@ static void do_pvm_exec(pvm_object_t current_thread)
                 printf("\n" );
 #endif // DEB_DYNCALL
 
-                if( find_dynamic_method( &mi ) )
+                if( find_dynamic_method( &mi, VM_IC ) )
                     pvm_exec_panic("dynamic invoke failed");
 
-                pvm_exec_call(da,mi.method_ordinal,mi.n_param,1,mi.new_this);
+                pvm_exec_call(da,mi.method_ordinal,mi.n_param,1,mi.new_this,0);
+                VM_SAFEPOINT();
             }
             break;
 
-        case opcode_static_invoke:
+        VM_CASE(main,static_invoke)
             {
-                unsigned int method_ordinal = pvm_code_get_int32(&(da->code));
-                unsigned int n_param = pvm_code_get_int32(&(da->code));
+                unsigned int method_ordinal = VM_ARG_INT32(0);
+                unsigned int n_param = VM_ARG_INT32(1);
 
                 pvm_object_t class_ref = os_pop();
                 pvm_object_t new_this = os_pop();
 
                 // Now there are just parameters on object stack
                 pvm_exec_static_call(da,method_ordinal,n_param,class_ref,new_this);
+                VM_SAFEPOINT();
             }
             break;
 
             // object stack --------------------------------------------------------------
 
-        case opcode_os_dup:
+        VM_CASE(main,os_dup)
             LISTI("os dup");
             {
                 pvm_object_t o = os_top();
@@ -1835,35 +2300,35 @@ static void do_pvm_exec(pvm_object_t current_thread)
             }
             break;
 
-        case opcode_os_drop:
+        VM_CASE(main,os_drop)
             LISTI("os drop");
             ref_dec_o( os_pop() );
             break;
 
-        case opcode_os_pull32:
+        VM_CASE(main,os_pull32)
             LISTI("os pull");
             {
-                pvm_object_t o = os_pull(pvm_code_get_int32(&(da->code)));
+                pvm_object_t o = os_pull(VM_ARG_INT32(0));
                 os_push( ref_inc_o( o ) );
             }
             break;
 
-        case opcode_os_load8:       pvm_exec_load(da, pvm_code_get_byte(&(da->code)));	break;
-        case opcode_os_load32:      pvm_exec_load(da, pvm_code_get_int32(&(da->code)));	break;
+        VM_CASE(main,os_load8)       pvm_exec_load(da, VM_ARG_BYTE(0));	break;
+        VM_CASE(main,os_load32)      pvm_exec_load(da, VM_ARG_INT32(0));	break;
 
-        case opcode_os_save8:       pvm_exec_save(da, pvm_code_get_byte(&(da->code)));	break;
-        case opcode_os_save32:      pvm_exec_save(da, pvm_code_get_int32(&(da->code)));	break;
+        VM_CASE(main,os_save8)       pvm_exec_save(da, VM_ARG_BYTE(0));	break;
+        VM_CASE(main,os_save32)      pvm_exec_save(da, VM_ARG_INT32(0));	break;
 
-        case opcode_is_load8:       pvm_exec_iload(da, pvm_code_get_byte(&(da->code)));	break;
-        case opcode_is_save8:       pvm_exec_isave(da, pvm_code_get_byte(&(da->code)));	break;
+        VM_CASE(main,is_load8)       pvm_exec_iload(da, VM_ARG_BYTE(0));	break;
+        VM_CASE(main,is_save8)       pvm_exec_isave(da, VM_ARG_BYTE(0));	break;
 
-        case opcode_os_get32:        pvm_exec_get(da, pvm_code_get_int32(&(da->code)));	break;
-        case opcode_os_set32:        pvm_exec_set(da, pvm_code_get_int32(&(da->code)));	break;
+        VM_CASE(main,os_get32)        pvm_exec_get(da, VM_ARG_INT32(0));	break;
+        VM_CASE(main,os_set32)        pvm_exec_set(da, VM_ARG_INT32(0));	break;
 
-        case opcode_is_get32:        pvm_exec_iget(da, pvm_code_get_int32(&(da->code)));	break;
-        case opcode_is_set32:        pvm_exec_iset(da, pvm_code_get_int32(&(da->code)));	break;
+        VM_CASE(main,is_get32)        pvm_exec_iget(da, VM_ARG_INT32(0));	break;
+        VM_CASE(main,is_set32)        pvm_exec_iset(da, VM_ARG_INT32(0));	break;
 
-        default:
+        VM_DEFAULT(main)
             if( (instruction & 0xF0 ) == opcode_sys_0 )
             {
                 pvm_exec_sys(da,instruction & 0x0F);
@@ -1879,20 +2344,22 @@ static void do_pvm_exec(pvm_object_t current_thread)
                     phantom_thread_sleep_worker( da );
                 }
 #endif
+                VM_SAFEPOINT();
                 break;
             }
 
             if( instruction  == opcode_sys_8bit )
             {
-                pvm_exec_sys(da,pvm_code_get_byte(&(da->code))); //cf->cs.get_byte( cf->IP ));
+                pvm_exec_sys(da,VM_ARG_BYTE(0)); //cf->cs.get_byte( cf->IP ));
                 goto sys_sleep;
                 //break;
             }
 
             if( (instruction & 0xE0 ) == opcode_call_00 )
             {
-                unsigned n_param = pvm_code_get_byte(&(da->code));
-                pvm_exec_call(da,instruction & 0x1F,n_param,0,pvm_get_null_object()); //no optimization for soon return
+                unsigned n_param = VM_ARG_BYTE(0);
+                pvm_exec_call(da,instruction & 0x1F,n_param,0,pvm_get_null_object(),VM_IC); //no optimization for soon return
+                VM_SAFEPOINT();
                 break;
             }
 
@@ -2087,6 +2554,37 @@ struct pvm_object_storage * pvm_exec_find_method( struct pvm_object o, unsigned
 }
 
 
+/*
+ *
+ * Same as pvm_exec_find_method, but looks into call site cache first
+ *
+ */
+
+static struct pvm_object_storage * pvm_exec_find_method_ic( struct pvm_object o, unsigned int method_index, struct pvm_inline_cache *ic )
+{
+    // Let pvm_exec_find_method panic on broken objects
+    if( (ic == 0) || (o.data == 0) )
+        return pvm_exec_find_method( o, method_index );
+
+    struct pvm_object_storage *iface = o.interface;
+    if( iface == 0 )
+    {
+        if( o.data->_class.data == 0 )
+            return pvm_exec_find_method( o, method_index );
+        iface = pvm_object_da( o.data->_class, class )->object_default_interface.data;
+    }
+
+    struct pvm_object_storage *code = pvm_ic_get_code( ic, iface );
+    if( code )
+        return code;
+
+    code = pvm_exec_find_method( o, method_index );
+    pvm_ic_put_code( ic, iface, code );
+
+    return code;
+}
+
+
 
 static int catch_comparator( void *backptr, struct pvm_exception_handler *test )
 {
@@ -2121,6 +2619,103 @@ static int pvm_exec_find_catch(
 }
 
 
+#if VM_HANDLER_TABLES
+
+/**
+ *
+ * Frame keeps just code bytes, so handler table is found by code
+ * object: class of this or its ancestor has it as method code. It
+ * is not always the class of this - method could be inherited or
+ * called statically.
+ *
+**/
+
+static pvm_object_t pvm_exec_get_handler_table( struct data_area_4_call_frame *cfda )
+{
+    if( cfda->code == 0 || pvm_is_null( cfda->this_object ) )
+        return pvm_get_null_object();
+
+    struct pvm_object_storage *code = pvm_code_storage( cfda->code );
+    struct pvm_object_storage *nullc = pvm_get_null_class().data;
+    unsigned int ordinal = cfda->ordinal;
+    pvm_object_t c = pvm_get_class( cfda->this_object );
+
+    while( !pvm_is_null( c ) && c.data != nullc &&
+           pvm_object_class_exactly_is( c, pvm_get_class_class() ) )
+    {
+        struct data_area_4_class *cda = pvm_object_da( c, class );
+        struct pvm_object_storage *iface = cda->object_default_interface.data;
+
+        if( iface && ordinal < da_po_limit( iface ) &&
+            da_po_ptr( iface->da )[ordinal].data == code &&
+            PVM_CLASS_HAS_FIELD( c.data, handler_tables ) &&
+            !pvm_is_null( cda->handler_tables ) &&
+            ordinal < (unsigned)get_array_size( cda->handler_tables.data ) )
+        {
+            pvm_object_t table = pvm_get_array_ofield( cda->handler_tables.data, ordinal );
+            if( !pvm_is_null( table ) )
+                return table;
+        }
+
+        // Inherited method has code, but no table in child
+        c = cda->class_parent;
+    }
+
+    return pvm_get_null_object();
+}
+
+static int pvm_exec_find_table_catch(
+                               struct data_area_4_thread *da,
+                               unsigned int *jump_to,
+                               struct pvm_object thrown_obj )
+{
+    struct data_area_4_call_frame *cfda = pvm_object_da( da->call_frame, call_frame );
+    pvm_object_t table = pvm_exec_get_handler_table( cfda );
+
+    if( pvm_is_null( table ) )
+        return 0;
+
+    pvm_object_t bin = pvm_get_array_ofield( table.data, 0 );
+    struct data_area_4_binary *bda = pvm_object_da( bin, binary );
+    const struct vm_code_catch *ct = (const void *)bda->data;
+    unsigned int ip = da->code.IP;
+
+    // Number of entries with start < ip
+    int lo = 0, hi = bda->data_size / sizeof(struct vm_code_catch);
+    while( lo < hi )
+    {
+        int mid = (lo + hi) / 2;
+        if( ct[mid].start < ip )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    // Later start is a nested range, so innermost one is met first
+    while( --lo >= 0 )
+    {
+        if( ip > ct[lo].end )
+            continue;
+
+        pvm_object_t cl = pvm_exec_lookup_class_by_name( pvm_get_array_ofield( table.data, ct[lo].name ) );
+
+        int match = !pvm_is_null( cl ) && pvm_object_class_is_or_child( thrown_obj, cl );
+        ref_dec_o( cl ); // lookup returns a reference
+
+        if( match )
+        {
+            LISTIA("table catch %u", ct[lo].handler );
+            *jump_to = ct[lo].handler;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+#endif // VM_HANDLER_TABLES
+
+
 
 
 // Todo it's a call_frame method!
@@ -2208,7 +2803,7 @@ pvm_exec_run_method(
 }
 
 // Find a method for a dynamic invoke
-static errno_t find_dynamic_method( dynamic_method_info_t *mi )
+static errno_t find_dynamic_method( dynamic_method_info_t *mi, struct pvm_inline_cache *ic )
 {
     //int is_global = 0;
     if( pvm_is_null( mi->new_this ) )
@@ -2224,7 +2819,26 @@ static errno_t find_dynamic_method( dynamic_method_info_t *mi )
         return ENOENT;
 
 
-    int ord = pvm_get_method_ordinal( mi->target_class, mi->method_name );
+    // Cache is keyed by name contents, so it must be a string
+    if( ic && ( pvm_is_null( mi->method_name ) ||
+                !pvm_object_class_exactly_is( mi->method_name, pvm_get_string_class() ) ) )
+        ic = 0;
+
+    int ord = -1;
+
+    if( ic )
+        ord = pvm_ic_get_ordinal( ic, mi->target_class.data,
+                                  pvm_get_str_data(mi->method_name), pvm_get_str_len(mi->method_name) );
+
+    if( ord < 0 )
+    {
+        ord = pvm_get_method_ordinal( mi->target_class, mi->method_name );
+
+        if( ic && ord >= 0 )
+            pvm_ic_put_ordinal( ic, mi->target_class.data,
+                                pvm_get_str_data(mi->method_name), pvm_get_str_len(mi->method_name), ord );
+    }
+
     if( ord < 0 )
     {
         printf("dyn method not found '");
@@ -31,6 +31,16 @@
 #define DEBUG_PRINT1(a,b)  if (debug_allocation) printf(a,b)
 
 
+#if VM_SMP
+// Other CPUs change the same counters at once
+#  define REF_INC(p)            ATOMIC_ADD_AND_FETCH( &((p)->_ah.refCount), 1 )
+#  define REF_DEC_FETCH(p)      ATOMIC_ADD_AND_FETCH( &((p)->_ah.refCount), -1 )
+#else
+#  define REF_INC(p)            ((p)->_ah.refCount++)
+#  define REF_DEC_FETCH(p)      (--((p)->_ah.refCount))
+#endif
+
+
 
 
 // -----------------------------------------------------------------------
@@ -39,10 +49,12 @@
 // TODO: not implemented,
 // Need persistent cycles_root_buffer not collected by usual gc/refcount - new internal object type?
 
+#if !VM_SMP
 static void cycle_root_buffer_add_candidate(pvm_object_storage_t *p)
 {
     (void)p;
 }
+#endif
 static void cycle_root_buffer_rm_candidate(pvm_object_storage_t *p)
 {
     (void)p;
@@ -155,7 +167,7 @@ static int free_unmarked()
             freed++;
             debug_catch_object("gc", p);
             p->_ah.refCount = 0;  // free now
-            p->_ah.alloc_flags = PVM_OBJECT_AH_ALLOCATOR_FLAG_FREE; // free now
+            pvm_alloc_free( p ); // free now
         }
     }
     return freed;
@@ -184,6 +196,9 @@ static void mark_tree_o(pvm_object_t o, void *arg)
     if(o.data == 0) // Don't try to process null objects
         return;
 
+    if(pvm_is_immediate(o)) // Immediate int, nothing to mark
+        return;
+
     if (o.data->_ah.gc_flags != gc_flags_last_generation)  mark_tree( o.data );
     if (o.interface->_ah.gc_flags != gc_flags_last_generation)  mark_tree( o.interface );
 }
@@ -246,7 +261,7 @@ void refzero_process_children( pvm_object_storage_t *p )
     if ( p->_ah.alloc_flags & PVM_OBJECT_AH_ALLOCATOR_FLAG_IN_BUFFER )
         cycle_root_buffer_rm_candidate( p );
 
-    p->_ah.alloc_flags = PVM_OBJECT_AH_ALLOCATOR_FLAG_FREE;
+    pvm_alloc_free( p );
 
     debug_catch_object("del", p);
     DEBUG_PRINT("x");
@@ -360,7 +375,7 @@ static void gc_clear_weakrefs(pvm_object_storage_t *p);
 //static inline
 void do_ref_dec_p(pvm_object_storage_t *p)
 {
-    if( p == 0 ) return;
+    if( p == 0 || pvm_is_immediate_p(p) ) return;
     debug_catch_object("--", p);
 
     assert( p->_ah.object_start_marker == PVM_OBJECT_START_MARKER );
@@ -376,7 +391,7 @@ void do_ref_dec_p(pvm_object_storage_t *p)
 
     if(p->_ah.refCount < INT_MAX) // Do we really need this check? Sure, we see many decrements for saturated objects!
     {
-        if( 0 == ( --(p->_ah.refCount) ) )
+        if( 0 == REF_DEC_FETCH(p) )
         {
             if( p->_flags & PHANTOM_OBJECT_STORAGE_FLAG_HAS_WEAKREF )
             {
@@ -402,10 +417,10 @@ void do_ref_dec_p(pvm_object_storage_t *p)
                     if (func != 0) func(p);
                 }
 
-                p->_ah.alloc_flags = PVM_OBJECT_AH_ALLOCATOR_FLAG_FREE;
                 debug_catch_object("del", p);
                 DEBUG_PRINT("-");
                 pvm_collapse_free(p); 
+                pvm_alloc_free(p);
             } else
                 ref_dec_proccess_zero(p);
         STAT_INC_CNT( OBJECT_FREE );
@@ -415,6 +430,9 @@ void do_ref_dec_p(pvm_object_storage_t *p)
         else
         {
         nonzero:;
+#if !VM_SMP
+            // Cycles are not collected yet, and this flags byte can't be
+            // changed here on SMP - other CPU could free object just now
             if ( !(p->_flags & PHANTOM_OBJECT_STORAGE_FLAG_IS_INTERNAL) )
             {
                 if ( !(p->_ah.alloc_flags & PVM_OBJECT_AH_ALLOCATOR_FLAG_IN_BUFFER) )
@@ -424,6 +442,7 @@ void do_ref_dec_p(pvm_object_storage_t *p)
                 }
                 p->_ah.alloc_flags |= PVM_OBJECT_AH_ALLOCATOR_FLAG_WENT_DOWN ;  // set down flag
             }
+#endif
         }
     //nokill:;
     }
@@ -431,6 +450,7 @@ void do_ref_dec_p(pvm_object_storage_t *p)
 
 void ref_dec_p(pvm_object_storage_t *p)
 {
+    if( pvm_is_immediate_p(p) ) return;
 #if VM_DEFERRED_REFDEC
     deferred_refdec(p);
 #else
@@ -443,7 +463,7 @@ void ref_dec_p(pvm_object_storage_t *p)
 //static inline
 void ref_inc_p(pvm_object_storage_t *p)
 {
-    if( p == 0 ) return;
+    if( p == 0 || pvm_is_immediate_p(p) ) return;
     debug_catch_object("++", p);
 
     assert( p->_ah.object_start_marker == PVM_OBJECT_START_MARKER );
@@ -457,10 +477,12 @@ void ref_inc_p(pvm_object_storage_t *p)
 
     if( p->_ah.refCount < INT_MAX )
     {
-        (p->_ah.refCount)++;
+        REF_INC(p);
 
+#if !VM_SMP
         if ( p->_ah.alloc_flags & PVM_OBJECT_AH_ALLOCATOR_FLAG_IN_BUFFER )
             p->_ah.alloc_flags &= ~PVM_OBJECT_AH_ALLOCATOR_FLAG_WENT_DOWN ;  //clear down flag
+#endif
     }
 }
 
@@ -492,7 +514,7 @@ void ref_saturate_p(pvm_object_storage_t *p)
 //external calls:
 void ref_saturate_o(pvm_object_t o)
 {
-    if(!(o.data)) return;
+    if(!(o.data) || pvm_is_immediate(o)) return;
     ref_saturate_p(o.data);
 }
 void ref_dec_o(pvm_object_t o)
@@ -0,0 +1,140 @@
+/**
+ *
+ * Phantom OS
+ *
+ * Copyright (C) 2005-2016 Dmitry Zavalishin, dz@dz.ru
+ *
+ * JIT codegen - ia32 part
+ *
+ * Entry is cdecl ( da, native start ). Frame is: saved EBX and 24 bytes
+ * of outgoing helper args area, so that ESP is 16 bytes aligned on each
+ * helper call.
+ *
+**/
+
+#if defined(__i386__)
+
+#include <phantom_assert.h>
+#include <phantom_types.h>
+
+#include "vm/internal_da.h"
+
+#include <kernel/snap_sync.h>
+
+#include "jit.h"
+
+
+#define IP_OFFSET (__offsetof(struct data_area_4_thread, code) + __offsetof(struct pvm_code_handler, IP))
+
+#define FRAME_SIZE 24
+
+
+void jit_gen_prologue( jit_out_t *j )
+{
+    jit_put_byte( j, 0x53 );                            // push ebx
+    jit_put_byte( j, 0x8B ); jit_put_byte( j, 0x5C );   // mov ebx, [esp+8]
+    jit_put_byte( j, 0x24 ); jit_put_byte( j, 0x08 );
+    jit_put_byte( j, 0x8B ); jit_put_byte( j, 0x44 );   // mov eax, [esp+12]
+    jit_put_byte( j, 0x24 ); jit_put_byte( j, 0x0C );
+    jit_put_byte( j, 0x83 ); jit_put_byte( j, 0xEC );   // sub esp, FRAME_SIZE
+    jit_put_byte( j, FRAME_SIZE );
+    jit_put_byte( j, 0xFF ); jit_put_byte( j, 0xE0 );   // jmp eax
+}
+
+void jit_gen_set_ip( jit_out_t *j, unsigned int ip )
+{
+    jit_put_byte( j, 0xC7 ); jit_put_byte( j, 0x83 );   // mov dword [ebx+disp32], imm32
+    jit_put_int32( j, IP_OFFSET );
+    jit_put_int32( j, ip );
+}
+
+void jit_gen_leave( jit_out_t *j )
+{
+    jit_put_byte( j, 0x83 ); jit_put_byte( j, 0xC4 );   // add esp, FRAME_SIZE
+    jit_put_byte( j, FRAME_SIZE );
+    jit_put_byte( j, 0x5B );                            // pop ebx
+    jit_put_byte( j, 0xC3 );                            // ret
+}
+
+void jit_gen_exit( jit_out_t *j, unsigned int ip )
+{
+    jit_gen_set_ip( j, ip );
+    jit_gen_leave( j );
+}
+
+void jit_gen_call_helper( jit_out_t *j, void *func, int a1, int a2 )
+{
+    jit_put_byte( j, 0x89 ); jit_put_byte( j, 0x1C );   // mov [esp], ebx
+    jit_put_byte( j, 0x24 );
+
+    jit_put_byte( j, 0xC7 ); jit_put_byte( j, 0x44 );   // mov dword [esp+4], a1
+    jit_put_byte( j, 0x24 ); jit_put_byte( j, 0x04 );
+    jit_put_int32( j, a1 );
+
+    jit_put_byte( j, 0xC7 ); jit_put_byte( j, 0x44 );   // mov dword [esp+8], a2
+    jit_put_byte( j, 0x24 ); jit_put_byte( j, 0x08 );
+    jit_put_int32( j, a2 );
+
+    jit_put_byte( j, 0xB8 );                            // mov eax, func
+    jit_put_int32( j, (addr_t)func );
+    jit_put_byte( j, 0xFF ); jit_put_byte( j, 0xD0 );   // call eax
+}
+
+
+static void jit_gen_rel32( jit_out_t *j, unsigned int target_ip )
+{
+    jit_add_fixup( j, jit_get_pos( j ), target_ip );
+    jit_put_int32( j, 0 );
+}
+
+void jit_gen_jmp( jit_out_t *j, unsigned int target_ip )
+{
+    jit_put_byte( j, 0xE9 );                            // jmp rel32
+    jit_gen_rel32( j, target_ip );
+}
+
+void jit_gen_jz( jit_out_t *j, unsigned int target_ip )
+{
+    jit_put_byte( j, 0x85 ); jit_put_byte( j, 0xC0 );   // test eax, eax
+    jit_put_byte( j, 0x0F ); jit_put_byte( j, 0x84 );   // jz rel32
+    jit_gen_rel32( j, target_ip );
+}
+
+void jit_gen_jnz( jit_out_t *j, unsigned int target_ip )
+{
+    jit_put_byte( j, 0x85 ); jit_put_byte( j, 0xC0 );   // test eax, eax
+    jit_put_byte( j, 0x0F ); jit_put_byte( j, 0x85 );   // jnz rel32
+    jit_gen_rel32( j, target_ip );
+}
+
+
+void jit_gen_check_snap_request( jit_out_t *j, unsigned int ip, void *helper )
+{
+#if NEW_SNAP_SYNC
+    jit_gen_set_ip( j, ip );
+    jit_gen_call_helper( j, helper, 0, 0 );
+#else
+    jit_put_byte( j, 0x83 ); jit_put_byte( j, 0x3D );   // cmp dword [abs32], 0
+    jit_put_int32( j, (addr_t)&phantom_virtual_machine_snap_request );
+    jit_put_byte( j, 0x00 );
+
+    jit_put_byte( j, 0x0F ); jit_put_byte( j, 0x84 );   // jz skip
+    unsigned int skip = jit_get_pos( j );
+    jit_put_int32( j, 0 );
+
+    jit_gen_set_ip( j, ip );
+    jit_gen_call_helper( j, helper, 0, 0 );
+
+    jit_gen_resolve( j, skip, jit_get_pos( j ) );
+#endif
+}
+
+
+void jit_gen_resolve( jit_out_t *j, unsigned int pos, unsigned int native_offset )
+{
+    // rel32 is counted from the end of instruction, which is rel32 itself
+    jit_patch_int32( j, pos, native_offset - (pos + 4) );
+}
+
+
+#endif // __i386__
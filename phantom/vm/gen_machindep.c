@@ -36,18 +36,145 @@
 
 #include "jit.h"
 
-int jit_init_unit( jit_out_t *j )
+int jit_init_unit( jit_out_t *j, unsigned int code_size )
 {
-    /*
-    j->nextLabel = 0;
     j->buf = 0;
     j->bufp = 0;
     j->bufsize = 0;
-    */
+
+    j->fixups = 0;
+    j->nfixups = 0;
+    j->fixups_size = 0;
+
+    j->code_size = code_size;
+    j->bc2n = calloc( code_size ? code_size : 1, sizeof(u_int32_t) );
+    if( 0 == j->bc2n ) return ENOMEM;
 
     return 0;
 }
 
+void jit_release_unit( jit_out_t *j )
+{
+    if( j->buf ) free( j->buf );
+    if( j->fixups ) free( j->fixups );
+    if( j->bc2n ) free( j->bc2n );
+
+    j->buf = j->bufp = 0;
+    j->fixups = 0;
+    j->bc2n = 0;
+}
+
+
+// --------------------------------------------------------------------------
+// Code buffer
+// --------------------------------------------------------------------------
+
+static void jit_checkbuf( jit_out_t *j, int size )
+{
+    if( j->buf == 0 )
+    {
+        j->bufsize = PAGE_SIZE;
+
+        while( j->bufsize < size )
+            j->bufsize += PAGE_SIZE;
+
+        j->buf = calloc( 1, j->bufsize );
+        j->bufp = j->buf;
+
+        assert(j->buf);
+
+        return;
+    }
+
+    int used = j->bufp - j->buf;
+
+    if( j->bufsize - used > size )
+        return;
+
+    int oldsize = j->bufsize;
+
+    while( j->bufsize - used <= size )
+        j->bufsize += PAGE_SIZE;
+
+    unsigned char *newb = calloc( 1, j->bufsize );
+    assert(newb);
+
+    memmove( newb, j->buf, oldsize );
+    free( j->buf );
+
+    j->buf = newb;
+    j->bufp = newb + used;
+}
+
+
+unsigned int jit_get_pos( jit_out_t *j )
+{
+    return j->bufp - j->buf;
+}
+
+void jit_put_byte( jit_out_t *j, unsigned char b )
+{
+    jit_checkbuf( j, 1 );
+    *j->bufp++ = b;
+}
+
+// Native byte order, little endian on all we support now
+void jit_put_int32( jit_out_t *j, u_int32_t v )
+{
+    jit_checkbuf( j, sizeof(v) );
+    memcpy( j->bufp, &v, sizeof(v) );
+    j->bufp += sizeof(v);
+}
+
+void jit_put_int64( jit_out_t *j, u_int64_t v )
+{
+    jit_checkbuf( j, sizeof(v) );
+    memcpy( j->bufp, &v, sizeof(v) );
+    j->bufp += sizeof(v);
+}
+
+void jit_patch_int32( jit_out_t *j, unsigned int pos, u_int32_t v )
+{
+    assert( pos + sizeof(v) <= jit_get_pos( j ) );
+    memcpy( j->buf + pos, &v, sizeof(v) );
+}
+
+
+// --------------------------------------------------------------------------
+// Labels
+// --------------------------------------------------------------------------
+
+void jit_add_fixup( jit_out_t *j, unsigned int pos, unsigned int target_ip )
+{
+    if( j->nfixups >= j->fixups_size )
+    {
+        j->fixups_size = j->fixups_size ? j->fixups_size * 2 : 32;
+
+        struct jit_fixup *nf = calloc( j->fixups_size, sizeof(struct jit_fixup) );
+        assert( nf );
+
+        if( j->fixups )
+        {
+            memmove( nf, j->fixups, j->nfixups * sizeof(struct jit_fixup) );
+            free( j->fixups );
+        }
+        j->fixups = nf;
+    }
+
+    j->fixups[j->nfixups].pos = pos;
+    j->fixups[j->nfixups].target_ip = target_ip;
+    j->nfixups++;
+}
+
+void jit_mark_possible_label( jit_out_t *j, unsigned int ip, int can_enter )
+{
+    assert( ip < j->code_size );
+
+    u_int32_t e = jit_get_pos( j ) + 1;
+    if( !can_enter ) e |= JIT_NOT_ENTRY;
+
+    j->bc2n[ip] = e;
+}
 
 
 
@@ -64,7 +191,9 @@ ft_entry_t jit_kernel_func_table[JIT_FUNC_TABLE_SIZE];
 void jit_kernel_func_table_init()
 {
     _SF_( JIT_F_LOAD_F_ACC, 		pvm_exec_load_fast_acc );
+#if OLD_VM_SLEEP
     _SF_( JIT_F_THREAD_SLEEP_WORKER,    phantom_thread_sleep_worker );
+#endif
     _SF_( JIT_F_WAIT_SNAP, 		phantom_thread_wait_4_snap );
     _SF_( JIT_F_CODE_GET_BYTE, 		pvm_code_get_byte );
     _SF_( JIT_F_CREATE_OBJ, 		pvm_create_object );
@@ -90,4 +219,3 @@ void jit_init(void)
     // TODO mem map JITted code as executable
 }
 
-
@@ -159,6 +159,15 @@
 #define opcode_call_1E   0xBE 
 #define opcode_call_1F   0xBF 
 // c0-cf
+#define opcode_ilt_jz   0xC0 // superinstructions: compare and jump if false, rel32
+#define opcode_ile_jz   0xC1 
+#define opcode_igt_jz   0xC2 
+#define opcode_ige_jz   0xC3 
+#define opcode_is_get32_iconst_ilt_jz   0xC4 // is_get32 slot; iconst const; cmp; jz rel32
+#define opcode_is_get32_iconst_ile_jz   0xC5 
+#define opcode_is_get32_iconst_igt_jz   0xC6 
+#define opcode_is_get32_iconst_ige_jz   0xC7 
+#define opcode_is_inc32   0xC8 // int stack slot += const, is_get32; iconst; isum; is_dup; is_set32; is_drop
 // d0-df
 // e0-ef
 // f0-ff
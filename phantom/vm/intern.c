@@ -0,0 +1,146 @@
+/**
+ *
+ * Phantom OS
+ *
+ * Copyright (C) 2005-2016 Dmitry Zavalishin, dz@dz.ru
+ *
+ * Intern table for class, method and field names.
+ *
+ * Class loader replaces names with strings from this table. There is
+ * just one interned string for given contents, it is marked with
+ * IS_INTERNED flag, so two interned names are equal only if it is the
+ * same object - see pvm_string_equals().
+ *
+ * Table is persistent: array of buckets, bucket is an array of strings
+ * with the same hash modulo bucket count. Strings are never removed.
+ *
+**/
+
+#define DEBUG_MSG_PREFIX "vm.intern"
+#include <debug_ext.h>
+#define debug_level_flow 6
+#define debug_level_error 10
+#define debug_level_info 10
+
+#include <phantom_libc.h>
+#include <kernel/init.h>
+#include <kernel/debug.h>
+#include <kernel/mutex.h>
+
+#include <vm/root.h>
+#include <vm/object.h>
+#include <vm/object_flags.h>
+#include <vm/internal_da.h>
+#include <vm/alloc.h>
+#include <vm/p2c.h>
+
+
+#define INTERN_BUCKETS          1024
+
+
+static hal_mutex_t              intern_mutex;
+
+static void dbg_intern_stats( int ac, char **av );
+
+static void pvm_intern_init(void)
+{
+    hal_mutex_init( &intern_mutex, "Intern" );
+    dbg_add_command( dbg_intern_stats, "intern", "intern - show names intern table stats");
+}
+
+INIT_ME( 0, pvm_intern_init, 0 )
+
+
+//! Called on a fresh system and on restart of an image which has no table
+pvm_object_t pvm_create_intern_table(void)
+{
+    pvm_object_t table = pvm_create_array_object();
+    // Make all buckets (nulls)
+    pvm_set_array_ofield( table.data, INTERN_BUCKETS-1, pvm_get_null_object() );
+    return table;
+}
+
+
+pvm_object_t pvm_intern_string( pvm_object_t s )
+{
+#if VM_INTERN_NAMES
+    pvm_object_t table = pvm_root.intern_table;
+
+    if( pvm_is_null( table ) || !IS_PHANTOM_STRING( s ) )
+        return s;
+
+    if( s.data->_flags & PHANTOM_OBJECT_STORAGE_FLAG_IS_INTERNED )
+        return s;
+
+    // Bucket count is taken from table, it could be made by other kernel
+    int nbuckets = get_array_size( table.data );
+    int pos = pvm_string_hash( s ) % nbuckets;
+
+    hal_mutex_lock( &intern_mutex );
+
+    pvm_object_t bucket = pvm_get_array_ofield( table.data, pos );
+    if( pvm_is_null( bucket ) )
+    {
+        bucket = pvm_create_array_object();
+        pvm_set_array_ofield( table.data, pos, bucket );
+    }
+
+    int n = get_array_size( bucket.data );
+    int i;
+
+    for( i = 0; i < n; i++ )
+    {
+        pvm_object_t is = pvm_get_array_ofield( bucket.data, i );
+
+        if( pvm_string_equals( is, s ) )
+        {
+            ref_inc_o( is );
+            hal_mutex_unlock( &intern_mutex );
+
+            ref_dec_o( s );
+            return is;
+        }
+    }
+
+    s.data->_flags |= PHANTOM_OBJECT_STORAGE_FLAG_IS_INTERNED;
+    pvm_append_array( bucket.data, ref_inc_o( s ) );
+
+    hal_mutex_unlock( &intern_mutex );
+#endif // VM_INTERN_NAMES
+
+    return s;
+}
+
+
+static void dbg_intern_stats( int ac, char **av )
+{
+    (void) ac;
+    (void) av;
+
+    pvm_object_t table = pvm_root.intern_table;
+
+    if( pvm_is_null( table ) )
+    {
+        printf("No intern table\n");
+        return;
+    }
+
+    int nbuckets = get_array_size( table.data );
+    int used = 0, strings = 0, longest = 0;
+    int i;
+
+    for( i = 0; i < nbuckets; i++ )
+    {
+        pvm_object_t bucket = pvm_get_array_ofield( table.data, i );
+        if( pvm_is_null( bucket ) )
+            continue;
+
+        int n = get_array_size( bucket.data );
+        used++;
+        strings += n;
+        if( n > longest ) longest = n;
+    }
+
+    printf("Intern table: %d strings, %d of %d buckets used, longest bucket %d\n",
+           strings, used, nbuckets, longest );
+}
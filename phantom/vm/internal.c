@@ -78,11 +78,11 @@ struct internal_class pvm_internal_classes[] =
         syscall_table_4_code,  &n_syscall_table_4_code,
         pvm_internal_init_code,
         0 /*pvm_gc_iter_code*/,
-        0, // no finalizer
+        pvm_gc_finalizer_code, // kills pre-decoded code
         0, // no restart func
         0, // Dynamic
         PHANTOM_OBJECT_STORAGE_FLAG_IS_INTERNAL|PHANTOM_OBJECT_STORAGE_FLAG_IS_CODE|
-        PHANTOM_OBJECT_STORAGE_FLAG_IS_CHILDFREE,
+        PHANTOM_OBJECT_STORAGE_FLAG_IS_CHILDFREE|PHANTOM_OBJECT_STORAGE_FLAG_IS_FINALIZER,
         {0,0}
     },
     {
@@ -411,6 +411,18 @@ struct internal_class pvm_internal_classes[] =
         {0,0}
     },
 
+    // Must be last - index is sys_table_id, old images have no such class
+    {
+        ".internal.rope",
+        PVM_ROOT_OBJECT_ROPE_CLASS,
+        IINIT(rope),
+        0, // no finalizer
+        0, // no restart func
+        sizeof(struct data_area_4_rope),
+        PHANTOM_OBJECT_STORAGE_FLAG_IS_INTERNAL|PHANTOM_OBJECT_STORAGE_FLAG_IS_IMMUTABLE,
+        {0,0}
+    },
+
 };
 
 int pvm_n_internal_classes = sizeof(pvm_internal_classes) / sizeof(struct internal_class);
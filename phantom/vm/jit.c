@@ -1,17 +1,36 @@
-#if 0
 /**
  *
  * Phantom OS
  *
- * Copyright (C) 2005-2011 Dmitry Zavalishin, dz@dz.ru
+ * Copyright (C) 2005-2016 Dmitry Zavalishin, dz@dz.ru
  *
- * Minimalistic JIT - supposed to be based on libjit
+ * Baseline template JIT.
  *
+ * Method is compiled from its pre-decoded records (code_cache.c), one
+ * template per bytecode. Stack ops call small helpers below, jumps are
+ * native, calls are done by helper and then native code returns to
+ * interpreter, which continues in callee. Each bytecode we can't do
+ * is compiled as an exit to interpreter at this IP.
+ *
+ * Interpreter enters native code at any IP which is marked as entry in
+ * bc2n map, so hot loops are entered from the middle of method too.
  *
 **/
 
+#define DEBUG_MSG_PREFIX "vm.jit"
+#include <debug_ext.h>
+#define debug_level_flow 6
+#define debug_level_error 10
+#define debug_level_info 10
+
 #include <phantom_assert.h>
+#include <phantom_libc.h>
 #include <errno.h>
+#include <time.h>
+
+#include <kernel/init.h>
+#include <kernel/debug.h>
+#include <kernel/snap_sync.h>
 
 #include "vm/root.h"
 #include "vm/internal_da.h"
@@ -30,758 +49,569 @@
 
 #include "jit.h"
 
-static int debug_print_instr = 0;
 
+#if JIT_ENABLED
+
+int jit_enabled = 1;
+
+static void jit_bench_cmd( int ac, char **av );
+
+static void jit_start(void)
+{
+    jit_init();
+    dbg_add_command( jit_bench_cmd, "jitbench", "jitbench [loops] - run int loop interpreted and JIT compiled, compare time");
+}
+
+INIT_ME( 0, jit_start, 0 )
+
+
+// --------------------------------------------------------------------------
+// Helpers. Native code calls them as ( da, arg, arg ).
+// --------------------------------------------------------------------------
+
+#define is_push( i ) 	pvm_istack_push( da->_istack, i )
+#define is_pop() 	pvm_istack_pop( da->_istack )
+#define is_top() 	pvm_istack_top( da->_istack )
+
+#define this_object()   (da->_this_object)
+
+typedef int (*jit_helper_t)( struct data_area_4_thread *da, int a1, int a2 );
+
+
+static int jit_h_iconst( struct data_area_4_thread *da, int v, int unused )
+{
+    (void) unused;
+    is_push( v );
+    return 0;
+}
+
+static int jit_h_is_dup( struct data_area_4_thread *da, int unused1, int unused2 )
+{
+    (void) unused1; (void) unused2;
+    is_push( is_top() );
+    return 0;
+}
+
+static int jit_h_is_drop( struct data_area_4_thread *da, int unused1, int unused2 )
+{
+    (void) unused1; (void) unused2;
+    is_pop();
+    return 0;
+}
+
+// Returns popped value, for jz
+static int jit_h_is_pop( struct data_area_4_thread *da, int unused1, int unused2 )
+{
+    (void) unused1; (void) unused2;
+    return is_pop();
+}
+
+// Returns decremented top, for djnz
+static int jit_h_is_dec( struct data_area_4_thread *da, int unused1, int unused2 )
+{
+    (void) unused1; (void) unused2;
+    int v = is_pop() - 1;
+    is_push( v );
+    return v;
+}
+
+static int jit_h_is_get( struct data_area_4_thread *da, int abs_stack_pos, int unused )
+{
+    (void) unused;
+    is_push( pvm_istack_abs_get( da->_istack, abs_stack_pos ) );
+    return 0;
+}
+
+static int jit_h_is_set( struct data_area_4_thread *da, int abs_stack_pos, int unused )
+{
+    (void) unused;
+    pvm_istack_abs_set( da->_istack, abs_stack_pos, is_pop() );
+    return 0;
+}
+
+static int jit_h_is_load( struct data_area_4_thread *da, int slot, int unused )
+{
+    (void) unused;
+    is_push( pvm_get_int( pvm_get_ofield( this_object(), slot ) ) );
+    return 0;
+}
+
+static int jit_h_is_save( struct data_area_4_thread *da, int slot, int unused )
+{
+    (void) unused;
+    pvm_set_ofield( this_object(), slot, pvm_create_int_object( is_pop() ) );
+    return 0;
+}
+
+
+// u is top of stack, l is next, just as in exec.c
+#define JIT_H_BINOP( __name, __expr ) \
+static int jit_h_##__name( struct data_area_4_thread *da, int unused1, int unused2 ) \
+{ \
+    (void) unused1; (void) unused2; \
+    int u = is_pop(); \
+    int l = is_pop(); \
+    is_push( __expr ); \
+    return 0; \
+}
+
+JIT_H_BINOP( isum,      l + u )
+JIT_H_BINOP( imul,      l * u )
+JIT_H_BINOP( isubul,    u - l )
+JIT_H_BINOP( isublu,    l - u )
+JIT_H_BINOP( idivul,    u / l )
+JIT_H_BINOP( idivlu,    l / u )
+JIT_H_BINOP( ior,       l | u )
+JIT_H_BINOP( iand,      l & u )
+JIT_H_BINOP( ixor,      l ^ u )
+JIT_H_BINOP( log_or,    u || l )
+JIT_H_BINOP( log_and,   u && l )
+JIT_H_BINOP( log_xor,   (u ? 1 : 0) ^ (l ? 1 : 0) )
+JIT_H_BINOP( ige,       l >= u )
+JIT_H_BINOP( ile,       l <= u )
+JIT_H_BINOP( igt,       l > u )
+JIT_H_BINOP( ilt,       l < u )
+JIT_H_BINOP( ishl,      u << l )
+JIT_H_BINOP( ishr,      u >> l )
+JIT_H_BINOP( ushr,      ((unsigned)u) >> l )
+
+// Compare and pop, result is returned for jz - superinstructions
+#define JIT_H_CMP( __name, __expr ) \
+static int jit_h_##__name##_jz( struct data_area_4_thread *da, int unused1, int unused2 ) \
+{ \
+    (void) unused1; (void) unused2; \
+    int u = is_pop(); \
+    int l = is_pop(); \
+    return __expr; \
+} \
+static int jit_h_is_get32_iconst_##__name##_jz( struct data_area_4_thread *da, int abs_stack_pos, int u ) \
+{ \
+    int l = pvm_istack_abs_get( da->_istack, abs_stack_pos ); \
+    return __expr; \
+}
 
-void jit_binary_op(
-                   struct jit_out *j,
-                   jit_value_t (*func)( struct jit_out *j, jit_value_t r_src, jit_value_t r_dst ) )
+JIT_H_CMP( ige,         l >= u )
+JIT_H_CMP( ile,         l <= u )
+JIT_H_CMP( igt,         l > u )
+JIT_H_CMP( ilt,         l < u )
+
+static int jit_h_is_inc32( struct data_area_4_thread *da, int abs_stack_pos, int add )
 {
-    jit_value_t a1 = jit_is_pop( j );
-    jit_value_t a2 = jit_is_pop( j );
-    jit_value_t r = func( j, a1, a2 );
-    jit_is_push( j, r );
+    pvm_istack_abs_set( da->_istack, abs_stack_pos, pvm_istack_abs_get( da->_istack, abs_stack_pos ) + add );
+    return 0;
 }
 
-void jit_unary_op(
-                   struct jit_out *j,
-                   jit_value_t  (*func)( struct jit_out *j, jit_value_t  r_src ) )
+static int jit_h_inot( struct data_area_4_thread *da, int unused1, int unused2 )
 {
-    jit_is_push( j, func( j, jit_is_pop( j ) ) );
+    (void) unused1; (void) unused2;
+    is_push( ~is_pop() );
+    return 0;
 }
 
+static int jit_h_log_not( struct data_area_4_thread *da, int unused1, int unused2 )
+{
+    (void) unused1; (void) unused2;
+    is_push( !is_pop() );
+    return 0;
+}
 
-errno_t jit_compile_method(struct pvm_code_handler *code)
+
+static int jit_h_call( struct data_area_4_thread *da, int method_index, int n_param )
 {
+    pvm_exec_jit_call( da, method_index, n_param, 1 );
+    return 0;
+}
 
-    struct jit_out      jo;
-    struct jit_out      *j = &jo;
+// call_00 .. call_1F, no optimization for soon return
+static int jit_h_call_noopt( struct data_area_4_thread *da, int method_index, int n_param )
+{
+    pvm_exec_jit_call( da, method_index, n_param, 0 );
+    return 0;
+}
+
+
+// Native code stored IP already
+static int jit_h_snap( struct data_area_4_thread *da, int unused1, int unused2 )
+{
+    (void) unused1; (void) unused2;
+
+#if NEW_SNAP_SYNC
+    pvm_exec_save_fast_acc(da);
+    touch_snap_catch();
+#else
+    if(phantom_virtual_machine_snap_request)
+    {
+        pvm_exec_save_fast_acc(da); // Before snap
+        phantom_thread_wait_4_snap();
+    }
+#endif
+    return 0;
+}
 
-    //struct data_area_4_thread *da = (struct data_area_4_thread *)&(current_thread.data->da);
-    // TODO: check for current_thread to be thread for real
 
-    // JITted code supposed to be called with da in BX
 
-    //jit_gen_push( j, JIT_R_BX );
-    //jit_gen_call( j, JIT_F_LOAD_F_ACC );
-    //pvm_exec_load_fast_acc(da); // For any case
 
+// --------------------------------------------------------------------------
+// Compiler
+// --------------------------------------------------------------------------
+
+static jit_helper_t jit_simple_helper( unsigned char opcode )
+{
+    switch(opcode)
     {
-#warning resleep?
-    // Thread was snapped sleeping - resleep it
-        //if(da->sleep_flag)        phantom_thread_sleep_worker( da );
-        /*
-        jit_load_thread_field( j, offsetof(da->sleep_flag) ); // to AX, gen flags
-        jit_label jl = jit_get_label( j );
-        jit_jz( jl );
-
-        jit_gen_push( j, JIT_R_BX );
-        jit_gen_call( j, JIT_F_THREAD_SLEEP_WORKER );
-        jit_mark_label( j, jl );
-        */
+    case opcode_is_dup:         return jit_h_is_dup;
+    case opcode_is_drop:        return jit_h_is_drop;
+
+    case opcode_isum:           return jit_h_isum;
+    case opcode_imul:           return jit_h_imul;
+    case opcode_isubul:         return jit_h_isubul;
+    case opcode_isublu:         return jit_h_isublu;
+    case opcode_idivul:         return jit_h_idivul;
+    case opcode_idivlu:         return jit_h_idivlu;
+    case opcode_ior:            return jit_h_ior;
+    case opcode_iand:           return jit_h_iand;
+    case opcode_ixor:           return jit_h_ixor;
+    case opcode_inot:           return jit_h_inot;
+    case opcode_log_or:         return jit_h_log_or;
+    case opcode_log_and:        return jit_h_log_and;
+    case opcode_log_xor:        return jit_h_log_xor;
+    case opcode_log_not:        return jit_h_log_not;
+    case opcode_ige:            return jit_h_ige;
+    case opcode_ile:            return jit_h_ile;
+    case opcode_igt:            return jit_h_igt;
+    case opcode_ilt:            return jit_h_ilt;
+    case opcode_ishl:           return jit_h_ishl;
+    case opcode_ishr:           return jit_h_ishr;
+    case opcode_ushr:           return jit_h_ushr;
+
+    case opcode_is_get32:       return jit_h_is_get;
+    case opcode_is_set32:       return jit_h_is_set;
+    case opcode_is_load8:       return jit_h_is_load;
+    case opcode_is_save8:       return jit_h_is_save;
     }
 
-    while(1)
+    return 0;
+}
+
+
+// Superinstruction helper which returns zero to jump
+static jit_helper_t jit_cmp_jz_helper( unsigned char opcode )
+{
+    switch(opcode)
     {
+    case opcode_ilt_jz:                 return jit_h_ilt_jz;
+    case opcode_ile_jz:                 return jit_h_ile_jz;
+    case opcode_igt_jz:                 return jit_h_igt_jz;
+    case opcode_ige_jz:                 return jit_h_ige_jz;
+
+    case opcode_is_get32_iconst_ilt_jz: return jit_h_is_get32_iconst_ilt_jz;
+    case opcode_is_get32_iconst_ile_jz: return jit_h_is_get32_iconst_ile_jz;
+    case opcode_is_get32_iconst_igt_jz: return jit_h_is_get32_iconst_igt_jz;
+    case opcode_is_get32_iconst_ige_jz: return jit_h_is_get32_iconst_ige_jz;
+    }
 
-        /*
-        if(phantom_virtual_machine_snap_request)
-        {
-            pvm_exec_save_fast_acc(da); // Before snap
-            phantom_thread_wait_4_snap();
-            //pvm_exec_load_fast_acc(da); // We don't need this, if we die, we will enter again from above :)
-        }
-        */
+    return 0;
+}
+
+
+static void jit_gen_call( jit_out_t *j, const struct pvm_code_op *op, void *helper, int method_index, int n_param )
+{
+    // Interpreter has IP past the call when it does one, callee frame will return there
+    jit_gen_set_ip( j, op->next_IP );
+    jit_gen_call_helper( j, helper, method_index, n_param );
+    jit_gen_leave( j );
+}
+
+
+// Returns -1 if op is not supported, 0 if control does not pass to next op, 1 if passes
+static int jit_gen_op( jit_out_t *j, const struct pvm_code_op *op, unsigned int ip )
+{
+    unsigned char opcode = op->opcode;
+    jit_helper_t h = jit_simple_helper( opcode );
+
+    if( h )
+    {
+        jit_gen_call_helper( j, h, op->arg[0], 0 );
+        return 1;
+    }
 
+    if( (opcode & 0xE0) == opcode_call_00 )
+    {
+        jit_gen_call( j, op, jit_h_call_noopt, opcode & 0x1F, op->arg[0] );
+        return 0;
+    }
+
+    // Superinstruction is followed by records it is made of, jump over them
+    h = jit_cmp_jz_helper( opcode );
+    if( h )
+    {
+        // Jump target is the last arg
+        unsigned int target = (opcode == opcode_ilt_jz || opcode == opcode_ile_jz ||
+                               opcode == opcode_igt_jz || opcode == opcode_ige_jz) ? op->arg[0] : op->arg[2];
+        if( target <= ip )
+            jit_gen_check_snap_request( j, ip, jit_h_snap );
+        jit_gen_call_helper( j, h, op->arg[0], op->arg[1] );
+        jit_gen_jz( j, target );
+        jit_gen_jmp( j, op->next_IP );
+        return 0;
+    }
+
+    switch(opcode)
+    {
+    case opcode_nop:
+        return 1;
+
+    case opcode_iconst_0:       jit_gen_call_helper( j, jit_h_iconst, 0, 0 ); return 1;
+    case opcode_iconst_1:       jit_gen_call_helper( j, jit_h_iconst, 1, 0 ); return 1;
+    case opcode_iconst_8bit:
+    case opcode_iconst_32bit:   jit_gen_call_helper( j, jit_h_iconst, op->arg[0], 0 ); return 1;
+
+    case opcode_jmp:
+        if( (unsigned)op->arg[0] <= ip )
+            jit_gen_check_snap_request( j, ip, jit_h_snap );
+        jit_gen_jmp( j, op->arg[0] );
+        return 0;
+
+    case opcode_jz:
+        if( (unsigned)op->arg[0] <= ip )
+            jit_gen_check_snap_request( j, ip, jit_h_snap );
+        jit_gen_call_helper( j, jit_h_is_pop, 0, 0 );
+        jit_gen_jz( j, op->arg[0] );
+        return 1;
+
+    case opcode_djnz:
+        if( (unsigned)op->arg[0] <= ip )
+            jit_gen_check_snap_request( j, ip, jit_h_snap );
+        jit_gen_call_helper( j, jit_h_is_dec, 0, 0 );
+        jit_gen_jnz( j, op->arg[0] );
+        return 1;
+
+    case opcode_is_inc32:
+        jit_gen_call_helper( j, jit_h_is_inc32, op->arg[0], op->arg[1] );
+        jit_gen_jmp( j, op->next_IP );
+        return 0;
+
+    case opcode_short_call_0:   jit_gen_call( j, op, jit_h_call, 0, 0 ); return 0;
+    case opcode_short_call_1:   jit_gen_call( j, op, jit_h_call, 1, 0 ); return 0;
+    case opcode_short_call_2:   jit_gen_call( j, op, jit_h_call, 2, 0 ); return 0;
+    case opcode_short_call_3:   jit_gen_call( j, op, jit_h_call, 3, 0 ); return 0;
+
+    case opcode_call_8bit:
+    case opcode_call_32bit:
+        jit_gen_call( j, op, jit_h_call, op->arg[0], op->arg[1] );
+        return 0;
+    }
+
+    return -1;
+}
+
+
+errno_t jit_compile_method( struct pvm_code_cache *cc )
+{
+    jit_out_t           jo;
+    jit_out_t           *j = &jo;
+
+    if( !jit_enabled )
+        return ENXIO;
+
+    if( jit_init_unit( j, cc->code_size ) )
+        return ENOMEM;
+
+    jit_gen_prologue( j );
+
+    unsigned int ip;
+    int ncompiled = 0;
+
+    for( ip = 0; ip < cc->code_size; ip++ )
+    {
+        if( 0 == cc->map[ip] )
+            continue;
+
+        const struct pvm_code_op *op = cc->ops + (cc->map[ip] - 1);
+
+        jit_mark_possible_label( j, ip, 1 );
+
+        int rc = jit_gen_op( j, op, ip );
+
+        if( rc < 0 )
         {
-            jit_check_snap_request( j );
-            /*
-            jit_label jl = jit_get_label( j );
-            jit_jz( jl );
-
-            //jit_gen_push( j, JIT_R_BX );
-            jit_gen_call( j, JIT_F_WAIT_SNAP );
-            jit_mark_label( j, jl );
-            */
+            jit_mark_possible_label( j, ip, 0 );
+            jit_gen_exit( j, ip );
+            continue;
         }
 
+        ncompiled++;
 
-        jit_mark_possible_label(j);
+        // Next one is not compiled, go interpret it
+        if( rc && ((op->next_IP >= cc->code_size) || (0 == cc->map[op->next_IP])) )
+            jit_gen_exit( j, op->next_IP );
+    }
 
-        unsigned char instruction = pvm_code_get_byte(code);
-        //printf("instr 0x%02X ", instruction);
+    if( 0 == ncompiled )
+    {
+        jit_release_unit( j );
+        return ENOENT;
+    }
 
+    // Resolve jumps, give exits to targets we have no code for
+    int i;
+    for( i = 0; i < j->nfixups; i++ )
+    {
+        unsigned int target = j->fixups[i].target_ip;
 
-        switch(instruction)
+        if( (target >= j->code_size) || (0 == j->bc2n[target]) )
         {
-        case opcode_nop:
-            //if( debug_print_instr ) printf("nop; ");
-            break;
-
-        case opcode_debug:
-
-            {
-                int type = pvm_code_get_byte(code); //cf->cs.get_instr( cf->IP );
-
-                //printf("\n\nDebug 0x%02X", type );
-                if( type & 0x80 )
-                {
-                    //printf(" (" );
-                    pvm_object_t o = pvm_code_get_string(code);
-                    //pvm_object_print(o);
-                    ref_dec_o(o);
-                    //printf(")" );
-                }
-
-                if( type & 0x01 ) debug_print_instr = 1;
-                if( type & 0x02 ) debug_print_instr = 0;
-
-                /*
-                if( is_empty() ) printf(", istack empty");
-                else                    printf(",\n\tistack top = %d", is_top() );
-                if( os_empty() ) printf(", ostack empty");
-                else
-                {
-                    printf(",\n\tostack top = {" );
-                    pvm_object_print( os_top() );
-                    printf("}" );
-                }
-                printf(";\n\n");
-                */
-            }
-
-            break;
-
-
-            // int stack ops ---------------------------------------
-
-        case opcode_is_dup:
-            if( debug_print_instr ) printf("is dup; ");
-            jit_is_push( j, jit_is_top( j ) );
-            break;
-
-        case opcode_is_drop:
-            if( debug_print_instr ) printf("is drop; ");
-            jit_is_pop( j );
-            break;
-
-        case opcode_iconst_0:
-            if( debug_print_instr ) printf("iconst 0; ");
-            jit_is_push( j, jit_iconst( j, 0 ) );
-            break;
-
-        case opcode_iconst_1:
-            if( debug_print_instr ) printf("iconst 1; ");
-            jit_is_push( j, jit_iconst( j, 1 ) );
-            break;
-
-        case opcode_iconst_8bit:
-            {
-                int v = pvm_code_get_byte(code);
-                jit_is_push( j, jit_iconst( j, v ) );
-                if( debug_print_instr ) printf("iconst8 = %d; ", v);
-                break;
-            }
-
-        case opcode_iconst_32bit:
-            {
-                int v = pvm_code_get_int32(code);
-                jit_is_push( j, jit_iconst( j, v ) );
-                if( debug_print_instr ) printf("iconst32 = %d; ", v);
-                break;
-            }
-
-
-        case opcode_isum:
-            if( debug_print_instr ) printf("isum; ");
-            jit_binary_op( j, jit_gen_add );
-            break;
-
-        case opcode_imul:
-            if( debug_print_instr ) printf("imul; ");
-            {
-                //int mul = is_pop();
-                //is_push( is_pop() * mul );
-                jit_binary_op( j, jit_gen_mul );
-            }
-            break;
-
-        case opcode_isubul:
-            if( debug_print_instr ) printf("isubul; ");
-            {
-                jit_value_t u = jit_is_pop( j );
-                jit_value_t l = jit_is_pop( j );
-                jit_value_t r = jit_gen_sub( j, u, l );
-                jit_is_push( j, r );
-            }
-            break;
-
-        case opcode_isublu:
-            if( debug_print_instr ) printf("isublu; ");
-            {
-                jit_value_t u = jit_is_pop( j );
-                jit_value_t l = jit_is_pop( j );
-                jit_value_t r = jit_gen_sub( j, l, u );
-                jit_is_push( j, r );
-            }
-            break;
-
-        case opcode_idivul:
-            if( debug_print_instr ) printf("idivul; ");
-            {
-                jit_value_t u = jit_is_pop( j );
-                jit_value_t l = jit_is_pop( j );
-                jit_value_t r = jit_gen_div( j, u, l );
-                jit_is_push( j, r );
-            }
-            break;
-
-        case opcode_idivlu:
-            if( debug_print_instr ) printf("idivlu; ");
-            {
-                jit_value_t u = jit_is_pop( j );
-                jit_value_t l = jit_is_pop( j );
-                jit_value_t r = jit_gen_div( j, l, u );
-                jit_is_push( j, r );
-            }
-            break;
-
-        case opcode_ior:
-            if( debug_print_instr ) printf("ior; ");
-            //{ int operand = is_pop();	is_push( is_pop() | operand ); }
-            jit_binary_op( j, jit_gen_binor );
-            break;
-
-        case opcode_iand:
-            if( debug_print_instr ) printf("iand; ");
-            //{ int operand = is_pop();	is_push( is_pop() & operand ); }
-            jit_binary_op( j, jit_gen_binand );
-            break;
-
-        case opcode_ixor:
-            if( debug_print_instr ) printf("ixor; ");
-            //{ int operand = is_pop();	is_push( is_pop() ^ operand ); }
-            jit_binary_op( j, jit_gen_binxor );
-            break;
-
-        case opcode_inot:
-            if( debug_print_instr ) printf("inot; ");
-            jit_unary_op( j, jit_gen_binnot );
-            break;
-
-
-
-        case opcode_log_or:
-            if( debug_print_instr ) printf("lor; ");
-            jit_binary_op( j, jit_gen_logor );
-            break;
-
-        case opcode_log_and:
-            if( debug_print_instr ) printf("land; ");
-            jit_binary_op( j, jit_gen_logand );
-            break;
-
-        case opcode_log_xor:
-            if( debug_print_instr ) printf("lxor; ");
-            jit_binary_op( j, jit_gen_logxor );
-            break;
-
-        case opcode_log_not:
-            if( debug_print_instr ) printf("lnot; ");
-            jit_unary_op( j, jit_gen_lognot );
-            break;
-
-
-        case opcode_ige:	// >=
-            if( debug_print_instr ) printf("ige; ");
-            jit_binary_op( j, jit_gen_ige );
-            break;
-        case opcode_ile:	// <=
-            if( debug_print_instr ) printf("ile; ");
-            jit_binary_op( j, jit_gen_ile );
-            break;
-        case opcode_igt:	// >
-            if( debug_print_instr ) printf("igt; ");
-            jit_binary_op( j, jit_gen_igt );
-            break;
-        case opcode_ilt:	// <
-            if( debug_print_instr ) printf("ilt; ");
-            jit_binary_op( j, jit_gen_ilt );
-            break;
-
-
-
-        case opcode_i2o:
-            if( debug_print_instr ) printf("i2o; ");
-            jit_push_arg( j, jit_is_pop( j ) );
-            jit_os_push( j, jit_gen_call( j, JIT_F_CREATE_INT_OBJ ) );
-            break;
-
-        case opcode_o2i:
-            if( debug_print_instr ) printf("o2i; ");
-            {
-                jit_is_push( j, jit_o2int( j, jit_os_pop( j ) ) );// push AX
-                //jit_refdec( j ); // TODO jit_o2int must refdec?
-            }
-            break;
-
-
-        case opcode_os_eq:
-            if( debug_print_instr ) printf("os eq; ");
-            {
-                jit_value_t v1 = jit_os_pop( j );
-                jit_value_t v2 = jit_os_pop( j );
-
-                jit_is_push( j, jit_gen_cmp( j, v1, v2 ) );
-
-                jit_refdec( j, v1 );
-                jit_refdec( j, v2 );
-
-                break;
-            }
-
-        case opcode_os_neq:
-            if( debug_print_instr ) printf("os neq; ");
-            {
-                jit_value_t v1 = jit_os_pop( j );
-                jit_value_t v2 = jit_os_pop( j );
-
-                jit_is_push( j, jit_gen_lognot( j, jit_gen_cmp( j, v1, v2 )) );
-
-                jit_refdec( j, v1 );
-                jit_refdec( j, v2 );
-
-                break;
-            }
-
-        case opcode_os_isnull:
-            if( debug_print_instr ) printf("isnull; ");
-            {
-                jit_value_t o1 = jit_os_pop( j );
-                jit_is_push( j, jit_is_null( j, o1 ) );
-                jit_refdec( j, o1 );
-                break;
-            }
-
-        case opcode_os_push_null:
-        case opcode_summon_null:
-            if( debug_print_instr ) printf("push null; ");
-            {
-                jit_os_push( j, jit_get_null( j ) );
-                break;
-            }
-
-            // summoning, special ----------------------------------------------------
-
-        case opcode_summon_thread:
-            if( debug_print_instr ) printf("summon thread; ");
-            jit_os_push( j, jit_get_thread( j ) );
-            break;
-
-        case opcode_summon_this:
-            if( debug_print_instr ) printf("summon this; ");
-            jit_os_push( j, jit_refinc( j, jit_get_this( j ) ) );
-            break;
-
-        case opcode_summon_class_class:
-            if( debug_print_instr ) printf("summon class class; ");
-            jit_os_push( j, jit_get_class_class( j ) );
-            break;
-
-        case opcode_summon_interface_class:
-            if( debug_print_instr ) printf("summon interface class; ");
-            // locked refcnt
-            jit_os_push( j, jit_get_iface_class( j ) );
-            break;
-
-        case opcode_summon_code_class:
-            if( debug_print_instr ) printf("summon code class; ");
-            // locked refcnt
-            jit_os_push( j, jit_get_code_class( j ) );
-            break;
-
-        case opcode_summon_int_class:
-            if( debug_print_instr ) printf("summon int class; ");
-            // locked refcnt
-            jit_os_push( j, jit_get_int_class( j ) );
-            break;
-
-        case opcode_summon_string_class:
-            if( debug_print_instr ) printf("summon string class; ");
-            // locked refcnt
-            jit_os_push( j, jit_get_string_class( j ) );
-            break;
-
-        case opcode_summon_array_class:
-            if( debug_print_instr ) printf("summon array class; ");
-            // locked refcnt
-            jit_os_push( j, jit_get_array_class( j ) );
-            break;
-
-            // TODO we can turn class to const, but the we have to keep refcount for it in
-            // const space and release when we release compiled code
-            // TODO const list is just an array? easy to release all
-
-        case opcode_summon_by_name:
-            {
-                if( debug_print_instr ) printf("summon by name; ");
-
-                struct pvm_object name = pvm_code_get_string(code);
-                struct pvm_object cl = pvm_exec_lookup_class_by_name( name ); // TODO XXX must inc ref
-                ref_dec_o(name);
-
-                // Need throw here?
-
-                if( pvm_is_null( cl ) ) {
-                    printf("JIT: summon by name: null class\n");
-                    return ENOENT;
-
-                    // TODO XXX generate summon in run time?
-
-                }
-                int cid = jit_alloc_const( j, cl );
-                jit_os_push( j, jit_get_const( j, cid ) );
-
-            }
-            break;
-
-            /**
-             * A BIG NOTE for object creation
-             *
-             * We must be SURE that it is NOT ever possible to pass
-             * non-internal object as init data to internal and vice versa!
-             * It would be a securily hole!
-             *
-             **/
-
-
-        case opcode_new:
-            if( debug_print_instr ) printf("new; ");
-            {
-                //pvm_object_t cl = os_pop();
-                //os_push( pvm_create_object( cl ) );
-                //ref_dec_o( cl );  // object keep class ref
-
-                jit_os_pop( j );// pop AX, DX
-                jit_os_push( j, jit_gen_call( j, JIT_F_CREATE_OBJ ) );// push AX, DX
-            }
-            break;
-
-        case opcode_copy:
-            if( debug_print_instr ) printf("copy; ");
-            {
-                jit_push_arg( j, jit_os_pop( j ) );
-                jit_os_push( j, jit_gen_call( j, JIT_F_COPY_OBJ ) );
-                // jit_refdec( j, JIT_R_CX ); XXX TODO need?
-            }
-            break;
-
-            // if you want to enable these, work out refcount
-            // and security issues first!
-            // compose/decompose
-#if 0
-        case opcode_os_compose32:
-            if( debug_print_instr ) printf(" compose32; ");
-            {
-                int num = pvm_code_get_int32(code);
-                struct pvm_object in_class = os_pop();
-                os_push( pvm_exec_compose_object( in_class, da->_ostack, num ) );
-            }
-            break;
-
-        case opcode_os_decompose:
-            if( debug_print_instr ) printf(" decompose; ");
-            {
-                struct pvm_object to_decomp = os_pop();
-                int num = da_po_limit(to_decomp.data);
-                is_push( num );
-                while( num )
-                {
-                    num--;
-                    struct pvm_object o = pvm_get_ofield( to_decomp, num);
-                    os_push( ref_inc_o( o ) );
-                }
-                os_push(to_decomp.data->_class);
-            }
-            break;
-#endif
-            // string ----------------------------------------------------------------
-
-        case opcode_sconst_bin:
-            if( debug_print_instr ) printf("sconst bin; ");
-            //os_push(pvm_code_get_string(code));
-            {
-                int constid = jit_alloc_const( j, pvm_code_get_string( code ) );
-                jit_os_push( j, jit_get_const( j, constid ) );
-            }
-            break;
-
-
-            // flow ------------------------------------------------------------------
-
-        case opcode_jmp:
-            {
-                int newip = pvm_code_get_rel_IP_as_abs(code);
-                if( debug_print_instr ) printf("jmp %d; ", newip );
-                //da->code.IP = pvm_code_get_rel_IP_as_abs(code);
-                jit_jump( j, newip );
-            }
-            break;
-
-
-        case opcode_djnz:
-            {
-                if( debug_print_instr ) printf("djnz " );
-                int newip = pvm_code_get_rel_IP_as_abs(code);
-
-                //is_push( is_pop() - 1 );
-                jit_decrement( j, jit_is_top(j) );
-                jit_jnz( j, newip, jit_is_top(j) );
-
-                //if( debug_print_instr ) printf("(%d) -> %d; ", is_top() , new_IP );
-            }
-            break;
-
-        case opcode_jz:
-            {
-                if( debug_print_instr ) printf("jz " );
-                int newip = pvm_code_get_rel_IP_as_abs(code);
-                jit_jz( j, newip, jit_is_pop(j) );
-            }
-            break;
-
-
-        case opcode_switch:
-            {
-#warning impl
-                /*
-                if( debug_print_instr ) printf("switch ");
-                unsigned int tabsize    = pvm_code_get_int32(code);
-                int shift               = pvm_code_get_int32(code);
-                unsigned int divisor    = pvm_code_get_int32(code);
-                int stack_top = is_pop();
-
-                if( debug_print_instr ) printf("(%d+%d)/%d, ", stack_top, shift, divisor );
-
-
-                unsigned int start_table_IP = da->code.IP;
-                unsigned int displ = (stack_top+shift)/divisor;
-                unsigned int new_IP = start_table_IP+(tabsize*4); // default
-
-                if( debug_print_instr ) printf("displ %d, etab addr %d ", displ, new_IP );
-
-
-                if( displ < tabsize )
-                {
-                    da->code.IP = start_table_IP+(displ*4); // BUG! 4!
-                    if( debug_print_instr ) printf("load from %d, ", da->code.IP );
-                    new_IP = pvm_code_get_rel_IP_as_abs(code);
-                }
-                da->code.IP = new_IP;
-
-                if( debug_print_instr ) printf("switch(%d) ->%d; ", displ, new_IP );
-                */
-                printf("no switch yet");
-                return ENXIO;
-            }
-            break;
-
-
-        case opcode_ret:
-            {
-                if( debug_print_instr ) printf( "\nret\n" );
-                jit_ret(j);
-            }
-            break;
-
-            // exceptions are like ret ---------------------------------------------------
-
-        case opcode_throw:
-            if( debug_print_instr ) printf( "\nthrow\n" );
-            jit_throw(j, jit_os_pop(j) );
-            break;
-
-        case opcode_push_catcher:
-            {
-                unsigned addr = pvm_code_get_rel_IP_as_abs(code);
-                if( debug_print_instr ) printf("push catcher %u; ", addr );
-                jit_es_push( j, jit_os_pop(j), addr );
-            }
-            break;
-
-        case opcode_pop_catcher:
-            if( debug_print_instr ) printf("pop catcher; ");
-            jit_refdec( j, jit_es_pop(j) );
-            break;
-
-            // ok, now method calls ------------------------------------------------------
-
-            // these 4 are parameter-less calls!
-        case opcode_short_call_0:
-            jit_os_push( j, jit_call_method( j, 0, 0, 1) );
-            break;
-        case opcode_short_call_1:
-            jit_os_push( j, jit_call_method( j, 1, 0, 1) );
-            break;
-        case opcode_short_call_2:
-            jit_os_push( j, jit_call_method( j, 2, 0, 1) );
-            break;
-        case opcode_short_call_3:
-            jit_os_push( j, jit_call_method( j, 3, 0, 1) );
-            break;
-
-        case opcode_call_8bit:
-            {
-                unsigned int method_index = pvm_code_get_byte(code);
-                unsigned int n_param = pvm_code_get_int32(code);
-                jit_os_push( j, jit_call_method( j, method_index, n_param, 1) ); // optimization for soon return
-            }
-            break;
-        case opcode_call_32bit:
-            {
-                unsigned int method_index = pvm_code_get_int32(code);
-                unsigned int n_param = pvm_code_get_int32(code);
-                jit_os_push( j, jit_call_method( j, method_index, n_param, 1) ); // optimization for soon return
-            }
-            break;
-
-
-            // object stack --------------------------------------------------------------
-
-        case opcode_os_dup:
-            if( debug_print_instr ) printf("os dup; ");
-            jit_os_push( j, jit_refinc( j, jit_os_top( j ) ) );
-            break;
-
-        case opcode_os_drop:
-            if( debug_print_instr ) printf("os drop; ");
-            jit_refdec( j, jit_os_pop( j ) );
-            break;
-
-        case opcode_os_pull32:
-            if( debug_print_instr ) printf("os pull; ");
-            {
-                int pos = pvm_code_get_int32(code);
-                jit_os_push( j, jit_refinc( j, jit_os_pull( j, pos ) )  ); // TODO XXX load must refinc!
-            }
-            break;
-
-        case opcode_os_load8:
-            {
-                int slot = pvm_code_get_byte(code);
-                jit_os_push( j, jit_os_load( j, slot ) ); // TODO XXX load must refinc!
-            }
-            break;
-
-        case opcode_os_load32:
-            {
-                int slot = pvm_code_get_int32(code);
-                jit_os_push( j, jit_os_load( j, slot ) ); // TODO XXX load must refinc!
-                break;
-            }
-
-        case opcode_os_save8:
-            {
-                int slot = pvm_code_get_byte(code);
-                jit_os_save( j, slot, jit_os_pop( j ) );
-            }
-            break;
-
-        case opcode_os_save32:
-            {
-                int slot = pvm_code_get_int32(code);
-                jit_os_save( j, slot, jit_os_pop( j ) );
-            }
-            break;
-
-        case opcode_is_load8:
-            //pvm_exec_iload(da, pvm_code_get_byte(code));
-            {
-                int slot = pvm_code_get_byte(code);
-                jit_value_t ov = jit_os_load( j, slot );
-                jit_value_t iv = jit_o2int( j, ov ); // TODO XXX jit_o2int must gen refdec
-                jit_is_push( j, iv );
-            }
-            break;
-
-        case opcode_is_save8:
-            {
-                int slot = pvm_code_get_byte(code);
-                jit_push_arg( j, jit_is_pop( j ) ); // TODO arg is int?
-                // pvm_create_int_object
-                jit_os_save( j, slot, jit_gen_call( j, JIT_F_CREATE_INT_OBJ ) );
-            }
-            break;
-
-        case opcode_os_get32:
-            {
-                int pos = pvm_code_get_int32(code);
-                jit_value_t v = jit_os_absget( j, pos ); // AX, DX = obj
-                //jit_refinc( j, v ); // TODO XXX must not be needed - absget must inc!
-                jit_os_push( j, v );
-            }
-            break;
-
-        case opcode_os_set32:
-            {
-                int pos = pvm_code_get_int32(code);
-                jit_os_absset( j, pos, jit_os_pop( j ) );
-            }
-            break;
-
-        case opcode_is_get32:
-            {
-                int pos = pvm_code_get_int32(code);
-                jit_is_push( j, jit_is_absget( j, pos ) );
-            }
-            break;
-        case opcode_is_set32:
-            {
-                int pos = pvm_code_get_int32(code);
-                jit_is_absset( j, pos, jit_is_pop( j ) );
-            }
-            break;
-
-        default:
-            if( (instruction & 0xF0 ) == opcode_sys_0 )
-            {
-                jit_sys( j, instruction & 0x0F);
-                /*
-    sys_sleep:
-                // Only sys can put thread asleep
-                // If we are snapped here we, possibly, will continue from
-                // the entry to this func. So save fasc acc and recheck
-                // sleep condition on the func entry.
-                if(da->sleep_flag)
-                {
-                    pvm_exec_save_fast_acc(da); // Before snap
-                    phantom_thread_sleep_worker( da );
-                }
-                break;
-                */
-            }
-
-            if( instruction  == opcode_sys_8bit )
-            {
-                jit_sys( j, pvm_code_get_byte(code)); 
-                //goto sys_sleep;
-                break;
-            }
-
-            if( (instruction & 0xE0 ) == opcode_call_00 )
-            {
-                unsigned int n_param = pvm_code_get_byte(code);
-                jit_os_push( j, jit_call_method( j, instruction & 0x1F, n_param, 0) ); //no optimization for soon return
-                break;
-            }
-
-            printf("JIT: Unknown op code 0x%X\n", instruction );
-
-            return ENOENT;
+            unsigned int stub = jit_get_pos( j );
+            jit_gen_exit( j, target );
+            if( target < j->code_size )
+                j->bc2n[target] = (stub + 1) | JIT_NOT_ENTRY;
+
+            jit_gen_resolve( j, j->fixups[i].pos, stub );
+            continue;
         }
+
+        jit_gen_resolve( j, j->fixups[i].pos, (j->bc2n[target] & ~JIT_NOT_ENTRY) - 1 );
+    }
+
+    struct jit_code *jc = calloc( 1, sizeof(struct jit_code) );
+    if( 0 == jc )
+    {
+        jit_release_unit( j );
+        return ENOMEM;
+    }
+
+    jc->native_size = jit_get_pos( j );
+    jc->native = jit_alloc_exec( jc->native_size );
+    if( 0 == jc->native )
+    {
+        free( jc );
+        jit_release_unit( j );
+        return ENOMEM;
+    }
+
+    memcpy( jc->native, j->buf, jc->native_size );
+
+    jc->code_size = j->code_size;
+    jc->bc2n = j->bc2n;
+    j->bc2n = 0; // Now owned by jc
+
+    jit_release_unit( j );
+
+    SHOW_FLOW( 2, "compiled %d ops of %d bytes to %d bytes", ncompiled, jc->code_size, jc->native_size );
+
+    if( pvm_code_cache_set_jit( cc, jc ) )
+        jit_free_code( jc ); // Someone compiled it in parallel
+
+    return 0;
+}
+
+
+void jit_free_code( struct jit_code *jc )
+{
+    jit_free_exec( jc->native, jc->native_size );
+    free( jc->bc2n );
+    free( jc );
+}
+
+
+void jit_run( struct data_area_4_thread *da, const struct jit_code *jc )
+{
+    void (*entry)( struct data_area_4_thread *da, void *start ) = (void *)jc->native;
+
+    entry( da, jc->native + (jc->bc2n[da->code.IP] - 1) );
+}
+
+
+
+
+// --------------------------------------------------------------------------
+// Benchmark
+// --------------------------------------------------------------------------
+
+
+// Counts down from loops, doing some int math on each step
+static pvm_object_t jit_bench_code( int loops )
+{
+    unsigned char code[] =
+    {
+        opcode_iconst_32bit, 0, 0, 0, 0,        // 0
+        opcode_iconst_1,                        // 5 - loop
+        opcode_iconst_8bit, 3,
+        opcode_isum,
+        opcode_iconst_8bit, 2,
+        opcode_imul,
+        opcode_is_drop,
+        opcode_djnz, 0, 0, 0, 0,                // 13
+        opcode_is_drop,
+        opcode_ret,
+    };
+
+    code[1] = loops >> 24;
+    code[2] = loops >> 16;
+    code[3] = loops >> 8;
+    code[4] = loops;
+
+    // Relative to the displacement itself, see pvm_code_get_rel_IP_as_abs
+    int jump = 5 - 14;
+    code[14] = jump >> 24;
+    code[15] = jump >> 16;
+    code[16] = jump >> 8;
+    code[17] = jump;
+
+    return pvm_create_code_object( sizeof(code), code );
+}
+
+static bigtime_t jit_bench_run( int loops )
+{
+    pvm_object_t code = jit_bench_code( loops );
+
+    struct pvm_object new_cf = pvm_create_call_frame_object();
+    struct data_area_4_call_frame* cfda = pvm_object_da( new_cf, call_frame );
+
+    pvm_exec_set_cs( cfda, code.data );
+    cfda->this_object = pvm_get_null_object();
+
+    pvm_object_t thread = pvm_create_thread_object( new_cf );
+
+    bigtime_t start = hal_system_time();
+    pvm_exec( thread );
+    bigtime_t time = hal_system_time() - start;
+
+    pvm_release_thread_object( thread );
+    ref_dec_o( code );
+
+    return time;
+}
+
+static void jit_bench_cmd( int ac, char **av )
+{
+    int loops = 1000000;
+
+    if( ac > 1 )
+        loops = atoi( av[1] );
+
+    if( loops <= 0 )
+    {
+        printf("loops must be positive\n");
+        return;
     }
+
+    int save = jit_enabled;
+
+    jit_enabled = 0;
+    bigtime_t interp = jit_bench_run( loops );
+
+    jit_enabled = 1;
+    bigtime_t jit = jit_bench_run( loops );
+
+    jit_enabled = save;
+
+    printf("%d loops: interpreter %d usec, jit %d usec", loops, (int)interp, (int)jit );
+    if( jit > 0 )
+        printf(", speedup %d.%02d", (int)(interp/jit), (int)((interp*100/jit)%100) );
+    printf("\n");
 }
 
 
+#endif // JIT_ENABLED
 
-#endif
@@ -2,11 +2,19 @@
  *
  * Phantom OS
  *
- * Copyright (C) 2005-2011 Dmitry Zavalishin, dz@dz.ru
+ * Copyright (C) 2005-2016 Dmitry Zavalishin, dz@dz.ru
  *
  * JIT header
  *
+ * Baseline template JIT. Hot methods (see VM_JIT_THRESHOLD) are compiled
+ * from pre-decoded code (code_cache.c) to a native code which calls small
+ * helpers for each bytecode and does jumps natively. Anything not supported
+ * is left to interpreter: native code stores IP and returns.
  *
+ * Native code never keeps VM state, IP is stored to thread on each exit,
+ * so interpreter and snapshot see usual bytecode state. Native code is
+ * in kernel memory, after restart we run interpreter till method gets hot
+ * again.
  *
 **/
 
@@ -14,25 +22,67 @@
 #define JIT_H
 
 #include <sys/types.h>
+#include <errno.h>
 #include "vm/internal_da.h"
 
+struct pvm_code_cache;
+
+// See gen_ia32.c and gen_amd64.c
+#if defined(__i386__) || defined(__x86_64__)
+#  define JIT_ARCH_SUPPORTED 1
+#else
+#  define JIT_ARCH_SUPPORTED 0
+#endif
+
+#define JIT_ENABLED (VM_JIT && VM_CODE_CACHE_SIZE && JIT_ARCH_SUPPORTED)
+
+
 void jit_init(void);
 
-//! Compile JIT code for class
-//void jit_compile_class(struct data_area_4_class *da);
 
-//! Compile JIT code for method
-errno_t jit_compile_method(struct pvm_code_handler *code);
+// --------------------------------------------------------------------------
+// Compiled code
+// --------------------------------------------------------------------------
+
+// bc2n entry is not an entry point, just an exit to interpreter
+#define JIT_NOT_ENTRY 0x80000000u
+
+struct jit_code
+{
+    unsigned char *             native;         // Executable copy
+    size_t                      native_size;
+
+    unsigned int                code_size;      // Bytecode size
+    u_int32_t *                 bc2n;           // Bytecode IP -> native offset + 1, 0 - none
+};
+
+//! Runtime switch, no new methods are compiled if zero
+extern int jit_enabled;
+
+//! Compile JIT code for method, attach to cache entry
+errno_t jit_compile_method( struct pvm_code_cache *cc );
+
+void jit_free_code( struct jit_code *jc );
+
+//! Can we start native code at this IP
+static inline int jit_can_enter( const struct jit_code *jc, unsigned int ip )
+{
+    if( ip >= jc->code_size ) return 0;
+    u_int32_t e = jc->bc2n[ip];
+    return e && !(e & JIT_NOT_ENTRY);
+}
+
+//! Run native code from da->code.IP till it exits to interpreter
+void jit_run( struct data_area_4_thread *da, const struct jit_code *jc );
+
+
+//! Called from native code to do a method call. Is in exec.c.
+void pvm_exec_jit_call( struct data_area_4_thread *da, unsigned int method_index, unsigned int n_param, int do_optimize );
+
+//! Executable memory. Kernel or hosted environment specific.
+void *jit_alloc_exec( size_t size );
+void jit_free_exec( void *mem, size_t size );
 
-/*!
- *
- * struct data_area_4_class *da - class
- * void *b_code                 - method bytecode
- * int bc_size                  - size of bytecode
- * pvm_object_t out             - output (binary) variable to put binary code to
- *
- */
-//void jit_compile_method( struct data_area_4_class *da, void *b_code, int bc_size, pvm_object_t out );
 
 // --------------------------------------------------------------------------
 // Enter/leave JIT code
@@ -41,7 +91,9 @@ errno_t jit_compile_method(struct pvm_code_handler *code);
 
 // JIT code runs with:
 // BX = thread da
-// ?? = this
+//
+// Native code never calls anything but helpers, helper gets da
+// and up to two int args, returns int in AX.
 
 
 
@@ -81,168 +133,85 @@ enum jit_callable
 
 
 
-struct jit_out
+// --------------------------------------------------------------------------
+// Code generation state
+// --------------------------------------------------------------------------
+
+struct jit_fixup
 {
-    //! Next label id
-    //int 	nextLabel;
+    unsigned int        pos;            // Native offset of rel32 to patch
+    unsigned int        target_ip;      // Bytecode IP to jump to
+};
 
+struct jit_out
+{
     // Code buffer
-    //char *	buf;
-    //char *	bufp; // Current put pos
-    //int   	bufsize;
+    unsigned char *     buf;
+    unsigned char *     bufp;           // Current put pos
+    int                 bufsize;
 
     // map of interpreted IP to asm instr offset
+    u_int32_t *         bc2n;
+    unsigned int        code_size;
 
-    // map of callable kernel funcs - id to func
+    // Jumps to be resolved after all the code is generated
+    struct jit_fixup *  fixups;
+    int                 nfixups;
+    int                 fixups_size;
 };
 
 
 typedef struct jit_out jit_out_t;
 
 
-struct jit_value
-{
-};
-
-typedef struct jit_value jit_value_t;
-
-
-
 // --------------------------------------------------------------------------
-// Misc
+// Machine independent part, gen_machindep.c
 // --------------------------------------------------------------------------
 
-// Store curr IP as possible jump target
-void  jit_mark_possible_label(jit_out_t *j);
-
-
-jit_value_t jit_o2int( jit_out_t *j, jit_value_t v );
-jit_value_t jit_gen_isnull( jit_out_t *j, jit_value_t ); // dst = (dst == 0)
-void jit_check_snap_request( jit_out_t *j );
-
-// TODO const list is just an array? easy to release all
-int jit_alloc_const( jit_out_t *j, pvm_object_t s );
-jit_value_t jit_get_const( jit_out_t *j, int id );
-
-
-void jit_push_arg( jit_out_t *j, jit_value_t v );
-jit_value_t jit_gen_call( jit_out_t *, enum jit_callable );
+int                     jit_init_unit( jit_out_t *j, unsigned int code_size );
+void                    jit_release_unit( jit_out_t *j );
 
-jit_value_t jit_call_method( jit_out_t *j, int n_method, int n_param, int flags );
+unsigned int            jit_get_pos( jit_out_t *j );
+void                    jit_put_byte( jit_out_t *j, unsigned char b );
+void                    jit_put_int32( jit_out_t *j, u_int32_t v );
+void                    jit_put_int64( jit_out_t *j, u_int64_t v );
+void                    jit_patch_int32( jit_out_t *j, unsigned int pos, u_int32_t v );
 
+//! Remember rel32 at pos must point to bytecode IP
+void                    jit_add_fixup( jit_out_t *j, unsigned int pos, unsigned int target_ip );
 
-void jit_ret( jit_out_t *j );
-void jit_throw( jit_out_t *j, jit_value_t v );
-
-jit_value_t jit_sys( jit_out_t *, int nsys ); // TODO fall asleep there
-
-
-void jit_jump( jit_out_t *j, int newip );
-void jit_jnz( jit_out_t *j, int newip, jit_value_t v );
-void jit_jz( jit_out_t *j, int newip, jit_value_t v );
-
-void jit_decrement( jit_out_t *j, jit_value_t v );
-
-
-
-
-// --------------------------------------------------------------------------
-// I Stack
-// --------------------------------------------------------------------------
-
-
-jit_value_t jit_is_pop( jit_out_t *j );
-void        jit_is_push( jit_out_t *j, jit_value_t );
-jit_value_t jit_is_top( jit_out_t *j );
-jit_value_t jit_iconst( jit_out_t *j, int const);
-
-jit_value_t jit_is_load( jit_out_t *j, int slot );
-jit_value_t jit_is_pull( jit_out_t *j, int slot );
-jit_value_t jit_is_absget( jit_out_t *j, int slot );
-
-jit_value_t jit_is_save( jit_out_t *j, int slot, jit_value_t  );
-jit_value_t jit_is_absset( jit_out_t *j, int slot, jit_value_t );
-
-
-// --------------------------------------------------------------------------
-// O Stack
-// --------------------------------------------------------------------------
-
-void        jit_os_push( jit_out_t *j, jit_value_t );
-jit_value_t jit_os_pop( jit_out_t *j );
-jit_value_t jit_os_top( jit_out_t *j );
-
-jit_value_t jit_os_load( jit_out_t *j, int slot );
-jit_value_t jit_os_pull( jit_out_t *j, int slot );
-jit_value_t jit_os_absget( jit_out_t *j, int slot );
-
-jit_value_t jit_os_save( jit_out_t *j, int slot, jit_value_t  );
-jit_value_t jit_os_absset( jit_out_t *j, int slot, jit_value_t );
-
-
-// --------------------------------------------------------------------------
-// E Stack
-// --------------------------------------------------------------------------
-
-void jit_es_push( jit_out_t *j, jit_value_t type, int addr );
-jit_value_t  jit_es_pop( jit_out_t *j );
-
-
-// --------------------------------------------------------------------------
-// Ref inc/dec
-// --------------------------------------------------------------------------
-
-
-jit_value_t jit_refinc( jit_out_t *j, jit_value_t );
-void jit_refdec( jit_out_t *j, jit_value_t );
-
-
-// --------------------------------------------------------------------------
-// Summon
-// --------------------------------------------------------------------------
-
-jit_value_t jit_get_null( jit_out_t *j );
-jit_value_t jit_get_thread( jit_out_t *j );
-jit_value_t jit_get_this( jit_out_t *j ); 
-jit_value_t jit_get_class_class( jit_out_t *j );
-jit_value_t jit_get_iface_class( jit_out_t *j );
-jit_value_t jit_get_code_class( jit_out_t *j );
-jit_value_t jit_get_int_class( jit_out_t *j );
-jit_value_t jit_get_string_class( jit_out_t *j );
-jit_value_t jit_get_array_class( jit_out_t *j );
+//! Store curr native pos as code for bytecode IP
+void                    jit_mark_possible_label( jit_out_t *j, unsigned int ip, int can_enter );
 
 
 // --------------------------------------------------------------------------
-// ops
+// Machine dependent part, gen_ia32.c or gen_amd64.c
 // --------------------------------------------------------------------------
 
+//! Entry: ( da, native start address ), saves regs and jumps to start
+void                    jit_gen_prologue( jit_out_t *j );
 
+//! Store IP to thread and return to interpreter
+void                    jit_gen_exit( jit_out_t *j, unsigned int ip );
+//! Return to interpreter, IP is set by someone else
+void                    jit_gen_leave( jit_out_t *j );
+//! Store IP to thread, continue
+void                    jit_gen_set_ip( jit_out_t *j, unsigned int ip );
 
-jit_value_t jit_gen_binor( struct jit_out *j, jit_value_t a, jit_value_t b );
-jit_value_t jit_gen_binand( struct jit_out *j, jit_value_t a, jit_value_t b );
-jit_value_t jit_gen_binxor( struct jit_out *j, jit_value_t a, jit_value_t b );
-jit_value_t jit_gen_logor( struct jit_out *j, jit_value_t a, jit_value_t b );
-jit_value_t jit_gen_logand( struct jit_out *j, jit_value_t a, jit_value_t b );
-jit_value_t jit_gen_logxor( struct jit_out *j, jit_value_t a, jit_value_t b );
-jit_value_t jit_gen_ige( struct jit_out *j, jit_value_t a, jit_value_t b );
-jit_value_t jit_gen_ile( struct jit_out *j, jit_value_t a, jit_value_t b );
-jit_value_t jit_gen_igt( struct jit_out *j, jit_value_t a, jit_value_t b );
-jit_value_t jit_gen_ilt( struct jit_out *j, jit_value_t a, jit_value_t b );
-jit_value_t jit_gen_add( struct jit_out *j, jit_value_t a, jit_value_t b );
-jit_value_t jit_gen_sub( struct jit_out *j, jit_value_t a, jit_value_t b );
-jit_value_t jit_gen_mul( struct jit_out *j, jit_value_t a, jit_value_t b );
-jit_value_t jit_gen_div( struct jit_out *j, jit_value_t a, jit_value_t b );
-
-jit_value_t jit_gen_cmp( struct jit_out *j, jit_value_t a, jit_value_t b );
-//jit_value_t jit_gen_neg( struct jit_out *j, jit_value_t a );
+//! Call func( da, a1, a2 ), result (int) is in accumulator
+void                    jit_gen_call_helper( jit_out_t *j, void *func, int a1, int a2 );
 
-jit_value_t jit_gen_binnot( struct jit_out *j, jit_value_t a );
-jit_value_t jit_gen_lognot( struct jit_out *j, jit_value_t a );
+void                    jit_gen_jmp( jit_out_t *j, unsigned int target_ip );
+//! Jump if helper returned zero
+void                    jit_gen_jz( jit_out_t *j, unsigned int target_ip );
+//! Jump if helper returned nonzero
+void                    jit_gen_jnz( jit_out_t *j, unsigned int target_ip );
 
-jit_value_t jit_is_null( struct jit_out *j, jit_value_t a );
+//! Snapshot checkpoint, ip is a place to restart from. Calls helper( da ) if snap is requested.
+void                    jit_gen_check_snap_request( jit_out_t *j, unsigned int ip, void *helper );
 
+//! Make rel32 at pos point to native offset
+void                    jit_gen_resolve( jit_out_t *j, unsigned int pos, unsigned int native_offset );
 
 
 #endif // JIT_H
-
-
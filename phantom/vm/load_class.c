@@ -25,12 +25,14 @@
 
 #include "vm/p2c.h"
 #include "vm/alloc.h"
+#include "vm/reflect.h"
 
 
 int debug_print = 0;
 
 
 static int vm_code_linenum_cmp(const void *, const void *) __attribute__((used));
+static int vm_code_catch_cmp(const void *, const void *);
 
 
 
@@ -99,7 +101,7 @@ pvm_load_method( struct method_loader_handler *mh, const unsigned char *data, in
     mh->ch.IP_max = in_size;
     mh->ch.IP = 0;
 
-    pvm_object_t name = pvm_code_get_string(&(mh->ch));
+    pvm_object_t name = pvm_intern_string( pvm_code_get_string(&(mh->ch)) );
 
     if(debug_print) printf("Method is: " );
     if(debug_print) pvm_object_print( name );
@@ -115,6 +117,14 @@ pvm_load_method( struct method_loader_handler *mh, const unsigned char *data, in
     //if(debug_print) printf("code size %d, IP = %d, in_size = %d\n", code_size, IP, in_size );
 
     mh->my_code = pvm_create_code_object( code_size, (void *)code_data );
+
+    // Verified code runs with less checks, not verified - as before
+    if( pvm_code_verify( mh->my_code ) && debug_print )
+    {
+        printf("Method ");
+        pvm_object_print( name );
+        printf(" is not verified\n");
+    }
 }
 
 
@@ -136,9 +146,11 @@ int pvm_load_class_from_memory( const void *data, int fsize, struct pvm_object *
 
 
     struct pvm_object iface        = { 0, 0 };
+    struct pvm_object base_class   = { 0, 0 };
     struct pvm_object ip2line_maps = { 0, 0 };
     struct pvm_object method_names = { 0, 0 };
     struct pvm_object field_names  = { 0, 0 };
+    struct pvm_object handler_tables = { 0, 0 };
     pvm_object_t const_pool  = { 0, 0 };
 
     int got_class_header = 0;
@@ -183,7 +195,7 @@ int pvm_load_class_from_memory( const void *data, int fsize, struct pvm_object *
             {
                 if(1||debug_print) printf("Class is: " );
 
-                class_name = pvm_code_get_string(&h);//.get_string();
+                class_name = pvm_intern_string( pvm_code_get_string(&h) );//.get_string();
                 if(1||debug_print) pvm_object_print( class_name );
 
                 n_object_slots = pvm_code_get_int32(&h); //.get_int32();
@@ -209,8 +221,6 @@ int pvm_load_class_from_memory( const void *data, int fsize, struct pvm_object *
 #if 0
 #warning base class ignored
 #else
-                struct pvm_object base_class;
-
                 if( EQ_STRING_P2C(base_name,".internal.object") )
                     base_class = pvm_get_null_class();
                 else
@@ -232,6 +242,7 @@ int pvm_load_class_from_memory( const void *data, int fsize, struct pvm_object *
                 ip2line_maps = pvm_create_object( pvm_get_array_class() );
                 method_names = pvm_create_object( pvm_get_array_class() );
                 field_names = pvm_create_object( pvm_get_array_class() );
+                handler_tables = pvm_create_array_object();
                 const_pool = pvm_create_array_object();
 
             }
@@ -280,6 +291,56 @@ int pvm_load_class_from_memory( const void *data, int fsize, struct pvm_object *
             }
             break;
 
+        case 'H': // exception handler table, goes after method
+            {
+                if(debug_print) printf(" handler table\n");
+                int ordinal = pvm_code_get_int32(&h);
+                int count = pvm_code_get_int32(&h);
+
+                if( !got_class_header || ordinal < 0 || ordinal >= (int)da_po_limit(iface.data) ||
+                    pvm_is_null( da_po_ptr(iface.data->da)[ordinal] ) || count <= 0 || count > record_data_size )
+                {
+                    printf("Invalid handler table\n" );
+                    return 1;
+                }
+
+                unsigned int code_size = pvm_object_da( da_po_ptr(iface.data->da)[ordinal], code )->code_size;
+
+                pvm_object_t table = pvm_create_array_object();
+                pvm_object_t bin = pvm_create_binary_object( count * sizeof(struct vm_code_catch), 0 );
+                struct vm_code_catch *cp = (void *)pvm_object_da( bin, binary )->data;
+
+                pvm_append_array( table.data, bin );
+
+                int i;
+                for( i = 0; i < count; i++, cp++ )
+                {
+                    cp->start = pvm_code_get_int32(&h);
+                    cp->end = pvm_code_get_int32(&h);
+                    cp->handler = pvm_code_get_int32(&h);
+                    cp->name = i + 1;
+
+                    if( cp->start > cp->end || cp->end > code_size || cp->handler >= code_size )
+                    {
+                        printf("Invalid handler table entry\n" );
+                        ref_dec_o( table );
+                        return 1;
+                    }
+
+                    pvm_append_array( table.data, pvm_intern_string( pvm_code_get_string(&h) ) );
+                }
+
+                // Names stay in place, entries refer them by index
+                qsort( pvm_object_da( bin, binary )->data, count, sizeof(struct vm_code_catch), vm_code_catch_cmp );
+
+                // Handlers are reached by no jump, method was verified without them
+                if( pvm_code_verify_handlers( da_po_ptr(iface.data->da)[ordinal], (void *)pvm_object_da( bin, binary )->data, count ) && debug_print )
+                    printf("Method %d handlers not verified\n", ordinal );
+
+                pvm_set_array_ofield( handler_tables.data, ordinal, table );
+            }
+            break;
+
         case 'S': // method signature
             {
                 if(debug_print) printf("meth sig\n" );
@@ -363,7 +424,7 @@ int pvm_load_class_from_memory( const void *data, int fsize, struct pvm_object *
 
                 while( h.IP < h.IP_max )
                 {
-                    pvm_object_t f_name = pvm_code_get_string(&h);
+                    pvm_object_t f_name = pvm_intern_string( pvm_code_get_string(&h) );
                     int f_ordinal = pvm_code_get_int32(&h);
 
                     struct type_loader_handler th;
@@ -405,6 +466,20 @@ int pvm_load_class_from_memory( const void *data, int fsize, struct pvm_object *
     cda->ip2line_maps = ip2line_maps;
     cda->method_names = method_names;
     cda->field_names = field_names;
+    cda->handler_tables = handler_tables;
+
+    // Reference from pvm_exec_lookup_class_by_name goes here
+    if( !pvm_is_null( base_class ) )
+        cda->class_parent = base_class;
+
+#if VM_METHOD_INDEX
+    pvm_build_method_index( new_class );
+#endif
+
+#if VM_CLASS_DISPLAY
+    // Parent is known just now
+    pvm_build_class_display( new_class );
+#endif
 
     *out = new_class;
     return 0;
@@ -412,6 +487,21 @@ int pvm_load_class_from_memory( const void *data, int fsize, struct pvm_object *
 
 
 
+// Outer range goes first if two start at the same IP
+static int vm_code_catch_cmp(const void *_a, const void *_b)
+{
+    const struct vm_code_catch *a = _a;
+    const struct vm_code_catch *b = _b;
+
+    if( a->start != b->start )
+        return (a->start > b->start) ? 1 : -1;
+
+    if( a->end != b->end )
+        return (a->end < b->end) ? 1 : -1;
+
+    return 0;
+}
+
 static int vm_code_linenum_cmp(const void *_a, const void *_b)
 {
     const struct vm_code_linenum *a = _a;
@@ -0,0 +1,384 @@
+/**
+ *
+ * Phantom OS
+ *
+ * Copyright (C) 2005-2016 Dmitry Zavalishin, dz@dz.ru
+ *
+ * Per-method bytecode profiler.
+ *
+ * Counts invocations, instructions executed and time spent in each
+ * method (code object). Interpreter reports each switch to other code,
+ * time between switches and instructions interpreted are charged to
+ * the code thread ran before. Time is wall clock, so time thread was
+ * preempted or blocked in sys is charged to the method too.
+ *
+ * Switched on and off with 'mprof' debugger command. Interpreter picks
+ * new state on next code switch. Counters are not atomic - it is a
+ * statistics.
+ *
+ * NB! Instructions run by JIT code are not counted, time is.
+ *
+**/
+
+#define DEBUG_MSG_PREFIX "vm.mprof"
+#include <debug_ext.h>
+#define debug_level_flow 6
+#define debug_level_error 10
+#define debug_level_info 10
+
+#include <phantom_libc.h>
+#include <kernel/init.h>
+#include <kernel/debug.h>
+#include <kernel/mutex.h>
+#include <kernel/json.h>
+#include <time.h>
+
+#include <vm/code.h>
+#include <vm/object.h>
+#include <vm/reflect.h>
+#include <vm/alloc.h>
+#include <vm/internal_da.h>
+
+
+#if VM_METHOD_PROFILE
+
+
+#define MPROF_METHODS           1024    // Power of 2
+#define MPROF_PROBES            16
+#define MPROF_TOP               20
+#define MPROF_NAME              40
+
+struct pvm_mprof_method
+{
+    const unsigned char *       code;           // Key, 0 - empty, set last
+    int                         ordinal;
+
+    u_int32_t                   invocations;
+    u_int64_t                   instructions;
+    bigtime_t                   time;           // usec
+
+    char                        class_name[MPROF_NAME];
+    char                        method_name[MPROF_NAME];
+};
+
+volatile int                    pvm_mprof_on = 0;
+
+static struct pvm_mprof_method *mprof_methods;
+static u_int32_t                mprof_lost;     // Table was full
+static hal_mutex_t              mprof_mutex;
+
+
+static void dbg_mprof( int ac, char **av );
+
+static void pvm_mprof_init(void)
+{
+    hal_mutex_init( &mprof_mutex, "MethProf" );
+    dbg_add_command( dbg_mprof, "mprof", "mprof on|off|clear|json|[time|calls|instr] [n] - per method profiler, show top n");
+}
+
+INIT_ME( 0, pvm_mprof_init, 0 )
+
+
+static inline unsigned mprof_hash( const unsigned char *code )
+{
+    return (((addr_t)code) * 2654435761u) >> 16;
+}
+
+static void mprof_copy_name( char *to, pvm_object_t s )
+{
+    if( pvm_is_null( s ) || !pvm_object_class_exactly_is( s, pvm_get_string_class() ) )
+    {
+        strlcpy( to, "?", MPROF_NAME );
+        return;
+    }
+
+    int len = pvm_get_str_len( s );
+    if( len > MPROF_NAME-1 ) len = MPROF_NAME-1;
+
+    memcpy( to, pvm_get_str_data( s ), len );
+    to[len] = 0;
+}
+
+// Add record for code thread is running now, names are taken from current frame
+static struct pvm_mprof_method * mprof_add( struct data_area_4_thread *da, unsigned h )
+{
+    struct pvm_mprof_method *m = 0;
+    int i;
+
+    hal_mutex_lock( &mprof_mutex );
+
+    for( i = 0; i < MPROF_PROBES; i++ )
+    {
+        struct pvm_mprof_method *t = mprof_methods + ((h + i) & (MPROF_METHODS-1));
+
+        if( t->code == da->code.code ) { m = t; break; } // Someone was faster
+        if( t->code == 0 ) { m = t; break; }
+    }
+
+    if( m && m->code == 0 )
+    {
+        pvm_object_t tclass = pvm_get_class( da->_this_object );
+
+        m->ordinal = pvm_object_da( da->call_frame, call_frame )->ordinal;
+        // Could be charged by thread which had it before clear
+        m->invocations = 0;
+        m->instructions = 0;
+        m->time = 0;
+
+        pvm_object_t cname = pvm_get_class_name( da->_this_object );
+        mprof_copy_name( m->class_name, cname );
+        ref_dec_o( cname );
+
+        mprof_copy_name( m->method_name, pvm_get_method_name( tclass, m->ordinal ) );
+
+        m->code = da->code.code; // Publish
+    }
+
+    hal_mutex_unlock( &mprof_mutex );
+
+    if( 0 == m ) mprof_lost++;
+    return m;
+}
+
+static struct pvm_mprof_method * mprof_get( struct data_area_4_thread *da )
+{
+    if( 0 == mprof_methods )
+        return 0;
+
+    unsigned h = mprof_hash( da->code.code );
+    int i;
+
+    for( i = 0; i < MPROF_PROBES; i++ )
+    {
+        struct pvm_mprof_method *t = mprof_methods + ((h + i) & (MPROF_METHODS-1));
+
+        if( t->code == da->code.code ) return t;
+        if( t->code == 0 ) break;
+    }
+
+    return mprof_add( da, h );
+}
+
+
+void pvm_mprof_invoked( struct data_area_4_thread *da )
+{
+    struct pvm_mprof_method *m = mprof_get( da );
+    if( m ) m->invocations++;
+}
+
+
+struct pvm_mprof_method * pvm_mprof_switch( struct data_area_4_thread *da, struct pvm_mprof_method *prev, bigtime_t *since, unsigned int *instructions )
+{
+    bigtime_t now = hal_system_time();
+
+    if( prev )
+    {
+        prev->time += now - *since;
+        prev->instructions += *instructions;
+    }
+
+    *instructions = 0;
+    *since = now;
+
+    return pvm_mprof_on ? mprof_get( da ) : 0;
+}
+
+
+static void mprof_clear(void)
+{
+    hal_mutex_lock( &mprof_mutex );
+    memset( mprof_methods, 0, MPROF_METHODS * sizeof(struct pvm_mprof_method) );
+    mprof_lost = 0;
+    hal_mutex_unlock( &mprof_mutex );
+}
+
+static errno_t mprof_start(void)
+{
+    if( 0 == mprof_methods )
+    {
+        struct pvm_mprof_method *m = calloc( MPROF_METHODS, sizeof(struct pvm_mprof_method) );
+        if( 0 == m )
+            return ENOMEM;
+
+        mprof_methods = m;
+    }
+
+    pvm_mprof_on = 1;
+    return 0;
+}
+
+
+// --------------------------------------------------------------
+// Reports
+// --------------------------------------------------------------
+
+enum mprof_key { mprof_by_time, mprof_by_calls, mprof_by_instr };
+
+static u_int64_t mprof_value( struct pvm_mprof_method *m, enum mprof_key key )
+{
+    switch( key )
+    {
+    case mprof_by_calls:        return m->invocations;
+    case mprof_by_instr:        return m->instructions;
+    default:                    return m->time;
+    }
+}
+
+// Get next biggest record below previous one, destroys nothing.
+// Start with *last = -1. Returns index or -1.
+static int mprof_next( enum mprof_key key, u_int64_t *limit, int *last )
+{
+    u_int64_t max = 0;
+    int imax = -1, i;
+
+    for( i = 0; i < MPROF_METHODS; i++ )
+    {
+        struct pvm_mprof_method *m = mprof_methods + i;
+        if( m->code == 0 ) continue;
+
+        u_int64_t v = mprof_value( m, key );
+        // Equal values are taken in index order
+        if( *last >= 0 && (v > *limit || (v == *limit && i <= *last)) ) continue;
+        if( imax < 0 || v > max ) { max = v; imax = i; }
+    }
+
+    if( imax >= 0 )
+    {
+        *limit = max;
+        *last = imax;
+    }
+
+    return imax;
+}
+
+static void mprof_print( enum mprof_key key, int n )
+{
+    u_int64_t limit = 0;
+    int last = -1;
+
+    printf("Top methods by %s:\n       calls        instr     time,us  method\n",
+           key == mprof_by_calls ? "calls" : (key == mprof_by_instr ? "instructions" : "time") );
+
+    while( n-- > 0 )
+    {
+        int i = mprof_next( key, &limit, &last );
+        if( i < 0 ) break;
+
+        struct pvm_mprof_method *m = mprof_methods + i;
+        printf("  %10u %12lu %11lu  %s.%s (%d)\n",
+               m->invocations, (unsigned long)m->instructions, (unsigned long)m->time,
+               m->class_name, m->method_name, m->ordinal );
+    }
+
+    if( mprof_lost )
+        printf("  (%u method switches not counted, table is full)\n", mprof_lost );
+}
+
+
+static void json_encode_method( json_output *jo, struct pvm_mprof_method *m )
+{
+    json_out_string( jo, "class", m->class_name );
+    json_out_delimiter( jo );
+
+    json_out_string( jo, "method", m->method_name );
+    json_out_delimiter( jo );
+
+    json_out_int( jo, "ordinal", m->ordinal );
+    json_out_delimiter( jo );
+
+    json_out_long( jo, "calls", m->invocations );
+    json_out_delimiter( jo );
+
+    json_out_long( jo, "instructions", (long)m->instructions );
+    json_out_delimiter( jo );
+
+    json_out_long( jo, "time_us", (long)m->time );
+}
+
+//! Methods sorted by time spent
+void json_dump_method_profile( json_output *jo )
+{
+    u_int64_t limit = 0;
+    int last = -1;
+    int count = 0;
+
+    json_out_open_array( jo, "methods" );
+
+    if( mprof_methods )
+    {
+        int i;
+        while( (i = mprof_next( mprof_by_time, &limit, &last )) >= 0 )
+        {
+            if( count++ > 0 )
+                json_out_delimiter( jo );
+
+            json_out_open_anon_struct( jo );
+            json_encode_method( jo, mprof_methods + i );
+            json_out_close_struct( jo );
+        }
+    }
+
+    json_out_close_array( jo );
+}
+
+
+static void dbg_mprof( int ac, char **av )
+{
+    const char *cmd = ac > 1 ? av[1] : "";
+    int top = MPROF_TOP;
+
+    if( ac > 2 )
+        top = atoi( av[2] );
+    else if( ac > 1 && isdigit( *cmd ) )
+    {
+        top = atoi( cmd );
+        cmd = "";
+    }
+
+    if( 0 == strcmp( cmd, "on" ) )
+    {
+        if( mprof_start() )
+            printf("no memory for profiler\n");
+        return;
+    }
+
+    if( 0 == strcmp( cmd, "off" ) )
+    {
+        pvm_mprof_on = 0;
+        return;
+    }
+
+    if( 0 == mprof_methods )
+    {
+        printf("profiler was never on, say 'mprof on'\n");
+        return;
+    }
+
+    if( 0 == strcmp( cmd, "clear" ) )
+    {
+        mprof_clear();
+        return;
+    }
+
+    if( 0 == strcmp( cmd, "json" ) )
+    {
+        json_output jo = { 0 };
+
+        json_start( &jo );
+        json_dump_method_profile( &jo );
+        json_stop( &jo );
+        return;
+    }
+
+    printf("Profiler is %s\n", pvm_mprof_on ? "on" : "off" );
+
+    if( 0 == strcmp( cmd, "calls" ) )
+        mprof_print( mprof_by_calls, top );
+    else if( 0 == strcmp( cmd, "instr" ) )
+        mprof_print( mprof_by_instr, top );
+    else
+        mprof_print( mprof_by_time, top );
+}
+
+
+#endif // VM_METHOD_PROFILE
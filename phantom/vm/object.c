@@ -40,7 +40,7 @@ static inline void verify_p( pvm_object_storage_t *p )
 
 static inline void verify_o( pvm_object_t o )
 {
-    if( o.data )
+    if( o.data && !pvm_is_immediate(o) )
     {
         verify_p( o.data );
         verify_p( o.interface );
@@ -57,6 +57,34 @@ static inline void verify_o( pvm_object_t o )
  *
 **/
 
+// Page with given number of slots, used slots are moved to it
+static void array_resize_page( struct data_area_4_array *da, int new_page_size )
+{
+    pvm_object_t old = da->page;
+
+    if( pvm_is_null(old) || da->page_size <= 0 )
+    {
+        da->page = pvm_create_page_object( new_page_size, 0, 0 );
+        da->page_size = new_page_size;
+        return;
+    }
+
+    // Slots above used_slots are null or stale copies left by pvm_pop_array, not references
+    int old_size = da->page_size;
+    int ncopy = da->used_slots < new_page_size ? da->used_slots : new_page_size;
+    struct pvm_object *p = da_po_ptr(old.data->da);
+
+    da->page = pvm_create_page_object( new_page_size, p, ncopy );
+    da->page_size = new_page_size;
+
+    // References are moved and stale copies are not ours, old page must not release them
+    int i;
+    for( i = 0; i < old_size; i++ )
+        p[i] = pvm_get_null_object();
+
+    ref_dec_o( old );
+}
+
 struct pvm_object  pvm_get_array_ofield(struct pvm_object_storage *o, unsigned int slot  )
 {
     verify_p(o);
@@ -94,18 +122,13 @@ void pvm_set_array_ofield(struct pvm_object_storage *o, unsigned int slot, struc
     // need resize?
     if( pvm_is_null(da->page) || slot >= da->page_size )
         {
-        const int step = 1024;
-        int new_page_size = slot < (step/2) ? (slot * 2) : (slot+step);
+        int new_page_size = da->page_size + (da->page_size * VM_ARRAY_GROW_PERCENT) / 100;
 
-        if(new_page_size < 16) new_page_size = 16;
+        if( pvm_is_null(da->page) ) new_page_size = 0;
+        if( new_page_size <= (int)slot ) new_page_size = slot+1;
+        if( new_page_size < VM_ARRAY_MIN_PAGE ) new_page_size = VM_ARRAY_MIN_PAGE;
 
-        if( (!pvm_is_null(da->page)) && da->page_size > 0 )
-            //da->page = pvm_object_storage::create_page( new_page_size, da->page.data()->da_po_ptr(), da->page_size );
-            da->page = pvm_create_page_object( new_page_size, (void *)&(da->page.data->da), da->page_size );
-        else
-            da->page = pvm_create_page_object( new_page_size, 0, 0 );
-
-        da->page_size = new_page_size;
+        array_resize_page( da, new_page_size );
         }
 
     if( slot >= da->used_slots )
@@ -165,6 +188,56 @@ void pvm_pop_array(struct pvm_object_storage *array, struct pvm_object value_to_
     pvm_exec_panic( "attempt to remove non existing element from array" );
 }
 
+//! Make page big enough for capacity slots, so that appends up to it do not copy
+void pvm_reserve_array(struct pvm_object_storage *array, int capacity )
+{
+    struct data_area_4_array *da = (struct data_area_4_array *)&(array->da);
+
+    verify_p(array);
+    if(
+       !(PHANTOM_OBJECT_STORAGE_FLAG_IS_INTERNAL & (array->_flags) ) ||
+       !( PHANTOM_OBJECT_STORAGE_FLAG_IS_RESIZEABLE & (array->_flags) )
+      )
+        pvm_exec_panic( "attempt to do an array op to non-array" );
+
+    if( PHANTOM_OBJECT_STORAGE_FLAG_IS_IMMUTABLE &  (array->_flags) )
+        pvm_exec_panic( "attempt to reserve_array for immutable" );
+
+    if( !pvm_is_null(da->page) && capacity <= da->page_size )
+        return;
+
+    if( capacity < VM_ARRAY_MIN_PAGE ) capacity = VM_ARRAY_MIN_PAGE;
+
+    array_resize_page( da, capacity );
+}
+
+//! Drop unused page slots, array which is not going to grow takes less space
+void pvm_trim_array(struct pvm_object_storage *array )
+{
+    struct data_area_4_array *da = (struct data_area_4_array *)&(array->da);
+
+    verify_p(array);
+    if(
+       !(PHANTOM_OBJECT_STORAGE_FLAG_IS_INTERNAL & (array->_flags) ) ||
+       !( PHANTOM_OBJECT_STORAGE_FLAG_IS_RESIZEABLE & (array->_flags) )
+      )
+        pvm_exec_panic( "attempt to do an array op to non-array" );
+
+    if( pvm_is_null(da->page) || da->used_slots >= da->page_size )
+        return;
+
+    if( da->used_slots == 0 )
+    {
+        pvm_object_t old = da->page;
+        da->page = pvm_get_null_object();
+        da->page_size = 0;
+        ref_dec_o( old );
+        return;
+    }
+
+    array_resize_page( da, da->used_slots );
+}
+
 
 
 /**
@@ -204,6 +277,9 @@ struct pvm_object
 pvm_get_ofield( struct pvm_object op, unsigned int slot )
 {
     verify_o(op);
+    if( pvm_is_immediate(op) )
+        pvm_exec_panic( "attempt to load from int" );
+
     if( PHANTOM_OBJECT_STORAGE_FLAG_IS_INTERNAL & ((op.data)->_flags) )
     {
         if( PHANTOM_OBJECT_STORAGE_FLAG_IS_RESIZEABLE & ((op.data)->_flags) )
@@ -255,6 +331,9 @@ pvm_set_ofield( struct pvm_object op, unsigned int slot, struct pvm_object value
 {
     verify_o(op);
     verify_o(value);
+    if( pvm_is_immediate(op) )
+        pvm_exec_panic( "attempt to save to int" );
+
     if( PHANTOM_OBJECT_STORAGE_FLAG_IS_INTERNAL & ((op.data)->_flags) )
     {
         if( PHANTOM_OBJECT_STORAGE_FLAG_IS_RESIZEABLE & ((op.data)->_flags) )
@@ -307,7 +386,7 @@ int pvm_object_class_is( struct pvm_object object, struct pvm_object tclass )
 
 int pvm_object_class_exactly_is( struct pvm_object object, struct pvm_object tclass )
 {
-    struct pvm_object_storage *tested = object.data->_class.data;
+    struct pvm_object_storage *tested = pvm_get_class( object ).data;
     //struct pvm_object_storage *nullc = pvm_get_null_class().data;
 
     if( (!pvm_is_null( tclass )) && (tested == tclass.data) )
@@ -316,12 +395,116 @@ int pvm_object_class_exactly_is( struct pvm_object object, struct pvm_object tcl
     return 0;
 }
 
+/**
+ *
+ * Class display: binary with pointers to all the class ancestors,
+ * root (usually null class) first and class itself last. Class C is
+ * T or a child of T if C's display has T at T's depth, so no parent
+ * chain walk is needed.
+ *
+ * Display is made by class loader after parent is set, or on the
+ * first check. Reloaded class is a new class object and gets its
+ * own display; its children keep the old parent and old display.
+ *
+**/
+
+#if VM_CLASS_DISPLAY
+
+// Deeper (or looped) chain is not displayed, checks walk it
+#define CLASS_MAX_DEPTH         1024
+
+void pvm_build_class_display( pvm_object_t tclass )
+{
+    if( !PVM_CLASS_HAS_FIELD( tclass.data, display ) )
+        return;
+
+    struct pvm_object_storage *nullc = pvm_get_null_class().data;
+    pvm_object_t c = tclass;
+    int n = 0;
+
+    while( !pvm_is_null( c ) )
+    {
+        if( ++n > CLASS_MAX_DEPTH )
+            return;
+
+        if( c.data == nullc )
+            break;
+
+        c = pvm_object_da( c, class )->class_parent;
+    }
+
+    pvm_object_t display = pvm_create_binary_object( n * sizeof( struct pvm_object_storage * ), 0 );
+    struct pvm_object_storage **dp = (void *)pvm_object_da( display, binary )->data;
+
+    // Ancestors are kept alive by class_parent references, pointers are enough
+    for( c = tclass; n > 0; c = pvm_object_da( c, class )->class_parent )
+        dp[--n] = c.data;
+
+    struct data_area_4_class *cda = pvm_object_da( tclass, class );
+
+    // Two threads could build it at once, then one display is just dropped
+    if( pvm_is_null( cda->display ) )
+        cda->display = display;
+    else
+        ref_dec_o( display );
+}
+
+static struct data_area_4_binary * class_display( pvm_object_t tclass )
+{
+    if( tclass.data->_class.data != pvm_get_class_class().data ||
+        !PVM_CLASS_HAS_FIELD( tclass.data, display ) )
+        return 0;
+
+    struct data_area_4_class *cda = pvm_object_da( tclass, class );
+
+    if( pvm_is_null( cda->display ) )
+        pvm_build_class_display( tclass );
+
+    if( pvm_is_null( cda->display ) )
+        return 0;
+
+    return pvm_object_da( cda->display, binary );
+}
+
+// Returns 1 if oclass is tclass or its child, 0 if not, -1 if can't tell
+static int class_display_check( pvm_object_t oclass, pvm_object_t tclass )
+{
+    struct data_area_4_binary *od = class_display( oclass );
+    struct data_area_4_binary *td = class_display( tclass );
+
+    if( od == 0 || td == 0 )
+        return -1;
+
+    unsigned tpos = td->data_size / sizeof( struct pvm_object_storage * ) - 1;
+
+    if( tpos >= od->data_size / sizeof( struct pvm_object_storage * ) )
+        return 0;
+
+    return ((struct pvm_object_storage **)od->data)[tpos] == tclass.data;
+}
+
+#endif // VM_CLASS_DISPLAY
+
 // Really need this?
 int pvm_object_class_is_or_parent( struct pvm_object object, struct pvm_object tclass )
 {
-    struct pvm_object_storage *tested = object.data->_class.data;
+    struct pvm_object_storage *tested = pvm_get_class( object ).data;
     struct pvm_object_storage *nullc = pvm_get_null_class().data;
 
+    if( pvm_is_null( tclass ) ) return 0;
+
+#if VM_CLASS_DISPLAY
+    if( tested == tclass.data )
+        return 1;
+
+    if( !pvm_is_null( pvm_get_class( object ) ) )
+    {
+        int is = class_display_check( tclass, pvm_get_class( object ) );
+        if( is >= 0 )
+            return is;
+    }
+#endif
+
     while( !pvm_is_null( tclass ) )
     {
         if( tested == tclass.data )
@@ -337,12 +520,24 @@ int pvm_object_class_is_or_parent( struct pvm_object object, struct pvm_object t
 
 int pvm_object_class_is_or_child( struct pvm_object object, struct pvm_object tclass )
 {
-    struct pvm_object oclass = object.data->_class;
+    struct pvm_object oclass = pvm_get_class( object );
     //struct pvm_object_storage *tested = object.data->_class.data;
     struct pvm_object_storage *nullc = pvm_get_null_class().data;
 
     if( pvm_is_null( tclass ) ) return 0;
 
+#if VM_CLASS_DISPLAY
+    if( oclass.data == tclass.data )
+        return 1;
+
+    if( !pvm_is_null( oclass ) )
+    {
+        int is = class_display_check( oclass, tclass );
+        if( is >= 0 )
+            return is;
+    }
+#endif
+
     while(1)
     {
         if( oclass.data == tclass.data )
@@ -366,6 +561,9 @@ int pvm_object_class_is_or_child( struct pvm_object object, struct pvm_object tc
 struct pvm_object
 pvm_copy_object( struct pvm_object in_object )
 {
+    if( pvm_is_immediate( in_object ) )
+        return in_object;
+
     // TODO ERROR throw!
     if(in_object.data->_flags & PHANTOM_OBJECT_STORAGE_FLAG_IS_INTERNAL)
         panic("internal object copy?!");
@@ -411,7 +609,9 @@ pvm_object_t pvm_storage_to_object(pvm_object_storage_t *st)
 
 void pvm_puts(struct pvm_object o )
 {
-    if(o.data->_flags & PHANTOM_OBJECT_STORAGE_FLAG_IS_STRING)
+    if(pvm_is_immediate(o))
+        printf( "?" );
+    else if(o.data->_flags & PHANTOM_OBJECT_STORAGE_FLAG_IS_STRING)
     {
         struct data_area_4_string *da = (struct data_area_4_string *)&(o.data->da);
         int len = da->length;
@@ -428,7 +628,7 @@ void pvm_puts(struct pvm_object o )
 
 void pvm_object_print(struct pvm_object o )
 {
-    if(o.data->_flags & PHANTOM_OBJECT_STORAGE_FLAG_IS_INT)
+    if(pvm_is_immediate(o) || (o.data->_flags & PHANTOM_OBJECT_STORAGE_FLAG_IS_INT))
     {
         printf( "%d", pvm_get_int( o ) );
     }
@@ -501,13 +701,18 @@ void dumpo( addr_t addr )
 
 void pvm_object_dump(struct pvm_object o )
 {
+    if(pvm_is_immediate(o))
+    {
+        printf("Immediate int: %d\n", pvm_get_int( o ) );
+        return;
+    }
 	dumpo((addr_t)o.data);
 }
 
 struct pvm_object
 pvm_get_class_name( struct pvm_object o )
 {
-    struct pvm_object c = o.data->_class;
+    struct pvm_object c = pvm_get_class( o );
     if(c.data->_flags & PHANTOM_OBJECT_STORAGE_FLAG_IS_CLASS)
     {
         struct data_area_4_class *da = (struct data_area_4_class *)&(c.data->da);
@@ -0,0 +1,224 @@
+/**
+ *
+ * Phantom OS
+ *
+ * Copyright (C) 2005-2016 Dmitry Zavalishin, dz@dz.ru
+ *
+ * Opcode pairs and triples profiler.
+ *
+ * Interpreter counts each instruction along with two previous ones
+ * when profiler is on. Used to find out which sequences deserve to be
+ * a superinstruction (see code_cache_fuse). Costs one flag check per
+ * instruction when off. Interpreter sees profiler is switched on or off
+ * when it switches to other code. Counters are not atomic - it is a
+ * statistics.
+ *
+ * NB! Sequences run by JIT code are not seen here, turn JIT off to
+ * profile everything.
+ *
+**/
+
+#define DEBUG_MSG_PREFIX "vm.opprof"
+#include <debug_ext.h>
+#define debug_level_flow 6
+#define debug_level_error 10
+#define debug_level_info 10
+
+#include <phantom_libc.h>
+#include <kernel/init.h>
+#include <kernel/debug.h>
+
+#include <vm/code.h>
+
+
+#if VM_OPCODE_PROFILE
+
+
+#define OPPROF_TRIPLES          4096    // Power of 2
+#define OPPROF_PROBES           8
+#define OPPROF_TOP              16
+
+struct opprof_triple
+{
+    u_int32_t                   key;            // Opcodes + 1 in 3 low bytes, 0 - empty
+    u_int32_t                   count;
+};
+
+volatile int                    pvm_opprof_on = 0;
+
+static u_int32_t *              opprof_pairs;   // [prev][op]
+static struct opprof_triple *   opprof_triples;
+static u_int32_t                opprof_lost;    // Triples table was full
+
+
+static void dbg_opprof( int ac, char **av );
+
+static void pvm_opprof_init(void)
+{
+    dbg_add_command( dbg_opprof, "opprof", "opprof on|off|clear|[pairs|triples] [n] - opcode sequences profiler, show top n");
+}
+
+INIT_ME( 0, pvm_opprof_init, 0 )
+
+
+void pvm_opprof_count( unsigned char prev2, unsigned char prev1, unsigned char op )
+{
+    opprof_pairs[(prev1 << 8) | op]++;
+
+    // Key can't be 0
+    u_int32_t key = 0x1000000 | (prev2 << 16) | (prev1 << 8) | op;
+    unsigned h = (key * 2654435761u) >> 20;
+    int i;
+
+    for( i = 0; i < OPPROF_PROBES; i++ )
+    {
+        struct opprof_triple *t = opprof_triples + ((h + i) & (OPPROF_TRIPLES-1));
+
+        if( t->key == key ) { t->count++; return; }
+        if( t->key == 0 ) { t->key = key; t->count = 1; return; }
+    }
+
+    opprof_lost++;
+}
+
+
+static void opprof_clear(void)
+{
+    memset( opprof_pairs, 0, 256 * 256 * sizeof(u_int32_t) );
+    memset( opprof_triples, 0, OPPROF_TRIPLES * sizeof(struct opprof_triple) );
+    opprof_lost = 0;
+}
+
+static errno_t opprof_start(void)
+{
+    if( 0 == opprof_pairs )
+    {
+        u_int32_t *p = calloc( 256 * 256, sizeof(u_int32_t) );
+        struct opprof_triple *t = calloc( OPPROF_TRIPLES, sizeof(struct opprof_triple) );
+
+        if( 0 == p || 0 == t )
+        {
+            if( p ) free( p );
+            if( t ) free( t );
+            return ENOMEM;
+        }
+
+        opprof_pairs = p;
+        opprof_triples = t;
+    }
+
+    pvm_opprof_on = 1;
+    return 0;
+}
+
+
+// Print n biggest counters, destroys nothing - picks next max below previous
+static void opprof_print_pairs( int n )
+{
+    u_int32_t limit = ~0u;
+    int last = -1;
+
+    printf("Top opcode pairs:\n  prev   op       count\n");
+
+    while( n-- > 0 )
+    {
+        u_int32_t max = 0;
+        int imax = -1, i;
+
+        for( i = 0; i < 256*256; i++ )
+        {
+            u_int32_t c = opprof_pairs[i];
+            // Equal counters are taken in index order
+            if( c > limit || (c == limit && i <= last) ) continue;
+            if( c > max ) { max = c; imax = i; }
+        }
+
+        if( imax < 0 ) break;
+
+        printf("  0x%02X 0x%02X  %10u\n", imax >> 8, imax & 0xFF, max );
+        limit = max;
+        last = imax;
+    }
+}
+
+static void opprof_print_triples( int n )
+{
+    u_int32_t limit = ~0u;
+    int last = -1;
+
+    printf("Top opcode triples:\n  prev2 prev1  op       count\n");
+
+    while( n-- > 0 )
+    {
+        u_int32_t max = 0;
+        int imax = -1, i;
+
+        for( i = 0; i < OPPROF_TRIPLES; i++ )
+        {
+            u_int32_t c = opprof_triples[i].count;
+            if( c > limit || (c == limit && i <= last) ) continue;
+            if( c > max ) { max = c; imax = i; }
+        }
+
+        if( imax < 0 ) break;
+
+        u_int32_t key = opprof_triples[imax].key;
+        printf("  0x%02X  0x%02X  0x%02X  %10u\n", (key >> 16) & 0xFF, (key >> 8) & 0xFF, key & 0xFF, max );
+        limit = max;
+        last = imax;
+    }
+
+    if( opprof_lost )
+        printf("  (%u triples not counted, table is full)\n", opprof_lost );
+}
+
+
+static void dbg_opprof( int ac, char **av )
+{
+    const char *cmd = ac > 1 ? av[1] : "";
+    int top = OPPROF_TOP;
+
+    if( ac > 2 )
+        top = atoi( av[2] );
+    else if( ac > 1 && isdigit( *cmd ) )
+    {
+        top = atoi( cmd );
+        cmd = "";
+    }
+
+    if( 0 == strcmp( cmd, "on" ) )
+    {
+        if( opprof_start() )
+            printf("no memory for profiler\n");
+        return;
+    }
+
+    if( 0 == strcmp( cmd, "off" ) )
+    {
+        pvm_opprof_on = 0;
+        return;
+    }
+
+    if( 0 == opprof_pairs )
+    {
+        printf("profiler was never on, say 'opprof on'\n");
+        return;
+    }
+
+    if( 0 == strcmp( cmd, "clear" ) )
+    {
+        opprof_clear();
+        return;
+    }
+
+    printf("Profiler is %s\n", pvm_opprof_on ? "on" : "off" );
+
+    if( 0 != strcmp( cmd, "triples" ) )
+        opprof_print_pairs( top );
+
+    if( 0 != strcmp( cmd, "pairs" ) )
+        opprof_print_triples( top );
+}
+
+
+#endif // VM_OPCODE_PROFILE
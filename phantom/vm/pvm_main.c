@@ -30,7 +30,7 @@
 
 #include <vm/root.h>
 //#include "vm/bulk.h"
-//#include "vm/internal_da.h"
+#include <vm/internal_da.h>
 
 #include <hal.h>
 #include "main.h"
@@ -399,6 +399,7 @@ int main(int argc, char* argv[])
         exit(22);
     }
     bulk_read_pos = bulk_code;
+    pvm_bulk_map( bulk_code, bulk_size );
 
 
     pvm_root_init();
@@ -443,6 +444,7 @@ static void usage()
            "Usage: pvm_test [-flags]\n\n"
            "Flags:\n"
            "-di\t- debug (print) instructions\n"
+           "-s<ops>\t- string ops version: scalar, sse2, avx2\n"
            "-h\t- print this\n"
            );
 }
@@ -496,6 +498,14 @@ static void args(int argc, char* argv[])
             }
             break;
 
+        case 's':
+            if( pvm_strops_select( arg+1 ) )
+            {
+                printf("String ops '%s' are unknown or not supported by CPU\n", arg+1 );
+                exit(22);
+            }
+            break;
+
         case 'h':
         default:
             usage(); exit(22);
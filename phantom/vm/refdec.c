@@ -19,6 +19,7 @@
 #include <kernel/stats.h>
 #include <kernel/atomic.h>
 #include <kernel/snap_sync.h>
+#include <spinlock.h>
 
 #include <threads.h>
 
@@ -39,11 +40,18 @@ INIT_ME( 0, deferred_refdec_init, 0 )
 
 #define REFDEC_BUFFER_SIZE (1024*16)
 
+#define REFDEC_BUFFER_HALF (REFDEC_BUFFER_SIZE/2)
+
     // Where to start agressive action
-#define REFDEC_BUFFER_RED_ZONE (REFDEC_BUFFER_SIZE/4)
+#define REFDEC_BUFFER_RED_ZONE (REFDEC_BUFFER_HALF/2)
+
 
-#define REFDEC_BUFFER_HALF (REFDEC_BUFFER_SIZE/2)
 
+// 2 halves: one is filled, other is processed
+static pvm_object_storage_t *refdec_buffer[2][REFDEC_BUFFER_HALF];
+static int refdec_count[2];
+static int refdec_fill = 0; // half which is filled now
+static hal_spinlock_t refdec_lock;
 
 
 static hal_mutex_t deferred_refdec_mutex;
@@ -58,6 +66,8 @@ static void deferred_refdec_init(void)
     hal_cond_init(  &start_refdec_cond, "refdec st" );
     hal_cond_init(  &end_refdec_cond, "refdec end" );
 
+    hal_spin_init( &refdec_lock );
+
     deferred_refdec_thread_id = hal_start_thread( deferred_refdec_thread, 0, 0 );
     assert(deferred_refdec_thread_id > 0 );
 
@@ -74,61 +84,48 @@ static void deferred_refdec_stop(void) //__attribute__((unused))
 
 
 
-// 2 pages
-static volatile pvm_object_storage_t *refdec_buffer[REFDEC_BUFFER_SIZE];
-static volatile int refdec_put_ptr = 0;
-//static volatile int npage = 0;
-
-
 void deferred_refdec(pvm_object_storage_t *os)
 {
     assert(inited);
-#if 0
-    if( os->_ah.refCount > 1 )
+
+    // Children of object killed by RefDec thread: no one can read
+    // them from dead object, and we can't wait for ourselves
+    if( get_current_tid() == deferred_refdec_thread_id )
     {
-        os->_ah.refCount--;
-        if( os->_ah.refCount <= 0 )
-        {
-            os->_ah.refCount++;
-            goto long_way;
-        }
+        do_ref_dec_p(os);
         return;
     }
-#endif
 
     STAT_INC_CNT(DEFERRED_REFDEC_REQS);
 
-    if(
-       ( (refdec_put_ptr <= REFDEC_BUFFER_HALF) && (refdec_put_ptr > REFDEC_BUFFER_RED_ZONE ) )
-       ||
-       ( refdec_put_ptr > REFDEC_BUFFER_RED_ZONE+REFDEC_BUFFER_HALF )
-      )
+    while(1)
     {
-        //hal_mutex_lock(  &deferred_refdec_mutex );
+        int ie = hal_save_cli();
+        hal_wired_spin_lock( &refdec_lock );
 
-        hal_cond_signal( &start_refdec_cond );
-        //hal_cond_wait(   &end_refdec_cond, &deferred_refdec_mutex );
-
-        //hal_mutex_unlock( &deferred_refdec_mutex );
-    }
+        int n = refdec_count[refdec_fill];
+        if( n < REFDEC_BUFFER_HALF )
+        {
+            refdec_buffer[refdec_fill][n] = os;
+            refdec_count[refdec_fill] = n+1;
+        }
 
+        hal_wired_spin_unlock( &refdec_lock );
+        if( ie ) hal_sti();
 
-    //long_way:
-    // TODO ERROR atomic_add returns not what we assume!
-    //int pos = atomic_add( (int *)&refdec_put_ptr, 1 );
-    int pos = ATOMIC_ADD_AND_FETCH( (int *)&refdec_put_ptr, 1 );
+        if( n < REFDEC_BUFFER_HALF )
+        {
+            if( n >= REFDEC_BUFFER_RED_ZONE )
+                hal_cond_signal( &start_refdec_cond );
+            return;
+        }
 
-    // Overflow
-    if( (pos >= REFDEC_BUFFER_SIZE) || (pos == REFDEC_BUFFER_HALF) )
-    {
-        STAT_INC_CNT(DEFERRED_REFDEC_LOST);
-        // We just loose refdec - big GC will pick it up
-        return;
+        // Both halves are full, wait for RefDec thread. Decrement
+        // can't be lost - object would never be freed.
+        STAT_INC_CNT(DEFERRED_REFDEC_WAIT);
+        hal_cond_signal( &start_refdec_cond );
+        hal_sleep_msec( 1 );
     }
-
-    refdec_buffer[pos] = os;
-
-
 }
 
 /**
@@ -154,33 +151,32 @@ static void deferred_refdec_thread(void *a)
 
         STAT_INC_CNT(DEFERRED_REFDEC_RUNS);
 
-        // Decide where to switch put pointer
-        int new_put_ptr = REFDEC_BUFFER_HALF + 1; // first one used to check low half overflow
+        // Switch halves, other one was emptied on previous run
+        int ie = hal_save_cli();
+        hal_wired_spin_lock( &refdec_lock );
 
-        // Was in upper page?
-        if( refdec_put_ptr >= REFDEC_BUFFER_HALF )
-            new_put_ptr = 0;
+        int half = refdec_fill;
+        refdec_fill = !half;
 
-        //int last_pos = atomic_set( &refdec_put_ptr, new_put_ptr);
-        int last_pos = ATOMIC_FETCH_AND_SET( &refdec_put_ptr, new_put_ptr);
-        int start_pos = (last_pos >= REFDEC_BUFFER_HALF) ? REFDEC_BUFFER_HALF+1 : 0;
+        hal_wired_spin_unlock( &refdec_lock );
+        if( ie ) hal_sti();
 
         // Check that all VM threads are either sleep or passed an bytecode instr boundary
         phantom_check_threads_pass_bytecode_instr_boundary();
 
         int pos;
-        for( pos = start_pos; pos < last_pos; pos++ )
+        for( pos = 0; pos < refdec_count[half]; pos++ )
         {
-            pvm_object_storage_t volatile *os;
-            os = refdec_buffer[pos];
+            pvm_object_storage_t *os = refdec_buffer[half][pos];
 
             assert( os->_ah.refCount > 0);
-            do_ref_dec_p((pvm_object_storage_t *)os);
+            do_ref_dec_p(os);
         }
 
+        // No one puts here till next switch
+        refdec_count[half] = 0;
+
         hal_cond_broadcast(   &end_refdec_cond );
         hal_mutex_unlock( &deferred_refdec_mutex );
     }
 }
-
-
@@ -51,6 +51,7 @@ static void runclass(int, char **);
 
 static void process_generic_restarts(struct pvm_object_storage *root);
 static void process_specific_restarts(void);
+static void create_missing_internal_classes(struct pvm_object_storage *root);
 
 
 /**
@@ -65,6 +66,9 @@ static void process_specific_restarts(void);
 
 void pvm_root_init(void)
 {
+    // Arenas layout is kept in object space, root object position depends on it
+    pvm_alloc_load_layout();
+
     struct pvm_object_storage *root = get_root_object_storage();
 
     dbg_add_command( runclass, "runclass", "runclass class [method ordinal] - create object of given class and run method (ord 8 by default)");
@@ -124,10 +128,25 @@ void pvm_root_init(void)
 
     pvm_root.kernel_stats = pvm_get_field( root, PVM_ROOT_KERNEL_STATISTICS );
 
+    create_missing_internal_classes( root );
+
+    pvm_root.intern_table = pvm_get_field( root, PVM_ROOT_OBJECT_INTERN_TABLE );
+#if VM_INTERN_NAMES
+    if( pvm_is_null( pvm_root.intern_table ) )
+    {
+        pvm_root.intern_table = pvm_create_intern_table();
+        ref_saturate_o( pvm_root.intern_table );
+        pvm_set_field( root, PVM_ROOT_OBJECT_INTERN_TABLE, pvm_root.intern_table );
+    }
+#endif
 
     process_specific_restarts();
     process_generic_restarts(root);
 
+    // Convert to current layout
+    if( !pvm_is_null( pvm_root.root_dir ) )
+        pvm_restart_directory( pvm_root.root_dir );
+
 }
 
 static void process_generic_restarts(struct pvm_object_storage *root)
@@ -170,6 +189,93 @@ static void process_generic_restarts(struct pvm_object_storage *root)
 }
 
 
+/**
+ *
+ * Internal classes have no parent but rope, which is a string for
+ * class checks and catch - see rope.c.
+ *
+**/
+
+static struct pvm_object internal_class_parent( int i )
+{
+    if( pvm_internal_classes[i].root_index == PVM_ROOT_OBJECT_ROPE_CLASS )
+        return pvm_root.string_class;
+
+    return pvm_root.null_class;
+}
+
+// Internal class of older image can have old flags (code class had no
+// finalizer) and rope class has null parent
+static void fix_internal_class( int i )
+{
+    struct pvm_object_storage *curr = pvm_internal_classes[i].class_object.data;
+    struct data_area_4_class *da = (struct data_area_4_class *)curr->da;
+    struct pvm_object parent = internal_class_parent( i );
+
+    da->object_flags = pvm_internal_classes[i].flags;
+
+    if( da->class_parent.data == parent.data )
+        return;
+
+    da->class_parent = parent;
+
+    // Made with old parent, will be rebuilt on first check
+    if( PVM_CLASS_HAS_FIELD( curr, display ) && !pvm_is_null( da->display ) )
+    {
+        ref_dec_o( da->display );
+        da->display = pvm_get_null_object();
+    }
+}
+
+
+/**
+ *
+ * Image was made by kernel which had less internal classes. New
+ * ones are added to the end of the table, so old classes keep their
+ * sys_table_id. Create missing ones just as pvm_create_root_objects does.
+ *
+**/
+
+static void create_missing_internal_classes(struct pvm_object_storage *root)
+{
+    int i, created = 0;
+
+    for( i = 0; i < pvm_n_internal_classes; i++ )
+    {
+        if( pvm_internal_classes[i].class_object.data != 0 )
+        {
+            fix_internal_class( i );
+            continue;
+        }
+
+        printf("Adding internal class %s to old image\n", pvm_internal_classes[i].name );
+
+        unsigned int flags = PHANTOM_OBJECT_STORAGE_FLAG_IS_INTERNAL|PHANTOM_OBJECT_STORAGE_FLAG_IS_CLASS ;
+        struct pvm_object_storage *curr = pvm_object_alloc( sizeof( struct data_area_4_class ), flags, 1 );
+        struct data_area_4_class *da = (struct data_area_4_class *)curr->da;
+
+        da->sys_table_id                = i;
+        da->object_flags                = pvm_internal_classes[i].flags;
+        da->object_data_area_size       = pvm_internal_classes[i].da_size;
+
+        da->class_parent                = internal_class_parent( i );
+        da->object_default_interface    = pvm_root.sys_interface_object;
+        da->class_name                  = pvm_create_string_object(pvm_internal_classes[i].name);
+
+        curr->_class = pvm_root.class_class;
+
+        pvm_internal_classes[i].class_object.data           = curr;
+        pvm_internal_classes[i].class_object.interface      = pvm_root.sys_interface_object.data;
+
+        pvm_set_field( root, pvm_internal_classes[i].root_index, pvm_internal_classes[i].class_object );
+        created++;
+    }
+
+    if( created )
+        set_root_from_table();
+}
+
+
 static void start_persistent_stats(void)
 {
     struct data_area_4_binary *bda = pvm_data_area( pvm_root.kernel_stats, binary );
@@ -233,6 +339,7 @@ static void pvm_save_root_objects()
     pvm_set_field( root, PVM_ROOT_OBJECT_ROOT_DIR, pvm_root.root_dir);
 
     pvm_set_field( root, PVM_ROOT_KERNEL_STATISTICS, pvm_root.kernel_stats );
+    pvm_set_field( root, PVM_ROOT_OBJECT_INTERN_TABLE, pvm_root.intern_table );
 
 }
 
@@ -289,7 +396,7 @@ static void pvm_create_root_objects()
         struct pvm_object_storage *curr = pvm_internal_classes[i].class_object.data;
         struct data_area_4_class *da = (struct data_area_4_class *)curr->da;
 
-        da->class_parent 		= pvm_root.null_class;
+        da->class_parent 		= internal_class_parent( i );
         da->object_default_interface    = pvm_root.sys_interface_object;
 
         curr->_class = pvm_root.class_class;
@@ -328,6 +435,13 @@ static void pvm_create_root_objects()
     ref_saturate_o(pvm_root.kernel_stats);
     start_persistent_stats();
 
+#if VM_INTERN_NAMES
+    pvm_root.intern_table  = pvm_create_intern_table();
+    ref_saturate_o(pvm_root.intern_table);
+#else
+    pvm_root.intern_table  = pvm_get_null_object();
+#endif
+
     //pvm_root.os_entry = pvm_get_null_object();
 }
 
@@ -369,6 +483,8 @@ static void set_root_from_table()
     SET_ROOT_CLASS(mutex,MUTEX);
     SET_ROOT_CLASS(cond,COND);
     SET_ROOT_CLASS(sema,SEMA);
+
+    SET_ROOT_CLASS(rope,ROPE);
 }
 
 
@@ -414,6 +530,8 @@ GCINLINE struct pvm_object     pvm_get_mutex_class() { return pvm_root.mutex_cla
 GCINLINE struct pvm_object     pvm_get_cond_class() { return pvm_root.cond_class; }
 GCINLINE struct pvm_object     pvm_get_sema_class() { return pvm_root.sema_class; }
 
+GCINLINE struct pvm_object     pvm_get_rope_class() { return pvm_root.rope_class; }
+
 
 #undef GCINLINE
 
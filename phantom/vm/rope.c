@@ -0,0 +1,351 @@
+/**
+ *
+ * Phantom OS
+ *
+ * Copyright (C) 2005-2016 Dmitry Zavalishin, dz@dz.ru
+ *
+ * Rope - lazy string concatenation.
+ *
+ * string.concat result which is VM_ROPE_MIN bytes or longer is a rope
+ * node referencing both parts, no bytes are copied. First access which
+ * needs bytes (charAt, find, equals, etc) flattens rope: makes string
+ * and drops the tree. Rope is an usual persistent object, so unflattened
+ * ropes survive restart.
+ *
+ * Appending to a rope is balanced like a binary counter: right spine
+ * subtrees of equal depth are merged, so depth is log(n) and each append
+ * makes O(1) nodes amortized. Short tail is glued to the rightmost leaf
+ * instead, so that appending by one char does not make a node per char.
+ * Prepending is not balanced, such a rope is flattened when it gets too deep.
+ *
+**/
+
+#define DEBUG_MSG_PREFIX "vm.rope"
+#include <debug_ext.h>
+#define debug_level_flow 6
+#define debug_level_error 10
+#define debug_level_info 10
+
+#include <assert.h>
+#include <phantom_libc.h>
+#include <kernel/init.h>
+#include <kernel/debug.h>
+#include <kernel/mutex.h>
+#include <time.h>
+
+#include <vm/object.h>
+#include <vm/internal.h>
+#include <vm/internal_da.h>
+#include <vm/alloc.h>
+#include <vm/p2c.h>
+
+
+// Leaf string a short tail is glued to is not longer than that
+#define ROPE_LEAF               256
+// Deeper rope is flattened at once
+#define ROPE_MAX_DEPTH          48
+// Flatten stack, rope which is just made can be one level deeper than max
+#define ROPE_STACK              (ROPE_MAX_DEPTH+4)
+
+
+// Protects tree of all ropes, as flattening changes it
+static hal_mutex_t              rope_mutex;
+
+static void dbg_rope_bench( int ac, char **av );
+
+static void pvm_rope_init(void)
+{
+    hal_mutex_init( &rope_mutex, "Rope" );
+    dbg_add_command( dbg_rope_bench, "ropebench", "ropebench [n] - time building strings by n, 2n, 4n appends");
+}
+
+INIT_ME( 0, pvm_rope_init, 0 )
+
+
+
+void pvm_internal_init_rope(struct pvm_object_storage * os)
+{
+    (void)os;
+    // Zero da is an empty rope
+}
+
+void pvm_gc_iter_rope(gc_iterator_call_t func, struct pvm_object_storage * os, void *arg)
+{
+    struct data_area_4_rope *da = (struct data_area_4_rope *)&(os->da);
+
+    func( da->left, arg );
+    func( da->right, arg );
+    func( da->flat, arg );
+}
+
+
+static inline int rope_is_tree( pvm_object_t o )
+{
+    return IS_PHANTOM_ROPE(o) && pvm_is_null( pvm_object_da( o, rope )->flat );
+}
+
+static inline int rope_depth( pvm_object_t o )
+{
+    return rope_is_tree( o ) ? pvm_object_da( o, rope )->depth : 0;
+}
+
+static inline int rope_piece_length( pvm_object_t o )
+{
+    return IS_PHANTOM_ROPE(o) ? pvm_object_da( o, rope )->length : pvm_get_str_len( o );
+}
+
+// Reference to o or, if it is a flattened rope, to its string
+static pvm_object_t rope_piece( pvm_object_t o )
+{
+    if( IS_PHANTOM_ROPE(o) && !rope_is_tree( o ) )
+        return ref_inc_o( pvm_object_da( o, rope )->flat );
+
+    return ref_inc_o( o );
+}
+
+// Consumes references to parts
+static pvm_object_t rope_node( pvm_object_t left, pvm_object_t right )
+{
+    pvm_object_t o = pvm_create_object( pvm_get_rope_class() );
+    struct data_area_4_rope *da = pvm_object_da( o, rope );
+
+    int ld = rope_depth( left );
+    int rd = rope_depth( right );
+
+    da->length = rope_piece_length( left ) + rope_piece_length( right );
+    da->depth = 1 + ((ld > rd) ? ld : rd);
+    da->left = left;
+    da->right = right;
+
+    return o;
+}
+
+// Called with rope_mutex taken, s1 must be a tree
+static pvm_object_t rope_append( pvm_object_t s1, pvm_object_t s2 )
+{
+    struct data_area_4_rope *da = pvm_object_da( s1, rope );
+
+    if( IS_PHANTOM_STRING(s2) && IS_PHANTOM_STRING(da->right) &&
+        pvm_get_str_len(da->right) + pvm_get_str_len(s2) <= ROPE_LEAF )
+    {
+        pvm_object_t leaf = pvm_create_string_object_binary_cat(
+            pvm_get_str_data(da->right), pvm_get_str_len(da->right),
+            pvm_get_str_data(s2), pvm_get_str_len(s2) );
+
+        return rope_node( ref_inc_o( da->left ), leaf );
+    }
+
+    pvm_object_t tail = rope_piece( s2 );
+
+    while( rope_is_tree( s1 ) )
+    {
+        da = pvm_object_da( s1, rope );
+
+        if( rope_depth( da->right ) > rope_depth( tail ) )
+            break;
+
+        tail = rope_node( rope_piece( da->right ), tail );
+        s1 = da->left;
+    }
+
+    return rope_node( rope_piece( s1 ), tail );
+}
+
+
+pvm_object_t pvm_string_concat( pvm_object_t s1, pvm_object_t s2 )
+{
+    int len1 = rope_piece_length( s1 );
+    int len2 = rope_piece_length( s2 );
+
+    if( VM_ROPE_MIN == 0 || len1 + len2 < VM_ROPE_MIN )
+    {
+        if( IS_PHANTOM_ROPE(s1) ) s1 = pvm_rope_flat( s1 );
+        if( IS_PHANTOM_ROPE(s2) ) s2 = pvm_rope_flat( s2 );
+
+        return pvm_create_string_object_binary_cat(
+            pvm_get_str_data(s1), len1, pvm_get_str_data(s2), len2 );
+    }
+
+    if( len2 == 0 ) return rope_piece( s1 );
+    if( len1 == 0 ) return rope_piece( s2 );
+
+    pvm_object_t ret;
+
+    hal_mutex_lock( &rope_mutex );
+
+    if( rope_is_tree( s1 ) )
+        ret = rope_append( s1, s2 );
+    else
+        ret = rope_node( rope_piece( s1 ), rope_piece( s2 ) );
+
+    hal_mutex_unlock( &rope_mutex );
+
+    if( pvm_object_da( ret, rope )->depth > ROPE_MAX_DEPTH )
+        pvm_rope_flat( ret );
+
+    return ret;
+}
+
+
+// Called with rope_mutex taken
+static void rope_flatten( struct data_area_4_rope *da )
+{
+    pvm_object_t s = pvm_create_string_object_binary( 0, da->length );
+    struct data_area_4_string *sda = pvm_object_da( s, string );
+    sda->length = da->length;
+
+    // Depth first, right to left - fill string from the end
+    pvm_object_t stack[ROPE_STACK];
+    int sp = 0;
+    int pos = da->length;
+
+    stack[sp++] = da->right;
+    stack[sp++] = da->left;
+
+    while( sp > 0 )
+    {
+        pvm_object_t o = stack[--sp];
+
+        if( pvm_is_null( o ) )
+            continue;
+
+        if( rope_is_tree( o ) )
+        {
+            struct data_area_4_rope *oda = pvm_object_da( o, rope );
+
+            if( sp+2 > ROPE_STACK )
+                panic("rope is too deep");
+
+            stack[sp++] = oda->right;
+            stack[sp++] = oda->left;
+            continue;
+        }
+
+        if( IS_PHANTOM_ROPE(o) )
+            o = pvm_object_da( o, rope )->flat;
+
+        int len = pvm_get_str_len( o );
+        pos -= len;
+        assert( pos >= 0 );
+        memcpy( sda->data + pos, pvm_get_str_data( o ), len );
+    }
+
+    assert( pos == 0 );
+    pvm_string_hash_reset( s );
+
+    // Publish flat string before dropping tree, readers check flat first
+    da->flat = s;
+
+    pvm_object_t left = da->left;
+    pvm_object_t right = da->right;
+
+    da->left = pvm_get_null_object();
+    da->right = pvm_get_null_object();
+
+    ref_dec_o( left );
+    ref_dec_o( right );
+}
+
+pvm_object_t pvm_rope_flat( pvm_object_t rope )
+{
+    struct data_area_4_rope *da = pvm_object_da( rope, rope );
+
+    if( pvm_is_null( da->flat ) )
+    {
+        hal_mutex_lock( &rope_mutex );
+        if( pvm_is_null( da->flat ) )
+            rope_flatten( da );
+        hal_mutex_unlock( &rope_mutex );
+    }
+
+    return da->flat;
+}
+
+pvm_object_t pvm_rope_release_flat( pvm_object_t rope )
+{
+    pvm_object_t s = ref_inc_o( pvm_rope_flat( rope ) );
+    ref_dec_o( rope );
+    return s;
+}
+
+
+
+// --------------------------------------------------------------
+// Benchmark
+// --------------------------------------------------------------
+
+#define ROPE_BENCH_N            1000
+
+static const char rope_bench_piece[] = "0123456789abcdef";
+
+// Returns time in usec to build string of n pieces, rope or flat
+static bigtime_t rope_bench_build( int n, int use_rope )
+{
+    pvm_object_t piece = pvm_create_string_object( rope_bench_piece );
+    pvm_object_t s = pvm_create_string_object( "" );
+    int plen = pvm_get_str_len( piece );
+    int i;
+
+    bigtime_t start = hal_system_time();
+
+    for( i = 0; i < n; i++ )
+    {
+        pvm_object_t ns;
+
+        if( use_rope )
+            ns = pvm_string_concat( s, piece );
+        else
+        {
+            pvm_object_t fs = IS_PHANTOM_ROPE(s) ? pvm_rope_flat( s ) : s;
+            ns = pvm_create_string_object_binary_cat(
+                pvm_get_str_data(fs), pvm_get_str_len(fs),
+                pvm_get_str_data(piece), plen );
+        }
+
+        ref_dec_o( s );
+        s = ns;
+    }
+
+    // Indexed access flattens, count it too
+    if( IS_PHANTOM_ROPE(s) )
+        pvm_rope_flat( s );
+
+    bigtime_t time = hal_system_time() - start;
+
+    pvm_object_t fs = IS_PHANTOM_ROPE(s) ? pvm_rope_flat( s ) : s;
+    if( pvm_get_str_len(fs) != n * plen ||
+        pvm_get_str_data(fs)[(n-1) * plen + 7] != rope_bench_piece[7] )
+        printf("ropebench: wrong result string\n");
+
+    ref_dec_o( s );
+    ref_dec_o( piece );
+
+    return time;
+}
+
+static void dbg_rope_bench( int ac, char **av )
+{
+    int n = ROPE_BENCH_N;
+    int mul;
+
+    if( ac > 1 )
+        n = atoi( av[1] );
+
+    if( n <= 0 )
+    {
+        printf("ropebench: n must be positive\n");
+        return;
+    }
+
+    printf("    appends     rope,us     flat,us\n");
+
+    for( mul = 1; mul <= 4; mul *= 2 )
+    {
+        bigtime_t rt = rope_bench_build( n * mul, 1 );
+        bigtime_t ft = rope_bench_build( n * mul, 0 );
+
+        printf("  %9d  %10ld  %10ld\n", n * mul, (long)rt, (long)ft );
+    }
+
+    printf("Rope time must grow about as appends count does, flat time - as its square\n");
+}
@@ -17,10 +17,25 @@
 #include "vm/exception.h"
 #include "vm/alloc.h"
 #include "vm/exec.h"
+#include "vm/stacks.h"
 
 // Ok. All these methods receive ptr to root stack object da,
 // which curr_da field points to the active page data area.
 // so rootda is root page da, and s is curr page da.
+//
+// Stack is kept contiguous: when page is full, we make page of twice
+// the size, move all the cells there and link it as root's next. So
+// active page has all the cells and no prev, push and pop are just
+// a bounds check and index inc/dec (see inline ones in stacks.h).
+//
+// Images made by older kernels can have stacks of linked pages, with
+// prev set in all pages but root. These are served the old way: new
+// page is linked on overflow and we go back to prev on underflow.
+
+static struct pvm_object     pvm_create_general_stack_object(struct pvm_object object_class, int ssize, int da_size );
+
+//! Size of stack da with n cells
+#define stack_da_size(type,n) (__offsetof(struct data_area_4_##type, stack) + (n) * sizeof(((struct data_area_4_##type *)0)->stack[0]))
 
 
 #define   	page_push(v) 		do { s->stack[s->common.free_cell_ptr++] = v; } while(0)
@@ -35,6 +50,27 @@
 
 #define    	set_me(to) 		do { rootda->common.curr = to; rootda->curr_da = s = (void *)&(to.data->da); } while(0)
 
+#define 	is_contiguous()		no_prev()
+
+// Move all cells to twice as big page, which replaces root's next
+#define grow()                                                              \
+    do {                                                                    \
+        unsigned int __size = s->common.__sSize * 2;                        \
+        struct pvm_object __np = make_sized( __size );                      \
+        __typeof__(s) __ns = (void *)&(__np.data->da);                      \
+        struct pvm_object __old = rootda->common.next;                      \
+                                                                            \
+        memcpy( __ns->stack, s->stack,                                      \
+                s->common.free_cell_ptr * sizeof(s->stack[0]) );            \
+        __ns->common.free_cell_ptr = s->common.free_cell_ptr;               \
+        __ns->common.root = rootda->common.root;                            \
+        s->common.free_cell_ptr = 0;                                        \
+                                                                            \
+        rootda->common.next = __np;                                         \
+        set_me( __np );                                                     \
+        if( __old.data ) ref_dec_o( __old );                                \
+    } while(0)
+
 
 #define check_underflow()     \
     do {                      \
@@ -49,6 +85,7 @@
     do {                                             \
         if( page_is_full() )                         \
         {                                            \
+            if( is_contiguous() ) { grow(); break; } \
             if( no_next() )                          \
                 {                                    \
                 s->common.next = make();             \
@@ -68,9 +105,11 @@
 **/
 
 #define make()  pvm_create_ostack_object()
+#define make_sized(n)  pvm_create_general_stack_object( pvm_get_ostack_class(), (n), stack_da_size(object_stack,(n)) )
 #define set_next_prev()  { pvm_object_da(s->common.next, object_stack)->common.prev = rootda->common.curr; pvm_object_da(s->common.next, object_stack)->common.root = rootda->common.root; }
 
-void pvm_ostack_push( struct data_area_4_object_stack* rootda, struct pvm_object o )
+// Fast path is pvm_ostack_push() in stacks.h
+void pvm_ostack_push_slow( struct data_area_4_object_stack* rootda, struct pvm_object o )
 {
     struct data_area_4_object_stack* s = rootda->curr_da;
     check_overflow();
@@ -78,7 +117,7 @@ void pvm_ostack_push( struct data_area_4_object_stack* rootda, struct pvm_object
     page_push(o);
 }
 
-struct pvm_object pvm_ostack_pop( struct data_area_4_object_stack* rootda )
+struct pvm_object pvm_ostack_pop_slow( struct data_area_4_object_stack* rootda )
 {
     struct data_area_4_object_stack* s = rootda->curr_da;
     check_underflow();
@@ -100,9 +139,25 @@ int pvm_ostack_empty( struct data_area_4_object_stack* rootda )
     return page_is_empty() && no_prev();
 }
 
+// Pages stay linked for reuse
+void pvm_ostack_reset( struct data_area_4_object_stack* rootda )
+{
+    while( !pvm_ostack_empty( rootda ) )
+        ref_dec_o( pvm_ostack_pop( rootda ) );
+}
+
 
 void pvm_ostack_abs_set( struct data_area_4_object_stack* rootda, int abs_pos, struct pvm_object val )
 {
+    struct data_area_4_object_stack* s = rootda->curr_da;
+    if( is_contiguous() )
+    {
+        if( abs_pos < 0 || abs_pos >= s->common.__sSize ) pvm_exec_panic( "o abs_set: out of stack" );
+        if( s->stack[abs_pos].data != 0 ) ref_dec_o( s->stack[abs_pos] );
+        s->stack[abs_pos] = val;
+        return;
+    }
+
     unsigned int pagesize = rootda->common.__sSize;
     struct pvm_object c = rootda->common.root;
 
@@ -121,6 +176,13 @@ void pvm_ostack_abs_set( struct data_area_4_object_stack* rootda, int abs_pos, s
 
 struct pvm_object pvm_ostack_abs_get( struct data_area_4_object_stack* rootda, int abs_pos )
 {
+    struct data_area_4_object_stack* s = rootda->curr_da;
+    if( is_contiguous() )
+    {
+        if( abs_pos < 0 || abs_pos >= s->common.__sSize ) pvm_exec_panic( "o abs_get: out of stack" );
+        return s->stack[abs_pos];
+    }
+
     unsigned int pagesize = rootda->common.__sSize;
     struct pvm_object c = rootda->common.root;
 
@@ -163,19 +225,22 @@ struct pvm_object  pvm_ostack_pull( struct data_area_4_object_stack* rootda, int
 
 #undef make
 #undef set_next_prev
+#undef make_sized
 #define make()  pvm_create_istack_object()
+#define make_sized(n)  pvm_create_general_stack_object( pvm_get_istack_class(), (n), stack_da_size(integer_stack,(n)) )
 #define set_next_prev()  { pvm_object_da(s->common.next, integer_stack)->common.prev = rootda->common.curr; pvm_object_da(s->common.next, integer_stack)->common.root = rootda->common.root; }
 
 
 
-void pvm_istack_push( struct data_area_4_integer_stack* rootda, int o )
+// Fast path is pvm_istack_push() in stacks.h
+void pvm_istack_push_slow( struct data_area_4_integer_stack* rootda, int o )
 {
     struct data_area_4_integer_stack* s = rootda->curr_da;
     check_overflow();
     page_push(o);
 }
 
-int pvm_istack_pop( struct data_area_4_integer_stack* rootda )
+int pvm_istack_pop_slow( struct data_area_4_integer_stack* rootda )
 {
     struct data_area_4_integer_stack* s = rootda->curr_da;
     check_underflow();
@@ -195,6 +260,19 @@ int pvm_istack_empty( struct data_area_4_integer_stack* rootda )
     return page_is_empty() && no_prev();
 }
 
+// Pages stay linked for reuse
+void pvm_istack_reset( struct data_area_4_integer_stack* rootda )
+{
+    struct data_area_4_integer_stack* s = rootda->curr_da;
+
+    while(1)
+    {
+        s->common.free_cell_ptr = 0;
+        if( no_prev() ) break;
+        set_me( s->common.prev );
+    }
+}
+
 
 
 
@@ -202,6 +280,14 @@ int pvm_istack_empty( struct data_area_4_integer_stack* rootda )
 
 void pvm_istack_abs_set( struct data_area_4_integer_stack* rootda, int abs_pos, int val )
 {
+    struct data_area_4_integer_stack* s = rootda->curr_da;
+    if( is_contiguous() )
+    {
+        if( abs_pos < 0 || abs_pos >= s->common.__sSize ) pvm_exec_panic( "i abs_set: out of stack" );
+        s->stack[abs_pos] = val;
+        return;
+    }
+
     unsigned int pagesize = rootda->common.__sSize;
     struct pvm_object c = rootda->common.root;
 
@@ -217,6 +303,13 @@ void pvm_istack_abs_set( struct data_area_4_integer_stack* rootda, int abs_pos,
 
 int pvm_istack_abs_get( struct data_area_4_integer_stack* rootda, int abs_pos )
 {
+    struct data_area_4_integer_stack* s = rootda->curr_da;
+    if( is_contiguous() )
+    {
+        if( abs_pos < 0 || abs_pos >= s->common.__sSize ) pvm_exec_panic( "i abs_get: out of stack" );
+        return s->stack[abs_pos];
+    }
+
     unsigned int pagesize = rootda->common.__sSize;
     struct pvm_object c = rootda->common.root;
 
@@ -268,6 +361,7 @@ int pvm_istack_abs_get( struct data_area_4_integer_stack* rootda, int abs_pos )
     do {                                             \
         if( lpage_is_full() )                         \
         {                                            \
+            if( is_contiguous() ) { grow(); break; } \
             if( no_next() )                          \
                 {                                    \
                 s->common.next = make();             \
@@ -360,8 +454,10 @@ int pvm_istack_abs_get( struct data_area_4_integer_stack* rootda, int abs_pos )
 **/
 
 #undef make
+#undef make_sized
 #undef set_next_prev
 #define make()  pvm_create_estack_object()
+#define make_sized(n)  pvm_create_general_stack_object( pvm_get_estack_class(), (n), stack_da_size(exception_stack,(n)) )
 #define set_next_prev()  { pvm_object_da(s->common.next, exception_stack)->common.prev = rootda->common.curr; pvm_object_da(s->common.next, exception_stack)->common.root = rootda->common.root; }
 
 
@@ -394,6 +490,13 @@ int pvm_estack_empty( struct data_area_4_exception_stack* rootda )
     return page_is_empty() && no_prev();
 }
 
+// Pages stay linked for reuse
+void pvm_estack_reset( struct data_area_4_exception_stack* rootda )
+{
+    while( !pvm_estack_empty( rootda ) )
+        ref_dec_o( pvm_estack_pop( rootda ).object );
+}
+
 
 int e_page_foreach( struct data_area_4_exception_stack* s,
                     void *pass,
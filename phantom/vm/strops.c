@@ -0,0 +1,678 @@
+/**
+ *
+ * Phantom OS
+ *
+ * Copyright (C) 2005-2016 Dmitry Zavalishin, dz@dz.ru
+ *
+ * Byte string primitives: substring find, equality, common prefix,
+ * byte find and Internet checksum (RFC 1071).
+ *
+ * String and binary syscalls, directory and string equality go through pointers
+ * which are set at start to the best version CPU can run: AVX2, SSE2
+ * or portable one. CPUID is asked directly, so that selection works in
+ * kernel and in hosted pvm_test (which can also force version with -s).
+ *
+ * AVX2 is picked only if OS enabled YMM state (OSXSAVE and XCR0), so in
+ * kernel, which saves just FXSAVE area on thread switch and does not
+ * turn XSAVE on, SSE2 is used.
+ *
+ * Find checks first and last needle bytes for 16 (32) positions at
+ * once, whole needle is compared only where both match.
+ *
+ * No intrinsics headers - we are built with -nostdinc - vectors are
+ * GCC vector extensions plus pmovmskb builtins.
+ *
+**/
+
+#define DEBUG_MSG_PREFIX "vm.strops"
+#include <debug_ext.h>
+#define debug_level_flow 6
+#define debug_level_error 10
+#define debug_level_info 10
+
+#include <phantom_libc.h>
+#include <kernel/init.h>
+#include <kernel/debug.h>
+#include <time.h>
+
+#include <vm/internal_da.h>
+
+
+#if VM_STRING_SIMD && (defined(ARCH_ia32) || defined(ARCH_amd64)) && defined(__GNUC__)
+#define STROPS_X86 1
+#else
+#define STROPS_X86 0
+#endif
+
+
+// --------------------------------------------------------------
+// Portable
+// --------------------------------------------------------------
+
+static const char * scalar_find( const char *hay, int hay_len, const char *needle, int needle_len )
+{
+    if( needle_len <= 0 )
+        return hay;
+
+    const char *last = hay + hay_len - needle_len;
+    char first = *needle;
+
+    for( ; hay <= last; hay++ )
+    {
+        if( *hay != first )
+            continue;
+
+        if( 0 == memcmp( hay+1, needle+1, needle_len-1 ) )
+            return hay;
+    }
+
+    return 0;
+}
+
+static int scalar_prefix( const void *a, const void *b, int len )
+{
+    const unsigned char *ca = a;
+    const unsigned char *cb = b;
+    int i = 0;
+
+    while( i < len && ca[i] == cb[i] )
+        i++;
+
+    return i;
+}
+
+static int scalar_equal( const void *a, const void *b, int len )
+{
+    return 0 == memcmp( a, b, len );
+}
+
+static int scalar_find_byte( const void *p, int c, int len )
+{
+    const unsigned char *cp = p;
+    int i;
+
+    for( i = 0; i < len; i++ )
+        if( cp[i] == (unsigned char)c )
+            return i;
+
+    return -1;
+}
+
+// Checksum does not depend on byte order: we sum little endian 16 bit
+// words and swap bytes of result.
+static u_int64_t scalar_csum_sum( const void *p, int len )
+{
+    const unsigned char *cp = p;
+    u_int64_t sum = 0;
+    int i;
+
+    for( i = 0; i + 1 < len; i += 2 )
+        sum += cp[i] | (cp[i+1] << 8);
+
+    if( i < len )
+        sum += cp[i];
+
+    return sum;
+}
+
+static int csum_finish( u_int64_t sum )
+{
+    while( sum >> 16 )
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    sum = ((sum & 0xFF) << 8) | (sum >> 8);
+    return (int)(~sum & 0xFFFF);
+}
+
+static int scalar_checksum( const void *p, int len )
+{
+    return csum_finish( scalar_csum_sum( p, len ) );
+}
+
+
+#if STROPS_X86
+
+// --------------------------------------------------------------
+// SSE2
+// --------------------------------------------------------------
+
+typedef char v16qi __attribute__ ((vector_size (16)));
+typedef char v16qi_u __attribute__ ((vector_size (16), aligned (1)));
+
+typedef char v32qi __attribute__ ((vector_size (32)));
+typedef char v32qi_u __attribute__ ((vector_size (32), aligned (1)));
+
+typedef unsigned v4su __attribute__ ((vector_size (16)));
+typedef unsigned v4su_u __attribute__ ((vector_size (16), aligned (1)));
+
+typedef unsigned v8su __attribute__ ((vector_size (32)));
+typedef unsigned v8su_u __attribute__ ((vector_size (32), aligned (1)));
+
+// Checksum lane gets up to 2*0xFFFF per load, this many loads can't overflow it
+#define CSUM_BLOCK              0x8000
+
+#define SSE2 __attribute__ ((target ("sse2")))
+#define AVX2 __attribute__ ((target ("avx2")))
+
+
+static inline SSE2 v16qi sse2_load( const void *p ) { return *(const v16qi_u *)p; }
+
+// Bit per byte, set if bytes are equal
+static inline SSE2 unsigned sse2_eq_mask( v16qi a, v16qi b )
+{
+    return __builtin_ia32_pmovmskb128( (v16qi)(a == b) );
+}
+
+static inline SSE2 v16qi sse2_splat( char c )
+{
+    v16qi v = { c, c, c, c, c, c, c, c, c, c, c, c, c, c, c, c };
+    return v;
+}
+
+
+static SSE2 int sse2_prefix( const void *a, const void *b, int len )
+{
+    const char *ca = a;
+    const char *cb = b;
+    int i;
+
+    for( i = 0; i + 16 <= len; i += 16 )
+    {
+        unsigned m = sse2_eq_mask( sse2_load( ca+i ), sse2_load( cb+i ) );
+        if( m != 0xFFFF )
+            return i + __builtin_ctz( ~m );
+    }
+
+    // Tail: last 16 bytes again, overlapping part is known to be equal
+    if( i < len && len >= 16 )
+    {
+        unsigned m = sse2_eq_mask( sse2_load( ca+len-16 ), sse2_load( cb+len-16 ) );
+        return (m == 0xFFFF) ? len : len - 16 + __builtin_ctz( ~m );
+    }
+
+    return i + scalar_prefix( ca+i, cb+i, len-i );
+}
+
+static SSE2 int sse2_equal( const void *a, const void *b, int len )
+{
+    const char *ca = a;
+    const char *cb = b;
+    int i;
+
+    if( len < 16 )
+        return scalar_equal( a, b, len );
+
+    for( i = 0; i + 16 <= len; i += 16 )
+    {
+        if( sse2_eq_mask( sse2_load( ca+i ), sse2_load( cb+i ) ) != 0xFFFF )
+            return 0;
+    }
+
+    return sse2_eq_mask( sse2_load( ca+len-16 ), sse2_load( cb+len-16 ) ) == 0xFFFF;
+}
+
+static SSE2 const char * sse2_find( const char *hay, int hay_len, const char *needle, int needle_len )
+{
+    if( needle_len <= 0 )
+        return hay;
+
+    if( needle_len > hay_len )
+        return 0;
+
+    v16qi first = sse2_splat( needle[0] );
+    v16qi last = sse2_splat( needle[needle_len-1] );
+
+    // Bytes between first and last to compare on candidate
+    int mid = needle_len > 2 ? needle_len - 2 : 0;
+    int i;
+
+    // Both loads must be inside hay: i + needle_len - 1 + 16 <= hay_len
+    for( i = 0; i + needle_len + 15 <= hay_len; i += 16 )
+    {
+        unsigned m = sse2_eq_mask( sse2_load( hay+i ), first ) &
+            sse2_eq_mask( sse2_load( hay+i+needle_len-1 ), last );
+
+        while( m )
+        {
+            int pos = i + __builtin_ctz( m );
+            if( sse2_equal( hay+pos+1, needle+1, mid ) )
+                return hay+pos;
+            m &= m - 1;
+        }
+    }
+
+    return scalar_find( hay+i, hay_len-i, needle, needle_len );
+}
+
+static SSE2 int sse2_find_byte( const void *p, int c, int len )
+{
+    const char *cp = p;
+    v16qi v = sse2_splat( c );
+    int i;
+
+    for( i = 0; i + 16 <= len; i += 16 )
+    {
+        unsigned m = sse2_eq_mask( sse2_load( cp+i ), v );
+        if( m )
+            return i + __builtin_ctz( m );
+    }
+
+    int r = scalar_find_byte( cp+i, c, len-i );
+    return r < 0 ? r : i + r;
+}
+
+static SSE2 int sse2_checksum( const void *p, int len )
+{
+    const char *cp = p;
+    u_int64_t sum = 0;
+    int i = 0;
+
+    while( i + 16 <= len )
+    {
+        int end = (len - i) / 16 > CSUM_BLOCK ? i + 16 * CSUM_BLOCK : len;
+        v4su acc = { 0, 0, 0, 0 };
+
+        for( ; i + 16 <= end; i += 16 )
+        {
+            v4su w = *(const v4su_u *)(cp+i);
+            acc += (w & 0xFFFF) + (w >> 16);
+        }
+
+        sum += (u_int64_t)acc[0] + acc[1] + acc[2] + acc[3];
+    }
+
+    return csum_finish( sum + scalar_csum_sum( cp+i, len-i ) );
+}
+
+
+// --------------------------------------------------------------
+// AVX2
+// --------------------------------------------------------------
+
+static inline AVX2 v32qi avx2_load( const void *p ) { return *(const v32qi_u *)p; }
+
+static inline AVX2 unsigned avx2_eq_mask( v32qi a, v32qi b )
+{
+    return (unsigned)__builtin_ia32_pmovmskb256( (v32qi)(a == b) );
+}
+
+static inline AVX2 v32qi avx2_splat( char c )
+{
+    v32qi v = { c, c, c, c, c, c, c, c, c, c, c, c, c, c, c, c,
+                c, c, c, c, c, c, c, c, c, c, c, c, c, c, c, c };
+    return v;
+}
+
+
+static AVX2 int avx2_prefix( const void *a, const void *b, int len )
+{
+    const char *ca = a;
+    const char *cb = b;
+    int i;
+
+    for( i = 0; i + 32 <= len; i += 32 )
+    {
+        unsigned m = avx2_eq_mask( avx2_load( ca+i ), avx2_load( cb+i ) );
+        if( m != 0xFFFFFFFFu )
+            return i + __builtin_ctz( ~m );
+    }
+
+    return i + sse2_prefix( ca+i, cb+i, len-i );
+}
+
+static AVX2 int avx2_equal( const void *a, const void *b, int len )
+{
+    const char *ca = a;
+    const char *cb = b;
+    int i;
+
+    if( len < 32 )
+        return sse2_equal( a, b, len );
+
+    for( i = 0; i + 32 <= len; i += 32 )
+    {
+        if( avx2_eq_mask( avx2_load( ca+i ), avx2_load( cb+i ) ) != 0xFFFFFFFFu )
+            return 0;
+    }
+
+    return avx2_eq_mask( avx2_load( ca+len-32 ), avx2_load( cb+len-32 ) ) == 0xFFFFFFFFu;
+}
+
+static AVX2 const char * avx2_find( const char *hay, int hay_len, const char *needle, int needle_len )
+{
+    if( needle_len <= 0 )
+        return hay;
+
+    if( needle_len > hay_len )
+        return 0;
+
+    v32qi first = avx2_splat( needle[0] );
+    v32qi last = avx2_splat( needle[needle_len-1] );
+
+    int mid = needle_len > 2 ? needle_len - 2 : 0;
+    int i;
+
+    for( i = 0; i + needle_len + 31 <= hay_len; i += 32 )
+    {
+        unsigned m = avx2_eq_mask( avx2_load( hay+i ), first ) &
+            avx2_eq_mask( avx2_load( hay+i+needle_len-1 ), last );
+
+        while( m )
+        {
+            int pos = i + __builtin_ctz( m );
+            if( avx2_equal( hay+pos+1, needle+1, mid ) )
+                return hay+pos;
+            m &= m - 1;
+        }
+    }
+
+    return sse2_find( hay+i, hay_len-i, needle, needle_len );
+}
+
+static AVX2 int avx2_find_byte( const void *p, int c, int len )
+{
+    const char *cp = p;
+    v32qi v = avx2_splat( c );
+    int i;
+
+    for( i = 0; i + 32 <= len; i += 32 )
+    {
+        unsigned m = avx2_eq_mask( avx2_load( cp+i ), v );
+        if( m )
+            return i + __builtin_ctz( m );
+    }
+
+    int r = sse2_find_byte( cp+i, c, len-i );
+    return r < 0 ? r : i + r;
+}
+
+static AVX2 int avx2_checksum( const void *p, int len )
+{
+    const char *cp = p;
+    u_int64_t sum = 0;
+    int i = 0;
+
+    while( i + 32 <= len )
+    {
+        int end = (len - i) / 32 > CSUM_BLOCK ? i + 32 * CSUM_BLOCK : len;
+        v8su acc = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+        for( ; i + 32 <= end; i += 32 )
+        {
+            v8su w = *(const v8su_u *)(cp+i);
+            acc += (w & 0xFFFF) + (w >> 16);
+        }
+
+        sum += (u_int64_t)acc[0] + acc[1] + acc[2] + acc[3] +
+            acc[4] + acc[5] + acc[6] + acc[7];
+    }
+
+    return csum_finish( sum + scalar_csum_sum( cp+i, len-i ) );
+}
+
+
+// --------------------------------------------------------------
+// CPU features
+// --------------------------------------------------------------
+
+static void strops_cpuid( unsigned leaf, unsigned subleaf, unsigned r[4] )
+{
+#if defined(ARCH_ia32)
+    // ebx can be PIC register in hosted build
+    __asm__ volatile( "xchgl %%ebx, %1; cpuid; xchgl %%ebx, %1"
+                      : "=a" (r[0]), "=&r" (r[1]), "=c" (r[2]), "=d" (r[3])
+                      : "0" (leaf), "2" (subleaf) );
+#else
+    __asm__ volatile( "cpuid"
+                      : "=a" (r[0]), "=b" (r[1]), "=c" (r[2]), "=d" (r[3])
+                      : "0" (leaf), "2" (subleaf) );
+#endif
+}
+
+static int strops_have_sse2( void )
+{
+    unsigned r[4];
+
+#if defined(ARCH_amd64)
+    // Always there
+    (void) r;
+    return 1;
+#else
+    strops_cpuid( 0, 0, r );
+    if( r[0] < 1 ) return 0;
+
+    strops_cpuid( 1, 0, r );
+    return 0 != (r[3] & (1u << 26));
+#endif
+}
+
+static int strops_have_avx2( void )
+{
+    unsigned r[4];
+
+    strops_cpuid( 0, 0, r );
+    unsigned max_leaf = r[0];
+    if( max_leaf < 7 ) return 0;
+
+    strops_cpuid( 1, 0, r );
+    // OSXSAVE and AVX
+    if( (r[2] & ((1u << 27)|(1u << 28))) != ((1u << 27)|(1u << 28)) )
+        return 0;
+
+    // OS saves XMM and YMM state?
+    unsigned xcr0_lo, xcr0_hi;
+    __asm__ volatile( "xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0) );
+    (void) xcr0_hi;
+    if( (xcr0_lo & 6) != 6 )
+        return 0;
+
+    strops_cpuid( 7, 0, r );
+    return 0 != (r[1] & (1u << 5));
+}
+
+#endif // STROPS_X86
+
+
+// --------------------------------------------------------------
+// Selection
+// --------------------------------------------------------------
+
+struct pvm_strops
+{
+    const char *        name;
+    const char *        (*find)( const char *hay, int hay_len, const char *needle, int needle_len );
+    int                 (*equal)( const void *a, const void *b, int len );
+    int                 (*prefix)( const void *a, const void *b, int len );
+    int                 (*find_byte)( const void *p, int c, int len );
+    int                 (*checksum)( const void *p, int len );
+    int                 (*supported)( void );
+};
+
+static int strops_always( void ) { return 1; }
+
+// Best last
+static const struct pvm_strops strops[] =
+{
+    { "scalar", scalar_find, scalar_equal, scalar_prefix, scalar_find_byte, scalar_checksum, strops_always },
+#if STROPS_X86
+    { "sse2", sse2_find, sse2_equal, sse2_prefix, sse2_find_byte, sse2_checksum, strops_have_sse2 },
+    { "avx2", avx2_find, avx2_equal, avx2_prefix, avx2_find_byte, avx2_checksum, strops_have_avx2 },
+#endif
+};
+
+#define N_STROPS ((int)(sizeof(strops)/sizeof(struct pvm_strops)))
+
+
+const char * (*pvm_str_find)( const char *hay, int hay_len, const char *needle, int needle_len ) = scalar_find;
+int (*pvm_str_equal)( const void *a, const void *b, int len ) = scalar_equal;
+int (*pvm_str_prefix)( const void *a, const void *b, int len ) = scalar_prefix;
+int (*pvm_mem_find_byte)( const void *p, int c, int len ) = scalar_find_byte;
+int (*pvm_mem_checksum)( const void *p, int len ) = scalar_checksum;
+
+static const char *strops_selected = "scalar";
+
+
+static void strops_set( const struct pvm_strops *s )
+{
+    pvm_str_find = s->find;
+    pvm_str_equal = s->equal;
+    pvm_str_prefix = s->prefix;
+    pvm_mem_find_byte = s->find_byte;
+    pvm_mem_checksum = s->checksum;
+    strops_selected = s->name;
+}
+
+int pvm_strops_select( const char *name )
+{
+    int i;
+
+    for( i = 0; i < N_STROPS; i++ )
+    {
+        if( strcmp( strops[i].name, name ) )
+            continue;
+
+        if( !strops[i].supported() )
+            return ENXIO;
+
+        strops_set( strops + i );
+        SHOW_FLOW( 1, "string ops: %s", strops_selected );
+        return 0;
+    }
+
+    return EINVAL;
+}
+
+
+static void dbg_str_bench( int ac, char **av );
+
+static void pvm_strops_init(void)
+{
+    int i;
+
+    for( i = N_STROPS-1; i > 0; i-- )
+        if( strops[i].supported() )
+            break;
+
+    strops_set( strops + i );
+    SHOW_FLOW( 1, "string ops: %s", strops_selected );
+
+    dbg_add_command( dbg_str_bench, "strbench", "strbench [kbytes] - compare string and byte array primitive implementations on large data");
+}
+
+INIT_ME( 0, pvm_strops_init, 0 )
+
+
+
+// --------------------------------------------------------------
+// Benchmark
+// --------------------------------------------------------------
+
+#define STRBENCH_KB             1024
+#define STRBENCH_RUNS           16
+#define STRBENCH_NEEDLE         24
+
+// Loops we had before: strnstrn, memcmp and byte compare
+static const char * old_find( const char *hay, int hay_len, const char *needle, int needle_len )
+{
+    return strnstrn( hay, hay_len, needle, needle_len );
+}
+
+
+
+static void strbench_one( const char *name, const struct pvm_strops *s, char *hay, char *copy, int len, const char *needle )
+{
+    bigtime_t tf, te, tp, tb, tc;
+    int r, bad = 0;
+
+    bigtime_t start = hal_system_time();
+    for( r = 0; r < STRBENCH_RUNS; r++ )
+        if( s->find( hay, len, needle, STRBENCH_NEEDLE ) != hay + len - STRBENCH_NEEDLE )
+            bad++;
+    tf = hal_system_time() - start;
+
+    start = hal_system_time();
+    for( r = 0; r < STRBENCH_RUNS; r++ )
+        if( !s->equal( hay, copy, len ) )
+            bad++;
+    te = hal_system_time() - start;
+
+    // Differs in last byte
+    copy[len-1] ^= 1;
+    start = hal_system_time();
+    for( r = 0; r < STRBENCH_RUNS; r++ )
+        if( s->prefix( hay, copy, len ) != len-1 || s->equal( hay, copy, len ) )
+            bad++;
+    tp = hal_system_time() - start;
+    copy[len-1] ^= 1;
+
+    // Hay is lower case letters only
+    copy[len-1] = '*';
+    start = hal_system_time();
+    for( r = 0; r < STRBENCH_RUNS; r++ )
+        if( s->find_byte( copy, '*', len ) != len-1 )
+            bad++;
+    tb = hal_system_time() - start;
+    copy[len-1] = hay[len-1];
+
+    int sum = scalar_checksum( hay, len );
+    start = hal_system_time();
+    for( r = 0; r < STRBENCH_RUNS; r++ )
+        if( s->checksum( hay, len ) != sum )
+            bad++;
+    tc = hal_system_time() - start;
+
+    printf("  %-8s %10ld %10ld %10ld %10ld %10ld %s\n", name, (long)tf, (long)te, (long)tp, (long)tb, (long)tc, bad ? " WRONG RESULT" : "" );
+}
+
+static void dbg_str_bench( int ac, char **av )
+{
+    int kb = STRBENCH_KB;
+    int i;
+
+    if( ac > 1 )
+        kb = atoi( av[1] );
+
+    if( kb <= 0 )
+    {
+        printf("strbench: size must be positive\n");
+        return;
+    }
+
+    int len = kb * 1024;
+    char *hay = malloc( len );
+    char *copy = malloc( len );
+
+    if( 0 == hay || 0 == copy )
+    {
+        printf("strbench: out of memory\n");
+        if( hay ) free( hay );
+        if( copy ) free( copy );
+        return;
+    }
+
+    // Text-like hay, needle is at the very end
+    unsigned seed = 12345;
+    for( i = 0; i < len; i++ )
+    {
+        seed = seed * 1103515245 + 12345;
+        hay[i] = 'a' + (seed >> 16) % 26;
+    }
+
+    memcpy( copy, hay, len );
+    const char *needle = hay + len - STRBENCH_NEEDLE;
+
+    printf("%d Kb x %d runs, usec; now using %s\n", kb, STRBENCH_RUNS, strops_selected );
+    printf("  impl           find     equals     prefix   find_byte   checksum\n");
+
+    struct pvm_strops old = { "old", old_find, scalar_equal, scalar_prefix, scalar_find_byte, scalar_checksum, strops_always };
+    strbench_one( old.name, &old, hay, copy, len, needle );
+
+    for( i = 0; i < N_STROPS; i++ )
+    {
+        if( strops[i].supported() )
+            strbench_one( strops[i].name, strops + i, hay, copy, len, needle );
+    }
+
+    free( hay );
+    free( copy );
+}
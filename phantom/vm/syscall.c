@@ -94,7 +94,7 @@ static int debug_print = 0;
 int invalid_syscall(struct pvm_object o, struct data_area_4_thread *tc )
 {
     DEBUG_INFO;
-printf("invalid syscal for object: "); dumpo( (addr_t)(o.data) );//pvm_object_print( o ); printf("\n");
+printf("invalid syscal for object: "); pvm_object_dump( o );//pvm_object_print( o ); printf("\n");
 //printf("invalid value's class: "); pvm_object_print( o.data->_class); printf("\n");
     SYSCALL_THROW_STRING( "invalid syscall called" );
 }
@@ -124,7 +124,7 @@ int si_void_2_class(struct pvm_object this_obj, struct data_area_4_thread *tc )
 {
     DEBUG_INFO;
     //ref_inc_o( this_obj.data->_class );  //increment if class is refcounted
-    SYSCALL_RETURN(this_obj.data->_class);
+    SYSCALL_RETURN(pvm_get_class( this_obj ));
 }
 
 int si_void_3_clone(struct pvm_object o, struct data_area_4_thread *tc )
@@ -189,6 +189,11 @@ int si_void_9_def_op_2(struct pvm_object o, struct data_area_4_thread *tc )
 int si_void_15_hashcode(struct pvm_object me, struct data_area_4_thread *tc )
 {
     DEBUG_INFO;
+
+    // Strings cache it
+    if( IS_PHANTOM_STRING(me) )
+        SYSCALL_RETURN(pvm_create_int_object( pvm_string_hashcode( me ) ));
+
     size_t os = me.data->_da_size;
     void *oa = me.data->da;
 
@@ -235,8 +240,8 @@ static int si_int_4_equals(struct pvm_object me, struct data_area_4_thread *tc )
 
     struct pvm_object him = POP_ARG;
 
-    int same_class = me.data->_class.data == him.data->_class.data;
-    int same_value = pvm_get_int(me) == pvm_get_int(him);
+    int same_class = IS_PHANTOM_INT(him);
+    int same_value = same_class && (pvm_get_int(me) == pvm_get_int(him));
 
     SYS_FREE_O(him);
 
@@ -260,6 +265,16 @@ static int si_int_6_toXML(struct pvm_object me, struct data_area_4_thread *tc )
     SYSCALL_THROW_STRING( "int toXML called" );
 }
 
+// Same as si_void_15_hashcode gives for boxed int
+static int si_int_15_hashcode(struct pvm_object me, struct data_area_4_thread *tc )
+{
+    DEBUG_INFO;
+    int v = pvm_get_int(me);
+    void *oa = &v;
+
+    SYSCALL_RETURN(pvm_create_int_object( calc_hash( oa, oa+sizeof(v) ) ));
+}
+
 
 syscall_func_t	syscall_table_4_int[16] =
 {
@@ -271,7 +286,7 @@ syscall_func_t	syscall_table_4_int[16] =
     &si_void_8_def_op_1,            	&si_void_9_def_op_2,
     &invalid_syscall,               	&invalid_syscall,
     &invalid_syscall,               	&invalid_syscall,
-    &invalid_syscall,               	&si_void_15_hashcode
+    &invalid_syscall,               	&si_int_15_hashcode
 };
 //int	n_syscall_table_4_int =	(sizeof syscall_table_4_int) / sizeof(syscall_func_t);
 DECLARE_SIZE(int);
@@ -302,7 +317,7 @@ static int si_long_4_equals(struct pvm_object me, struct data_area_4_thread *tc
 
     struct pvm_object him = POP_ARG;
 
-    int same_class = me.data->_class.data == him.data->_class.data;
+    int same_class = pvm_get_class( me ).data == pvm_get_class( him ).data;
     int same_value = pvm_get_long(me) == pvm_get_long(him);
 
     SYS_FREE_O(him);
@@ -362,7 +377,7 @@ static int si_float_4_equals(struct pvm_object me, struct data_area_4_thread *tc
 
     struct pvm_object him = POP_ARG;
 
-    int same_class = me.data->_class.data == him.data->_class.data;
+    int same_class = pvm_get_class( me ).data == pvm_get_class( him ).data;
     int same_value = pvm_get_float(me) == pvm_get_float(him);
 
     SYS_FREE_O(him);
@@ -423,7 +438,7 @@ static int si_double_4_equals(struct pvm_object me, struct data_area_4_thread *t
 
     struct pvm_object him = POP_ARG;
 
-    int same_class = me.data->_class.data == him.data->_class.data;
+    int same_class = pvm_get_class( me ).data == pvm_get_class( him ).data;
     int same_value = pvm_get_double(me) == pvm_get_double(him);
 
     SYS_FREE_O(him);
@@ -503,14 +518,9 @@ static int si_string_4_equals(struct pvm_object me, struct data_area_4_thread *t
     {
         ASSERT_STRING(him);
 
-        struct data_area_4_string *meda = pvm_object_da( me, string );
-        struct data_area_4_string *himda = pvm_object_da( him, string );
-
         ret =
-            me.data->_class.data == him.data->_class.data &&
-            meda->length == himda->length &&
-            0 == strncmp( (const char*)meda->data, (const char*)himda->data, meda->length )
-            ;
+            pvm_get_class( me ).data == pvm_get_class( him ).data &&
+            pvm_string_equals( me, him );
     }
     SYS_FREE_O(him);
 
@@ -581,14 +591,12 @@ static int si_string_10_concat(struct pvm_object me, struct data_area_4_thread *
     CHECK_PARAM_COUNT(n_param, 1);
 
     struct pvm_object him = POP_ARG;
-    ASSERT_STRING(him);
-
-    struct data_area_4_string *meda = pvm_object_da( me, string );
-    struct data_area_4_string *himda = pvm_object_da( him, string );
+    // Don't flatten, rope can be a part of other rope
+    if( !IS_PHANTOM_ROPE(him) )
+        ASSERT_STRING(him);
 
-    pvm_object_t ret = pvm_create_string_object_binary_cat(
-    		(char *)meda->data, meda->length,
-                (char *)himda->data, himda->length );
+    // Flat string if short, rope otherwise
+    pvm_object_t ret = pvm_string_concat( me, him );
 
     SYS_FREE_O(him);
 
@@ -621,7 +629,7 @@ static int si_string_12_find(struct pvm_object me, struct data_area_4_thread *tc
     struct data_area_4_string *meda = pvm_object_da( me, string );
     struct data_area_4_string *himda = pvm_object_da( him, string );
 
-    unsigned char * ret = (unsigned char *)strnstrn(
+    unsigned char * ret = (unsigned char *)pvm_str_find(
     		(char *)meda->data, meda->length,
                 (char *)himda->data, himda->length );
 
@@ -652,6 +660,76 @@ DECLARE_SIZE(string);
 
 
 
+// --------- rope -----------------------------------------------------------
+
+// Rope is a string made by concat. Anything but concat and length
+// is done by string code on rope's flat copy.
+
+static int si_rope_3_clone(struct pvm_object me, struct data_area_4_thread *tc )
+{
+    return si_string_3_clone( pvm_rope_flat( me ), tc );
+}
+
+static int si_rope_4_equals(struct pvm_object me, struct data_area_4_thread *tc )
+{
+    return si_string_4_equals( pvm_rope_flat( me ), tc );
+}
+
+static int si_rope_5_tostring(struct pvm_object me, struct data_area_4_thread *tc )
+{
+    DEBUG_INFO;
+    SYSCALL_RETURN( ref_inc_o( pvm_rope_flat( me ) ) );
+}
+
+static int si_rope_8_substring(struct pvm_object me, struct data_area_4_thread *tc )
+{
+    return si_string_8_substring( pvm_rope_flat( me ), tc );
+}
+
+static int si_rope_9_charat(struct pvm_object me, struct data_area_4_thread *tc )
+{
+    return si_string_9_charat( pvm_rope_flat( me ), tc );
+}
+
+static int si_rope_11_length(struct pvm_object me, struct data_area_4_thread *tc )
+{
+    DEBUG_INFO;
+    struct data_area_4_rope *meda = pvm_object_da( me, rope );
+
+    int n_param = POP_ISTACK;
+    CHECK_PARAM_COUNT(n_param, 0);
+
+    SYSCALL_RETURN(pvm_create_int_object( meda->length ));
+}
+
+static int si_rope_12_find(struct pvm_object me, struct data_area_4_thread *tc )
+{
+    return si_string_12_find( pvm_rope_flat( me ), tc );
+}
+
+static int si_rope_15_hashcode(struct pvm_object me, struct data_area_4_thread *tc )
+{
+    // Same as for string with same content
+    return si_void_15_hashcode( pvm_rope_flat( me ), tc );
+}
+
+
+syscall_func_t	syscall_table_4_rope[16] =
+{
+    &si_void_0_construct,           &si_void_1_destruct,
+    &si_void_2_class,               &si_rope_3_clone,
+    &si_rope_4_equals,              &si_rope_5_tostring,
+    &si_void_6_toXML,               &si_void_7_fromXML,
+    // 8
+    &si_rope_8_substring,           &si_rope_9_charat,
+    &si_string_10_concat,           &si_rope_11_length,
+    &si_rope_12_find,               &invalid_syscall,
+    &invalid_syscall,               &si_rope_15_hashcode
+};
+DECLARE_SIZE(rope);
+
+
+
 
 
 // --------- thread ---------------------------------------------------------
@@ -1450,6 +1528,31 @@ static int si_array_12_size(struct pvm_object me, struct data_area_4_thread *tc
     SYSCALL_RETURN(pvm_create_int_object( da->used_slots ) );
 }
 
+static int si_array_13_reserve(struct pvm_object me, struct data_area_4_thread *tc )
+{
+    DEBUG_INFO;
+    int n_param = POP_ISTACK;
+    CHECK_PARAM_COUNT(n_param, 1);
+
+    int capacity = POP_INT();
+
+    if( capacity < 0 )
+        SYSCALL_THROW_STRING( "array reserve - negative capacity" );
+
+    pvm_reserve_array( me.data, capacity );
+    SYSCALL_RETURN_NOTHING;
+}
+
+static int si_array_14_trim(struct pvm_object me, struct data_area_4_thread *tc )
+{
+    DEBUG_INFO;
+    int n_param = POP_ISTACK;
+    CHECK_PARAM_COUNT(n_param, 0);
+
+    pvm_trim_array( me.data );
+    SYSCALL_RETURN_NOTHING;
+}
+
 
 
 
@@ -1462,8 +1565,8 @@ syscall_func_t	syscall_table_4_array[16] =
     // 8
     &si_array_8_get_iterator,       &si_array_9_get_subarray,
     &si_array_10_get,               &si_array_11_set,
-    &si_array_12_size,               &invalid_syscall,
-    &invalid_syscall,               &si_void_15_hashcode
+    &si_array_12_size,              &si_array_13_reserve,
+    &si_array_14_trim,              &si_void_15_hashcode
     // 16
 
 };
@@ -1528,6 +1631,17 @@ static int si_binary_9_setbyte(struct pvm_object me, struct data_area_4_thread *
     SYSCALL_RETURN_NOTHING;
 }
 
+// Range pos, len is inside of binary of given size, can't overflow
+static inline int binary_range_ok( unsigned int pos, unsigned int len, int size )
+{
+    return pos <= (unsigned)size && len <= (unsigned)size - pos;
+}
+
+static inline int binary_size( struct pvm_object o )
+{
+    return o.data->_da_size - sizeof( struct data_area_4_binary );
+}
+
 // setrange( binary source, int from pos, int topos, int len )
 static int si_binary_10_setrange(struct pvm_object me, struct data_area_4_thread *tc )
 {
@@ -1538,44 +1652,168 @@ static int si_binary_10_setrange(struct pvm_object me, struct data_area_4_thread
     unsigned int frompos = POP_INT();
     unsigned int topos = POP_INT();
 
-    // TODO assert his class!!
     struct pvm_object _src = POP_ARG;
-    struct data_area_4_binary *src = pvm_object_da( _src, binary );
 
+    if( !pvm_object_class_exactly_is( _src, pvm_get_binary_class() ) )
+    {
+        SYS_FREE_O(_src);
+        SYSCALL_THROW_STRING( "binary copy src is not binary" );
+    }
 
-    int size = me.data->_da_size - sizeof( struct data_area_4_binary );
+    struct data_area_4_binary *src = pvm_object_da( _src, binary );
 
-    //if( topos < 0 || topos+len > size )
-    if( topos+len > size )
+    if( !binary_range_ok( topos, len, binary_size( me ) ) )
+    {
+        SYS_FREE_O(_src);
         SYSCALL_THROW_STRING( "binary copy dest index/len out of bounds" );
+    }
 
-    int src_size = _src.data->_da_size - sizeof( struct data_area_4_binary );
-
-    //if( frompos < 0 || frompos+len > src_size )
-    if( frompos+len > src_size )
+    if( !binary_range_ok( frompos, len, binary_size( _src ) ) )
+    {
+        SYS_FREE_O(_src);
         SYSCALL_THROW_STRING( "binary copy src index/len out of bounds" );
+    }
 
-    //da->data[index] = byte;
-    memcpy( (da->data)+topos, (src->data)+frompos, len );
+    // Can be copy inside of one binary
+    memmove( (da->data)+topos, (src->data)+frompos, len );
 
     SYS_FREE_O(_src);
 
     SYSCALL_RETURN_NOTHING;
 }
 
+// fill( int value, int pos, int len )
+static int si_binary_11_fill(struct pvm_object me, struct data_area_4_thread *tc )
+{
+    DEBUG_INFO;
+    struct data_area_4_binary *da = pvm_object_da( me, binary );
+
+    int n_param = POP_ISTACK;
+    CHECK_PARAM_COUNT(n_param, 3);
+
+    unsigned int len = POP_INT();
+    unsigned int pos = POP_INT();
+    int value = POP_INT();
+
+    if( !binary_range_ok( pos, len, binary_size( me ) ) )
+        SYSCALL_THROW_STRING( "binary fill index/len out of bounds" );
+
+    memset( da->data + pos, value, len );
+
+    SYSCALL_RETURN_NOTHING;
+}
+
+// compare( binary other, int pos, int otherpos, int len ) - returns -1, 0 or 1
+static int si_binary_12_compare(struct pvm_object me, struct data_area_4_thread *tc )
+{
+    DEBUG_INFO;
+    struct data_area_4_binary *da = pvm_object_da( me, binary );
+
+    int n_param = POP_ISTACK;
+    CHECK_PARAM_COUNT(n_param, 4);
+
+    unsigned int len = POP_INT();
+    unsigned int otherpos = POP_INT();
+    unsigned int pos = POP_INT();
+
+    struct pvm_object _other = POP_ARG;
+
+    if( !pvm_object_class_exactly_is( _other, pvm_get_binary_class() ) )
+    {
+        SYS_FREE_O(_other);
+        SYSCALL_THROW_STRING( "binary compare with not binary" );
+    }
+
+    struct data_area_4_binary *other = pvm_object_da( _other, binary );
+
+    if( !binary_range_ok( pos, len, binary_size( me ) ) ||
+        !binary_range_ok( otherpos, len, binary_size( _other ) ) )
+    {
+        SYS_FREE_O(_other);
+        SYSCALL_THROW_STRING( "binary compare index/len out of bounds" );
+    }
+
+    const unsigned char *a = da->data + pos;
+    const unsigned char *b = other->data + otherpos;
+
+    int same = pvm_str_prefix( a, b, len );
+    int ret = 0;
+
+    if( same < (int)len )
+        ret = (a[same] < b[same]) ? -1 : 1;
+
+    SYS_FREE_O(_other);
+
+    SYSCALL_RETURN(pvm_create_int_object( ret ));
+}
+
+// find( int value, int pos, int len ) - returns index of byte or -1
+static int si_binary_13_find(struct pvm_object me, struct data_area_4_thread *tc )
+{
+    DEBUG_INFO;
+    struct data_area_4_binary *da = pvm_object_da( me, binary );
+
+    int n_param = POP_ISTACK;
+    CHECK_PARAM_COUNT(n_param, 3);
+
+    unsigned int len = POP_INT();
+    unsigned int pos = POP_INT();
+    int value = POP_INT();
+
+    if( !binary_range_ok( pos, len, binary_size( me ) ) )
+        SYSCALL_THROW_STRING( "binary find index/len out of bounds" );
+
+    int ret = pvm_mem_find_byte( da->data + pos, value & 0xFF, len );
+
+    SYSCALL_RETURN(pvm_create_int_object( ret < 0 ? -1 : (int)pos + ret ));
+}
+
+// checksum( int pos, int len ) - Internet (RFC 1071) checksum of range
+static int si_binary_14_checksum(struct pvm_object me, struct data_area_4_thread *tc )
+{
+    DEBUG_INFO;
+    struct data_area_4_binary *da = pvm_object_da( me, binary );
+
+    int n_param = POP_ISTACK;
+    CHECK_PARAM_COUNT(n_param, 2);
+
+    unsigned int len = POP_INT();
+    unsigned int pos = POP_INT();
+
+    if( !binary_range_ok( pos, len, binary_size( me ) ) )
+        SYSCALL_THROW_STRING( "binary checksum index/len out of bounds" );
+
+    SYSCALL_RETURN(pvm_create_int_object( pvm_mem_checksum( da->data + pos, len ) ));
+}
+
+static int si_binary_16_size(struct pvm_object me, struct data_area_4_thread *tc )
+{
+    DEBUG_INFO;
+
+    int n_param = POP_ISTACK;
+    CHECK_PARAM_COUNT(n_param, 0);
 
-syscall_func_t	syscall_table_4_binary[16] =
+    SYSCALL_RETURN(pvm_create_int_object( binary_size( me ) ));
+}
+
+
+syscall_func_t	syscall_table_4_binary[24] =
 {
     &si_void_0_construct,           &si_void_1_destruct,
     &si_void_2_class,               &si_void_3_clone,
     &si_void_4_equals,              &si_binary_5_tostring,
     &si_void_6_toXML,               &si_void_7_fromXML,
     // 8
-    &si_binary_8_getbyte, &si_binary_9_setbyte,
-    &si_binary_10_setrange, &invalid_syscall,
-    &invalid_syscall,               &invalid_syscall,
-    &invalid_syscall,               &si_void_15_hashcode
+    &si_binary_8_getbyte,           &si_binary_9_setbyte,
+    &si_binary_10_setrange,         &si_binary_11_fill,
+    &si_binary_12_compare,          &si_binary_13_find,
+    &si_binary_14_checksum,         &si_void_15_hashcode,
     // 16
+    &si_binary_16_size,             &invalid_syscall,
+    &invalid_syscall,               &invalid_syscall,
+    &invalid_syscall,               &invalid_syscall,
+    &invalid_syscall,               &invalid_syscall
+    // 24
 
 };
 DECLARE_SIZE(binary);
@@ -1893,7 +2131,7 @@ static int si_directory_8_put(struct pvm_object o, struct data_area_4_thread *tc
     struct pvm_object key = POP_ARG;
     ASSERT_STRING(key);
 
-    errno_t rc = hdir_add( da, pvm_get_str_data(key), pvm_get_str_len(key), val );
+    errno_t rc = hdir_add_key( da, key, val );
 
     SYS_FREE_O(key); // dir code creates it's own binary object
     if( rc ) SYS_FREE_O( val ); // we didn't put it there
@@ -1910,7 +2148,7 @@ static int si_directory_9_get(struct pvm_object o, struct data_area_4_thread *tc
     ASSERT_STRING(key);
 
     pvm_object_t out;
-    errno_t rc = hdir_find( da, pvm_get_str_data(key), pvm_get_str_len(key), &out, 0 );
+    errno_t rc = hdir_find_key( da, key, &out, 0 );
     if( rc )
         SYSCALL_RETURN_NOTHING;
     else
@@ -1926,8 +2164,9 @@ static int si_directory_10_remove(struct pvm_object o, struct data_area_4_thread
     struct pvm_object key = POP_ARG;
     ASSERT_STRING(key);
 
-    pvm_object_t out; // unused
-    errno_t rc = hdir_find( da, pvm_get_str_data(key), pvm_get_str_len(key), &out, 1 );
+    pvm_object_t out;
+    errno_t rc = hdir_find_key( da, key, &out, 1 );
+    if( !rc ) SYS_FREE_O( out ); // we got dir's reference to removed value
     SYSCALL_RETURN(pvm_create_int_object( rc ));
 }
 
@@ -1992,6 +2231,9 @@ static int si_connection_8_connect(struct pvm_object o, struct data_area_4_threa
 
     pvm_object_t _s = POP_ARG;
 
+    if( IS_PHANTOM_ROPE(_s) )
+        _s = pvm_rope_release_flat(_s);
+
     if(!IS_PHANTOM_STRING(_s))
     {
         SYS_FREE_O(_s);
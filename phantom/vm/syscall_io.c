@@ -44,7 +44,7 @@ static int io_2_class(struct pvm_object this_obj, struct data_area_4_thread *tc
 {
     DEBUG_INFO;
     //ref_inc_o( this_obj.data->_class );  //increment if class is refcounted
-    SYSCALL_RETURN(this_obj.data->_class);
+    SYSCALL_RETURN(pvm_get_class(this_obj));
 }
 
 static int io_3_clone(struct pvm_object o, struct data_area_4_thread *tc )
@@ -394,6 +394,11 @@ void wire_page_for_addr( void *addr, size_t len ) {}
 void unwire_page_for_addr( void *addr, size_t len ) {}
 
 
+void *jit_alloc_exec( size_t size ) { return win_hal_alloc_exec( size ); }
+
+void jit_free_exec( void *mem, size_t size ) { (void) size; win_hal_free_exec( mem ); }
+
+
 struct wtty *get_thread_ctty( struct phantom_thread *t )
 {
     return 0;
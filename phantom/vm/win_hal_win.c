@@ -104,6 +104,18 @@ int win_hal_mutex_is_locked(void *_m)
 }
 
 
+// JIT code memory
+void * win_hal_alloc_exec( size_t size )
+{
+    return VirtualAlloc( 0, size, MEM_COMMIT|MEM_RESERVE, PAGE_EXECUTE_READWRITE );
+}
+
+void win_hal_free_exec( void *mem )
+{
+    VirtualFree( mem, 0, MEM_RELEASE );
+}
+
+
 //extern int errno;
 #include <errno.h>
 //errno_t k_write( int *nwritten, int fd, const void *addr, int count )
@@ -40,5 +40,8 @@ int win_hal_mutex_lock(void *_m);
 int win_hal_mutex_unlock(void *_m);
 int win_hal_mutex_is_locked(void *_m);
 
+void * win_hal_alloc_exec( size_t size );
+void win_hal_free_exec( void *mem );
+
 
 
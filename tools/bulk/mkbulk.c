@@ -5,6 +5,10 @@
 
 FILE *outf;
 
+// pvm_specific.c
+void save_hdr( char *classnm, long size );
+void save_index( int n, char **names, long *sizes );
+
 int fn2cn( char *out, const char *in, int outsz )
 {
     char *p;
@@ -113,19 +117,24 @@ int main( int ac, char **av )
 
     //printf("Writing bulk to %s: ", outfn);
 
+    // Index goes first and needs all the names and sizes
+    const char **infns = calloc( ac, sizeof(char *) );
+    char **cns = calloc( ac, sizeof(char *) );
+    long *sizes = calloc( ac, sizeof(long) );
+    int n = 0;
 
     while( ac-- )
     {
         const char *infn = *av++;
 
-        const cns = 1024;
-        char cn[cns];
-        int fail = fn2cn( cn, infn, cns );
+        const int cnsz = 1024;
+        char cn[cnsz];
+        int fail = fn2cn( cn, infn, cnsz );
 
         if(fail) continue;
 
         FILE *inf = fopen( infn, "rb" );
-        if( outf == NULL )
+        if( inf == NULL )
         {
             printf("can't open %s, skip%c ", infn, ac == 0 ? ' ' : ',');
             continue;
@@ -140,11 +149,29 @@ int main( int ac, char **av )
             continue;
         }
 
-        long size = ftell(inf);
-
         // TODO read class name from the class file!
-        save_hdr( cn, size );
-        copyf( outf, inf, (int)size );
+        infns[n] = infn;
+        cns[n] = strdup( cn );
+        sizes[n] = ftell(inf);
+        n++;
+
+        fclose( inf );
+    }
+
+    save_index( n, cns, sizes );
+
+    int i;
+    for( i = 0; i < n; i++ )
+    {
+        FILE *inf = fopen( infns[i], "rb" );
+        if( inf == NULL )
+        {
+            printf("can't reopen %s\n", infns[i]);
+            exit(2);
+        }
+
+        save_hdr( cns[i], sizes[i] );
+        copyf( outf, inf, (int)sizes[i] );
 
         if(ferror(inf) || ferror(outf))
         {
@@ -14,4 +14,45 @@ void save_hdr( char *classnm, long size )
     fwrite( &h, sizeof(h), 1, outf );
 }
 
+// Index is written first, class records with given names and sizes must follow it
+void save_index( int n, char **names, long *sizes )
+{
+    struct pvm_bulk_index_head ih;
+    u_int32_t n_slots = 1;
+
+    while( n_slots < 2 * (u_int32_t)n )
+        n_slots <<= 1;
+
+    struct pvm_bulk_index_slot *slots = calloc( n_slots, sizeof(struct pvm_bulk_index_slot) );
+    long index_len = sizeof(ih) + n_slots * sizeof(struct pvm_bulk_index_slot);
+    long pos = sizeof(struct pvm_bulk_class_head) + index_len;
+    int i;
+
+    for( i = 0; i < n; i++ )
+    {
+        u_int32_t hash = pvm_bulk_name_hash( names[i] );
+        u_int32_t s = hash & (n_slots-1);
+
+        // Duplicates go after the first one, as in sequential scan
+        while( slots[s].head_offset )
+            s = (s+1) & (n_slots-1);
+
+        slots[s].hash = hash;
+        slots[s].head_offset = pos;
+
+        pos += sizeof(struct pvm_bulk_class_head) + sizes[i];
+    }
+
+    ih.magic = PVM_BULK_INDEX_MAGIC;
+    ih.version = PVM_BULK_INDEX_VERSION;
+    ih.n_slots = n_slots;
+    ih.n_classes = n;
+
+    save_hdr( PVM_BULK_INDEX_NAME, index_len );
+    fwrite( &ih, sizeof(ih), 1, outf );
+    fwrite( slots, sizeof(struct pvm_bulk_index_slot), n_slots, outf );
+
+    free( slots );
+}
+
 
@@ -1,6 +1,7 @@
 package ru.dz.phantom.mkbulk;
 
 import java.io.*;
+import java.util.ArrayList;
 
 /**
  * The Phantom bulk maker.
@@ -19,6 +20,15 @@ class Main {
 	final static int header_size = 512;
 	static String[] cl_arguments = new String[max_classes_in_bulk];
 
+	// See include/vm/bulk.h
+	final static String index_name = "phantom.bulk.index";
+	final static int index_magic = 0x78644942;
+	final static int index_version = 1;
+	final static int class_head_size = header_size + 4;
+
+	// Class files to write, index goes before them and needs all the names and sizes
+	static ArrayList<byte[]> classes = new ArrayList<byte[]>();
+
 	/**
 	 * @param args
 	 */
@@ -71,7 +81,7 @@ class Main {
 
 			if (IsNotPCExtensionOf(fn)) continue;
 			
-			try { process(fn, out); }
+			try { process(fn); }
 			catch(IOException e)
 			{
 				out.close();
@@ -83,13 +93,24 @@ class Main {
 				System.exit(1);
 			}
 		}
+
+		writeIndex(out);
+
+		for (byte[] buffer : classes)
+		{
+			// Prepare and write header of the class
+			writeHeader(out, buffer, buffer.length);
+
+			// Write Phantom class to the bulk
+			out.write(buffer);
+		}
 		
 		out.flush();
 		out.close();
 		System.out.println("Ok. The bulk file <" + cl_arguments[0] + "> created.");
 	}
 	
-	private static void process(String fn, DataOutputStream out) throws IOException {
+	private static void process(String fn) throws IOException {
 
 		//System.out.println("Process <" + fn + ">");
 		
@@ -113,11 +134,80 @@ class Main {
 			throw new IOException("Wrong signature: "+fn);
 		}
 		
-		// Prepare and write header of the class
-		writeHeader(out, buffer, av);
-		
-		// Write Phantom class to the bulk
-		out.write(buffer);
+		classes.add(buffer);
+	}
+
+	static String className(byte[] buf) {
+		int k = classname_offset;
+		while (k < buf.length && buf[k] > ' ')
+			k++;
+		return new String(buf, classname_offset, k - classname_offset);
+	}
+
+	// Must be the same as pvm_bulk_name_hash() in include/vm/bulk.h
+	static int nameHash(String name) {
+		int hash = 0x811C9DC5;
+		int i = 0;
+
+		if (name.length() > 0 && (name.charAt(0) == '.' || name.charAt(0) == '/'))
+			i++;
+
+		for (; i < name.length(); i++) {
+			char c = name.charAt(i);
+			if (c == '/') c = '.';
+			hash = (hash ^ (c & 0xFF)) * 0x01000193;
+		}
+		return hash;
+	}
+
+	static void writeInt(DataOutputStream os, int v) throws IOException {
+		os.write(v);
+		os.write(v >>> 8);
+		os.write(v >>> 16);
+		os.write(v >>> 24);
+	}
+
+	// Pseudo class record with a hash table of class record offsets
+	static void writeIndex(DataOutputStream os) throws IOException {
+		int n = classes.size();
+		int n_slots = 1;
+		while (n_slots < 2 * n)
+			n_slots <<= 1;
+
+		int[] hashes = new int[n_slots];
+		int[] offsets = new int[n_slots];
+
+		int index_len = 16 + n_slots * 8;
+		int pos = class_head_size + index_len;
+
+		for (byte[] buffer : classes) {
+			int hash = nameHash(className(buffer));
+			int s = hash & (n_slots - 1);
+
+			// Duplicates go after the first one, as in sequential scan
+			while (offsets[s] != 0)
+				s = (s + 1) & (n_slots - 1);
+
+			hashes[s] = hash;
+			offsets[s] = pos;
+			pos += class_head_size + buffer.length;
+		}
+
+		byte[] header = new byte[header_size];
+		byte[] name = index_name.getBytes();
+		System.arraycopy(name, 0, header, 0, name.length);
+		os.write(header);
+		writeInt(os, index_len);
+
+		writeInt(os, index_magic);
+		writeInt(os, index_version);
+		writeInt(os, n_slots);
+		writeInt(os, n);
+
+		for (int s = 0; s < n_slots; s++) {
+			writeInt(os, hashes[s]);
+			writeInt(os, offsets[s]);
+		}
 	}
 
 	static void writeHeader(DataOutputStream os, byte[] buf, int len) throws IOException {
@@ -161,6 +161,15 @@ protected static final byte opcode_call_1D = (byte)0xBD;
 protected static final byte opcode_call_1E = (byte)0xBE;
 protected static final byte opcode_call_1F = (byte)0xBF;
 // c0-cf
+protected static final byte opcode_ilt_jz = (byte)0xC0; // superinstructions: compare and jump if false, rel32
+protected static final byte opcode_ile_jz = (byte)0xC1;
+protected static final byte opcode_igt_jz = (byte)0xC2;
+protected static final byte opcode_ige_jz = (byte)0xC3;
+protected static final byte opcode_is_get32_iconst_ilt_jz = (byte)0xC4; // is_get32 slot; iconst const; cmp; jz rel32
+protected static final byte opcode_is_get32_iconst_ile_jz = (byte)0xC5;
+protected static final byte opcode_is_get32_iconst_igt_jz = (byte)0xC6;
+protected static final byte opcode_is_get32_iconst_ige_jz = (byte)0xC7;
+protected static final byte opcode_is_inc32 = (byte)0xC8; // int stack slot += const, is_get32; iconst; isum; is_dup; is_set32; is_drop
 // d0-df
 // e0-ef
 // f0-ff
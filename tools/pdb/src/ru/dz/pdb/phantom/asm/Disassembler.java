@@ -177,6 +177,17 @@ public class Disassembler extends opcode_ids {
 		case opcode_call_05:			return int2arg("call", 0x05, getByte() );
 		case opcode_call_06:			return int2arg("call", 0x06, getByte() );
 		case opcode_call_07:			return int2arg("call", 0x07, getByte() );
+		// superinstructions
+		case opcode_ilt_jz:				{ int ip = getIp(); return intarg("ilt_jz", ip+getInt()); }
+		case opcode_ile_jz:				{ int ip = getIp(); return intarg("ile_jz", ip+getInt()); }
+		case opcode_igt_jz:				{ int ip = getIp(); return intarg("igt_jz", ip+getInt()); }
+		case opcode_ige_jz:				{ int ip = getIp(); return intarg("ige_jz", ip+getInt()); }
+		case opcode_is_get32_iconst_ilt_jz:	{ int p = getInt(); int v = getInt(); int ip = getIp(); return int2arg("is_get_ilt_jz "+v, p, ip+getInt()); }
+		case opcode_is_get32_iconst_ile_jz:	{ int p = getInt(); int v = getInt(); int ip = getIp(); return int2arg("is_get_ile_jz "+v, p, ip+getInt()); }
+		case opcode_is_get32_iconst_igt_jz:	{ int p = getInt(); int v = getInt(); int ip = getIp(); return int2arg("is_get_igt_jz "+v, p, ip+getInt()); }
+		case opcode_is_get32_iconst_ige_jz:	{ int p = getInt(); int v = getInt(); int ip = getIp(); return int2arg("is_get_ige_jz "+v, p, ip+getInt()); }
+		case opcode_is_inc32:			{ int p = getInt(); return int2arg("is_inc", p, getInt()); }
+
 		case opcode_call_08:			return int2arg("call", 0x08, getByte() );
 		case opcode_call_09:			return int2arg("call", 0x09, getByte() );
 		case opcode_call_0A:			return int2arg("call", 0x0A, getByte() );
@@ -68,6 +68,7 @@ public class Codegen extends opcode_ids {
 		this.os = f;
 		this.lst  = lst;
 		start_position_in_file = os.getFilePointer();
+		lastCompareEnd = -1;
 	}
 
 	private void list(String s) throws IOException 
@@ -175,6 +176,7 @@ public class Codegen extends opcode_ids {
 	 * @throws IOException
 	 */
 	public void markLabel( String name ) throws IOException {
+		lastCompareEnd = -1; // Can't fuse over label
 		long now_position_in_file = os.getFilePointer();
 		fmap.add(name,now_position_in_file);
 		listlbl(name+":");
@@ -217,11 +219,58 @@ public class Codegen extends opcode_ids {
 	 * @throws IOException
 	 */
 	public void emitJz(String label) throws IOException {
+		if( fuseCompareJz(label) ) return;
 		list("jz "+label);
 		put_byte(opcode_jz);
 		putNamedInt32Reference(label);
 	}
 
+	// ------------- superinstructions
+
+	// IP right after last int compare and its opcode, for compare + jz fusion
+	private long lastCompareEnd = -1;
+	private byte lastCompareOp;
+
+	private void compareEmitted(byte op) throws IOException {
+		lastCompareOp = op;
+		lastCompareEnd = getIP();
+	}
+
+	/**
+	 * If compare was emitted just before jz and nobody can jump between
+	 * them, replace both with one compare-and-jump superinstruction.
+	 */
+	private boolean fuseCompareJz(String label) throws IOException {
+		if( lastCompareEnd < 0 || lastCompareEnd != getIP() ) return false;
+		lastCompareEnd = -1;
+
+		byte op;
+		switch( lastCompareOp )
+		{
+		case opcode_ilt: op = opcode_ilt_jz; break;
+		case opcode_ile: op = opcode_ile_jz; break;
+		case opcode_igt: op = opcode_igt_jz; break;
+		case opcode_ige: op = opcode_ige_jz; break;
+		default: return false;
+		}
+
+		os.seek( os.getFilePointer() - 1 );
+		emitCompareJz(op, label);
+		return true;
+	}
+
+	/**
+	 * Pop u, pop l, jump to label if (l op u) is false.
+	 * @param op One of opcode_ilt_jz, opcode_ile_jz, opcode_igt_jz, opcode_ige_jz.
+	 * @param label Where to jump to.
+	 * @throws IOException
+	 */
+	public void emitCompareJz(byte op, String label) throws IOException {
+		list("cmp jz "+label);
+		put_byte(op);
+		putNamedInt32Reference(label);
+	}
+
 	//  public void emit_skipz() throws IOException {    put_byte(opcode_skipz);  }
 
 	//  public void emit_skipnz() throws IOException {    put_byte(opcode_skipnz);  }
@@ -568,10 +617,10 @@ public class Codegen extends opcode_ids {
 	public void emitLogXor() throws IOException {  list("logxor"); put_byte(opcode_log_xor); }
 	public void emitLogNot() throws IOException {  list("lognot"); put_byte(opcode_log_not); }
 
-	public void emit_igt() throws IOException	{  list("igt >"); put_byte(opcode_igt);}
-	public void emit_ilt() throws IOException	{  list("ilt <"); put_byte(opcode_ilt); }
-	public void emit_ige() throws IOException	{  list("ige >="); put_byte(opcode_ige); }
-	public void emit_ile() throws IOException	{  list("ile <="); put_byte(opcode_ile); }
+	public void emit_igt() throws IOException	{  list("igt >"); put_byte(opcode_igt); compareEmitted(opcode_igt); }
+	public void emit_ilt() throws IOException	{  list("ilt <"); put_byte(opcode_ilt); compareEmitted(opcode_ilt); }
+	public void emit_ige() throws IOException	{  list("ige >="); put_byte(opcode_ige); compareEmitted(opcode_ige); }
+	public void emit_ile() throws IOException	{  list("ile <="); put_byte(opcode_ile); compareEmitted(opcode_ile); }
 
 	/**
 	 * Class object for given name pushed on stack.
@@ -806,6 +855,7 @@ public class Codegen extends opcode_ids {
 	public void recordLineNumberToIPMapping(int lineNumber) {
 		try {
 			long ip = getIP();
+			lastCompareEnd = -1; // Line must start at instruction
 			
 			IpToLine.put(ip, lineNumber);
 			
@@ -821,6 +871,69 @@ public class Codegen extends opcode_ids {
 	}
 
 
+	// ------------------------------------------------------------------------
+	// exception handler table
+	// ------------------------------------------------------------------------
+
+	/**
+	 * Try range which is caught by handler, goes to class file 'H' record
+	 * instead of push/pop catcher code.
+	 */
+	public static class HandlerRange {
+		public final String startLabel, endLabel, handlerLabel;
+		public final String className;
+
+		HandlerRange(String startLabel, String endLabel, String handlerLabel, String className)
+		{
+			this.startLabel = startLabel;
+			this.endLabel = endLabel;
+			this.handlerLabel = handlerLabel;
+			this.className = className;
+		}
+	}
+
+	private List<HandlerRange> handlers = new LinkedList<HandlerRange>();
+	private int dynamicCatchDepth = 0;
+
+	/**
+	 * Code between labels is caught by handler if exception is of given class.
+	 * @param startLabel Try code start.
+	 * @param endLabel Try code end.
+	 * @param handlerLabel Where to pass control in case of exception catched.
+	 * @param className Class of exceptions to catch.
+	 */
+	public void addHandler(String startLabel, String endLabel, String handlerLabel, String className)
+	{
+		handlers.add(new HandlerRange(startLabel, endLabel, handlerLabel, className));
+	}
+
+	public List<HandlerRange> getHandlers() {
+		return handlers;
+	}
+
+	/**
+	 * VM looks up catchers pushed at run time first, so code inside of
+	 * such a catcher can't use handler table.
+	 * @return True if try can be put to handler table.
+	 */
+	public boolean canUseHandlerTable() {
+		return dynamicCatchDepth == 0;
+	}
+
+	public void enterDynamicCatch() { dynamicCatchDepth++; }
+	public void leaveDynamicCatch() { dynamicCatchDepth--; }
+
+	/**
+	 * Label position, valid after code is generated.
+	 * @param name Label name.
+	 * @return IP label refers to.
+	 */
+	public long getLabelIP(String name) throws EmptyPlcException
+	{
+		return fmap.get(name) - start_position_in_file;
+	}
+
+
 
 
 }
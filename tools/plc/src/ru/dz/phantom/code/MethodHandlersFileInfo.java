@@ -0,0 +1,44 @@
+package ru.dz.phantom.code;
+
+import java.io.IOException;
+import java.io.RandomAccessFile;
+import java.util.List;
+
+import ru.dz.plc.compiler.Method;
+import ru.dz.plc.util.PlcException;
+
+/**
+ * <p>Method exception handler table, 'H' record.</p>
+ * <p>Must be written after method code, as labels are resolved then.</p>
+ */
+public class MethodHandlersFileInfo extends FileInfo {
+
+	private final Method m;
+
+	public MethodHandlersFileInfo(RandomAccessFile os, Method m) {
+		super(os, (byte)'H');
+		this.m = m;
+	}
+
+	@Override
+	protected void do_write_specific() throws IOException, PlcException {
+		Codegen cg = m.get_cg();
+
+		List<Codegen.HandlerRange> handlers = cg.getHandlers();
+
+		// Method ordinal
+		Fileops.put_int32( os, m.getOrdinal() );
+		// Num of entries
+		Fileops.put_int32( os, handlers.size() );
+
+		// Each entry, VM sorts them
+		for( Codegen.HandlerRange h : handlers )
+		{
+			Fileops.put_int32( os, (int)cg.getLabelIP(h.startLabel) );
+			Fileops.put_int32( os, (int)cg.getLabelIP(h.endLabel) );
+			Fileops.put_int32( os, (int)cg.getLabelIP(h.handlerLabel) );
+			Fileops.put_string_bin( os, h.className );
+		}
+	}
+
+}
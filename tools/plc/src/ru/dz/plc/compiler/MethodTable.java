@@ -261,6 +261,12 @@ public class MethodTable implements IMethodTable
 			MethodLineNumbersFileInfo ml = new MethodLineNumbersFileInfo(os,m);
 			ml.write();
 
+			if( !m.get_cg().getHandlers().isEmpty() )
+			{
+				MethodHandlersFileInfo mh = new MethodHandlersFileInfo(os,m);
+				mh.write();
+			}
+
 			m.generateLlvmCode(s, llvmFile);
 			m.generateC_Code(s, c_File);
 			
@@ -172,6 +172,28 @@ public class PhantomType {
 				: "");
 	}
 
+	/**
+	 * Name of class emit_get_class_object summons, if it is known at compile time.
+	 * @return Class name or null if class is an expression.
+	 */
+	public String get_static_class_name()
+	{
+		if(is_void() && !is_container()) return null;
+		else if(is_container())
+		{
+			if( _container_class != null ) return _container_class.getName();
+			else if(_container_class_expression != null) return null;
+			else return ".internal.container.array";
+		}
+		else if(is_int())    return ".internal.int";
+		else if(is_long())   return ".internal.long";
+		else if(is_float())  return ".internal.float";
+		else if(is_double()) return ".internal.double";
+		else if(is_string()) return ".internal.string";
+		else if(_class != null) return _class.getName();
+		return null;
+	}
+
 	public void emit_get_class_object( Codegen c, CodeGeneratorState s ) throws PlcException, IOException 
 	{
 		if(is_void() && !is_container())        //c.emit_summon_null();
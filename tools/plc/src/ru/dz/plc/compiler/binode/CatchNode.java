@@ -50,12 +50,30 @@ public class CatchNode extends BiNode {
 
 		log.fine("Node "+this+" codegen");
 
-		// here we have to push class object of type to catch
-		catch_type.emit_get_class_object(c,s);
-		c.emitPushCatcher(catch_label);
-
-		_l.generate_code(c,s);
-		c.emitPopCatcher();
+		String catch_class = c.canUseHandlerTable() ? catch_type.get_static_class_name() : null;
+
+		if( catch_class != null )
+		{
+			// Class is known, try range goes to handler table, no code for it
+			String try_label = c.getLabel();
+			String try_end_label = c.getLabel();
+
+			c.markLabel(try_label);
+			_l.generate_code(c,s);
+			c.markLabel(try_end_label);
+			c.addHandler(try_label, try_end_label, catch_label, catch_class);
+		}
+		else
+		{
+			// here we have to push class object of type to catch
+			catch_type.emit_get_class_object(c,s);
+			c.emitPushCatcher(catch_label);
+
+			c.enterDynamicCatch();
+			_l.generate_code(c,s);
+			c.leaveDynamicCatch();
+			c.emitPopCatcher();
+		}
 		c.emitJmp(out_label);
 
 